@@ -0,0 +1,30 @@
+#include "benchmarks/benchmark.h"
+#include <inttypes.h>
+#include <stdio.h>
+
+struct benchmark_counts benchmark_now() {
+    return (struct benchmark_counts){ read_cycle_counter(), read_instruction_counter() };
+}
+
+struct benchmark_counts benchmark_since(struct benchmark_counts start) {
+    const struct benchmark_counts now = benchmark_now();
+    return (struct benchmark_counts){
+        now.cycles - start.cycles,
+        now.instructions - start.instructions,
+    };
+}
+
+void benchmark_add(struct benchmark_counts* total, struct benchmark_counts counts) {
+    total->cycles += counts.cycles;
+    total->instructions += counts.instructions;
+}
+
+void benchmark_report(const char* name, uint32_t iterations, struct benchmark_counts counts) {
+    printf(
+        "benchmark,%s,%lu,%" PRIu64 ",%" PRIu64 "\n",
+        name,
+        iterations,
+        counts.cycles,
+        counts.instructions
+    );
+}
@@ -0,0 +1,19 @@
+// shared by the benchmark programs, which print each result as a line of
+//     benchmark,<name>,<iterations>,<cycles>,<instructions>
+// that run.sh collects
+#include "lib/cpulib.h"
+
+struct benchmark_counts {
+    uint64_t cycles;
+    uint64_t instructions;
+};
+
+// the current values of mcycle and minstret
+struct benchmark_counts benchmark_now();
+
+// the cycles and instructions since start
+struct benchmark_counts benchmark_since(struct benchmark_counts start);
+
+void benchmark_add(struct benchmark_counts* total, struct benchmark_counts counts);
+
+void benchmark_report(const char* name, uint32_t iterations, struct benchmark_counts counts);
@@ -0,0 +1,13 @@
+# included by each benchmark's make file in place of top.mk; the benchmarks
+# only run in simulation
+
+benchmark_directory := $(dir $(lastword $(MAKEFILE_LIST)))
+program_files += $(benchmark_directory)benchmark.c
+
+include $(benchmark_directory)../top.mk
+
+# runs the simulation with benchmark_arguments as plusargs and benchmark_input,
+# if set, as stdin for testbenches that read it
+.PHONY: benchmark
+benchmark: $(simulation_directory)/sim $(simulation_image) $(benchmark_input)
+	$< $(simulation_arguments) $(benchmark_arguments) $(if $(benchmark_input),< $(benchmark_input))
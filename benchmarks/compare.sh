@@ -0,0 +1,27 @@
+#!/bin/bash
+# compares two results files from run.sh and fails if any benchmark takes
+# more than the given percentage of cycles more than in the baseline
+#
+# usage: benchmarks/compare.sh baseline.csv results.csv [max_increase_percent]
+
+baseline=$1
+results=$2
+max_increase_percent=${3:-1}
+
+awk -F, -v max_increase_percent="$max_increase_percent" '
+    FNR == 1 { next }
+    NR == FNR { baseline_cycles[$1 "," $2 "," $3] = $5; next }
+    {
+        key = $1 "," $2 "," $3
+        if (!(key in baseline_cycles)) {
+            printf "%s: %d cycles, not in baseline\n", key, $5
+            next
+        }
+        change = ($5 - baseline_cycles[key]) * 100 / baseline_cycles[key]
+        printf "%s: %d -> %d cycles (%+.2f%%)\n", key, baseline_cycles[key], $5, change
+        if (change > max_increase_percent) {
+            regressed = 1
+        }
+    }
+    END { exit regressed }
+' "$baseline" "$results"
@@ -0,0 +1,40 @@
+#include "benchmarks/benchmark.h"
+#include "coremark.h"
+
+volatile ee_s32 seed1_volatile = 0x0;
+volatile ee_s32 seed2_volatile = 0x0;
+volatile ee_s32 seed3_volatile = 0x66;
+volatile ee_s32 seed4_volatile = ITERATIONS;
+volatile ee_s32 seed5_volatile = 0;
+
+ee_u32 default_num_contexts = 1;
+
+static struct benchmark_counts start;
+static struct benchmark_counts elapsed;
+
+void start_time() {
+    start = benchmark_now();
+}
+
+void stop_time() {
+    elapsed = benchmark_since(start);
+}
+
+CORE_TICKS get_time() {
+    return elapsed.cycles;
+}
+
+secs_ret time_in_secs(CORE_TICKS ticks) {
+    return ticks / CLOCK_FREQUENCY;
+}
+
+void portable_init(core_portable* p, int* argc, char* argv[]) {
+    p->portable_id = 1;
+}
+
+// the last thing CoreMark does before returning from main
+void portable_fini(core_portable* p) {
+    p->portable_id = 0;
+    benchmark_report("coremark", ITERATIONS, elapsed);
+    simulation_pass();
+}
@@ -0,0 +1,49 @@
+// CoreMark port, see the porting section of the CoreMark README for what
+// each definition means
+#ifndef CORE_PORTME_H
+#define CORE_PORTME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HAS_FLOAT 0
+#define HAS_TIME_H 0
+#define USE_CLOCK 0
+#define HAS_STDIO 1
+#define HAS_PRINTF 1
+
+#define COMPILER_VERSION "GCC " __VERSION__
+#define COMPILER_FLAGS "-Os"
+#define MEM_LOCATION "STATIC"
+
+typedef int16_t ee_s16;
+typedef uint16_t ee_u16;
+typedef int32_t ee_s32;
+typedef double ee_f32;
+typedef uint8_t ee_u8;
+typedef uint32_t ee_u32;
+typedef uintptr_t ee_ptr_int;
+typedef size_t ee_size_t;
+
+// ticks are clock cycles
+#define CORETIMETYPE ee_u32
+typedef ee_u32 CORE_TICKS;
+
+#define align_mem(x) (void*)(4 + (((ee_ptr_int)(x) - 1) & ~3))
+
+#define SEED_METHOD SEED_VOLATILE
+#define MEM_METHOD MEM_STATIC
+#define MULTITHREAD 1
+#define MAIN_HAS_NOARGC 1
+#define MAIN_HAS_NORETURN 0
+
+extern ee_u32 default_num_contexts;
+
+typedef struct CORE_PORTABLE_S {
+    ee_u8 portable_id;
+} core_portable;
+
+void portable_init(core_portable* p, int* argc, char* argv[]);
+void portable_fini(core_portable* p);
+
+#endif
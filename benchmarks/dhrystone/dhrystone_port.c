@@ -0,0 +1,41 @@
+#include "benchmarks/benchmark.h"
+#include "dhrystone_port.h"
+
+#undef main
+
+// enough for the two records that Dhrystone allocates
+alignas(8) static uint8_t heap[256];
+static size_t heap_used = 0;
+
+char* dhrystone_malloc(size_t size) {
+    size = (size + 7) & ~7;
+    if (heap_used + size > sizeof(heap)) {
+        return nullptr;
+    }
+    char* allocation = (char*)heap + heap_used;
+    heap_used += size;
+    return allocation;
+}
+
+// the time is in cycles since the first call, which is right before the runs
+long dhrystone_time(void) {
+    static bool started = false;
+    static struct benchmark_counts start;
+
+    if (!started) {
+        started = true;
+        start = benchmark_now();
+        return 0;
+    }
+
+    const struct benchmark_counts elapsed = benchmark_since(start);
+    benchmark_report("dhrystone", DHRYSTONE_RUNS, elapsed);
+    return elapsed.cycles;
+}
+
+int dhrystone_main();
+
+int main() {
+    dhrystone_main();
+    simulation_pass();
+}
@@ -0,0 +1,21 @@
+// included before each Dhrystone source file, replaces the parts of the
+// environment that Dhrystone expects but this one does not have
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DHRYSTONE_RUNS 2000
+
+// the number of runs is normally read from stdin
+#define scanf(format, runs) (*(runs) = DHRYSTONE_RUNS)
+
+// Dhrystone calls time before and after the runs, see dhrystone_port.c
+long dhrystone_time(void);
+#define time(pointer) dhrystone_time()
+
+// a bump allocator, Dhrystone only allocates two records
+char* dhrystone_malloc(size_t size);
+#define malloc(size) dhrystone_malloc(size)
+
+// so that the simulation can end after Dhrystone returns
+#define main dhrystone_main
@@ -0,0 +1,136 @@
+// microbenchmarks of the library functions on the usb data path and of trap
+// entry and exit
+#include "benchmarks/benchmark.h"
+#include <assert.h>
+#include <string.h>
+
+#define ITERATIONS 64
+#define RING_BUFFER_LENGTH 512
+#define PACKET_SIZE 64
+#define COPY_SIZE 1024
+#define STRING_LENGTH 256
+
+static struct {
+    const size_t length;
+    atomic_size_t read_index;
+    atomic_size_t write_index;
+    uint8_t buffer[RING_BUFFER_LENGTH];
+} ring_buffer = {
+    RING_BUFFER_LENGTH,
+    0,
+    0,
+};
+
+static uint8_t packet[PACKET_SIZE];
+static uint32_t source[COPY_SIZE / 4];
+static uint32_t destination[COPY_SIZE / 4];
+static char string_1[STRING_LENGTH];
+static char string_2[STRING_LENGTH];
+
+// a packet at a time, like the usb bulk endpoints, and a byte at a time for
+// the per call overhead; the indices wrap around the buffer several times
+static void ring_buffer_transfers(const char* write_name, const char* read_name, size_t size) {
+    struct benchmark_counts write_total = {};
+    struct benchmark_counts read_total = {};
+    for (uint32_t i = 0; i < ITERATIONS; i++) {
+        struct benchmark_counts start = benchmark_now();
+        const size_t bytes_written =
+            ring_buffer_write((struct ring_buffer*)&ring_buffer, packet, size);
+        benchmark_add(&write_total, benchmark_since(start));
+
+        start = benchmark_now();
+        const size_t bytes_read = ring_buffer_read((struct ring_buffer*)&ring_buffer, packet, size);
+        benchmark_add(&read_total, benchmark_since(start));
+
+        assert(bytes_written == size && bytes_read == size);
+    }
+    benchmark_report(write_name, ITERATIONS, write_total);
+    benchmark_report(read_name, ITERATIONS, read_total);
+}
+
+// the same packets without copying them, as when the producer and the consumer
+// use the bytes in place; the packets never wrap around the end of the buffer
+static void ring_buffer_in_place_transfers() {
+    struct benchmark_counts commit_total = {};
+    struct benchmark_counts consume_total = {};
+    for (uint32_t i = 0; i < ITERATIONS; i++) {
+        struct benchmark_counts start = benchmark_now();
+        size_t space;
+        uint8_t* reserved = ring_buffer_reserve((struct ring_buffer*)&ring_buffer, &space);
+        ring_buffer_commit((struct ring_buffer*)&ring_buffer, PACKET_SIZE);
+        benchmark_add(&commit_total, benchmark_since(start));
+
+        start = benchmark_now();
+        size_t available;
+        const uint8_t* span = ring_buffer_peek_span((struct ring_buffer*)&ring_buffer, &available);
+        ring_buffer_consume((struct ring_buffer*)&ring_buffer, PACKET_SIZE);
+        benchmark_add(&consume_total, benchmark_since(start));
+
+        __asm__ volatile("" : : "r"(reserved), "r"(span) : "memory");
+        assert(space >= PACKET_SIZE && available >= PACKET_SIZE);
+    }
+    benchmark_report("ring_buffer_reserve_commit_64", ITERATIONS, commit_total);
+    benchmark_report("ring_buffer_peek_span_consume_64", ITERATIONS, consume_total);
+}
+
+static void copy(const char* name, void* destination, size_t size) {
+    const struct benchmark_counts start = benchmark_now();
+    for (uint32_t i = 0; i < ITERATIONS; i++) {
+        memcpy(destination, source, size);
+        // keeps the copies from being combined
+        __asm__ volatile("" : : : "memory");
+    }
+    benchmark_report(name, ITERATIONS, benchmark_since(start));
+}
+
+static void compare() {
+    memset(string_1, 'a', STRING_LENGTH - 1);
+    memset(string_2, 'a', STRING_LENGTH - 1);
+
+    const struct benchmark_counts start = benchmark_now();
+    for (uint32_t i = 0; i < ITERATIONS; i++) {
+        const int result = strncmp(string_1, string_2, STRING_LENGTH);
+        __asm__ volatile("" : : "r"(result) : "memory");
+    }
+    benchmark_report("strncmp_256", ITERATIONS, benchmark_since(start));
+}
+
+// from the ecall to the instruction after it, through on_trap
+static void trap() {
+    const struct benchmark_counts start = benchmark_now();
+    for (uint32_t i = 0; i < ITERATIONS; i++) {
+        __asm__ volatile("ecall" : : : "memory");
+    }
+    benchmark_report("trap_ecall", ITERATIONS, benchmark_since(start));
+}
+
+int main() {
+    ring_buffer_transfers("ring_buffer_write_64", "ring_buffer_read_64", PACKET_SIZE);
+    ring_buffer_transfers("ring_buffer_write_1", "ring_buffer_read_1", 1);
+    ring_buffer_in_place_transfers();
+    copy("memcpy_1024_aligned", destination, COPY_SIZE);
+    copy("memcpy_1023_unaligned", (uint8_t*)destination + 1, COPY_SIZE - 1);
+    compare();
+    trap();
+    simulation_pass();
+}
+
+[[gnu::interrupt]]
+void on_trap() {
+    unsigned int mcause;
+    __asm__("csrrs %0, mcause, zero" : "=r"(mcause));
+    switch (mcause) {
+        case MCAUSE_ENVIRONMENT_CALL_FROM_M_MODE: {
+            // returns to the instruction after the ecall
+            uint32_t mepc;
+            __asm__ volatile("csrr %0, mepc" : "=r"(mepc));
+            __asm__ volatile("csrw mepc, %0" : : "r"(mepc + 4));
+            break;
+        }
+        case MCAUSE_MACHINE_EXTERNAL_INTERRUPT:
+            handle_usb_transaction();
+            break;
+        default:
+            assert(false);
+    }
+}
@@ -0,0 +1,26 @@
+#!/bin/bash
+# runs every benchmark in simulation on both cores and writes the results as
+# csv to the given file, or stdout; CoreMark and Dhrystone are skipped when
+# their sources are missing, see their make files
+#
+# usage: benchmarks/run.sh [results.csv]
+
+set -o pipefail
+
+benchmarks_directory=$(dirname "$0")
+output=${1:-/dev/stdout}
+
+programs=(microbenchmarks usb)
+[ -d "$benchmarks_directory/coremark/coremark" ] && programs+=(coremark)
+[ -d "$benchmarks_directory/dhrystone/dhrystone" ] && programs+=(dhrystone)
+
+echo "core,program,benchmark,iterations,cycles,instructions" > "$output"
+for core in single_cycle pipelined; do
+    for program in "${programs[@]}"; do
+        make -s -C "$benchmarks_directory/$program" benchmark core=$core \
+            | grep '^benchmark,' \
+            | sed "s/^benchmark,/$core,$program,/" \
+            >> "$output" \
+            || exit 1
+    done
+done
@@ -0,0 +1,25 @@
+// echoes the bulk OUT endpoint back on the bulk IN endpoint for the stress mode
+// of tests/usb/tb_usb.v, which checks the echo and reports the throughput and
+// turnaround of the usb module
+#include "lib/cpulib.h"
+
+int main() {
+    // usb transactions go straight to handle_usb_transaction through the
+    // default on_external_interrupt
+    enable_vectored_interrupts();
+
+    while (true) {
+        uint8_t buffer[64];
+        disable_interrupts();
+        const size_t bytes_read = usb_read(buffer, sizeof(buffer));
+        if (bytes_read == 0) {
+            wait_for_usb_data();
+        }
+        enable_interrupts();
+
+        size_t bytes_written = 0;
+        while (bytes_written < bytes_read) {
+            bytes_written += usb_write(buffer + bytes_written, bytes_read - bytes_written);
+        }
+    }
+}
@@ -0,0 +1,74 @@
+// times handle_usb_transaction for each endpoint and transaction type while
+// tests/usb/tb_usb.v enumerates the device, streams its input to the bulk OUT
+// endpoint and checks that the bulk IN endpoint echoes it; the bulk OUT data
+// goes to the usb out fifo without a transaction to handle
+#include "benchmarks/benchmark.h"
+#include <assert.h>
+
+#define ENDPOINT_COUNT 3
+#define TRANSACTION_TYPE_COUNT 4
+// the testbench sends its input twice, once with each data toggle first
+#define ECHO_BYTES (2 * USB_BENCHMARK_BYTES)
+
+// indexed by the endpoint and the transaction type from usb_control, see
+// enum transaction in lib/usb.c; the transactions without a name aren't timed
+static const char* const names[ENDPOINT_COUNT][TRANSACTION_TYPE_COUNT] = {
+    { "usb_endpoint_0_out", nullptr, "usb_endpoint_0_in", "usb_endpoint_0_setup" },
+    { nullptr, nullptr, nullptr, nullptr },
+    { nullptr, nullptr, "usb_endpoint_2_in", nullptr },
+};
+static struct benchmark_counts totals[ENDPOINT_COUNT][TRANSACTION_TYPE_COUNT];
+static uint32_t transaction_counts[ENDPOINT_COUNT][TRANSACTION_TYPE_COUNT];
+
+int main() {
+    size_t echoed_bytes = 0;
+    while (echoed_bytes < ECHO_BYTES) {
+        uint8_t buffer[64];
+        const size_t bytes_read = usb_read(buffer, sizeof(buffer));
+        size_t bytes_written = 0;
+        while (bytes_written < bytes_read) {
+            bytes_written += usb_write(buffer + bytes_written, bytes_read - bytes_written);
+        }
+        echoed_bytes += bytes_read;
+    }
+    // the rest of the echo is sent as the testbench reads it
+    while (usb_write_pending() > 0) {
+    }
+
+    disable_external_interrupts();
+    for (int endpoint = 0; endpoint < ENDPOINT_COUNT; endpoint++) {
+        for (int type = 0; type < TRANSACTION_TYPE_COUNT; type++) {
+            if (names[endpoint][type] != nullptr && transaction_counts[endpoint][type] > 0) {
+                benchmark_report(
+                    names[endpoint][type],
+                    transaction_counts[endpoint][type],
+                    totals[endpoint][type]
+                );
+            }
+        }
+    }
+    simulation_pass();
+}
+
+[[gnu::interrupt]]
+void on_trap() {
+    unsigned int mcause;
+    __asm__("csrrs %0, mcause, zero" : "=r"(mcause));
+    switch (mcause) {
+        case MCAUSE_MACHINE_EXTERNAL_INTERRUPT: {
+            const uint16_t usb_control_copy = next_usb_control();
+            const unsigned int endpoint = (usb_control_copy >> 12) & 0xf;
+            const unsigned int type = (usb_control_copy >> 10) & 0b11;
+
+            const struct benchmark_counts start = benchmark_now();
+            handle_usb_transaction();
+            if (endpoint < ENDPOINT_COUNT && names[endpoint][type] != nullptr) {
+                benchmark_add(&totals[endpoint][type], benchmark_since(start));
+                transaction_counts[endpoint][type]++;
+            }
+            break;
+        }
+        default:
+            assert(false);
+    }
+}
@@ -0,0 +1,141 @@
+// a resident bootloader so that a program can be run on the board without
+// synthesizing a new bitstream: install it once with `make -C bootloader
+// install`, then `make upload` in a program's directory sends that program
+// with `usb-wrapper upload`
+//
+// it is linked into the top of the block ram, see linker-script, and the
+// program is loaded below it; the program's stack grows down over the
+// bootloader, which isn't needed once the program runs, and the program
+// continues the usb session that the bootloader enumerated, see usb_session in
+// lib/usb.c. power cycling the board starts the bootloader again
+//
+// the host sends the program in chunks, each a struct chunk_header followed by
+// length bytes of data, and waits for the enum status byte that answers each
+// one before sending the next; a chunk without data starts the program at its
+// address once its answer is received
+#include "lib/cpulib.h"
+
+// must match usb-wrapper/src/main.rs
+#define CHUNK_MAGIC 0x6b6e6863 // "chnk"
+#define MAX_CHUNK_LENGTH 1024
+
+struct chunk_header {
+    uint32_t magic;
+    uint32_t address;
+    uint32_t length;
+    // the crc-32 of address, length and the data, as in zlib
+    uint32_t crc;
+};
+
+enum status : uint8_t {
+    STATUS_OK = 0,
+    // the stream is out of sync, the bootloader has to be restarted
+    STATUS_BAD_HEADER = 1,
+    // the data was dropped, it would overwrite the bootloader
+    STATUS_OUT_OF_RANGE = 2,
+    // the data was written but is corrupt, the chunk can be sent again
+    STATUS_BAD_CRC = 3,
+};
+
+// defined in linker-script, the end of the memory a program can be loaded to
+extern uint8_t bootloader_start[];
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t* bytes, size_t length) {
+    // a table for each nibble rather than each byte keeps the bootloader small
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+        0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+    for (size_t i = 0; i < length; i++) {
+        crc ^= bytes[i];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+    }
+    return crc;
+}
+
+// sleeps until there is data or a usb transaction to handle when there is
+// nothing to read, the transaction is taken once interrupts are enabled again
+static void read_all(uint8_t* buffer, size_t size) {
+    size_t bytes_read = 0;
+    while (bytes_read < size) {
+        disable_interrupts();
+        const size_t got_bytes = usb_read(buffer + bytes_read, size - bytes_read);
+        if (got_bytes == 0) {
+            wait_for_usb_data();
+        }
+        enable_interrupts();
+        bytes_read += got_bytes;
+    }
+}
+
+static void discard(size_t size) {
+    uint8_t buffer[64];
+    while (size > 0) {
+        const size_t part = size < sizeof(buffer) ? size : sizeof(buffer);
+        read_all(buffer, part);
+        size -= part;
+    }
+}
+
+static void send_status(enum status status) {
+    const uint8_t byte = status;
+    while (usb_write(&byte, 1) == 0) {
+    }
+}
+
+[[noreturn]] static void start_program(uint32_t address) {
+    // the program handles the usb transactions from here on, so it must not
+    // start before the host has received everything
+    disable_interrupts();
+    while (usb_write_pending() != 0) {
+        wait_for_interrupt();
+        enable_interrupts();
+        disable_interrupts();
+    }
+
+    // _start in lib/cpulib.S sets the bits it needs in these
+    __asm__ volatile("csrw mie, zero");
+    __asm__ volatile("csrw mtvec, zero");
+    led = LED_COLOR_OFF;
+    ((void (*)())(uintptr_t)address)();
+    __builtin_unreachable();
+}
+
+int main() {
+    // usb transactions go straight to handle_usb_transaction through the
+    // default on_external_interrupt
+    enable_vectored_interrupts();
+    led = LED_COLOR_BLUE;
+
+    while (true) {
+        struct chunk_header header;
+        read_all((uint8_t*)&header, sizeof(header));
+
+        if (header.magic != CHUNK_MAGIC || header.length > MAX_CHUNK_LENGTH) {
+            send_status(STATUS_BAD_HEADER);
+            continue;
+        }
+        if (header.address >= (uintptr_t)bootloader_start
+            || header.length > (uintptr_t)bootloader_start - header.address) {
+            discard(header.length);
+            send_status(STATUS_OUT_OF_RANGE);
+            continue;
+        }
+
+        uint8_t* const destination = (uint8_t*)(uintptr_t)header.address;
+        read_all(destination, header.length);
+        uint32_t crc = crc32_update(~0, (const uint8_t*)&header.address, 8);
+        crc = ~crc32_update(crc, destination, header.length);
+        if (crc != header.crc) {
+            send_status(STATUS_BAD_CRC);
+            continue;
+        }
+
+        send_status(STATUS_OK);
+        if (header.length == 0) {
+            start_program(header.address);
+        }
+    }
+}
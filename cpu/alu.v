@@ -1,8 +1,10 @@
 module alu(operation, operand1, operand2, result);
-    input [3:0] operation;
+    input [4:0] operation;
     input [31:0] operand1, operand2;
     output reg [31:0] result;
 
+    integer i;
+
     always @* begin
         case (operation)
             ALU_OPCODE_ADD: result = operand1 + operand2;
@@ -13,6 +15,49 @@ module alu(operation, operand1, operand2, result);
             ALU_OPCODE_RIGHT_SHIFT_ARITHMETIC: result = $signed(operand1) >>> operand2[4:0];
             ALU_OPCODE_OR: result = operand1 | operand2;
             ALU_OPCODE_AND: result = operand1 & operand2;
+            ALU_OPCODE_AND_NOT: result = operand1 & ~operand2;
+            ALU_OPCODE_OR_NOT: result = operand1 | ~operand2;
+            ALU_OPCODE_XNOR: result = ~(operand1 ^ operand2);
+            ALU_OPCODE_MIN: result = $signed(operand1) < $signed(operand2) ? operand1 : operand2;
+            ALU_OPCODE_MIN_UNSIGNED: result = operand1 < operand2 ? operand1 : operand2;
+            ALU_OPCODE_MAX: result = $signed(operand1) < $signed(operand2) ? operand2 : operand1;
+            ALU_OPCODE_MAX_UNSIGNED: result = operand1 < operand2 ? operand2 : operand1;
+            // shifting a 32 bit value by 32 results in 0, which is correct
+            // for a rotation by 0
+            ALU_OPCODE_ROTATE_LEFT: result = (operand1 << operand2[4:0]) | (operand1 >> (6'd32 - operand2[4:0]));
+            ALU_OPCODE_ROTATE_RIGHT: result = (operand1 >> operand2[4:0]) | (operand1 << (6'd32 - operand2[4:0]));
+            ALU_OPCODE_COUNT_LEADING_ZEROS: begin
+                result = 32;
+                for (i = 0; i < 32; i = i + 1) begin
+                    if (operand1[i]) begin
+                        result = 31 - i;
+                    end
+                end
+            end
+            ALU_OPCODE_COUNT_TRAILING_ZEROS: begin
+                result = 32;
+                for (i = 31; i >= 0; i = i - 1) begin
+                    if (operand1[i]) begin
+                        result = i;
+                    end
+                end
+            end
+            ALU_OPCODE_COUNT_SET_BITS: begin
+                result = 0;
+                for (i = 0; i < 32; i = i + 1) begin
+                    result = result + { 31'b0, operand1[i] };
+                end
+            end
+            ALU_OPCODE_SIGN_EXTEND_BYTE: result = { {24{operand1[7]}}, operand1[7:0] };
+            ALU_OPCODE_SIGN_EXTEND_HALFWORD: result = { {16{operand1[15]}}, operand1[15:0] };
+            ALU_OPCODE_ZERO_EXTEND_HALFWORD: result = { 16'b0, operand1[15:0] };
+            ALU_OPCODE_OR_COMBINE_BYTES: result = {
+                {8{|operand1[31:24]}},
+                {8{|operand1[23:16]}},
+                {8{|operand1[15:8]}},
+                {8{|operand1[7:0]}}
+            };
+            ALU_OPCODE_REVERSE_BYTES: result = { operand1[7:0], operand1[15:8], operand1[23:16], operand1[31:24] };
             default: result = 32'bx;
         endcase
     end
@@ -0,0 +1,128 @@
+`include "core_constants.v"
+
+// decodes the alu operation of an immediate or arithmetic instruction other
+// than slt, sltu and the M extension, shared by the core implementations
+//
+// operand_1_shift is how far the first operand is shifted left before the
+// alu, for the Zba shift and add instructions
+module alu_decoder(
+    input [31:0] instruction,
+    output reg [4:0] alu_opcode,
+    output reg [1:0] operand_1_shift,
+    output reg illegal
+);
+    wire immediate = instruction[6:0] == OPCODE_IMMEDIATE;
+    wire [2:0] funct3 = instruction[14:12];
+    wire [6:0] funct7 = instruction[31:25];
+    // for the immediate instructions that take a single operand
+    wire [4:0] rs2 = instruction[24:20];
+
+    always @* begin
+        alu_opcode = 5'bx;
+        operand_1_shift = 0;
+        illegal = 0;
+
+        case (funct3)
+            FUNCT3_ADD: begin
+                if (immediate || funct7 == FUNCT7_BASE) begin
+                    alu_opcode = ALU_OPCODE_ADD;
+                end else if (funct7 == FUNCT7_BASE_ALTERNATE) begin
+                    alu_opcode = ALU_OPCODE_SUBTRACT;
+                end else begin
+                    illegal = 1;
+                end
+            end
+            FUNCT3_SLL: begin
+                if (funct7 == FUNCT7_BASE) begin
+                    alu_opcode = ALU_OPCODE_LEFT_SHIFT;
+                end else if (funct7 == FUNCT7_ROTATE && !immediate) begin
+                    alu_opcode = ALU_OPCODE_ROTATE_LEFT;
+                end else if (funct7 == FUNCT7_ROTATE && immediate) begin
+                    case (rs2)
+                        5'b00000: alu_opcode = ALU_OPCODE_COUNT_LEADING_ZEROS;
+                        5'b00001: alu_opcode = ALU_OPCODE_COUNT_TRAILING_ZEROS;
+                        5'b00010: alu_opcode = ALU_OPCODE_COUNT_SET_BITS;
+                        5'b00100: alu_opcode = ALU_OPCODE_SIGN_EXTEND_BYTE;
+                        5'b00101: alu_opcode = ALU_OPCODE_SIGN_EXTEND_HALFWORD;
+                        default: illegal = 1;
+                    endcase
+                end else begin
+                    illegal = 1;
+                end
+            end
+            FUNCT3_SLT: begin
+                // slt and slti use the comparator
+                if (funct7 == FUNCT7_SHIFT_ADD && !immediate) begin
+                    alu_opcode = ALU_OPCODE_ADD;
+                    operand_1_shift = 1;
+                end else if (!immediate && funct7 != FUNCT7_BASE) begin
+                    illegal = 1;
+                end
+            end
+            FUNCT3_SLTU: begin
+                // sltu and sltiu use the comparator
+                if (!immediate && funct7 != FUNCT7_BASE) begin
+                    illegal = 1;
+                end
+            end
+            FUNCT3_XOR: begin
+                if (immediate || funct7 == FUNCT7_BASE) begin
+                    alu_opcode = ALU_OPCODE_XOR;
+                end else if (funct7 == FUNCT7_BASE_ALTERNATE) begin
+                    alu_opcode = ALU_OPCODE_XNOR;
+                end else if (funct7 == FUNCT7_MIN_MAX) begin
+                    alu_opcode = ALU_OPCODE_MIN;
+                end else if (funct7 == FUNCT7_ZERO_EXTEND && rs2 == 0) begin
+                    alu_opcode = ALU_OPCODE_ZERO_EXTEND_HALFWORD;
+                end else if (funct7 == FUNCT7_SHIFT_ADD) begin
+                    alu_opcode = ALU_OPCODE_ADD;
+                    operand_1_shift = 2;
+                end else begin
+                    illegal = 1;
+                end
+            end
+            FUNCT3_SRL: begin
+                if (funct7 == FUNCT7_BASE) begin
+                    alu_opcode = ALU_OPCODE_RIGHT_SHIFT_LOGICAL;
+                end else if (funct7 == FUNCT7_BASE_ALTERNATE) begin
+                    alu_opcode = ALU_OPCODE_RIGHT_SHIFT_ARITHMETIC;
+                end else if (funct7 == FUNCT7_ROTATE) begin
+                    alu_opcode = ALU_OPCODE_ROTATE_RIGHT;
+                end else if (funct7 == FUNCT7_MIN_MAX && !immediate) begin
+                    alu_opcode = ALU_OPCODE_MIN_UNSIGNED;
+                end else if (instruction[31:20] == 12'h287 && immediate) begin
+                    alu_opcode = ALU_OPCODE_OR_COMBINE_BYTES;
+                end else if (instruction[31:20] == 12'h698 && immediate) begin
+                    alu_opcode = ALU_OPCODE_REVERSE_BYTES;
+                end else begin
+                    illegal = 1;
+                end
+            end
+            FUNCT3_OR: begin
+                if (immediate || funct7 == FUNCT7_BASE) begin
+                    alu_opcode = ALU_OPCODE_OR;
+                end else if (funct7 == FUNCT7_BASE_ALTERNATE) begin
+                    alu_opcode = ALU_OPCODE_OR_NOT;
+                end else if (funct7 == FUNCT7_MIN_MAX) begin
+                    alu_opcode = ALU_OPCODE_MAX;
+                end else if (funct7 == FUNCT7_SHIFT_ADD) begin
+                    alu_opcode = ALU_OPCODE_ADD;
+                    operand_1_shift = 3;
+                end else begin
+                    illegal = 1;
+                end
+            end
+            FUNCT3_AND: begin
+                if (immediate || funct7 == FUNCT7_BASE) begin
+                    alu_opcode = ALU_OPCODE_AND;
+                end else if (funct7 == FUNCT7_BASE_ALTERNATE) begin
+                    alu_opcode = ALU_OPCODE_AND_NOT;
+                end else if (funct7 == FUNCT7_MIN_MAX) begin
+                    alu_opcode = ALU_OPCODE_MAX_UNSIGNED;
+                end else begin
+                    illegal = 1;
+                end
+            end
+        endcase
+    end
+endmodule
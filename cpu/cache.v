@@ -0,0 +1,146 @@
+// a direct-mapped cache of the external memory, top.v has one for instruction
+// fetch and one for loads and stores
+//
+// an access is given in a cycle where hold is not set and its value is
+// available in the following cycle, unless busy is set, in which case it is
+// available in the first cycle where busy is not set; top.v sets hold while
+// either cache is busy, and the cache keeps the value of its access and
+// ignores new accesses until hold is not set
+//
+// like the block ram in top.v each word is split into its low and high halves
+// so that a 32 bit instruction that is only 16 bit aligned can be read in one
+// access, which can need two lines
+//
+// reads that miss fill each missing line from the external memory and then
+// read the arrays again; writes go through to the external memory, updating
+// the line if it is cached, and busy is set until the external memory has
+// the write
+module cache #(
+    parameter LINES = 64,
+    parameter LINE_WORDS = 4
+) (
+    input clock,
+    input hold,
+    input access,
+    input [31:0] address, // 16 bit aligned for reads, 32 bit aligned for writes
+    input [3:0] write_sections, // a write if nonzero
+    input [31:0] write_value,
+    output [31:0] read_value,
+    output busy,
+    // the external memory, see external_memory.v
+    output reg memory_request = 0,
+    output reg memory_write,
+    output reg [31:0] memory_address,
+    output [31:0] memory_write_value,
+    output [3:0] memory_write_sections,
+    input [31:0] memory_read_value,
+    input memory_read_valid,
+    input memory_done
+);
+    localparam OFFSET_BITS = $clog2(LINE_WORDS);
+    localparam INDEX_BITS = $clog2(LINES);
+    localparam TAG_BITS = 30 - INDEX_BITS - OFFSET_BITS;
+
+    // the words that hold the low and high halves of the pending access
+    wire [29:0] first_word = pending_address[31:2];
+    wire [29:0] last_word = pending_address[31:2] + pending_address[1];
+    wire first_hit = line_hit(first_word);
+    wire last_hit = line_hit(last_word);
+    wire pending_write = pending_write_sections != 0;
+
+    assign busy = pending && (pending_write ? !written : !(first_hit && last_hit && current));
+    assign read_value = misaligned ? { low_value, high_value } : { high_value, low_value };
+    assign memory_write_value = pending_write_value;
+    assign memory_write_sections = pending_write_sections;
+
+    // the access given, or the pending access again once its lines are filled
+    wire [31:0] read_address = hold ? pending_address : address;
+    wire [INDEX_BITS + OFFSET_BITS:0] read_halfword_index = read_address[INDEX_BITS + OFFSET_BITS + 1:1];
+    wire [INDEX_BITS + OFFSET_BITS - 1:0] read_low_index = (read_halfword_index + 1) >> 1;
+    wire [INDEX_BITS + OFFSET_BITS - 1:0] read_high_index = read_halfword_index >> 1;
+    wire [INDEX_BITS + OFFSET_BITS - 1:0] first_word_index = first_word[INDEX_BITS + OFFSET_BITS - 1:0];
+    wire [INDEX_BITS - 1:0] fill_line = memory_address[INDEX_BITS + OFFSET_BITS + 1:OFFSET_BITS + 2];
+    // a read fills the line of the first word before the line of the last
+    wire [29:0] missing_word = first_hit ? last_word : first_word;
+
+    // stateful regs written in the following block
+    reg [15:0] low[LINES * LINE_WORDS];
+    reg [15:0] high[LINES * LINE_WORDS];
+    reg [TAG_BITS - 1:0] tags[LINES];
+    reg [LINES - 1:0] valid = 0;
+
+    reg pending = 0;
+    reg [31:0] pending_address;
+    reg [3:0] pending_write_sections;
+    reg [31:0] pending_write_value;
+    reg [15:0] low_value, high_value;
+    reg misaligned;
+    reg current; // low_value and high_value were read after the last fill
+    reg written;
+    reg [OFFSET_BITS - 1:0] fill_offset;
+
+    always @(posedge clock) begin
+        if (!hold || (pending && !pending_write && first_hit && last_hit && !current)) begin
+            low_value <= low[read_low_index];
+            high_value <= high[read_high_index];
+            misaligned <= read_address[1];
+            current <= 1;
+        end
+
+        if (!hold) begin
+            pending <= access;
+            pending_address <= address;
+            pending_write_sections <= write_sections;
+            pending_write_value <= write_value;
+            written <= 0;
+        end else if (memory_request) begin
+            if (memory_read_valid) begin
+                low[{ fill_line, fill_offset }] <= memory_read_value[15:0];
+                high[{ fill_line, fill_offset }] <= memory_read_value[31:16];
+                fill_offset <= fill_offset + 1;
+            end
+
+            if (memory_done) begin
+                memory_request <= 0;
+                if (memory_write) begin
+                    written <= 1;
+                end else begin
+                    valid[fill_line] <= 1;
+                    tags[fill_line] <= memory_address[31:INDEX_BITS + OFFSET_BITS + 2];
+                end
+            end
+        end else if (pending && pending_write && !written) begin
+            memory_request <= 1;
+            memory_write <= 1;
+            memory_address <= { first_word, 2'b0 };
+
+            if (first_hit) begin
+                if (pending_write_sections[0]) begin
+                    low[first_word_index][7:0] <= pending_write_value[7:0];
+                end
+                if (pending_write_sections[1]) begin
+                    low[first_word_index][15:8] <= pending_write_value[15:8];
+                end
+                if (pending_write_sections[2]) begin
+                    high[first_word_index][7:0] <= pending_write_value[23:16];
+                end
+                if (pending_write_sections[3]) begin
+                    high[first_word_index][15:8] <= pending_write_value[31:24];
+                end
+            end
+        end else if (pending && !pending_write && (!first_hit || !last_hit)) begin
+            memory_request <= 1;
+            memory_write <= 0;
+            memory_address <= { missing_word[29:OFFSET_BITS], {(OFFSET_BITS + 2){1'b0}} };
+            fill_offset <= 0;
+            // the line is not valid while it is partly filled
+            valid[missing_word[INDEX_BITS + OFFSET_BITS - 1:OFFSET_BITS]] <= 0;
+            current <= 0;
+        end
+    end
+
+    function line_hit(input [29:0] word);
+        line_hit = valid[word[INDEX_BITS + OFFSET_BITS - 1:OFFSET_BITS]]
+            && tags[word[INDEX_BITS + OFFSET_BITS - 1:OFFSET_BITS]] == word[29:INDEX_BITS + OFFSET_BITS];
+    endfunction
+endmodule
@@ -1,124 +1,4 @@
-localparam OPCODE_LUI = 7'b0110111;
-localparam OPCODE_AUIPC = 7'b0010111;
-localparam OPCODE_JAL = 7'b1101111;
-localparam OPCODE_JALR = 7'b1100111;
-localparam OPCODE_BRANCH = 7'b1100011;
-localparam OPCODE_LOAD = 7'b0000011;
-localparam OPCODE_STORE = 7'b0100011;
-localparam OPCODE_IMMEDIATE = 7'b0010011;
-localparam OPCODE_ARITHMETIC = 7'b0110011;
-localparam OPCODE_FENCE = 7'b0001111; // includes PAUSE instruction
-localparam OPCODE_SYSTEM = 7'b1110011;
-
-localparam FUNCT3_JALR = 3'b000;
-
-localparam FUNCT3_BEQ = 3'b000;
-localparam FUNCT3_BNE = 3'b001;
-localparam FUNCT3_BLT = 3'b100;
-localparam FUNCT3_BGE = 3'b101;
-localparam FUNCT3_BLTU = 3'b110;
-localparam FUNCT3_BGEU = 3'b111;
-
-localparam FUNCT3_LB = 3'b000;
-localparam FUNCT3_LH = 3'b001;
-localparam FUNCT3_LW = 3'b010;
-localparam FUNCT3_LBU = 3'b100;
-localparam FUNCT3_LHU = 3'b101;
-
-localparam FUNCT3_SB = 3'b000;
-localparam FUNCT3_SH = 3'b001;
-localparam FUNCT3_SW = 3'b010;
-
-// funct3 values for arithmetic and immediate instructions are the same,
-// so use the same for both
-localparam FUNCT3_ADD = 3'b000;
-localparam FUNCT3_SUB = 3'b000;
-localparam FUNCT3_SLL = 3'b001;
-localparam FUNCT3_SLT = 3'b010;
-localparam FUNCT3_SLTU = 3'b011;
-localparam FUNCT3_XOR = 3'b100;
-localparam FUNCT3_SRL = 3'b101;
-localparam FUNCT3_SRA = 3'b101;
-localparam FUNCT3_OR = 3'b110;
-localparam FUNCT3_AND = 3'b111;
-
-localparam FUNCT3_FENCE = 3'b000;
-localparam FUNCT3_PRIV = 3'b000;
-
-localparam FUNCT3_CSRRW = 3'b001;
-localparam FUNCT3_CSRRS = 3'b010;
-localparam FUNCT3_CSRRC = 3'b011;
-localparam FUNCT3_CSRRWI = 3'b101;
-localparam FUNCT3_CSRRSI = 3'b110;
-localparam FUNCT3_CSRRCI = 3'b111;
-
-localparam FUNC12_ECALL = 12'b0;
-localparam FUNC12_EBREAK = 12'b1;
-localparam FUNC12_MRET = 12'b001100000010;
-localparam FUNC12_WFI = 12'b000100000101;
-
-`ifdef simulation
-localparam FUNC12_TEST_PASS = 12'b100011000000;
-localparam FUNC12_TEST_FAIL = 12'b110011000000;
-localparam FUNC12_SIMULATION_PUTCHAR = 12'b000011000000;
-`endif
-
-// the bit at index 3 is the bit at index 30 in the corresponding instruction
-// logic to produce the alu opcode relies on these being defined this way
-localparam ALU_OPCODE_ADD = { 1'b0, FUNCT3_ADD };
-localparam ALU_OPCODE_SUBTRACT = { 1'b1, FUNCT3_SUB };
-localparam ALU_OPCODE_LEFT_SHIFT = { 1'b0, FUNCT3_SLL };
-localparam ALU_OPCODE_XOR = { 1'b0, FUNCT3_XOR };
-localparam ALU_OPCODE_RIGHT_SHIFT_LOGICAL = { 1'b0, FUNCT3_SRL };
-localparam ALU_OPCODE_RIGHT_SHIFT_ARITHMETIC = { 1'b1, FUNCT3_SRA };
-localparam ALU_OPCODE_OR = { 1'b0, FUNCT3_OR };
-localparam ALU_OPCODE_AND = { 1'b0, FUNCT3_AND };
-
-localparam MCAUSE_ILLEGAL_INSTRUCTION = 2;
-localparam MCAUSE_BREAKPOINT = 3;
-localparam MCAUSE_ENVIRONMENT_CALL_FROM_M_MODE = 11;
-localparam MCAUSE_MACHINE_TIMER_INTERRUPT = (1 << 31) | 7;
-localparam MCAUSE_MACHINE_EXTERNAL_INTERRUPT = (1 << 31) | 11;
-
-localparam ADDRESS_MVENDORID = 12'hF11;
-localparam ADDRESS_MARCHID = 12'hF12;
-localparam ADDRESS_MIMPID = 12'hF13;
-localparam ADDRESS_MHARTID = 12'hF14;
-localparam ADDRESS_MCONFIGPTR = 12'hF15;
-
-localparam ADDRESS_MSTATUS = 12'h300;
-localparam ADDRESS_MISA = 12'h301;
-localparam ADDRESS_MIE = 12'h304;
-localparam ADDRESS_MTVEC = 12'h305;
-localparam ADDRESS_MCOUNTEREN = 12'h306;
-localparam ADDRESS_MSTATUSH = 12'h310;
-
-localparam ADDRESS_MSCRATCH = 12'h340;
-localparam ADDRESS_MEPC = 12'h341;
-localparam ADDRESS_MCAUSE = 12'h342;
-localparam ADDRESS_MTVAL = 12'h343;
-localparam ADDRESS_MIP = 12'h344;
-localparam ADDRESS_MTINST = 12'h34A;
-localparam ADDRESS_MTVAL2 = 12'h34B;
-
-localparam ADDRESS_MENVCFG = 12'h30A;
-localparam ADDRESS_MENVCFGH = 12'h31A;
-
-localparam ADDRESS_MHPMCOUNTER3 = 12'hB03;
-localparam ADDRESS_MHPMCOUNTER31 = 12'hB1F;
-localparam ADDRESS_MHPMCOUNTER3H = 12'hB83;
-localparam ADDRESS_MHPMCOUNTER31H = 12'hB9F;
-
-localparam ADDRESS_MHPMEVENT3 = 12'h323;
-localparam ADDRESS_MHPMEVENT31 = 12'h33F;
-localparam ADDRESS_MHPMEVENT3H = 12'h723;
-localparam ADDRESS_MHPMEVENT31H = 12'h73F;
-
-localparam ADDRESS_MCYCLE = 12'hB00;
-localparam ADDRESS_MINSTRET = 12'hB02;
-
-localparam ADDRESS_MCYCLEH = 12'hB80;
-localparam ADDRESS_MINSTRETH = 12'hB82;
+`include "core_constants.v"
 
 module core(
     input clock,
@@ -127,21 +7,90 @@ module core(
     output reg [31:0] memory_address,
     output reg [31:0] memory_write_value,
     output reg [2:0] memory_write_sections, // which bytes to write within the memory word
+    output reg memory_access, // a load or store, otherwise the memory is free for dma
     input [31:0] memory_read_value,
+    // the instruction or the value of the load before it is not read yet,
+    // nothing changes until it is
+    input memory_wait,
     input usb_packet_ready,
     output reg handled_usb_packet,
-    input mip_mtip // machine timer interrupt pending 
+    input mip_mtip, // machine timer interrupt pending
+    input mip_dmaip, // dma completion interrupt pending
+    input mip_fifoip, // usb out fifo interrupt pending
+    // what happened in each cycle, for trace_encoder.v
+    output trace_retired,
+    output trace_branch, // the instruction that retired is a conditional branch
+    output trace_taken,
+    output trace_indirect, // the instruction that retired is a jalr or an mret that returned
+    output trace_trap,
+    // the instruction that retired, or for a trap where its mret returns
+    output [31:0] trace_program_counter,
+    output [31:0] trace_target, // of a jalr, mret or trap
+    output [31:0] trace_mcause
 );
-    wire [31:0] alu_result, base_register_read_value_1, base_register_read_value_2;
-    wire comparator_result;
-
-    registers registers(clock, register_write_address_1, register_write_value_1, register_write_address_2, register_write_value_2, register_read_address_1, base_register_read_value_1, register_read_address_2, base_register_read_value_2);
+    wire [31:0] alu_result,
+        base_register_read_value_1,
+        base_register_read_value_2,
+        csr_read_value,
+        interrupt_mcause,
+        trap_vector,
+        interrupt_vector,
+        trap_return_address;
+    wire [31:0] muldiv_result, decompressed_instruction;
+    wire [4:0] decoded_alu_opcode;
+    wire [1:0] decoded_operand_1_shift;
+    wire comparator_result, take_interrupt, chain_interrupt, wake_from_wait, register_bank, muldiv_ready, alu_decoder_illegal;
+    wire instruction_retired;
+
+    registers registers(
+        clock,
+        { register_bank, register_write_address_1 },
+        register_write_value_1,
+        { load_register_bank, register_write_address_2 },
+        register_write_value_2,
+        { register_bank, register_read_address_1 },
+        base_register_read_value_1,
+        { register_bank, register_read_address_2 },
+        base_register_read_value_2
+    );
     alu alu(alu_opcode, alu_operand_1, alu_operand_2, alu_result);
+    alu_decoder alu_decoder(instruction, decoded_alu_opcode, decoded_operand_1_shift, alu_decoder_illegal);
     comparator comparator(comparator_opcode, comparator_operand_1, comparator_operand_2, comparator_result);
-
-    wire [31:0] instruction = program_memory_value;
+    decompressor decompressor(program_memory_value[15:0], decompressed_instruction);
+    muldiv muldiv(clock, funct3, register_read_value_1, register_read_value_2, muldiv_request, muldiv_result, muldiv_ready);
+    csrs csrs(
+        clock,
+        csr_address,
+        csr_read_value,
+        csr_write_enable,
+        csr_write_value,
+        trap,
+        trap_mcause,
+        trap_program_counter,
+        return_from_trap,
+        instruction_retired,
+        muldiv_waiting || memory_wait,
+        taken_branch,
+        waiting_for_interrupt,
+        mip_mtip,
+        mip_meip,
+        mip_dmaip,
+        mip_fifoip,
+        take_interrupt,
+        chain_interrupt,
+        wake_from_wait,
+        interrupt_mcause,
+        trap_vector,
+        interrupt_vector,
+        trap_return_address,
+        register_bank
+    );
+
+    // instructions from the C extension have the low two bits not both set
+    wire compressed = program_memory_value[1:0] != 2'b11;
+    wire [31:0] instruction = compressed ? decompressed_instruction : program_memory_value;
     wire [6:0] opcode = instruction[6:0];
-    wire [31:0] next_instruction_address = program_counter + 4;
+    wire [31:0] next_instruction_address = program_counter + (compressed ? 2 : 4);
 
     wire [31:0] i_immediate = { {21{instruction[31]}}, instruction[30:20] };
     wire [31:0] s_immediate = { {21{instruction[31]}}, instruction[30:25], instruction[11:7] };
@@ -151,6 +100,7 @@ module core(
     wire [31:0] csr_immediate = { 27'b0, instruction[19:15] };
 
     wire [2:0] funct3 = instruction[14:12];
+    wire [6:0] funct7 = instruction[31:25];
     wire [11:0] func12 = instruction[31:20];
 
     wire [4:0] register_read_address_1 = instruction[19:15];
@@ -161,23 +111,11 @@ module core(
     wire csr_is_read_only = csr[11:10] == 2'b11;
 
     wire mip_meip = usb_packet_ready; // machine external interrupt pending
-    wire [63:0] menvcfg = {
-        1'b0 /* STCE */,
-        1'b0 /* PBMTE */,
-        1'b0 /* ADUE */,
-        1'b0 /* CDE */,
-        26'b0 /* WPRI */,
-        2'b0 /* PMM */,
-        24'b0 /* WPRI */,
-        1'b0 /* CBZE */,
-        1'b0 /* CBCFE */,
-        2'b0 /* CBIE */,
-        3'b0 /* WPRI */,
-        1'b0 /* FIOM */
-    };
-
-    wire [63:0] next_mcycle = mcycle + 1;
-    wire [63:0] next_minstret = stall || trap ? minstret : minstret + 1;;
+
+    wire is_wfi = instruction == { FUNC12_WFI, 5'b0, FUNCT3_PRIV, 5'b0, OPCODE_SYSTEM };
+    // an interrupt that ends a wfi returns to the instruction after it, so
+    // that the wfi is not waited on again
+    wire [31:0] trap_program_counter = is_wfi && take_interrupt ? next_instruction_address : program_counter;
 
     // wire-like regs set in the following combinational block
     reg [31:0] register_write_value_1,
@@ -193,10 +131,14 @@ module core(
     reg [4:0] register_write_address_1,
         register_write_address_2,
         pending_load_register;
-    reg [3:0] alu_opcode;
+    reg [4:0] alu_opcode;
     reg [2:0] comparator_opcode,
         pending_load_funct3;
     reg csr_write_enable;
+    reg muldiv_request;
+    reg muldiv_waiting;
+    reg waiting_for_interrupt;
+    reg taken_branch;
 
     reg trap;
     reg [31:0] trap_mcause;
@@ -207,6 +149,11 @@ module core(
         reg fail;
         reg simulation_putchar;
         reg illegal_instruction;
+        // see the trace below
+        integer trace_file = 0;
+        reg [8 * 256 - 1:0] trace_file_name;
+        reg trace_load = 0;
+        reg [31:0] trace_load_address;
     `endif
 
     always @* begin
@@ -214,7 +161,7 @@ module core(
         comparator_operand_1 = 32'bx;
         comparator_operand_2 = 32'bx;
 
-        alu_opcode = 4'bx;
+        alu_opcode = 5'bx;
         alu_operand_1 = 32'bx;
         alu_operand_2 = 32'bx;
 
@@ -223,11 +170,17 @@ module core(
         memory_address = 32'bx;
         memory_write_value = 32'bx;
         memory_write_sections = 0;
+        memory_access = 0;
 
         csr_write_enable = 0;
         csr_write_value = 32'bx;
         csr_address = 12'bx;
 
+        muldiv_request = 0;
+        muldiv_waiting = 0;
+        waiting_for_interrupt = 0;
+        taken_branch = 0;
+
         // load operations take 2 cycles to complete because the memory is
         // synchronous so the register write has to be delayed until the next cycle
         pending_load_register = 5'b0;
@@ -247,7 +200,7 @@ module core(
             simulation_putchar = 0;
         `endif
 
-        if (load_register != 0) begin
+        if (load_register != 0 && !memory_wait) begin
             register_write_address_2 = load_register;
             case (load_funct3)
                 FUNCT3_LW: register_write_value_2 = memory_read_value;
@@ -262,10 +215,10 @@ module core(
             // these are so that the load is reflected in the instruction
             // following the load even though it hasn't actually written to
             // register yet
-            if (load_register == register_read_address_1) begin
+            if (load_register_bank == register_bank && load_register == register_read_address_1) begin
                 register_read_value_1 = register_write_value_2;
             end
-            if (load_register == register_read_address_2) begin
+            if (load_register_bank == register_bank && load_register == register_read_address_2) begin
                 register_read_value_2 = register_write_value_2;
             end
         end else begin
@@ -273,10 +226,10 @@ module core(
             register_write_value_2 = 32'bx;
         end
 
-        if (mstatus_mie && mie_mtie && mip_mtip) begin
-            raise(MCAUSE_MACHINE_TIMER_INTERRUPT);
-        end else if (mstatus_mie && mie_meie && mip_meip) begin
-            raise(MCAUSE_MACHINE_EXTERNAL_INTERRUPT);
+        if (memory_wait) begin
+            // this cycle happens again once the memory is ready
+        end else if (take_interrupt) begin
+            raise(interrupt_mcause);
         end else if (!stall) begin
             next_program_counter = next_instruction_address;
 
@@ -328,6 +281,7 @@ module core(
                         alu_operand_2 = b_immediate;
 
                         if (comparator_result) begin
+                            taken_branch = 1;
                             next_program_counter = alu_result;
                         end
                     end
@@ -340,6 +294,7 @@ module core(
                         alu_operand_1 = register_read_value_1;
                         alu_operand_2 = i_immediate;
                         memory_address = alu_result;
+                        memory_access = 1;
 
                         pending_load_register = rd;
                         pending_load_funct3 = funct3;
@@ -350,6 +305,7 @@ module core(
                     alu_operand_1 = register_read_value_1;
                     alu_operand_2 = s_immediate;
                     memory_address = alu_result;
+                    memory_access = 1;
                     memory_write_value = register_read_value_2;
 
                     case (funct3)
@@ -366,41 +322,54 @@ module core(
                     endcase
                 end
                 OPCODE_IMMEDIATE: begin
-                    // all funct3 values are valid here
-                    if (funct3 == FUNCT3_SLL || funct3 == FUNCT3_SRL || funct3 == FUNCT3_SRA) begin
-                        alu_opcode = { instruction[30], funct3 };
+                    if (alu_decoder_illegal) begin
+                        raise_illegal_instruction();
                     end else begin
-                        alu_opcode = { 1'b0, funct3 };
-                    end
-                    alu_operand_1 = register_read_value_1;
-                    alu_operand_2 = i_immediate;
+                        alu_opcode = decoded_alu_opcode;
+                        alu_operand_1 = register_read_value_1;
+                        alu_operand_2 = i_immediate;
 
-                    register_write_address_1 = rd;
-                    if (funct3 == FUNCT3_SLT || funct3 == FUNCT3_SLTU) begin
-                        comparator_opcode = { 1'b1, funct3[0], 1'b0 };
-                        comparator_operand_1 = register_read_value_1;
-                        comparator_operand_2 = i_immediate;
+                        register_write_address_1 = rd;
+                        if (funct3 == FUNCT3_SLT || funct3 == FUNCT3_SLTU) begin
+                            comparator_opcode = { 1'b1, funct3[0], 1'b0 };
+                            comparator_operand_1 = register_read_value_1;
+                            comparator_operand_2 = i_immediate;
 
-                        register_write_value_1 = { 31'b0, comparator_result };
-                    end else begin
-                        register_write_value_1 = alu_result;
+                            register_write_value_1 = { 31'b0, comparator_result };
+                        end else begin
+                            register_write_value_1 = alu_result;
+                        end
                     end
                 end
                 OPCODE_ARITHMETIC: begin
-                    // all funct3 values are valid here
-                    alu_opcode = { instruction[30], funct3 };
-                    alu_operand_1 = register_read_value_1;
-                    alu_operand_2 = register_read_value_2;
-
-                    register_write_address_1 = rd;
-                    if (funct3 == FUNCT3_SLT || funct3 == FUNCT3_SLTU) begin
-                        comparator_opcode = { 1'b1, funct3[0], 1'b0 };
-                        comparator_operand_1 = register_read_value_1;
-                        comparator_operand_2 = register_read_value_2;
-
-                        register_write_value_1 = { 31'b0, comparator_result };
+                    if (funct7 == FUNCT7_MULDIV) begin
+                        muldiv_request = 1;
+                        if (muldiv_ready) begin
+                            register_write_address_1 = rd;
+                            register_write_value_1 = muldiv_result;
+                        end else begin
+                            // execute this instruction again until the result
+                            // is ready
+                            next_program_counter = program_counter;
+                            muldiv_waiting = 1;
+                        end
+                    end else if (alu_decoder_illegal) begin
+                        raise_illegal_instruction();
                     end else begin
-                        register_write_value_1 = alu_result;
+                        alu_opcode = decoded_alu_opcode;
+                        alu_operand_1 = register_read_value_1 << decoded_operand_1_shift;
+                        alu_operand_2 = register_read_value_2;
+
+                        register_write_address_1 = rd;
+                        if ((funct3 == FUNCT3_SLT || funct3 == FUNCT3_SLTU) && funct7 == FUNCT7_BASE) begin
+                            comparator_opcode = { 1'b1, funct3[0], 1'b0 };
+                            comparator_operand_1 = register_read_value_1;
+                            comparator_operand_2 = register_read_value_2;
+
+                            register_write_value_1 = { 31'b0, comparator_result };
+                        end else begin
+                            register_write_value_1 = alu_result;
+                        end
                     end
                 end
                 OPCODE_FENCE: begin
@@ -421,10 +390,22 @@ module core(
                                     end
                                     FUNC12_MRET: begin
                                         return_from_trap = 1;
-                                        next_program_counter = { mepc, 2'b0 };
+                                        if (chain_interrupt) begin
+                                            // enters the next handler
+                                            // directly, see csrs.v
+                                            raise(interrupt_mcause);
+                                        end else begin
+                                            next_program_counter = trap_return_address;
+                                        end
                                     end
                                     FUNC12_WFI: begin
-                                        // nop
+                                        if (!wake_from_wait) begin
+                                            // execute this instruction again
+                                            // until an interrupt is pending,
+                                            // nothing else changes meanwhile
+                                            next_program_counter = program_counter;
+                                            waiting_for_interrupt = 1;
+                                        end
                                     end
                                     `ifdef simulation 
                                         // custom instructions for running tests
@@ -533,88 +514,42 @@ module core(
     end
 
     // register-like regs written in the following block
-    reg [31:0] program_counter = `INITIAL_PROGRAM_COUNTER;
+    `ifdef simulation
+        // the entry point of the program loaded by top.v
+        reg [31:0] program_counter;
+        initial begin
+            if (!$value$plusargs("entry=%d", program_counter)) begin
+                $display("the entry point must be given with +entry=<address>");
+                $finish;
+            end
+        end
+    `else
+        reg [31:0] program_counter = `INITIAL_PROGRAM_COUNTER;
+    `endif
     reg [4:0] load_register;
+    reg load_register_bank;
     reg [2:0] load_funct3;
     reg stall = 1;
 
-    reg mstatus_mie = 0; // machine interrupt enable
-    reg mstatus_mpie; // machine prior interrupt enable
-    reg [29:0] base;
-    reg mip_msip; // machine software interrupt pending
-
-    // machine interrupt enable
-    reg mie_meie; // machine external interrupt enable
-    reg mie_mtie; // machine timer interrupt enable
-    reg mie_msie; // machine software interrupt enable
+    assign instruction_retired = !stall && (!trap || return_from_trap) && !muldiv_waiting && !waiting_for_interrupt && !memory_wait;
 
-    reg [63:0] mcycle = 0;
-    reg [63:0] minstret = 0;
-    reg [31:0] mscratch;
-    reg [29:0] mepc; // machine exception program counter
-    reg [31:0] mcause = 0;
+    assign trace_retired = instruction_retired;
+    assign trace_branch = opcode == OPCODE_BRANCH;
+    assign trace_taken = taken_branch;
+    assign trace_indirect = opcode == OPCODE_JALR || (return_from_trap && !trap);
+    assign trace_trap = trap;
+    // an interrupt chained from an mret is taken where the mret would return
+    assign trace_program_counter = !trap ? program_counter : return_from_trap ? trap_return_address : trap_program_counter;
+    assign trace_target = next_program_counter;
+    assign trace_mcause = trap_mcause;
 
     always @(posedge clock) begin
         program_counter <= next_program_counter;
         stall <= 0;
-        load_register <= pending_load_register;
-        load_funct3 <= pending_load_funct3;
-
-        if (trap) begin
-            mcause <= trap_mcause;
-            mepc <= program_counter[31:2];
-            mstatus_mpie <= mstatus_mie;
-            mstatus_mie <= 0;
-        end else if (return_from_trap) begin
-            mstatus_mie <= mstatus_mpie;
-            mstatus_mpie <= 1;
-        end else if (csr_write_enable) begin
-            case (csr_address)
-                ADDRESS_MSTATUS: begin
-                    mstatus_mie <= csr_write_value[3];
-                    mstatus_mpie <= csr_write_value[7];
-                end
-                ADDRESS_MTVEC: begin
-                    base <= csr_write_value[31:2];
-                end
-                ADDRESS_MIP: begin
-                    // all are read-only
-                end
-                ADDRESS_MIE: begin
-                    // this could be read-only, TODO consider
-                    mie_msie <= csr_write_value[3];
-                    mie_mtie <= csr_write_value[7];
-                    mie_meie <= csr_write_value[11];
-                end
-                ADDRESS_MSCRATCH: begin
-                    mscratch <= csr_write_value;
-                end
-                ADDRESS_MEPC: begin
-                    mepc <= csr_write_value[31:2];
-                end
-                ADDRESS_MCAUSE: begin
-                    mcause <= csr_write_value;
-                end
-                default: begin
-                end
-            endcase
-        end
-
-        if (csr_write_enable) begin
-            case (csr_address)
-                ADDRESS_MCYCLE: mcycle[31:0] <= csr_write_value;
-                ADDRESS_MCYCLEH: mcycle[63:32] <= csr_write_value;
-                default: mcycle <= next_mcycle;
-            endcase
-
-            case (csr_address)
-                ADDRESS_MINSTRET: minstret[31:0] <= csr_write_value;
-                ADDRESS_MINSTRETH: minstret[63:32] <= csr_write_value;
-                default: minstret <= next_minstret;
-            endcase
-        end else begin
-            mcycle <= next_mcycle;
-            minstret <= next_minstret;
+        if (!memory_wait) begin
+            load_register <= pending_load_register;
+            load_register_bank <= register_bank;
+            load_funct3 <= pending_load_funct3;
         end
     end
 
@@ -628,163 +563,16 @@ module core(
     task raise(input [31:0] _mcause);
         trap = 1;
         trap_mcause = _mcause;
-        next_program_counter = { base, 2'b0 };
+        next_program_counter = _mcause[31] ? interrupt_vector : trap_vector;
     endtask
 
-    // wire-like regs set in the following combinational block
-    reg [31:0] csr_read_value;
-
-    always @* begin
-        case (csr_address)
-            ADDRESS_MISA: begin
-                csr_read_value = {
-                    2'b01 /* MXL */,
-                    4'b0,
-                    26'b1 << 8 /* Extensions */
-                };
-            end
-            ADDRESS_MVENDORID: begin
-                csr_read_value = 0;
-            end
-            ADDRESS_MARCHID: begin
-                csr_read_value = 0;
-            end
-            ADDRESS_MIMPID: begin
-                csr_read_value = 0;
-            end
-            ADDRESS_MHARTID: begin
-                csr_read_value = 0;
-            end
-            ADDRESS_MSTATUS: begin
-                csr_read_value = {
-                    1'b0 /* SD */,
-                    8'b0 /* WPRI */,
-                    1'b0 /* TSR */,
-                    1'b0 /* TW */,
-                    1'b0 /* TVM */,
-                    1'b0 /* MXR */,
-                    1'b0 /* SUM */,
-                    1'b0 /* MPRV */,
-                    2'b0 /* XS */,
-                    2'b0 /* FS */,
-                    2'b11 /* MPP */,
-                    2'b0 /* VS */,
-                    1'b0 /* SPP */,
-                    mstatus_mpie,
-                    1'b0 /* UBE */,
-                    1'b0 /* SPIE */,
-                    1'b0 /* WPRI */,
-                    mstatus_mie,
-                    1'b0 /* WPRI */,
-                    1'b0 /* SIE */,
-                    1'b0 /* WPRI */
-                };
-            end
-            ADDRESS_MSTATUSH: begin
-                csr_read_value = {
-                    26'b0 /* WPRI */,
-                    1'b0 /* MBE */,
-                    1'b0 /* SBE */,
-                    4'b0 /* WPRI */
-                };
-            end
-            ADDRESS_MTVEC: begin
-                csr_read_value = {
-                    base,
-                    2'b0 /* MODE */
-                };
-            end
-            ADDRESS_MIP: begin
-                csr_read_value = {
-                    16'b0 /* platform defined */,
-                    2'b0,
-                    1'b0 /* LCOFIP */,
-                    1'b0,
-                    mip_meip,
-                    1'b0,
-                    1'b0 /* SEIP */,
-                    1'b0,
-                    mip_mtip,
-                    1'b0,
-                    1'b0 /* STIP */,
-                    1'b0,
-                    mip_msip,
-                    1'b0,
-                    1'b0 /* SSIP */,
-                    1'b0
-                };
-            end
-            ADDRESS_MIE: begin
-                csr_read_value = {
-                    16'b0 /* platform defined */,
-                    2'b0,
-                    1'b0 /* LCOFIE */,
-                    1'b0,
-                    mie_meie,
-                    1'b0,
-                    1'b0 /* SEIP */,
-                    1'b0,
-                    mie_mtie,
-                    1'b0,
-                    1'b0 /* STIP */,
-                    1'b0,
-                    mie_msie,
-                    1'b0,
-                    1'b0 /* SSIP */,
-                    1'b0
-                };
-            end
-            ADDRESS_MCYCLE: begin
-                csr_read_value = mcycle[31:0];
-            end
-            ADDRESS_MCYCLEH: begin
-                csr_read_value = mcycle[63:32];
-            end
-            ADDRESS_MINSTRET: begin
-                csr_read_value = minstret[31:0];
-            end
-            ADDRESS_MINSTRETH: begin
-                csr_read_value = minstret[63:32];
-            end
-            ADDRESS_MSCRATCH: begin
-                csr_read_value = mscratch;
-            end
-            ADDRESS_MEPC: begin
-                csr_read_value = { mepc, 2'b0 };
-            end
-            ADDRESS_MCAUSE: begin
-                csr_read_value = mcause;
-            end
-            ADDRESS_MTVAL: begin
-                csr_read_value = 0;
-            end
-            ADDRESS_MCONFIGPTR: begin
-                csr_read_value = 0;
-            end
-            ADDRESS_MENVCFG: begin
-                csr_read_value = menvcfg[31:0];
-            end
-            ADDRESS_MENVCFGH: begin
-                csr_read_value = menvcfg[63:32];
-            end
-            default: begin
-                if ((csr_address >= ADDRESS_MHPMCOUNTER3 && csr_address <= ADDRESS_MHPMCOUNTER31)
-                    || (csr_address >= ADDRESS_MHPMCOUNTER3H && csr_address <= ADDRESS_MHPMCOUNTER31H)
-                    || (csr_address >= ADDRESS_MHPMEVENT3 && csr_address <= ADDRESS_MHPMEVENT31)
-                    || (csr_address >= ADDRESS_MHPMEVENT3H && csr_address <= ADDRESS_MHPMEVENT31H)) begin
-                    csr_read_value = 0;
-                end else begin
-                    csr_read_value = 32'bx;
-                end
-            end
-        endcase
-    end
-
     `ifdef simulation
-        reg [31:0] core_file;
-
         always @* begin
             if (finish) begin
+                // for tests/cpu to check the trace of a whole test
+                if ($test$plusargs("write_trace")) begin
+                    top.trace_encoder.write_trace_file();
+                end
                 $finish;
             end
         end
@@ -800,53 +588,14 @@ module core(
 
             if (fail || illegal_instruction) begin
                 $display("pc: 0x%h", program_counter);
-                $display("registers (decimal/hex):");
-                $display("    ra: %d/0x%h", registers.r[1], registers.r[1]);
-                $display("    sp: %d/0x%h", registers.r[2], registers.r[2]);
-                $display("    gp: %d/0x%h", registers.r[3], registers.r[3]);
-                $display("    tp: %d/0x%h", registers.r[4], registers.r[4]);
-                $display("    t0: %d/0x%h", registers.r[5], registers.r[5]);
-                $display("    t1: %d/0x%h", registers.r[6], registers.r[6]);
-                $display("    t2: %d/0x%h", registers.r[7], registers.r[7]);
-                $display("    s0: %d/0x%h", registers.r[8], registers.r[8]);
-                $display("    s1: %d/0x%h", registers.r[9], registers.r[9]);
-                $display("    a0: %d/0x%h", registers.r[10], registers.r[10]);
-                $display("    a1: %d/0x%h", registers.r[11], registers.r[11]);
-                $display("    a2: %d/0x%h", registers.r[12], registers.r[12]);
-                $display("    a3: %d/0x%h", registers.r[13], registers.r[13]);
-                $display("    a4: %d/0x%h", registers.r[14], registers.r[14]);
-                $display("    a5: %d/0x%h", registers.r[15], registers.r[15]);
-                $display("    a6: %d/0x%h", registers.r[16], registers.r[16]);
-                $display("    a7: %d/0x%h", registers.r[17], registers.r[17]);
-                $display("    s2: %d/0x%h", registers.r[18], registers.r[18]);
-                $display("    s3: %d/0x%h", registers.r[19], registers.r[19]);
-                $display("    s4: %d/0x%h", registers.r[20], registers.r[20]);
-                $display("    s5: %d/0x%h", registers.r[21], registers.r[21]);
-                $display("    s6: %d/0x%h", registers.r[22], registers.r[22]);
-                $display("    s7: %d/0x%h", registers.r[23], registers.r[23]);
-                $display("    s8: %d/0x%h", registers.r[24], registers.r[24]);
-                $display("    s9: %d/0x%h", registers.r[25], registers.r[25]);
-                $display("    s10: %d/0x%h", registers.r[26], registers.r[26]);
-                $display("    s11: %d/0x%h", registers.r[27], registers.r[27]);
-                $display("    t3: %d/0x%h", registers.r[28], registers.r[28]);
-                $display("    t4: %d/0x%h", registers.r[29], registers.r[29]);
-                $display("    t5: %d/0x%h", registers.r[30], registers.r[30]);
-                $display("    t6: %d/0x%h", registers.r[31], registers.r[31]);
-
-                core_file = $fopen("core", "w");
-                if (core_file != 0) begin
-                    for (reg [31:0] i = 0; i < MEMORY_SIZE / 4; i = i + 1) begin
-                        $fwriteb(core_file, "%u", top.memory[i]);
-                    end
-                    $display("core written to ./core");
-                    $fclose(core_file);
-                end else begin
-                    $display("could not create core file");
+                registers.display_registers();
+                top.write_core_file();
+                top.trace_encoder.write_trace_file();
+                if (trace_file != 0) begin
+                    $fflush(trace_file);
                 end
 
                 $stop;
-            end else begin
-                core_file = 32'bx;
             end
         end
 
@@ -856,6 +605,38 @@ module core(
                 $fflush(); // doesn't print immediately otherwise
             end
         end
+
+        // with +trace=<file> each retired instruction and each trap is
+        // written to the file for iss/ to compare against, see iss/src/trace.rs
+        // for the format. a load is written in the cycle that its register is
+        // written, before the instruction retired in that cycle
+        initial begin
+            if ($value$plusargs("trace=%s", trace_file_name)) begin
+                trace_file = $fopen(trace_file_name, "wb");
+            end
+        end
+
+        always @(posedge clock) begin
+            if (trace_file != 0 && !memory_wait) begin
+                if (trace_load) begin
+                    write_trace(trace_load_address, { 27'b0, load_register }, load_register == 0 ? 0 : register_write_value_2);
+                end
+                trace_load <= instruction_retired && opcode == OPCODE_LOAD;
+                trace_load_address <= program_counter;
+
+                if (instruction_retired && opcode != OPCODE_LOAD) begin
+                    write_trace(program_counter, { 27'b0, register_write_address_1 }, register_write_address_1 == 0 ? 0 : register_write_value_1);
+                end
+                if (trap) begin
+                    // a chained interrupt is taken where its mret would return
+                    write_trace(return_from_trap ? trap_return_address : trap_program_counter, 32'h80000000, trap_mcause);
+                end
+            end
+        end
+
+        task write_trace(input [31:0] address, input [31:0] kind, input [31:0] value);
+            $fwrite(trace_file, "%u%u%u", address, kind, value);
+        endtask
     `endif
 
 endmodule
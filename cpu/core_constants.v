@@ -0,0 +1,182 @@
+// shared between the core implementations
+
+`ifndef INCLUDE_CORE_CONSTANTS
+`define INCLUDE_CORE_CONSTANTS
+
+localparam OPCODE_LUI = 7'b0110111;
+localparam OPCODE_AUIPC = 7'b0010111;
+localparam OPCODE_JAL = 7'b1101111;
+localparam OPCODE_JALR = 7'b1100111;
+localparam OPCODE_BRANCH = 7'b1100011;
+localparam OPCODE_LOAD = 7'b0000011;
+localparam OPCODE_STORE = 7'b0100011;
+localparam OPCODE_IMMEDIATE = 7'b0010011;
+localparam OPCODE_ARITHMETIC = 7'b0110011;
+localparam OPCODE_FENCE = 7'b0001111; // includes PAUSE instruction
+localparam OPCODE_SYSTEM = 7'b1110011;
+
+localparam FUNCT3_JALR = 3'b000;
+
+localparam FUNCT3_BEQ = 3'b000;
+localparam FUNCT3_BNE = 3'b001;
+localparam FUNCT3_BLT = 3'b100;
+localparam FUNCT3_BGE = 3'b101;
+localparam FUNCT3_BLTU = 3'b110;
+localparam FUNCT3_BGEU = 3'b111;
+
+localparam FUNCT3_LB = 3'b000;
+localparam FUNCT3_LH = 3'b001;
+localparam FUNCT3_LW = 3'b010;
+localparam FUNCT3_LBU = 3'b100;
+localparam FUNCT3_LHU = 3'b101;
+
+localparam FUNCT3_SB = 3'b000;
+localparam FUNCT3_SH = 3'b001;
+localparam FUNCT3_SW = 3'b010;
+
+// funct3 values for arithmetic and immediate instructions are the same,
+// so use the same for both
+localparam FUNCT3_ADD = 3'b000;
+localparam FUNCT3_SUB = 3'b000;
+localparam FUNCT3_SLL = 3'b001;
+localparam FUNCT3_SLT = 3'b010;
+localparam FUNCT3_SLTU = 3'b011;
+localparam FUNCT3_XOR = 3'b100;
+localparam FUNCT3_SRL = 3'b101;
+localparam FUNCT3_SRA = 3'b101;
+localparam FUNCT3_OR = 3'b110;
+localparam FUNCT3_AND = 3'b111;
+
+localparam FUNCT7_BASE = 7'b0000000;
+localparam FUNCT7_BASE_ALTERNATE = 7'b0100000; // sub, sra and Zbb andn, orn, xnor
+// arithmetic instructions with this funct7 are from the M extension
+localparam FUNCT7_MULDIV = 7'b0000001;
+localparam FUNCT7_MIN_MAX = 7'b0000101;
+localparam FUNCT7_ZERO_EXTEND = 7'b0000100;
+localparam FUNCT7_SHIFT_ADD = 7'b0010000;
+localparam FUNCT7_ROTATE = 7'b0110000; // also clz, ctz, cpop, sext.b and sext.h
+
+localparam FUNCT3_MUL = 3'b000;
+localparam FUNCT3_MULH = 3'b001;
+localparam FUNCT3_MULHSU = 3'b010;
+localparam FUNCT3_MULHU = 3'b011;
+localparam FUNCT3_DIV = 3'b100;
+localparam FUNCT3_DIVU = 3'b101;
+localparam FUNCT3_REM = 3'b110;
+localparam FUNCT3_REMU = 3'b111;
+
+localparam FUNCT3_FENCE = 3'b000;
+localparam FUNCT3_PRIV = 3'b000;
+
+localparam FUNCT3_CSRRW = 3'b001;
+localparam FUNCT3_CSRRS = 3'b010;
+localparam FUNCT3_CSRRC = 3'b011;
+localparam FUNCT3_CSRRWI = 3'b101;
+localparam FUNCT3_CSRRSI = 3'b110;
+localparam FUNCT3_CSRRCI = 3'b111;
+
+localparam FUNC12_ECALL = 12'b0;
+localparam FUNC12_EBREAK = 12'b1;
+localparam FUNC12_MRET = 12'b001100000010;
+localparam FUNC12_WFI = 12'b000100000101;
+
+`ifdef simulation
+localparam FUNC12_TEST_PASS = 12'b100011000000;
+localparam FUNC12_TEST_FAIL = 12'b110011000000;
+localparam FUNC12_SIMULATION_PUTCHAR = 12'b000011000000;
+`endif
+
+// the base instructions have the bit at index 3 as the bit at index 30 in the
+// corresponding instruction and the bit at index 4 clear; the opcodes for the
+// bit manipulation extensions have the bit at index 4 set
+localparam ALU_OPCODE_ADD = { 2'b00, FUNCT3_ADD };
+localparam ALU_OPCODE_SUBTRACT = { 2'b01, FUNCT3_SUB };
+localparam ALU_OPCODE_LEFT_SHIFT = { 2'b00, FUNCT3_SLL };
+localparam ALU_OPCODE_XOR = { 2'b00, FUNCT3_XOR };
+localparam ALU_OPCODE_RIGHT_SHIFT_LOGICAL = { 2'b00, FUNCT3_SRL };
+localparam ALU_OPCODE_RIGHT_SHIFT_ARITHMETIC = { 2'b01, FUNCT3_SRA };
+localparam ALU_OPCODE_OR = { 2'b00, FUNCT3_OR };
+localparam ALU_OPCODE_AND = { 2'b00, FUNCT3_AND };
+localparam ALU_OPCODE_AND_NOT = 5'b10000;
+localparam ALU_OPCODE_OR_NOT = 5'b10001;
+localparam ALU_OPCODE_XNOR = 5'b10010;
+localparam ALU_OPCODE_MIN = 5'b10011;
+localparam ALU_OPCODE_MIN_UNSIGNED = 5'b10100;
+localparam ALU_OPCODE_MAX = 5'b10101;
+localparam ALU_OPCODE_MAX_UNSIGNED = 5'b10110;
+localparam ALU_OPCODE_ROTATE_LEFT = 5'b10111;
+localparam ALU_OPCODE_ROTATE_RIGHT = 5'b11000;
+localparam ALU_OPCODE_COUNT_LEADING_ZEROS = 5'b11001;
+localparam ALU_OPCODE_COUNT_TRAILING_ZEROS = 5'b11010;
+localparam ALU_OPCODE_COUNT_SET_BITS = 5'b11011;
+localparam ALU_OPCODE_SIGN_EXTEND_BYTE = 5'b11100;
+localparam ALU_OPCODE_SIGN_EXTEND_HALFWORD = 5'b11101;
+localparam ALU_OPCODE_ZERO_EXTEND_HALFWORD = 5'b11110;
+localparam ALU_OPCODE_OR_COMBINE_BYTES = 5'b11111;
+localparam ALU_OPCODE_REVERSE_BYTES = 5'b01001;
+
+localparam MCAUSE_ILLEGAL_INSTRUCTION = 2;
+localparam MCAUSE_BREAKPOINT = 3;
+localparam MCAUSE_ENVIRONMENT_CALL_FROM_M_MODE = 11;
+localparam MCAUSE_MACHINE_TIMER_INTERRUPT = (1 << 31) | 7;
+localparam MCAUSE_MACHINE_EXTERNAL_INTERRUPT = (1 << 31) | 11;
+localparam MCAUSE_DMA_INTERRUPT = (1 << 31) | 16; // platform defined
+localparam MCAUSE_USB_OUT_FIFO_INTERRUPT = (1 << 31) | 17; // platform defined
+
+localparam ADDRESS_MVENDORID = 12'hF11;
+localparam ADDRESS_MARCHID = 12'hF12;
+localparam ADDRESS_MIMPID = 12'hF13;
+localparam ADDRESS_MHARTID = 12'hF14;
+localparam ADDRESS_MCONFIGPTR = 12'hF15;
+
+localparam ADDRESS_MSTATUS = 12'h300;
+localparam ADDRESS_MISA = 12'h301;
+localparam ADDRESS_MIE = 12'h304;
+localparam ADDRESS_MTVEC = 12'h305;
+localparam ADDRESS_MCOUNTEREN = 12'h306;
+localparam ADDRESS_MSTATUSH = 12'h310;
+
+localparam ADDRESS_MSCRATCH = 12'h340;
+localparam ADDRESS_MEPC = 12'h341;
+localparam ADDRESS_MCAUSE = 12'h342;
+localparam ADDRESS_MTVAL = 12'h343;
+localparam ADDRESS_MIP = 12'h344;
+localparam ADDRESS_MTINST = 12'h34A;
+localparam ADDRESS_MTVAL2 = 12'h34B;
+
+localparam ADDRESS_MENVCFG = 12'h30A;
+localparam ADDRESS_MENVCFGH = 12'h31A;
+
+localparam ADDRESS_MHPMCOUNTER3 = 12'hB03;
+localparam ADDRESS_MHPMCOUNTER31 = 12'hB1F;
+localparam ADDRESS_MHPMCOUNTER3H = 12'hB83;
+localparam ADDRESS_MHPMCOUNTER31H = 12'hB9F;
+
+localparam ADDRESS_MHPMEVENT3 = 12'h323;
+localparam ADDRESS_MHPMEVENT31 = 12'h33F;
+localparam ADDRESS_MHPMEVENT3H = 12'h723;
+localparam ADDRESS_MHPMEVENT31H = 12'h73F;
+
+// the number of implemented mhpmcounter and mhpmevent registers, starting at
+// mhpmcounter3 and mhpmevent3
+localparam HPM_COUNTER_COUNT = 4;
+
+// the values of the mhpmevent registers, must match enum performance_event in
+// lib/cpulib.h
+localparam HPM_EVENT_NONE = 0;
+localparam HPM_EVENT_STALL = 1; // cycles where the core is waiting, such as for a division
+localparam HPM_EVENT_TAKEN_BRANCH = 2;
+localparam HPM_EVENT_TRAP = 3; // traps taken, including interrupts
+localparam HPM_EVENT_INTERRUPT_PENDING = 4; // cycles where an enabled interrupt is pending but not taken
+localparam HPM_EVENT_IN_TRAP = 5; // cycles between a trap and mret
+localparam HPM_EVENT_USB_BUFFER_OWNED = 6; // cycles where the core owns a usb data buffer bank
+localparam HPM_EVENT_WAIT_FOR_INTERRUPT = 7; // cycles spent waiting in wfi
+localparam HPM_EVENT_COUNT = 8;
+
+localparam ADDRESS_MCYCLE = 12'hB00;
+localparam ADDRESS_MINSTRET = 12'hB02;
+
+localparam ADDRESS_MCYCLEH = 12'hB80;
+localparam ADDRESS_MINSTRETH = 12'hB82;
+
+`endif
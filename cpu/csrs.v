@@ -0,0 +1,416 @@
+`include "core_constants.v"
+
+// the machine mode control and status registers, shared by the core implementations
+//
+// a trap takes precedence over a return from a trap, which takes precedence
+// over a csr write; both together chain to the next interrupt handler
+//
+// with mtvec in vectored mode, interrupts jump to base + 4 * cause and their
+// handlers run in the shadow register bank, so the registers of the
+// interrupted code do not need to be saved; exceptions still jump to base and
+// use the current bank, and the mret of an exception taken in the shadow bank
+// stays in it, so the handler's own mret still returns to the base bank. there
+// is only one shadow bank, so interrupts aren't taken, or chained to from the
+// mret of such an exception, while it is in use, even if the handler sets
+// mstatus.MIE; they are taken, or chained to, when the handler returns. like
+// mepc, the interrupt enable stack only has one level, so a handler that can
+// take an exception has to save mepc and mstatus around it
+//
+// an mret while another interrupt is pending that would be taken right after
+// it chains to the next handler instead of returning: the core sets both trap
+// and return_from_trap, and mepc and the interrupt enable stack are kept as
+// they are
+//
+// wake_from_wait ends a wfi, it is set when an interrupt is pending and
+// enabled in mie even if interrupts are disabled in mstatus
+module csrs(
+    input clock,
+    input [11:0] address,
+    output reg [31:0] read_value,
+    input write_enable,
+    input [31:0] write_value,
+    input trap,
+    input [31:0] trap_mcause,
+    input [31:0] trap_program_counter,
+    input return_from_trap,
+    input instruction_retired,
+    input stalled, // for performance counters
+    input taken_branch, // for performance counters
+    input waiting_for_interrupt, // for performance counters
+    input mip_mtip, // machine timer interrupt pending
+    input mip_meip, // machine external interrupt pending
+    input mip_dmaip, // dma completion interrupt pending, platform interrupt 16
+    input mip_fifoip, // usb out fifo interrupt pending, platform interrupt 17
+    output take_interrupt,
+    output chain_interrupt, // an mret should chain to the pending interrupt
+    output wake_from_wait,
+    output [31:0] interrupt_mcause, // of the pending interrupt
+    output [31:0] trap_vector, // for exceptions
+    output [31:0] interrupt_vector, // for the pending interrupt
+    output [31:0] trap_return_address,
+    output reg register_bank = 0 // 1 for the shadow register bank
+);
+    wire [63:0] menvcfg = {
+        1'b0 /* STCE */,
+        1'b0 /* PBMTE */,
+        1'b0 /* ADUE */,
+        1'b0 /* CDE */,
+        26'b0 /* WPRI */,
+        2'b0 /* PMM */,
+        24'b0 /* WPRI */,
+        1'b0 /* CBZE */,
+        1'b0 /* CBCFE */,
+        2'b0 /* CBIE */,
+        3'b0 /* WPRI */,
+        1'b0 /* FIOM */
+    };
+
+    `ifdef simulation
+        // run the simulation with +profile=<file> to write the address of the
+        // executing instruction every cycle, with bit 0 set if it retired, as
+        // 32 bit words for the profiler
+        integer profile_file = 0;
+        reg [8 * 256 - 1:0] profile_file_name;
+        initial begin
+            if ($value$plusargs("profile=%s", profile_file_name)) begin
+                profile_file = $fopen(profile_file_name, "wb");
+            end
+        end
+
+        always @(posedge clock) begin
+            if (profile_file != 0) begin
+                $fwrite(profile_file, "%u", { trap_program_counter[31:1], instruction_retired });
+            end
+        end
+    `endif
+
+    wire [63:0] next_mcycle = mcycle + 1;
+    wire [63:0] next_minstret = instruction_retired ? minstret + 1 : minstret;
+
+    wire timer_interrupt_pending = mie_mtie && mip_mtip;
+    wire external_interrupt_pending = mie_meie && mip_meip;
+    wire dma_interrupt_pending = mie_dmaie && mip_dmaip;
+    wire fifo_interrupt_pending = mie_fifoie && mip_fifoip;
+    wire interrupt_pending = timer_interrupt_pending || external_interrupt_pending
+        || dma_interrupt_pending || fifo_interrupt_pending;
+    // indexed by the event numbers
+    wire [HPM_EVENT_COUNT - 1:0] events = {
+        waiting_for_interrupt, // HPM_EVENT_WAIT_FOR_INTERRUPT
+        mip_meip, // HPM_EVENT_USB_BUFFER_OWNED
+        in_trap, // HPM_EVENT_IN_TRAP
+        interrupt_pending && !trap, // HPM_EVENT_INTERRUPT_PENDING
+        trap, // HPM_EVENT_TRAP
+        taken_branch, // HPM_EVENT_TAKEN_BRANCH
+        stalled, // HPM_EVENT_STALL
+        1'b0 // HPM_EVENT_NONE
+    };
+    // which counter is being accessed for the mhpmcounter and mhpmevent
+    // ranges, only valid when the address is in the range
+    wire [11:0] hpm_counter_offset = address - ADDRESS_MHPMCOUNTER3;
+    wire [11:0] hpm_counter_high_offset = address - ADDRESS_MHPMCOUNTER3H;
+    wire [11:0] hpm_event_offset = address - ADDRESS_MHPMEVENT3;
+
+    assign take_interrupt = mstatus_mie && interrupt_pending && !register_bank;
+    // an mret sets mstatus_mie to mstatus_mpie
+    assign chain_interrupt = mstatus_mpie && interrupt_pending && !shadow_bank_exception;
+    assign wake_from_wait = interrupt_pending;
+    // the timer interrupt takes precedence, then the external interrupt, then
+    // the dma interrupt
+    assign interrupt_mcause = timer_interrupt_pending
+        ? MCAUSE_MACHINE_TIMER_INTERRUPT
+        : external_interrupt_pending
+            ? MCAUSE_MACHINE_EXTERNAL_INTERRUPT
+            : dma_interrupt_pending ? MCAUSE_DMA_INTERRUPT : MCAUSE_USB_OUT_FIFO_INTERRUPT;
+    assign trap_vector = { base, 2'b0 };
+    assign interrupt_vector = mtvec_vectored ? { base, 2'b0 } + { interrupt_mcause[29:0], 2'b0 } : { base, 2'b0 };
+    assign trap_return_address = { mepc, 1'b0 };
+
+    // register-like regs written in the following block
+    reg mstatus_mie = 0; // machine interrupt enable
+    reg mstatus_mpie; // machine prior interrupt enable
+    reg [29:0] base;
+    reg mtvec_vectored = 0;
+    reg mip_msip; // machine software interrupt pending
+
+    // machine interrupt enable
+    reg mie_meie; // machine external interrupt enable
+    reg mie_mtie; // machine timer interrupt enable
+    reg mie_msie; // machine software interrupt enable
+    reg mie_dmaie; // dma completion interrupt enable
+    reg mie_fifoie; // usb out fifo interrupt enable
+
+    reg [63:0] mcycle = 0;
+    reg [63:0] minstret = 0;
+    reg [31:0] mscratch;
+    reg [30:0] mepc; // machine exception program counter, bit 1 is kept for the C extension
+    reg [31:0] mcause = 0;
+    reg in_trap = 0;
+    // an exception was taken in the shadow register bank, so the next mret
+    // stays in it; otherwise mret goes back to the base bank, since interrupts
+    // are only taken in the base bank
+    reg shadow_bank_exception = 0;
+
+    reg [63:0] hpm_counters[HPM_COUNTER_COUNT - 1:0];
+    reg [2:0] hpm_events[HPM_COUNTER_COUNT - 1:0];
+    integer i;
+    initial begin
+        for (i = 0; i < HPM_COUNTER_COUNT; i = i + 1) begin
+            hpm_counters[i] = 0;
+            hpm_events[i] = HPM_EVENT_NONE;
+        end
+    end
+
+    always @(posedge clock) begin
+        if (trap && return_from_trap) begin
+            // chaining to the next interrupt handler
+            mcause <= trap_mcause;
+        end else if (trap) begin
+            mcause <= trap_mcause;
+            mepc <= trap_program_counter[31:1];
+            mstatus_mpie <= mstatus_mie;
+            mstatus_mie <= 0;
+        end else if (return_from_trap) begin
+            mstatus_mie <= mstatus_mpie;
+            mstatus_mpie <= 1;
+        end else if (write_enable) begin
+            case (address)
+                ADDRESS_MSTATUS: begin
+                    mstatus_mie <= write_value[3];
+                    mstatus_mpie <= write_value[7];
+                end
+                ADDRESS_MTVEC: begin
+                    base <= write_value[31:2];
+                    // the reserved modes are treated as direct
+                    mtvec_vectored <= write_value[1:0] == 2'b01;
+                end
+                ADDRESS_MIP: begin
+                    // all are read-only
+                end
+                ADDRESS_MIE: begin
+                    // this could be read-only, TODO consider
+                    mie_msie <= write_value[3];
+                    mie_mtie <= write_value[7];
+                    mie_meie <= write_value[11];
+                    mie_dmaie <= write_value[16];
+                    mie_fifoie <= write_value[17];
+                end
+                ADDRESS_MSCRATCH: begin
+                    mscratch <= write_value;
+                end
+                ADDRESS_MEPC: begin
+                    mepc <= write_value[31:1];
+                end
+                ADDRESS_MCAUSE: begin
+                    mcause <= write_value;
+                end
+                default: begin
+                end
+            endcase
+        end
+
+        if (write_enable) begin
+            case (address)
+                ADDRESS_MCYCLE: mcycle[31:0] <= write_value;
+                ADDRESS_MCYCLEH: mcycle[63:32] <= write_value;
+                default: mcycle <= next_mcycle;
+            endcase
+
+            case (address)
+                ADDRESS_MINSTRET: minstret[31:0] <= write_value;
+                ADDRESS_MINSTRETH: minstret[63:32] <= write_value;
+                default: minstret <= next_minstret;
+            endcase
+        end else begin
+            mcycle <= next_mcycle;
+            minstret <= next_minstret;
+        end
+
+        if (trap) begin
+            in_trap <= 1;
+            if (trap_mcause[31]) begin
+                register_bank <= mtvec_vectored;
+            end else if (register_bank) begin
+                shadow_bank_exception <= 1;
+            end
+        end else if (return_from_trap) begin
+            in_trap <= 0;
+            if (shadow_bank_exception) begin
+                shadow_bank_exception <= 0;
+            end else begin
+                register_bank <= 0;
+            end
+        end
+
+        for (i = 0; i < HPM_COUNTER_COUNT; i = i + 1) begin
+            if (write_enable && address == ADDRESS_MHPMCOUNTER3 + i) begin
+                hpm_counters[i][31:0] <= write_value;
+            end else if (write_enable && address == ADDRESS_MHPMCOUNTER3H + i) begin
+                hpm_counters[i][63:32] <= write_value;
+            end else if (events[hpm_events[i]]) begin
+                hpm_counters[i] <= hpm_counters[i] + 1;
+            end
+
+            if (write_enable && address == ADDRESS_MHPMEVENT3 + i) begin
+                // unknown events are stored as no event
+                hpm_events[i] <= write_value < HPM_EVENT_COUNT ? write_value[2:0] : HPM_EVENT_NONE;
+            end
+        end
+    end
+
+    always @* begin
+        case (address)
+            ADDRESS_MISA: begin
+                read_value = {
+                    2'b01 /* MXL */,
+                    4'b0,
+                    26'b1 << 2 /* C */ | 26'b1 << 8 /* I */ | 26'b1 << 12 /* M */
+                };
+            end
+            ADDRESS_MVENDORID: begin
+                read_value = 0;
+            end
+            ADDRESS_MARCHID: begin
+                read_value = 0;
+            end
+            ADDRESS_MIMPID: begin
+                read_value = 0;
+            end
+            ADDRESS_MHARTID: begin
+                read_value = 0;
+            end
+            ADDRESS_MSTATUS: begin
+                read_value = {
+                    1'b0 /* SD */,
+                    8'b0 /* WPRI */,
+                    1'b0 /* TSR */,
+                    1'b0 /* TW */,
+                    1'b0 /* TVM */,
+                    1'b0 /* MXR */,
+                    1'b0 /* SUM */,
+                    1'b0 /* MPRV */,
+                    2'b0 /* XS */,
+                    2'b0 /* FS */,
+                    2'b11 /* MPP */,
+                    2'b0 /* VS */,
+                    1'b0 /* SPP */,
+                    mstatus_mpie,
+                    1'b0 /* UBE */,
+                    1'b0 /* SPIE */,
+                    1'b0 /* WPRI */,
+                    mstatus_mie,
+                    1'b0 /* WPRI */,
+                    1'b0 /* SIE */,
+                    1'b0 /* WPRI */
+                };
+            end
+            ADDRESS_MSTATUSH: begin
+                read_value = {
+                    26'b0 /* WPRI */,
+                    1'b0 /* MBE */,
+                    1'b0 /* SBE */,
+                    4'b0 /* WPRI */
+                };
+            end
+            ADDRESS_MTVEC: begin
+                read_value = {
+                    base,
+                    1'b0,
+                    mtvec_vectored /* MODE */
+                };
+            end
+            ADDRESS_MIP: begin
+                read_value = {
+                    14'b0 /* platform defined */,
+                    mip_fifoip,
+                    mip_dmaip,
+                    2'b0,
+                    1'b0 /* LCOFIP */,
+                    1'b0,
+                    mip_meip,
+                    1'b0,
+                    1'b0 /* SEIP */,
+                    1'b0,
+                    mip_mtip,
+                    1'b0,
+                    1'b0 /* STIP */,
+                    1'b0,
+                    mip_msip,
+                    1'b0,
+                    1'b0 /* SSIP */,
+                    1'b0
+                };
+            end
+            ADDRESS_MIE: begin
+                read_value = {
+                    14'b0 /* platform defined */,
+                    mie_fifoie,
+                    mie_dmaie,
+                    2'b0,
+                    1'b0 /* LCOFIE */,
+                    1'b0,
+                    mie_meie,
+                    1'b0,
+                    1'b0 /* SEIP */,
+                    1'b0,
+                    mie_mtie,
+                    1'b0,
+                    1'b0 /* STIP */,
+                    1'b0,
+                    mie_msie,
+                    1'b0,
+                    1'b0 /* SSIP */,
+                    1'b0
+                };
+            end
+            ADDRESS_MCYCLE: begin
+                read_value = mcycle[31:0];
+            end
+            ADDRESS_MCYCLEH: begin
+                read_value = mcycle[63:32];
+            end
+            ADDRESS_MINSTRET: begin
+                read_value = minstret[31:0];
+            end
+            ADDRESS_MINSTRETH: begin
+                read_value = minstret[63:32];
+            end
+            ADDRESS_MSCRATCH: begin
+                read_value = mscratch;
+            end
+            ADDRESS_MEPC: begin
+                read_value = { mepc, 1'b0 };
+            end
+            ADDRESS_MCAUSE: begin
+                read_value = mcause;
+            end
+            ADDRESS_MTVAL: begin
+                read_value = 0;
+            end
+            ADDRESS_MCONFIGPTR: begin
+                read_value = 0;
+            end
+            ADDRESS_MENVCFG: begin
+                read_value = menvcfg[31:0];
+            end
+            ADDRESS_MENVCFGH: begin
+                read_value = menvcfg[63:32];
+            end
+            default: begin
+                if (address >= ADDRESS_MHPMCOUNTER3 && hpm_counter_offset < HPM_COUNTER_COUNT) begin
+                    read_value = hpm_counters[hpm_counter_offset][31:0];
+                end else if (address >= ADDRESS_MHPMCOUNTER3H && hpm_counter_high_offset < HPM_COUNTER_COUNT) begin
+                    read_value = hpm_counters[hpm_counter_high_offset][63:32];
+                end else if (address >= ADDRESS_MHPMEVENT3 && hpm_event_offset < HPM_COUNTER_COUNT) begin
+                    read_value = { 29'b0, hpm_events[hpm_event_offset] };
+                end else if ((address >= ADDRESS_MHPMCOUNTER3 && address <= ADDRESS_MHPMCOUNTER31)
+                    || (address >= ADDRESS_MHPMCOUNTER3H && address <= ADDRESS_MHPMCOUNTER31H)
+                    || (address >= ADDRESS_MHPMEVENT3 && address <= ADDRESS_MHPMEVENT31)
+                    || (address >= ADDRESS_MHPMEVENT3H && address <= ADDRESS_MHPMEVENT31H)) begin
+                    read_value = 0;
+                end else begin
+                    read_value = 32'bx;
+                end
+            end
+        endcase
+    end
+endmodule
@@ -0,0 +1,177 @@
+`include "core_constants.v"
+
+// expands a 16 bit instruction from the C extension to the equivalent 32 bit
+// instruction; reserved and illegal encodings, including those only valid
+// for RV64 or with floating point, expand to 0 which is an illegal
+// instruction
+module decompressor(
+    input [15:0] compressed,
+    output reg [31:0] instruction
+);
+    wire [1:0] quadrant = compressed[1:0];
+    wire [2:0] funct3 = compressed[15:13];
+
+    // full register numbers for the register fields in the instruction
+    wire [4:0] rd = compressed[11:7];
+    wire [4:0] rs2 = compressed[6:2];
+    // the three bit register fields, which refer to x8 to x15
+    wire [4:0] rd_prime = { 2'b01, compressed[4:2] };
+    wire [4:0] rs1_prime = { 2'b01, compressed[9:7] };
+    wire [4:0] rs2_prime = rd_prime;
+
+    wire [11:0] immediate_6 = { {7{compressed[12]}}, compressed[6:2] };
+    wire [5:0] shift_amount = { compressed[12], compressed[6:2] };
+    wire [11:0] lw_offset = { 5'b0, compressed[5], compressed[12:10], compressed[6], 2'b0 };
+    wire [11:0] lwsp_offset = { 4'b0, compressed[3:2], compressed[12], compressed[6:4], 2'b0 };
+    wire [11:0] swsp_offset = { 4'b0, compressed[8:7], compressed[12:9], 2'b0 };
+    wire [11:0] addi4spn_immediate = { 2'b0, compressed[10:7], compressed[12:11], compressed[5], compressed[6], 2'b0 };
+    wire [11:0] addi16sp_immediate = { {3{compressed[12]}}, compressed[4:3], compressed[5], compressed[2], compressed[6], 4'b0 };
+    wire [20:0] jump_offset = { {10{compressed[12]}}, compressed[8], compressed[10:9], compressed[6], compressed[7], compressed[2], compressed[11], compressed[5:3], 1'b0 };
+    wire [12:0] branch_offset = { {5{compressed[12]}}, compressed[6:5], compressed[2], compressed[11:10], compressed[4:3], 1'b0 };
+
+    always @* begin
+        instruction = 0;
+        case (quadrant)
+            2'b00: begin
+                case (funct3)
+                    3'b000: begin // c.addi4spn
+                        if (addi4spn_immediate != 0) begin
+                            instruction = i_type(addi4spn_immediate, 5'd2, FUNCT3_ADD, rd_prime, OPCODE_IMMEDIATE);
+                        end
+                    end
+                    3'b010: begin // c.lw
+                        instruction = i_type(lw_offset, rs1_prime, FUNCT3_LW, rd_prime, OPCODE_LOAD);
+                    end
+                    3'b110: begin // c.sw
+                        instruction = s_type(lw_offset, rs2_prime, rs1_prime, FUNCT3_SW);
+                    end
+                    default: begin
+                    end
+                endcase
+            end
+            2'b01: begin
+                case (funct3)
+                    3'b000: begin // c.addi, c.nop
+                        instruction = i_type(immediate_6, rd, FUNCT3_ADD, rd, OPCODE_IMMEDIATE);
+                    end
+                    3'b001: begin // c.jal
+                        instruction = j_type(jump_offset, 5'd1);
+                    end
+                    3'b010: begin // c.li
+                        instruction = i_type(immediate_6, 5'd0, FUNCT3_ADD, rd, OPCODE_IMMEDIATE);
+                    end
+                    3'b011: begin
+                        if (rd == 2) begin // c.addi16sp
+                            if (addi16sp_immediate != 0) begin
+                                instruction = i_type(addi16sp_immediate, 5'd2, FUNCT3_ADD, 5'd2, OPCODE_IMMEDIATE);
+                            end
+                        end else begin // c.lui
+                            if (immediate_6 != 0) begin
+                                instruction = { {14{compressed[12]}}, compressed[12], compressed[6:2], rd, OPCODE_LUI };
+                            end
+                        end
+                    end
+                    3'b100: begin
+                        case (compressed[11:10])
+                            2'b00: begin // c.srli
+                                if (!shift_amount[5]) begin
+                                    instruction = i_type({ 7'b0000000, shift_amount[4:0] }, rs1_prime, FUNCT3_SRL, rs1_prime, OPCODE_IMMEDIATE);
+                                end
+                            end
+                            2'b01: begin // c.srai
+                                if (!shift_amount[5]) begin
+                                    instruction = i_type({ 7'b0100000, shift_amount[4:0] }, rs1_prime, FUNCT3_SRA, rs1_prime, OPCODE_IMMEDIATE);
+                                end
+                            end
+                            2'b10: begin // c.andi
+                                instruction = i_type(immediate_6, rs1_prime, FUNCT3_AND, rs1_prime, OPCODE_IMMEDIATE);
+                            end
+                            2'b11: begin
+                                if (!compressed[12]) begin
+                                    case (compressed[6:5])
+                                        2'b00: instruction = r_type(7'b0100000, rs2_prime, rs1_prime, FUNCT3_SUB, rs1_prime); // c.sub
+                                        2'b01: instruction = r_type(7'b0000000, rs2_prime, rs1_prime, FUNCT3_XOR, rs1_prime); // c.xor
+                                        2'b10: instruction = r_type(7'b0000000, rs2_prime, rs1_prime, FUNCT3_OR, rs1_prime); // c.or
+                                        2'b11: instruction = r_type(7'b0000000, rs2_prime, rs1_prime, FUNCT3_AND, rs1_prime); // c.and
+                                    endcase
+                                end
+                            end
+                        endcase
+                    end
+                    3'b101: begin // c.j
+                        instruction = j_type(jump_offset, 5'd0);
+                    end
+                    3'b110: begin // c.beqz
+                        instruction = b_type(branch_offset, 5'd0, rs1_prime, FUNCT3_BEQ);
+                    end
+                    3'b111: begin // c.bnez
+                        instruction = b_type(branch_offset, 5'd0, rs1_prime, FUNCT3_BNE);
+                    end
+                endcase
+            end
+            2'b10: begin
+                case (funct3)
+                    3'b000: begin // c.slli
+                        if (!shift_amount[5]) begin
+                            instruction = i_type({ 7'b0000000, shift_amount[4:0] }, rd, FUNCT3_SLL, rd, OPCODE_IMMEDIATE);
+                        end
+                    end
+                    3'b010: begin // c.lwsp
+                        if (rd != 0) begin
+                            instruction = i_type(lwsp_offset, 5'd2, FUNCT3_LW, rd, OPCODE_LOAD);
+                        end
+                    end
+                    3'b100: begin
+                        if (!compressed[12]) begin
+                            if (rs2 == 0) begin // c.jr
+                                if (rd != 0) begin
+                                    instruction = i_type(12'b0, rd, FUNCT3_JALR, 5'd0, OPCODE_JALR);
+                                end
+                            end else begin // c.mv
+                                instruction = r_type(7'b0000000, rs2, 5'd0, FUNCT3_ADD, rd);
+                            end
+                        end else begin
+                            if (rs2 == 0) begin
+                                if (rd == 0) begin // c.ebreak
+                                    instruction = { FUNC12_EBREAK, 5'd0, FUNCT3_PRIV, 5'd0, OPCODE_SYSTEM };
+                                end else begin // c.jalr
+                                    instruction = i_type(12'b0, rd, FUNCT3_JALR, 5'd1, OPCODE_JALR);
+                                end
+                            end else begin // c.add
+                                instruction = r_type(7'b0000000, rs2, rd, FUNCT3_ADD, rd);
+                            end
+                        end
+                    end
+                    3'b110: begin // c.swsp
+                        instruction = s_type(swsp_offset, rs2, 5'd2, FUNCT3_SW);
+                    end
+                    default: begin
+                    end
+                endcase
+            end
+            default: begin
+                // not a compressed instruction
+            end
+        endcase
+    end
+
+    function [31:0] i_type(input [11:0] immediate, input [4:0] rs1, input [2:0] funct3, input [4:0] rd, input [6:0] opcode);
+        i_type = { immediate, rs1, funct3, rd, opcode };
+    endfunction
+
+    function [31:0] s_type(input [11:0] immediate, input [4:0] rs2, input [4:0] rs1, input [2:0] funct3);
+        s_type = { immediate[11:5], rs2, rs1, funct3, immediate[4:0], OPCODE_STORE };
+    endfunction
+
+    function [31:0] b_type(input [12:0] offset, input [4:0] rs2, input [4:0] rs1, input [2:0] funct3);
+        b_type = { offset[12], offset[10:5], rs2, rs1, funct3, offset[4:1], offset[11], OPCODE_BRANCH };
+    endfunction
+
+    function [31:0] j_type(input [20:0] offset, input [4:0] rd);
+        j_type = { offset[20], offset[10:1], offset[11], offset[19:12], rd, OPCODE_JAL };
+    endfunction
+
+    function [31:0] r_type(input [6:0] funct7, input [4:0] rs2, input [4:0] rs1, input [2:0] funct3, input [4:0] rd);
+        r_type = { funct7, rs2, rs1, funct3, rd, OPCODE_ARITHMETIC };
+    endfunction
+endmodule
@@ -0,0 +1,145 @@
+// copies between memory and the usb data buffer, or within either, using the
+// cycles where the core is not accessing memory; see the dma registers in
+// top.v
+//
+// the source and destination can have any alignment: each word read from the
+// source is combined with the word read before it and shifted into place, so
+// after a possible first read each word written takes one read, and the bytes
+// outside of the destination are masked off in the first and last words
+//
+// a read is made in a cycle where read_granted is set and its value is on
+// read_value in the following cycle; a write is made in a cycle where
+// write_granted is set. read_request depends on write_granted, since a word
+// can only be read once there is room for it
+//
+// a copy whose source or destination is not entirely in the block ram or
+// entirely in the usb data buffer, such as one in external memory, which is
+// only reached through the caches, copies nothing and completes at once
+module dma #(
+    parameter MEMORY_SIZE = 32'h10000, // in bytes, the block ram is at address 0
+    parameter USB_DATA_BUFFER_ADDRESS = 32'hc0000000,
+    parameter USB_DATA_BUFFER_SIZE = 2048 // in bytes, of all banks
+) (
+    input clock,
+    input [31:0] register_write_value,
+    input write_source,
+    input write_destination,
+    input write_length, // starts the copy
+    // nonzero while copying, the bytes from the next destination word to the end
+    output [31:0] remaining,
+    output reg complete = 0, // cleared by writing the length
+    output read_request,
+    output [31:0] read_address,
+    input read_granted,
+    input [31:0] read_value,
+    output write_request,
+    output [31:0] write_address,
+    output [31:0] write_value,
+    output [3:0] write_sections,
+    input write_granted
+);
+    // the number of destination words that the length written covers
+    wire [15:0] destination_words = ((destination + register_write_value + 3) >> 2) - (destination >> 2);
+    // the first read only fills previous_word when the first destination word
+    // starts later in its source word than the destination does
+    wire first_read_only_fills = source[1:0] >= destination[1:0];
+    wire copy_allowed = in_dma_memory(source, register_write_value)
+        && in_dma_memory(destination, register_write_value);
+
+    wire [31:0] current_word = read_pending ? read_value : held_word;
+    wire have_word = (read_pending && !read_pending_fills) || held_word_valid;
+    wire [63:0] combined_words = { current_word, previous_word };
+
+    assign remaining = writes_remaining == 0 ? 0 : destination_end - write_pointer;
+    assign read_request = reads_remaining != 0 && (!have_word || write_granted);
+    assign read_address = read_pointer;
+    assign write_request = have_word;
+    assign write_address = write_pointer;
+    assign write_value = combined_words >> { shift, 3'b0 };
+    assign write_sections = {
+        in_destination(write_pointer + 3),
+        in_destination(write_pointer + 2),
+        in_destination(write_pointer + 1),
+        in_destination(write_pointer)
+    };
+
+    // register-like regs written in the following block
+    reg [31:0] source, destination;
+    reg [31:0] read_pointer, write_pointer; // word aligned
+    reg [31:0] destination_start, destination_end;
+    reg [1:0] shift; // in bytes
+    reg [15:0] reads_remaining = 0, writes_remaining = 0;
+    reg next_read_fills;
+    reg read_pending = 0;
+    reg read_pending_fills;
+    reg [31:0] held_word;
+    reg held_word_valid = 0;
+    reg [31:0] previous_word;
+
+    always @(posedge clock) begin
+        if (write_source) begin
+            source <= register_write_value;
+        end
+        if (write_destination) begin
+            destination <= register_write_value;
+        end
+
+        if (write_length) begin
+            read_pointer <= { source[31:2], 2'b0 };
+            write_pointer <= { destination[31:2], 2'b0 };
+            destination_start <= destination;
+            destination_end <= destination + register_write_value;
+            shift <= source[1:0] - destination[1:0];
+            if (register_write_value == 0 || !copy_allowed) begin
+                reads_remaining <= 0;
+                writes_remaining <= 0;
+            end else begin
+                reads_remaining <= destination_words + first_read_only_fills;
+                writes_remaining <= destination_words;
+            end
+            next_read_fills <= first_read_only_fills;
+            read_pending <= 0;
+            held_word_valid <= 0;
+            complete <= register_write_value != 0 && !copy_allowed;
+        end else begin
+            read_pending <= read_granted;
+            read_pending_fills <= next_read_fills;
+            if (read_granted) begin
+                read_pointer <= read_pointer + 4;
+                reads_remaining <= reads_remaining - 1;
+                next_read_fills <= 0;
+            end
+
+            if (write_granted) begin
+                write_pointer <= write_pointer + 4;
+                writes_remaining <= writes_remaining - 1;
+                previous_word <= current_word;
+                held_word_valid <= 0;
+                if (writes_remaining == 1) begin
+                    complete <= 1;
+                end
+            end else if (read_pending && read_pending_fills) begin
+                previous_word <= read_value;
+            end else if (read_pending) begin
+                // there was no write this cycle so the word is written later
+                held_word <= read_value;
+                held_word_valid <= 1;
+            end
+        end
+    end
+
+    function in_destination(input [31:0] address);
+        in_destination = address >= destination_start && address < destination_end;
+    endfunction
+
+    // whether the length bytes from start are all in the block ram or all in
+    // the usb data buffer
+    function in_dma_memory(input [31:0] start, input [31:0] length);
+        in_dma_memory = in_region(start, length, 0, MEMORY_SIZE)
+            || in_region(start, length, USB_DATA_BUFFER_ADDRESS, USB_DATA_BUFFER_SIZE);
+    endfunction
+
+    function in_region(input [31:0] start, input [31:0] length, input [31:0] base, input [31:0] size);
+        in_region = start - base < size && length <= size - (start - base);
+    endfunction
+endmodule
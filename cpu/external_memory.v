@@ -0,0 +1,100 @@
+// the external memory behind the caches in top.v
+//
+// in simulation this is a behavioral model of the ddr3 memory of the board;
+// there is no ddr3 controller yet, so on the board it reads as zero and
+// ignores writes
+//
+// a request is held until done is set; a write is of the word at the address
+// and a read is of the line of LINE_WORDS words at the address, which are on
+// read_value in order one per cycle with read_valid set. the first word of a
+// read, or the write, is LATENCY cycles after the request, which can be
+// changed in simulation with +dram_latency=<cycles>; done is set with the last
+// word of a read or once the write is done
+module external_memory #(
+    parameter SIZE = 32'h8000000, // in bytes
+    parameter LINE_WORDS = 4,
+    parameter LATENCY = 20
+) (
+    input clock,
+    input request,
+    input write,
+    input [31:0] address, // from the start of the external memory
+    input [31:0] write_value,
+    input [3:0] write_sections,
+    output reg [31:0] read_value,
+    output reg read_valid = 0,
+    output reg done = 0
+);
+    localparam ADDRESS_TOP_INDEX = $clog2(SIZE) - 1;
+
+    wire [ADDRESS_TOP_INDEX - 2:0] index = address[ADDRESS_TOP_INDEX:2] + word;
+
+    // stateful regs written in the following block
+    reg busy = 0;
+    reg [31:0] wait_cycles;
+    reg [$clog2(LINE_WORDS) - 1:0] word;
+
+    `ifdef simulation
+        reg [31:0] data[SIZE / 4];
+        reg [31:0] latency = LATENCY;
+        reg [8 * 256 - 1:0] image_directory, image_file_name;
+
+        initial begin
+            if ($value$plusargs("dram_latency=%d", latency)) begin
+                $display("external memory latency is %0d cycles", latency);
+            end
+            // the rest of the image, see top.v
+            if ($value$plusargs("image=%s", image_directory)) begin
+                $sformat(image_file_name, "%0s/external_memory.hex", image_directory);
+                $readmemh(image_file_name, data);
+            end
+        end
+    `else
+        wire [31:0] latency = LATENCY;
+    `endif
+
+    always @(posedge clock) begin
+        read_valid <= 0;
+        done <= 0;
+
+        if (done) begin
+            // the request is dropped in the cycle after done is set
+            busy <= 0;
+        end else if (!busy) begin
+            if (request) begin
+                busy <= 1;
+                wait_cycles <= latency;
+                word <= 0;
+            end
+        end else if (wait_cycles != 0) begin
+            wait_cycles <= wait_cycles - 1;
+        end else if (write) begin
+            `ifdef simulation
+                if (write_sections[0]) begin
+                    data[index][7:0] <= write_value[7:0];
+                end
+                if (write_sections[1]) begin
+                    data[index][15:8] <= write_value[15:8];
+                end
+                if (write_sections[2]) begin
+                    data[index][23:16] <= write_value[23:16];
+                end
+                if (write_sections[3]) begin
+                    data[index][31:24] <= write_value[31:24];
+                end
+            `endif
+            done <= 1;
+        end else begin
+            `ifdef simulation
+                read_value <= data[index];
+            `else
+                read_value <= 0;
+            `endif
+            read_valid <= 1;
+            word <= word + 1;
+            if (word == LINE_WORDS - 1) begin
+                done <= 1;
+            end
+        end
+    end
+endmodule
@@ -0,0 +1,96 @@
+`include "core_constants.v"
+
+// the M extension, operation is the funct3 of the instruction
+//
+// multiplication is combinational and is always ready; division takes 34
+// cycles, one for each quotient bit plus one to start and one to finish
+//
+// request must be held until ready is set and then dropped or held for
+// another operation the next cycle; dropping it before then cancels the
+// division, for example to take an interrupt
+module muldiv(
+    input clock,
+    input [2:0] operation,
+    input [31:0] operand1,
+    input [31:0] operand2,
+    input request,
+    output reg [31:0] result,
+    output ready
+);
+    localparam DIVIDE_STATE_IDLE = 2'd0;
+    localparam DIVIDE_STATE_BUSY = 2'd1;
+    localparam DIVIDE_STATE_DONE = 2'd2;
+
+    wire is_divide = operation[2];
+    wire signed_divide = operation == FUNCT3_DIV || operation == FUNCT3_REM;
+
+    // one 33 bit signed multiplier handles all of the signed and unsigned
+    // combinations, the low 64 bits of the product are the same either way
+    wire [32:0] multiply_operand_1 = { operation != FUNCT3_MULHU && operand1[31], operand1 };
+    wire [32:0] multiply_operand_2 = { operation == FUNCT3_MULH && operand2[31], operand2 };
+    wire [65:0] product = $signed(multiply_operand_1) * $signed(multiply_operand_2);
+
+    wire [32:0] difference = { remainder, quotient[31] } - { 1'b0, divisor };
+
+    assign ready = !is_divide || divide_state == DIVIDE_STATE_DONE;
+
+    always @* begin
+        case (operation)
+            FUNCT3_MUL: result = product[31:0];
+            FUNCT3_MULH, FUNCT3_MULHSU, FUNCT3_MULHU: result = product[63:32];
+            FUNCT3_DIV, FUNCT3_DIVU: result = negate_quotient ? -quotient : quotient;
+            FUNCT3_REM, FUNCT3_REMU: result = negate_remainder ? -remainder : remainder;
+        endcase
+    end
+
+    // register-like regs written in the following block
+    reg [1:0] divide_state = DIVIDE_STATE_IDLE;
+    reg [4:0] divide_step;
+    // the quotient starts out as the dividend and the bits are shifted out into
+    // the remainder as the quotient bits are shifted in
+    reg [31:0] quotient, remainder, divisor;
+    reg negate_quotient, negate_remainder;
+
+    always @(posedge clock) begin
+        if (!request || !is_divide) begin
+            divide_state <= DIVIDE_STATE_IDLE;
+        end else begin
+            case (divide_state)
+                DIVIDE_STATE_IDLE: begin
+                    // operates on magnitudes and fixes the signs at the end
+                    quotient <= signed_divide && operand1[31] ? -operand1 : operand1;
+                    divisor <= signed_divide && operand2[31] ? -operand2 : operand2;
+                    remainder <= 0;
+                    // division by zero results in all bits set in the quotient
+                    // and the dividend as the remainder, which is what the
+                    // unsigned algorithm gives when the quotient is not negated
+                    negate_quotient <= signed_divide && (operand1[31] ^ operand2[31]) && operand2 != 0;
+                    negate_remainder <= signed_divide && operand1[31];
+                    divide_step <= 0;
+                    divide_state <= DIVIDE_STATE_BUSY;
+                end
+                DIVIDE_STATE_BUSY: begin
+                    if (difference[32]) begin
+                        remainder <= { remainder[30:0], quotient[31] };
+                        quotient <= { quotient[30:0], 1'b0 };
+                    end else begin
+                        remainder <= difference[31:0];
+                        quotient <= { quotient[30:0], 1'b1 };
+                    end
+
+                    divide_step <= divide_step + 1;
+                    if (divide_step == 31) begin
+                        divide_state <= DIVIDE_STATE_DONE;
+                    end
+                end
+                DIVIDE_STATE_DONE: begin
+                    // the result is used this cycle
+                    divide_state <= DIVIDE_STATE_IDLE;
+                end
+                default: begin
+                    divide_state <= DIVIDE_STATE_IDLE;
+                end
+            endcase
+        end
+    end
+endmodule
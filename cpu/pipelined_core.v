@@ -0,0 +1,714 @@
+`include "core_constants.v"
+
+// a five stage pipelined implementation of the same instruction set as core.v
+// with the same interface so that either can be used by top.v
+//
+// stages:
+//     fetch: next_program_counter is the address given to the block ram, the
+//         instruction is available the next cycle as program_memory_value
+//     decode: expands compressed instructions and predicts branches and
+//         jumps, see below
+//     execute: decodes and executes the instruction, this is where branches,
+//         jumps, traps and csr accesses are resolved; loads and stores give
+//         their address to the block ram from a dedicated adder
+//     memory: the block ram read value is available for loads
+//     writeback: writes the result to the register file
+//
+// results are forwarded from the memory and writeback stages to the execute
+// stage, including load results, so there is no load-use stall
+//
+// jal and backward branches are predicted taken and forward branches are
+// predicted not taken; the decode stage sets next_program_counter to the
+// predicted address so a correctly predicted branch or jump costs nothing
+//
+// a redirect of the program counter from the execute stage discards the
+// instruction in the decode stage, so mispredicted branches, jalr and traps
+// cost one cycle
+//
+// a division holds the instruction in the execute stage until the result is
+// ready, stalling the fetch and decode stages
+//
+// while memory_wait is set every stage holds, since either the instruction in
+// the decode stage or the load value in the memory stage is not read yet
+module pipelined_core(
+    input clock,
+    output reg [31:0] next_program_counter,
+    input [31:0] program_memory_value,
+    output reg [31:0] memory_address,
+    output reg [31:0] memory_write_value,
+    output reg [2:0] memory_write_sections, // which bytes to write within the memory word
+    output reg memory_access, // a load or store, otherwise the memory is free for dma
+    input [31:0] memory_read_value,
+    input memory_wait, // nothing changes while this is set, see above
+    input usb_packet_ready,
+    output handled_usb_packet,
+    input mip_mtip, // machine timer interrupt pending
+    input mip_dmaip, // dma completion interrupt pending
+    input mip_fifoip, // usb out fifo interrupt pending
+    // what happened in the execute stage in each cycle, for trace_encoder.v
+    output trace_retired,
+    output trace_branch, // the instruction that retired is a conditional branch
+    output trace_taken,
+    output trace_indirect, // the instruction that retired is a jalr or an mret that returned
+    output trace_trap,
+    // the instruction that retired, or for a trap where its mret returns
+    output [31:0] trace_program_counter,
+    output [31:0] trace_target, // of a jalr, mret or trap
+    output [31:0] trace_mcause
+);
+    wire [31:0] alu_result,
+        base_register_read_value_1,
+        base_register_read_value_2,
+        csr_read_value,
+        interrupt_mcause,
+        trap_vector,
+        interrupt_vector,
+        trap_return_address;
+    wire [31:0] muldiv_result, decompressed_instruction;
+    wire [4:0] decoded_alu_opcode;
+    wire [1:0] decoded_operand_1_shift;
+    wire comparator_result, take_interrupt, chain_interrupt, wake_from_wait, register_bank, muldiv_ready, alu_decoder_illegal;
+    wire instruction_retired;
+
+    registers registers(
+        clock,
+        { writeback_register_bank, register_write_address_1 },
+        register_write_value_1,
+        6'b0,
+        32'bx,
+        { register_bank, register_read_address_1 },
+        base_register_read_value_1,
+        { register_bank, register_read_address_2 },
+        base_register_read_value_2
+    );
+    alu alu(alu_opcode, alu_operand_1, alu_operand_2, alu_result);
+    alu_decoder alu_decoder(instruction, decoded_alu_opcode, decoded_operand_1_shift, alu_decoder_illegal);
+    comparator comparator(comparator_opcode, comparator_operand_1, comparator_operand_2, comparator_result);
+    decompressor decompressor(program_memory_value[15:0], decompressed_instruction);
+    muldiv muldiv(clock, funct3, register_read_value_1, register_read_value_2, muldiv_request, muldiv_result, muldiv_ready);
+    csrs csrs(
+        clock,
+        csr_address,
+        csr_read_value,
+        csr_write_enable,
+        csr_write_value,
+        trap,
+        trap_mcause,
+        trap_program_counter,
+        return_from_trap,
+        instruction_retired,
+        (execute_stall && !waiting_for_interrupt) || memory_wait,
+        taken_branch,
+        waiting_for_interrupt,
+        mip_mtip,
+        mip_meip,
+        mip_dmaip,
+        mip_fifoip,
+        take_interrupt,
+        chain_interrupt,
+        wake_from_wait,
+        interrupt_mcause,
+        trap_vector,
+        interrupt_vector,
+        trap_return_address,
+        register_bank
+    );
+
+    assign handled_usb_packet = 0;
+    wire mip_meip = usb_packet_ready; // machine external interrupt pending
+
+    // decode stage
+    // instructions from the C extension have the low two bits not both set
+    // and are expanded here so the rest of the pipeline only sees 32 bit
+    // instructions
+    wire decode_compressed = program_memory_value[1:0] != 2'b11;
+    wire [31:0] decode_instruction = decode_compressed ? decompressed_instruction : program_memory_value;
+    wire [6:0] decode_opcode = decode_instruction[6:0];
+    wire [31:0] decode_b_immediate = { {20{decode_instruction[31]}}, decode_instruction[7], decode_instruction[30:25], decode_instruction[11:8], 1'b0 };
+    wire [31:0] decode_j_immediate = { {12{decode_instruction[31]}}, decode_instruction[19:12], decode_instruction[20], decode_instruction[30:21], 1'b0 };
+    wire [31:0] decode_next_instruction_address = decode_program_counter + (decode_compressed ? 2 : 4);
+    wire [31:0] decode_taken_address = decode_program_counter + (decode_opcode == OPCODE_JAL ? decode_j_immediate : decode_b_immediate);
+    // the sign bit of the branch offset is set for backward branches
+    wire decode_predict_taken = decode_valid
+        && (decode_opcode == OPCODE_JAL || (decode_opcode == OPCODE_BRANCH && decode_instruction[31]));
+
+    // execute stage
+    wire [31:0] instruction = execute_instruction;
+    wire [6:0] opcode = instruction[6:0];
+    wire [31:0] next_instruction_address = execute_program_counter + (execute_compressed ? 2 : 4);
+
+    wire [31:0] i_immediate = { {21{instruction[31]}}, instruction[30:20] };
+    wire [31:0] s_immediate = { {21{instruction[31]}}, instruction[30:25], instruction[11:7] };
+    wire [31:0] u_immediate = { instruction[31:12], 12'b0 };
+    wire [31:0] csr_immediate = { 27'b0, instruction[19:15] };
+
+    wire [2:0] funct3 = instruction[14:12];
+    wire [6:0] funct7 = instruction[31:25];
+    wire [11:0] func12 = instruction[31:20];
+
+    wire [4:0] rs1 = instruction[19:15];
+    wire [4:0] rd = instruction[11:7];
+
+    `ifdef simulation
+        // the simulation putchar instruction prints a0, so it is read like a
+        // source register to get the forwarded value
+        wire [4:0] register_read_address_1 =
+            opcode == OPCODE_SYSTEM && funct3 == FUNCT3_PRIV && func12 == FUNC12_SIMULATION_PUTCHAR
+            ? 5'd10
+            : rs1;
+    `else
+        wire [4:0] register_read_address_1 = rs1;
+    `endif
+    wire [4:0] register_read_address_2 = instruction[24:20];
+
+    wire [11:0] csr = instruction[31:20];
+    wire csr_is_read_only = csr[11:10] == 2'b11;
+
+    wire is_wfi = instruction == { FUNC12_WFI, 5'b0, FUNCT3_PRIV, 5'b0, OPCODE_SYSTEM };
+    // an interrupt that ends a wfi returns to the instruction after it, so
+    // that the wfi is not waited on again
+    wire [31:0] trap_program_counter = is_wfi && take_interrupt ? next_instruction_address : execute_program_counter;
+
+    wire memory_stage_forwards = memory_stage_register != 0 && memory_stage_register_bank == register_bank;
+    wire writeback_forwards = writeback_register != 0 && writeback_register_bank == register_bank;
+
+    // the address generation unit; this is separate from the alu so that the
+    // memory address does not go through the alu operand and opcode muxes
+    wire [31:0] agu_address = register_read_value_1 + (opcode == OPCODE_STORE ? s_immediate : i_immediate);
+
+    // wire-like regs set in the following combinational block
+    reg [31:0] register_write_value_1,
+        register_read_value_1,
+        register_read_value_2,
+        alu_operand_1,
+        alu_operand_2,
+        comparator_operand_1,
+        comparator_operand_2,
+        csr_write_value,
+        result_value,
+        memory_stage_result;
+    reg [11:0] csr_address;
+    reg [4:0] register_write_address_1,
+        result_register;
+    reg [4:0] alu_opcode;
+    reg [2:0] comparator_opcode,
+        pending_load_funct3;
+    reg csr_write_enable;
+    reg muldiv_request;
+    reg execute_stall;
+    reg waiting_for_interrupt;
+    reg taken_branch;
+    reg pending_load;
+    reg redirect;
+
+    reg trap;
+    reg [31:0] trap_mcause;
+    reg return_from_trap;
+
+    `ifdef simulation
+        reg finish;
+        reg fail;
+        reg simulation_putchar;
+        reg illegal_instruction;
+    `endif
+
+    always @* begin
+        // memory stage
+        if (memory_stage_load) begin
+            case (memory_stage_load_funct3)
+                FUNCT3_LW: memory_stage_result = memory_read_value;
+                FUNCT3_LH: memory_stage_result = { {16{memory_read_value[15]}}, memory_read_value[15:0] };
+                FUNCT3_LHU: memory_stage_result = { 16'b0, memory_read_value[15:0] };
+                FUNCT3_LB: memory_stage_result = { {24{memory_read_value[7]}}, memory_read_value[7:0] };
+                FUNCT3_LBU: memory_stage_result = { 24'b0, memory_read_value[7:0] };
+                // will not happen due to error checking performed when the
+                // instruction was executed
+                default: memory_stage_result = 32'bx;
+            endcase
+        end else begin
+            memory_stage_result = memory_stage_value;
+        end
+
+        // writeback stage
+        register_write_address_1 = writeback_register;
+        register_write_value_1 = writeback_value;
+
+        // forwarding to the execute stage; the memory stage result is newer
+        // so it takes precedence; results from before or after a trap or mret
+        // may be for the other register bank
+        register_read_value_1 = base_register_read_value_1;
+        register_read_value_2 = base_register_read_value_2;
+        if (writeback_forwards && register_write_address_1 == register_read_address_1) begin
+            register_read_value_1 = register_write_value_1;
+        end
+        if (writeback_forwards && register_write_address_1 == register_read_address_2) begin
+            register_read_value_2 = register_write_value_1;
+        end
+        if (memory_stage_forwards && memory_stage_register == register_read_address_1) begin
+            register_read_value_1 = memory_stage_result;
+        end
+        if (memory_stage_forwards && memory_stage_register == register_read_address_2) begin
+            register_read_value_2 = memory_stage_result;
+        end
+
+        // fetch stage, may be overridden by the execute stage
+        if (!decode_valid) begin
+            // nothing has been fetched yet, the size of the instruction isn't
+            // known
+            next_program_counter = decode_program_counter;
+        end else if (decode_predict_taken) begin
+            next_program_counter = decode_taken_address;
+        end else begin
+            next_program_counter = decode_next_instruction_address;
+        end
+
+        // execute stage
+        comparator_opcode = 3'bx;
+        comparator_operand_1 = 32'bx;
+        comparator_operand_2 = 32'bx;
+
+        alu_opcode = 5'bx;
+        alu_operand_1 = 32'bx;
+        alu_operand_2 = 32'bx;
+
+        result_register = 5'b0;
+        result_value = 32'bx;
+        memory_address = 32'bx;
+        memory_write_value = 32'bx;
+        memory_write_sections = 0;
+        memory_access = 0;
+        pending_load = 0;
+        pending_load_funct3 = 3'bx;
+
+        csr_write_enable = 0;
+        csr_write_value = 32'bx;
+        csr_address = 12'bx;
+
+        muldiv_request = 0;
+        execute_stall = 0;
+        waiting_for_interrupt = 0;
+        taken_branch = 0;
+
+        trap = 1'b0;
+        trap_mcause = 32'bx;
+        return_from_trap = 1'b0;
+        redirect = 0;
+
+        `ifdef simulation
+            simulation_putchar = 0;
+        `endif
+
+        if (!execute_valid || memory_wait) begin
+            // bubble, or the same instruction is executed once the memory is
+            // ready
+        end else if (take_interrupt) begin
+            raise(interrupt_mcause);
+        end else begin
+            case(opcode)
+                OPCODE_LUI: begin
+                    alu_opcode = ALU_OPCODE_ADD;
+                    alu_operand_1 = 0;
+                    alu_operand_2 = u_immediate;
+
+                    result_register = rd;
+                    result_value = alu_result;
+                end
+                OPCODE_AUIPC: begin
+                    alu_opcode = ALU_OPCODE_ADD;
+                    alu_operand_1 = execute_program_counter;
+                    alu_operand_2 = u_immediate;
+
+                    result_register = rd;
+                    result_value = alu_result;
+                end
+                OPCODE_JAL: begin
+                    // always predicted taken, so it was already jumped to
+                    result_register = rd;
+                    result_value = next_instruction_address;
+                end
+                OPCODE_JALR: begin
+                    alu_opcode = ALU_OPCODE_ADD;
+                    alu_operand_1 = register_read_value_1;
+                    alu_operand_2 = i_immediate;
+                    jump({ alu_result[31:1], 1'b0 });
+
+                    result_register = rd;
+                    result_value = next_instruction_address;
+                end
+                OPCODE_BRANCH: begin
+                    if (funct3 == 3'b010 || funct3 == 'b011) begin
+                        raise_illegal_instruction();
+                    end else begin
+                        comparator_opcode = funct3;
+                        comparator_operand_1 = register_read_value_1;
+                        comparator_operand_2 = register_read_value_2;
+
+                        taken_branch = comparator_result;
+                        if (comparator_result != execute_predicted_taken) begin
+                            jump(execute_alternate_program_counter);
+                        end
+                    end
+                end
+                OPCODE_LOAD: begin
+                    if (funct3 == 3'b011 || funct3 == 3'b110 || funct3 == 3'b111) begin
+                        raise_illegal_instruction();
+                    end else begin
+                        memory_address = agu_address;
+                        memory_access = 1;
+
+                        result_register = rd;
+                        pending_load = 1;
+                        pending_load_funct3 = funct3;
+                    end
+                end
+                OPCODE_STORE: begin
+                    memory_address = agu_address;
+                    memory_access = 1;
+                    memory_write_value = register_read_value_2;
+
+                    case (funct3)
+                        FUNCT3_SW: memory_write_sections = 3'b111;
+                        FUNCT3_SH: memory_write_sections = 3'b011;
+                        FUNCT3_SB: memory_write_sections = 3'b001;
+                        default: raise_illegal_instruction();
+                    endcase
+                end
+                OPCODE_IMMEDIATE: begin
+                    if (alu_decoder_illegal) begin
+                        raise_illegal_instruction();
+                    end else begin
+                        alu_opcode = decoded_alu_opcode;
+                        alu_operand_1 = register_read_value_1;
+                        alu_operand_2 = i_immediate;
+
+                        result_register = rd;
+                        if (funct3 == FUNCT3_SLT || funct3 == FUNCT3_SLTU) begin
+                            comparator_opcode = { 1'b1, funct3[0], 1'b0 };
+                            comparator_operand_1 = register_read_value_1;
+                            comparator_operand_2 = i_immediate;
+
+                            result_value = { 31'b0, comparator_result };
+                        end else begin
+                            result_value = alu_result;
+                        end
+                    end
+                end
+                OPCODE_ARITHMETIC: begin
+                    if (funct7 == FUNCT7_MULDIV) begin
+                        muldiv_request = 1;
+                        if (muldiv_ready) begin
+                            result_register = rd;
+                            result_value = muldiv_result;
+                        end else begin
+                            // hold this instruction until the result is ready
+                            next_program_counter = decode_program_counter;
+                            execute_stall = 1;
+                        end
+                    end else if (alu_decoder_illegal) begin
+                        raise_illegal_instruction();
+                    end else begin
+                        alu_opcode = decoded_alu_opcode;
+                        alu_operand_1 = register_read_value_1 << decoded_operand_1_shift;
+                        alu_operand_2 = register_read_value_2;
+
+                        result_register = rd;
+                        if ((funct3 == FUNCT3_SLT || funct3 == FUNCT3_SLTU) && funct7 == FUNCT7_BASE) begin
+                            comparator_opcode = { 1'b1, funct3[0], 1'b0 };
+                            comparator_operand_1 = register_read_value_1;
+                            comparator_operand_2 = register_read_value_2;
+
+                            result_value = { 31'b0, comparator_result };
+                        end else begin
+                            result_value = alu_result;
+                        end
+                    end
+                end
+                OPCODE_FENCE: begin
+                    if (funct3 != FUNCT3_FENCE) begin
+                        raise_illegal_instruction();
+                    end
+                end
+                OPCODE_SYSTEM: begin
+                    case (funct3)
+                        FUNCT3_PRIV: begin
+                            if (rs1 == 0 && rd == 0) begin
+                                case (func12)
+                                    FUNC12_ECALL: begin
+                                        raise(MCAUSE_ENVIRONMENT_CALL_FROM_M_MODE);
+                                    end
+                                    FUNC12_EBREAK: begin
+                                        raise(MCAUSE_BREAKPOINT);
+                                    end
+                                    FUNC12_MRET: begin
+                                        return_from_trap = 1;
+                                        if (chain_interrupt) begin
+                                            // enters the next handler
+                                            // directly, see csrs.v
+                                            raise(interrupt_mcause);
+                                        end else begin
+                                            jump(trap_return_address);
+                                        end
+                                    end
+                                    FUNC12_WFI: begin
+                                        if (!wake_from_wait) begin
+                                            // hold this instruction until an
+                                            // interrupt is pending
+                                            next_program_counter = decode_program_counter;
+                                            execute_stall = 1;
+                                            waiting_for_interrupt = 1;
+                                        end
+                                    end
+                                    `ifdef simulation
+                                        // custom instructions for running tests
+                                        FUNC12_TEST_PASS: begin
+                                            finish = 1;
+                                        end
+                                        FUNC12_TEST_FAIL: begin
+                                            fail = 1;
+                                        end
+                                        FUNC12_SIMULATION_PUTCHAR: begin
+                                            simulation_putchar = 1;
+                                        end
+                                    `endif
+                                    default: begin
+                                        raise_illegal_instruction();
+                                    end
+                                endcase
+                            end else begin
+                                raise_illegal_instruction();
+                            end
+                        end
+                        FUNCT3_CSRRW: begin
+                            if (!csr_is_read_only) begin
+                                csr_address = csr;
+                                result_register = rd;
+                                result_value = csr_read_value;
+                                csr_write_enable = 1;
+                                csr_write_value = register_read_value_1;
+                            end else begin
+                                raise_illegal_instruction();
+                            end
+                        end
+                        FUNCT3_CSRRS: begin
+                            if (!(csr_is_read_only && rs1 != 0)) begin
+                                csr_address = csr;
+                                result_register = rd;
+                                result_value = csr_read_value;
+                                if (rs1 != 0) begin
+                                    csr_write_enable = 1;
+                                    csr_write_value = csr_read_value | register_read_value_1;
+                                end
+                            end else begin
+                                raise_illegal_instruction();
+                            end
+                        end
+                        FUNCT3_CSRRC: begin
+                            if (!(csr_is_read_only && rs1 != 0)) begin
+                                csr_address = csr;
+                                result_register = rd;
+                                result_value = csr_read_value;
+                                if (rs1 != 0) begin
+                                    csr_write_enable = 1;
+                                    csr_write_value = csr_read_value & (~register_read_value_1);
+                                end
+                            end else begin
+                                raise_illegal_instruction();
+                            end
+                        end
+                        FUNCT3_CSRRWI: begin
+                            if (!csr_is_read_only) begin
+                                csr_address = csr;
+                                result_register = rd;
+                                result_value = csr_read_value;
+                                csr_write_enable = 1;
+                                csr_write_value = csr_immediate;
+                            end else begin
+                                raise_illegal_instruction();
+                            end
+                        end
+                        FUNCT3_CSRRSI: begin
+                            if (!(csr_is_read_only && rs1 != 0)) begin
+                                csr_address = csr;
+                                result_register = rd;
+                                result_value = csr_read_value;
+                                if (csr_immediate != 0) begin
+                                    csr_write_enable = 1;
+                                    csr_write_value = csr_read_value | csr_immediate;
+                                end
+                            end else begin
+                                raise_illegal_instruction();
+                            end
+                        end
+                        FUNCT3_CSRRCI: begin
+                            if (!(csr_is_read_only && rs1 != 0)) begin
+                                csr_address = csr;
+                                result_register = rd;
+                                result_value = csr_read_value;
+                                if (csr_immediate != 0) begin
+                                    csr_write_enable = 1;
+                                    csr_write_value = csr_read_value & (~csr_immediate);
+                                end
+                            end else begin
+                                raise_illegal_instruction();
+                            end
+                        end
+                        default: begin
+                            raise_illegal_instruction();
+                        end
+                    endcase
+                end
+                default: begin
+                    raise_illegal_instruction();
+                end
+            endcase
+        end
+
+        if (trap) begin
+            // an instruction that traps has no other effects
+            result_register = 5'b0;
+            pending_load = 0;
+            memory_write_sections = 0;
+            memory_access = 0;
+            csr_write_enable = 0;
+        end
+    end
+
+    assign instruction_retired = execute_valid && (!trap || return_from_trap) && !execute_stall && !memory_wait;
+
+    assign trace_retired = instruction_retired;
+    assign trace_branch = opcode == OPCODE_BRANCH;
+    assign trace_taken = taken_branch;
+    assign trace_indirect = opcode == OPCODE_JALR || (return_from_trap && !trap);
+    assign trace_trap = trap;
+    // an interrupt chained from an mret is taken where the mret would return
+    assign trace_program_counter = !trap ? execute_program_counter : return_from_trap ? trap_return_address : trap_program_counter;
+    // the execute stage only sets next_program_counter when it redirects,
+    // which it always does for these
+    assign trace_target = next_program_counter;
+    assign trace_mcause = trap_mcause;
+
+    // register-like regs written in the following block
+
+    // decode stage, set up so that the first fetch is the initial program counter
+    `ifdef simulation
+        // the entry point of the program loaded by top.v
+        reg [31:0] decode_program_counter;
+        initial begin
+            if (!$value$plusargs("entry=%d", decode_program_counter)) begin
+                $display("the entry point must be given with +entry=<address>");
+                $finish;
+            end
+        end
+    `else
+        reg [31:0] decode_program_counter = `INITIAL_PROGRAM_COUNTER;
+    `endif
+    reg decode_valid = 0;
+
+    // execute stage
+    reg [31:0] execute_program_counter;
+    reg [31:0] execute_instruction;
+    reg execute_compressed;
+    reg execute_valid = 0;
+    reg execute_predicted_taken;
+    // the address that was not predicted, used when the prediction is wrong
+    reg [31:0] execute_alternate_program_counter;
+
+    // memory stage
+    reg [4:0] memory_stage_register = 0;
+    reg memory_stage_register_bank = 0;
+    reg [31:0] memory_stage_value;
+    reg memory_stage_load = 0;
+    reg [2:0] memory_stage_load_funct3;
+
+    // writeback stage
+    reg [4:0] writeback_register = 0;
+    reg writeback_register_bank = 0;
+    reg [31:0] writeback_value;
+
+    always @(posedge clock) begin
+        if (!memory_wait) begin
+            decode_program_counter <= next_program_counter;
+            decode_valid <= 1;
+
+            // the decode stage holds its instruction during a stall by fetching
+            // it again
+            if (!execute_stall) begin
+                execute_program_counter <= decode_program_counter;
+                execute_instruction <= decode_instruction;
+                execute_compressed <= decode_compressed;
+                execute_valid <= decode_valid && !redirect;
+                execute_predicted_taken <= decode_predict_taken;
+                execute_alternate_program_counter <= decode_predict_taken ? decode_next_instruction_address : decode_taken_address;
+            end
+
+            memory_stage_register <= result_register;
+            memory_stage_register_bank <= register_bank;
+            memory_stage_value <= result_value;
+            memory_stage_load <= pending_load;
+            memory_stage_load_funct3 <= pending_load_funct3;
+
+            writeback_register <= memory_stage_register;
+            writeback_register_bank <= memory_stage_register_bank;
+            writeback_value <= memory_stage_result;
+        end
+    end
+
+    task raise_illegal_instruction();
+        raise(MCAUSE_ILLEGAL_INSTRUCTION);
+        `ifdef simulation
+            illegal_instruction = 1;
+        `endif
+    endtask
+
+    task raise(input [31:0] _mcause);
+        trap = 1;
+        trap_mcause = _mcause;
+        jump(_mcause[31] ? interrupt_vector : trap_vector);
+    endtask
+
+    // discards the instruction in the decode stage and fetches from the
+    // given address instead
+    task jump(input [31:0] target);
+        redirect = 1;
+        next_program_counter = target;
+    endtask
+
+    `ifdef simulation
+        always @* begin
+            if (finish) begin
+                // for tests/cpu to check the trace of a whole test
+                if ($test$plusargs("write_trace")) begin
+                    top.trace_encoder.write_trace_file();
+                end
+                $finish;
+            end
+        end
+
+        always @* begin
+            if (fail) begin
+                $display("got fail instruction");
+            end
+
+            if (illegal_instruction) begin
+                $display("got illegal instruction");
+            end
+
+            if (fail || illegal_instruction) begin
+                $display("pc: 0x%h", execute_program_counter);
+                registers.display_registers();
+                top.write_core_file();
+                top.trace_encoder.write_trace_file();
+
+                $stop;
+            end
+        end
+
+        always @(posedge clock) begin
+            if (simulation_putchar) begin
+                $write("%u", register_read_value_1[7:0]); // a0 as a char
+                $fflush(); // doesn't print immediately otherwise
+            end
+        end
+    `endif
+
+endmodule
@@ -1,24 +1,65 @@
 // when write addresses 1 and 2 are to the same register, write value 1 takes
 // precedence
+//
+// the top bit of each address selects the register bank, bank 1 is the shadow
+// bank used by interrupt handlers, see csrs.v; register 0 of both banks is
+// always 0
 module registers(clock, write_address_1, write_value_1, write_address_2, write_value_2, read_address_1, read_value_1, read_address_2, read_value_2);
     input clock;
-    input [4:0] read_address_1, read_address_2, write_address_1, write_address_2;
+    input [5:0] read_address_1, read_address_2, write_address_1, write_address_2;
     input [31:0] write_value_1, write_value_2;
     output [31:0] read_value_1, read_value_2;
 
-    reg [31:0] r[31:1];
+    reg [31:0] r[63:1];
 
     always @(posedge clock) begin
-        if (write_address_1 != 0) begin
+        if (write_address_1[4:0] != 0) begin
             r[write_address_1] <= write_value_1;
         end
-        if (write_address_2 != 0 && write_address_2 != write_address_1) begin
+        if (write_address_2[4:0] != 0 && write_address_2 != write_address_1) begin
             r[write_address_2] <= write_value_2;
         end
     end
 
-    assign read_value_1 = read_address_1 == 0 ? 0 : r[read_address_1];
-    assign read_value_2 = read_address_2 == 0 ? 0 : r[read_address_2];
+    assign read_value_1 = read_address_1[4:0] == 0 ? 0 : r[read_address_1];
+    assign read_value_2 = read_address_2[4:0] == 0 ? 0 : r[read_address_2];
+
+    `ifdef simulation
+    task display_registers();
+        $display("registers (decimal/hex):");
+        $display("    ra: %d/0x%h", r[1], r[1]);
+        $display("    sp: %d/0x%h", r[2], r[2]);
+        $display("    gp: %d/0x%h", r[3], r[3]);
+        $display("    tp: %d/0x%h", r[4], r[4]);
+        $display("    t0: %d/0x%h", r[5], r[5]);
+        $display("    t1: %d/0x%h", r[6], r[6]);
+        $display("    t2: %d/0x%h", r[7], r[7]);
+        $display("    s0: %d/0x%h", r[8], r[8]);
+        $display("    s1: %d/0x%h", r[9], r[9]);
+        $display("    a0: %d/0x%h", r[10], r[10]);
+        $display("    a1: %d/0x%h", r[11], r[11]);
+        $display("    a2: %d/0x%h", r[12], r[12]);
+        $display("    a3: %d/0x%h", r[13], r[13]);
+        $display("    a4: %d/0x%h", r[14], r[14]);
+        $display("    a5: %d/0x%h", r[15], r[15]);
+        $display("    a6: %d/0x%h", r[16], r[16]);
+        $display("    a7: %d/0x%h", r[17], r[17]);
+        $display("    s2: %d/0x%h", r[18], r[18]);
+        $display("    s3: %d/0x%h", r[19], r[19]);
+        $display("    s4: %d/0x%h", r[20], r[20]);
+        $display("    s5: %d/0x%h", r[21], r[21]);
+        $display("    s6: %d/0x%h", r[22], r[22]);
+        $display("    s7: %d/0x%h", r[23], r[23]);
+        $display("    s8: %d/0x%h", r[24], r[24]);
+        $display("    s9: %d/0x%h", r[25], r[25]);
+        $display("    s10: %d/0x%h", r[26], r[26]);
+        $display("    s11: %d/0x%h", r[27], r[27]);
+        $display("    t3: %d/0x%h", r[28], r[28]);
+        $display("    t4: %d/0x%h", r[29], r[29]);
+        $display("    t5: %d/0x%h", r[30], r[30]);
+        $display("    t6: %d/0x%h", r[31], r[31]);
+    endtask
+    `endif
 
     /*
     initial begin
@@ -0,0 +1,26 @@
+// drives the 48 mhz clock of tb_top.v directly instead of through verilator's
+// timing scheduler, which is most of the time of a simulation that only has a
+// clock; see harness in top.mk
+#include "Vtb_top.h"
+#include "verilated.h"
+#include <memory>
+
+// half of the 48 mhz period in the default time precision of 1 ps
+constexpr uint64_t HALF_PERIOD = 10417;
+
+int main(int argc, char** argv) {
+    const auto context = std::make_unique<VerilatedContext>();
+    // for plusargs like +profile
+    context->commandArgs(argc, argv);
+    const auto tb_top = std::make_unique<Vtb_top>(context.get());
+
+    tb_top->clock = 0;
+    tb_top->eval();
+    // the core ends the simulation with $finish or $stop
+    while (!context->gotFinish()) {
+        context->timeInc(HALF_PERIOD);
+        tb_top->clock = !tb_top->clock;
+        tb_top->eval();
+    }
+    tb_top->final();
+}
@@ -7,13 +7,54 @@ localparam ADDRESS_MTIMEH = ADDRESS_MTIME + 4;
 localparam ADDRESS_MTIMECMP = ADDRESS_MTIMEH + 4;
 localparam ADDRESS_MTIMECMPH = ADDRESS_MTIMECMP + 4;
 localparam ADDRESS_LED = 32'h80000010;
+// the usb control of usb data buffer bank 0 in the low half and of bank 1 in
+// the high half
 localparam ADDRESS_USB_CONTROL = 32'h80000014;
 localparam ADDRESS_USB_DEVICE_ADDRESS = 32'h80000018;
+localparam ADDRESS_USB_RESET_DATA_TOGGLES = 32'h8000001c;
+// the dma engine copies the length in bytes from the source address to the
+// destination address when the length is written, each is in the block ram or
+// the usb data buffer; reading the length is nonzero until the copy is done, and
+// then the completion interrupt is pending until the length is written again. a
+// copy with either outside of those, such as in external memory, copies nothing
+// and completes at once, see dma.v
+localparam ADDRESS_DMA_SOURCE = 32'h80000020;
+localparam ADDRESS_DMA_DESTINATION = 32'h80000024;
+localparam ADDRESS_DMA_LENGTH = 32'h80000028;
+// the instruction trace of trace_encoder.v: the control and status, and the
+// trace ram, which is read-only
+localparam ADDRESS_TRACE_CONTROL = 32'h8000002c;
+// the fifo of the data received on the bulk OUT endpoint, see usb_out_fifo.v:
+// reading the data pops the next 4 bytes and reading the data byte pops the
+// next byte, the count is the number of bytes in the fifo, and the fifo
+// interrupt, platform interrupt 17, is pending while the count is at least the
+// threshold, unless the threshold is 0
+localparam ADDRESS_USB_OUT_FIFO_DATA = 32'h80000030;
+localparam ADDRESS_USB_OUT_FIFO_DATA_BYTE = 32'h80000034;
+localparam ADDRESS_USB_OUT_FIFO_COUNT = 32'h80000038;
+localparam ADDRESS_USB_OUT_FIFO_THRESHOLD = 32'h8000003c;
+localparam ADDRESS_TRACE = 32'h90000000;
+localparam TRACE_ENTRIES = 512; // 8 bytes each
 localparam ADDRESS_USB_DATA_BUFFER = 32'hc0000000;
 
 // this would only need to be 1023 bytes to contain the maximum size data
 // payload but this way it makes only full memory words
-localparam USB_DATA_BUFFER_SIZE = 1024; // in bytes
+localparam USB_DATA_BUFFER_SIZE = 1024; // in bytes, for each bank
+// the usb module receives into one bank while the core handles the packet in
+// the other, bank 1 follows bank 0 at ADDRESS_USB_DATA_BUFFER
+localparam USB_DATA_BUFFER_BANKS = 2;
+localparam USB_OUT_FIFO_SIZE = 2048; // in bytes
+localparam USB_OUT_FIFO_ENDPOINT = 1;
+localparam USB_MAX_PACKET_SIZE = 64; // of the bulk OUT endpoint
+
+// the ddr3 memory of the board, which is only reached through the instruction
+// and data caches; the block ram at address 0 is not cached so it stays
+// single-cycle for the stack, interrupt handlers and hot code
+localparam ADDRESS_EXTERNAL_MEMORY = 32'h40000000;
+localparam EXTERNAL_MEMORY_SIZE = 32'h8000000; // in bytes
+// each cache is 1 KiB
+localparam CACHE_LINES = 64;
+localparam CACHE_LINE_WORDS = 4;
 
 module top(
     input clk48,
@@ -54,71 +95,353 @@ module top(
         next_program_counter;
     wire [2:0] unshifted_memory_write_sections;
     wire [7:0] usb_data_buffer_address;
+    wire usb_data_buffer_bank;
     wire write_to_usb_data_buffer;
     wire handled_usb_packet;
     wire got_usb_packet;
     wire [15:0] usb_usb_control;
-
-    core core(clk24, next_program_counter, program_memory_value, memory_address, unshifted_memory_write_value, unshifted_memory_write_sections, memory_read_value, usb_packet_ready, handled_usb_packet, mip_mtip);
-    usb usb(
+    wire usb_data_to_out_fifo, usb_out_fifo_commit, usb_out_fifo_has_room, usb_out_fifo_interrupt;
+    wire [31:0] usb_out_fifo_read_value;
+    wire [$clog2(USB_OUT_FIFO_SIZE):0] usb_out_fifo_count, usb_out_fifo_threshold;
+    wire memory_access;
+    wire [31:0] dma_remaining,
+        dma_read_address,
+        dma_write_address,
+        dma_write_value;
+    wire [3:0] dma_write_sections;
+    wire dma_complete, dma_read_request, dma_write_request;
+    wire [31:0] instruction_cache_read_value,
+        data_cache_read_value,
+        instruction_cache_memory_address,
+        data_cache_memory_address,
+        instruction_cache_memory_write_value,
+        data_cache_memory_write_value,
+        external_memory_read_value;
+    wire [3:0] instruction_cache_memory_write_sections, data_cache_memory_write_sections;
+    wire trace_retired, trace_branch, trace_taken, trace_indirect, trace_trap;
+    wire [31:0] trace_program_counter,
+        trace_target,
+        trace_mcause,
+        trace_status,
+        trace_read_value;
+    wire instruction_cache_busy,
+        data_cache_busy,
+        instruction_cache_memory_request,
+        data_cache_memory_request,
+        instruction_cache_memory_write,
+        data_cache_memory_write,
+        external_memory_read_valid,
+        external_memory_done;
+
+    `ifdef PIPELINED_CORE
+        wire core_clock = clk48;
+        pipelined_core core(core_clock, next_program_counter, program_memory_value, memory_address, unshifted_memory_write_value, unshifted_memory_write_sections, memory_access, memory_read_value, memory_wait, usb_packet_ready != 0, handled_usb_packet, mip_mtip, dma_complete, usb_out_fifo_interrupt, trace_retired, trace_branch, trace_taken, trace_indirect, trace_trap, trace_program_counter, trace_target, trace_mcause);
+    `else
+        wire core_clock = clk24;
+        core core(core_clock, next_program_counter, program_memory_value, memory_address, unshifted_memory_write_value, unshifted_memory_write_sections, memory_access, memory_read_value, memory_wait, usb_packet_ready != 0, handled_usb_packet, mip_mtip, dma_complete, usb_out_fifo_interrupt, trace_retired, trace_branch, trace_taken, trace_indirect, trace_trap, trace_program_counter, trace_target, trace_mcause);
+    `endif
+    dma #(MEMORY_SIZE, ADDRESS_USB_DATA_BUFFER, USB_DATA_BUFFER_BANKS * USB_DATA_BUFFER_SIZE) dma(
+        core_clock,
+        memory_write_value,
+        memory_address == ADDRESS_DMA_SOURCE && memory_write_sections != 0,
+        memory_address == ADDRESS_DMA_DESTINATION && memory_write_sections != 0,
+        memory_address == ADDRESS_DMA_LENGTH && memory_write_sections != 0,
+        dma_remaining,
+        dma_complete,
+        dma_read_request,
+        dma_read_address,
+        dma_read_granted,
+        dma_read_value,
+        dma_write_request,
+        dma_write_address,
+        dma_write_value,
+        dma_write_sections,
+        dma_write_granted
+    );
+    trace_encoder #(TRACE_ENTRIES) trace_encoder(
+        core_clock,
+        trace_retired,
+        trace_branch,
+        trace_taken,
+        trace_indirect,
+        trace_trap,
+        trace_program_counter,
+        trace_target,
+        trace_mcause,
+        memory_address == ADDRESS_TRACE_CONTROL && memory_write_sections != 0,
+        memory_write_value,
+        trace_status,
+        !memory_wait,
+        memory_address[$clog2(TRACE_ENTRIES) + 2:2],
+        trace_read_value
+    );
+    usb #(USB_OUT_FIFO_ENDPOINT) usb(
         clk48,
         usb_d_p,
         usb_d_n,
         usb_pullup,
         got_usb_packet,
         usb_data_buffer_address,
-        usb_data_buffer_read_value,
+        usb_data_buffer_bank,
+        usb_data_buffer_read_values[!usb_data_buffer_bank],
         usb_module_usb_data_buffer_write_value,
         write_to_usb_data_buffer,
         usb_packet_ready,
         usb_device_address[6:0],
-        usb_control,
-        usb_usb_control
+        usb_control[!usb_data_buffer_bank],
+        usb_usb_control,
+        usb_reset_data_toggles,
+        usb_data_to_out_fifo,
+        usb_out_fifo_has_room,
+        usb_out_fifo_commit
+    );
+    usb_out_fifo #(USB_OUT_FIFO_SIZE, USB_MAX_PACKET_SIZE) usb_out_fifo(
+        core_clock,
+        write_to_usb_data_buffer && usb_data_to_out_fifo,
+        usb_data_buffer_address,
+        usb_module_usb_data_buffer_write_value,
+        usb_out_fifo_commit,
+        usb_usb_control[9:0],
+        usb_out_fifo_has_room,
+        !memory_wait,
+        memory_access && !memory_wait && memory_write_sections == 0
+            ? memory_address[31:2] == ADDRESS_USB_OUT_FIFO_DATA[31:2]
+                ? 3'd4
+                : memory_address[31:2] == ADDRESS_USB_OUT_FIFO_DATA_BYTE[31:2] ? 3'd1 : 3'd0
+            : 3'd0,
+        usb_out_fifo_read_value,
+        usb_out_fifo_count,
+        memory_address == ADDRESS_USB_OUT_FIFO_THRESHOLD && memory_write_sections != 0,
+        memory_write_value,
+        usb_out_fifo_threshold,
+        usb_out_fifo_interrupt
+    );
+    cache #(CACHE_LINES, CACHE_LINE_WORDS) instruction_cache(
+        core_clock,
+        memory_wait,
+        in_external_memory(next_program_counter),
+        next_program_counter,
+        4'b0,
+        32'bx,
+        instruction_cache_read_value,
+        instruction_cache_busy,
+        instruction_cache_memory_request,
+        instruction_cache_memory_write,
+        instruction_cache_memory_address,
+        instruction_cache_memory_write_value,
+        instruction_cache_memory_write_sections,
+        external_memory_read_value,
+        external_memory_read_valid && !external_memory_for_data,
+        external_memory_done && !external_memory_for_data
+    );
+    cache #(CACHE_LINES, CACHE_LINE_WORDS) data_cache(
+        core_clock,
+        memory_wait,
+        memory_access && in_external_memory(memory_address),
+        { memory_address[31:2], 2'b0 },
+        memory_write_sections,
+        memory_write_value,
+        data_cache_read_value,
+        data_cache_busy,
+        data_cache_memory_request,
+        data_cache_memory_write,
+        data_cache_memory_address,
+        data_cache_memory_write_value,
+        data_cache_memory_write_sections,
+        external_memory_read_value,
+        external_memory_read_valid && external_memory_for_data,
+        external_memory_done && external_memory_for_data
+    );
+    external_memory #(EXTERNAL_MEMORY_SIZE, CACHE_LINE_WORDS) external_memory(
+        core_clock,
+        external_memory_for_data ? data_cache_memory_request : instruction_cache_memory_request,
+        external_memory_for_data ? data_cache_memory_write : instruction_cache_memory_write,
+        (external_memory_for_data ? data_cache_memory_address : instruction_cache_memory_address) - ADDRESS_EXTERNAL_MEMORY,
+        data_cache_memory_write_value,
+        data_cache_memory_write_sections,
+        external_memory_read_value,
+        external_memory_read_valid,
+        external_memory_done
     );
 
     // continuously assigned wires and wire-like regs
-    reg [3:0] usb_data_buffer_write_sections;
+    reg [3:0] block_ram_write_sections;
+    reg [31:0] block_ram_write_value;
     wire [3:0] memory_write_sections = { {2{unshifted_memory_write_sections[2]}}, unshifted_memory_write_sections[1:0] } << memory_address[1:0];
 
     reg [31:0] unshifted_memory_read_value;
     always @* begin
-        if (read_usb_data_buffer) begin
-            unshifted_memory_read_value = usb_data_buffer_read_value;
+        if (read_external_memory) begin
+            unshifted_memory_read_value = data_cache_read_value;
+        end else if (read_usb_data_buffer) begin
+            unshifted_memory_read_value = usb_data_buffer_read_values[read_usb_data_buffer_bank];
+        end else if (read_trace) begin
+            unshifted_memory_read_value = trace_read_value;
+        end else if (read_usb_out_fifo) begin
+            unshifted_memory_read_value = usb_out_fifo_read_value;
         end else if (read_memory_mapped_register) begin
             unshifted_memory_read_value = memory_mapped_register_read_value;
         end else begin
             unshifted_memory_read_value = block_ram_read_value;
         end
 
-        if (usb_packet_ready) begin
-            // core owns the usb data buffer
-            usb_data_buffer_write_sections = addressing_usb_data_buffer ? memory_write_sections : 0;
+        if (dma_writing_block_ram) begin
+            block_ram_write_sections = dma_write_sections;
+            block_ram_write_value = dma_write_value;
         end else begin
-            // usb module owns the usb data buffer
-            usb_data_buffer_write_sections = write_to_usb_data_buffer ? 4'b1111 : 0;
+            block_ram_write_sections = memory_address < MEMORY_SIZE ? memory_write_sections : 0;
+            block_ram_write_value = memory_write_value;
         end
     end
 
     // these shifts work due to requiring natural alignment of memory accesses
     wire [31:0] memory_read_value = unshifted_memory_read_value >> (pending_read_shift * 8);
     wire [31:0] memory_write_value = unshifted_memory_write_value << (memory_address[1:0] * 8);
-    wire [31:0] usb_data_buffer_write_value = addressing_usb_data_buffer ? memory_write_value : usb_module_usb_data_buffer_write_value;
 
-    wire addressing_usb_data_buffer = memory_address >= ADDRESS_USB_DATA_BUFFER && memory_address < (ADDRESS_USB_DATA_BUFFER + USB_DATA_BUFFER_SIZE);
-    // needed because of parsing errors that happen only in yosys when I do
-    // either of these inline
-    wire [31:0] usb_address_base = (memory_address - ADDRESS_USB_DATA_BUFFER);
-    wire [7:0] usb_address = addressing_usb_data_buffer ? usb_address_base[9:2] : usb_data_buffer_address;
+    wire addressing_usb_data_buffer = in_usb_data_buffer(memory_address);
+
+    // the core waits while either cache is busy, and the memories keep the
+    // values they read for it until then: the instruction it is executing and
+    // the value of the load before it
+    wire memory_wait = instruction_cache_busy || data_cache_busy;
+
+    // the caches share the external memory; a cache keeps it from the cycle
+    // it requests it until its request is done, and the data cache goes first
+    // if both request it in the same cycle
+    wire external_memory_for_data = external_memory_in_use ? external_memory_owned_by_data : data_cache_memory_request;
+
+    // the dma engine uses the memories in cycles where the core doesn't, but
+    // not while the core waits for the caches since the memories keep their
+    // read values then, and the usb data buffer banks only while the core owns
+    // them; a read and a write to the same memory can't be in the same cycle
+    // so the write goes first
+    wire dma_read_from_usb_data_buffer = in_usb_data_buffer(dma_read_address);
+    wire dma_write_to_usb_data_buffer = in_usb_data_buffer(dma_write_address);
+    wire dma_write_granted = dma_write_request && !memory_access && !memory_wait
+        && (!dma_write_to_usb_data_buffer || usb_packet_ready[dma_write_address[10]]);
+    wire dma_read_granted = dma_read_request && !memory_access && !memory_wait
+        && (!dma_read_from_usb_data_buffer || usb_packet_ready[dma_read_address[10]])
+        && !(dma_write_granted && dma_write_to_usb_data_buffer == dma_read_from_usb_data_buffer);
+    wire dma_writing_block_ram = dma_write_granted && !dma_write_to_usb_data_buffer;
+    wire dma_writing_usb_data_buffer = dma_write_granted && dma_write_to_usb_data_buffer;
+    wire dma_reading_usb_data_buffer = dma_read_granted && dma_read_from_usb_data_buffer;
+    wire [31:0] dma_read_value = dma_read_was_usb_data_buffer
+        ? usb_data_buffer_read_values[dma_read_usb_data_buffer_bank]
+        : block_ram_read_value;
+
+    // each bank is used by the core and the dma engine while the core owns it
+    // and by the usb module otherwise; bit 10 of an address selects the bank
+    //
+    // the usb module gives the core the bank it receives into once it has a
+    // packet in it and the usb control of the packet, writing the usb control
+    // of the bank with the response gives the bank back to the usb module
+    wire [USB_DATA_BUFFER_BANKS - 1:0] usb_packet_ready;
+    wire [15:0] usb_control[USB_DATA_BUFFER_BANKS];
+    wire [31:0] usb_data_buffer_read_values[USB_DATA_BUFFER_BANKS];
+    genvar bank;
+    generate
+        for (bank = 0; bank < USB_DATA_BUFFER_BANKS; bank = bank + 1) begin : usb_data_buffer_banks
+            // 1 means the core owns the bank, 0 means the usb module owns the
+            // bank; the usb module reads the response from the bank before the
+            // one it receives into so the control has to start out empty
+            reg core_owns_bank = 0;
+            reg [15:0] bank_usb_control = 0;
+            assign usb_packet_ready[bank] = core_owns_bank;
+            assign usb_control[bank] = bank_usb_control;
+
+            wire dma_writing_bank = dma_writing_usb_data_buffer && dma_write_address[10] == bank;
+            wire dma_reading_bank = dma_reading_usb_data_buffer && dma_read_address[10] == bank;
+            wire addressing_bank = addressing_usb_data_buffer && memory_address[10] == bank;
+
+            usb_data_buffer usb_data_buffer(
+                core_clock,
+                !core_owns_bank || !memory_wait,
+                !core_owns_bank
+                    ? usb_data_buffer_address
+                    : dma_reading_bank ? dma_read_address[9:2] : memory_address[9:2],
+                usb_data_buffer_read_values[bank],
+                !core_owns_bank
+                    ? usb_data_buffer_address
+                    : dma_writing_bank ? dma_write_address[9:2] : memory_address[9:2],
+                !core_owns_bank
+                    ? (write_to_usb_data_buffer && !usb_data_to_out_fifo && usb_data_buffer_bank == bank ? 4'b1111 : 4'b0)
+                    : dma_writing_bank ? dma_write_sections : addressing_bank ? memory_write_sections : 4'b0,
+                !core_owns_bank
+                    ? usb_module_usb_data_buffer_write_value
+                    : dma_writing_bank ? dma_write_value : memory_write_value
+            );
+
+            always @(posedge core_clock) begin
+                if (core_owns_bank) begin
+                    if (memory_address[31:2] == ADDRESS_USB_CONTROL[31:2] && memory_write_sections[bank * 2 +: 2] != 0) begin
+                        core_owns_bank <= 0;
+
+                        if (memory_write_sections[bank * 2]) begin
+                            bank_usb_control[7:0] <= memory_write_value[bank * 16 +: 8];
+                        end
+                        if (memory_write_sections[bank * 2 + 1]) begin
+                            bank_usb_control[15:8] <= memory_write_value[bank * 16 + 8 +: 8];
+                        end
+                    end
+                end else begin
+                    if (got_usb_packet && usb_data_buffer_bank == bank) begin
+                        core_owns_bank <= 1;
+                        bank_usb_control <= usb_usb_control;
+                    end
+                end
+            end
+        end
+    endgenerate
 
     wire mip_mtip = mtime >= mtimecmp;
 
+    // instructions only need 16 bit alignment, so a 32 bit instruction can
+    // start in the high half of one word and end in the low half of the next
+    wire [MEMORY_ADDRESS_TOP_INDEX - 1:0] fetch_halfword_index = next_program_counter[MEMORY_ADDRESS_TOP_INDEX:1];
+    wire [MEMORY_ADDRESS_TOP_INDEX - 2:0] fetch_low_index = (fetch_halfword_index + 1) >> 1;
+    wire [MEMORY_ADDRESS_TOP_INDEX - 2:0] fetch_high_index = fetch_halfword_index >> 1;
+    wire [31:0] program_memory_value = fetch_external_memory
+        ? instruction_cache_read_value
+        : fetch_misaligned
+            ? { program_memory_low_value, program_memory_high_value }
+            : { program_memory_high_value, program_memory_low_value };
+    wire [MEMORY_ADDRESS_TOP_INDEX - 2:0] memory_index = dma_writing_block_ram
+        ? dma_write_address[MEMORY_ADDRESS_TOP_INDEX:2]
+        : dma_read_granted && !dma_read_from_usb_data_buffer
+            ? dma_read_address[MEMORY_ADDRESS_TOP_INDEX:2]
+            : memory_address[MEMORY_ADDRESS_TOP_INDEX:2];
+
     // stateful regs written in the following block
-    (* ram_style = "block" *)
-    reg [31:0] memory[MEMORY_SIZE / 4 - 1:0];
-    initial $readmemh(`MEMORY_FILE, memory);
 
-    reg [31:0] program_memory_value,
-        block_ram_read_value,
+    // the memory is split into the low and high halves of each word so that
+    // each half can be read at a different index for instruction fetch
+    (* ram_style = "block" *)
+    reg [15:0] memory_low[MEMORY_SIZE / 4 - 1:0];
+    (* ram_style = "block" *)
+    reg [15:0] memory_high[MEMORY_SIZE / 4 - 1:0];
+    `ifdef simulation
+        // the simulation is built once for all programs, which it loads from
+        // the files that the loader wrote to the directory given with
+        // +image=<directory>, see simulation_arguments in top.mk
+        reg [8 * 256 - 1:0] image_directory, image_file_name;
+        initial begin
+            if (!$value$plusargs("image=%s", image_directory)) begin
+                $display("the program to run must be given with +image=<directory>");
+                $finish;
+            end
+            $sformat(image_file_name, "%0s/memory_low.hex", image_directory);
+            $readmemh(image_file_name, memory_low);
+            $sformat(image_file_name, "%0s/memory_high.hex", image_directory);
+            $readmemh(image_file_name, memory_high);
+        end
+    `else
+        initial $readmemh(`MEMORY_FILE_LOW, memory_low);
+        initial $readmemh(`MEMORY_FILE_HIGH, memory_high);
+    `endif
+
+    reg [15:0] program_memory_low_value, program_memory_high_value;
+    reg fetch_misaligned;
+    reg [31:0] block_ram_read_value,
         memory_mapped_register_read_value;
     reg [63:0] mtime, mtimecmp;
     reg [1:0] pending_read_shift;
@@ -129,104 +452,122 @@ module top(
     reg [2:0] led = ~0;
     reg read_memory_mapped_register;
     reg read_usb_data_buffer;
-    reg [31:0] usb_data_buffer_read_value;
-
-    always @(posedge clk24) begin
-        program_memory_value <= memory[next_program_counter[MEMORY_ADDRESS_TOP_INDEX:2]];
-        // needs to be shifted for non-32 bit aligned reads, but that can't be
-        // done in this block because the synthesizer has trouble with it
-        block_ram_read_value <= memory[memory_address[MEMORY_ADDRESS_TOP_INDEX:2]];
-        usb_data_buffer_read_value <= usb_data_buffer[usb_packet_ready
-            ? memory_address[9:2]
-            : usb_data_buffer_address
-        ];
-
-        read_usb_data_buffer <= 0;
-        case (memory_address[31:2])
-            ADDRESS_MTIME[31:2]: begin
-                memory_mapped_register_read_value <= mtime[31:0];
-                read_memory_mapped_register <= 1;
-            end
-            ADDRESS_MTIMEH[31:2]: begin
-                memory_mapped_register_read_value <= mtime[63:32];
-                read_memory_mapped_register <= 1;
-            end
-            ADDRESS_MTIMECMP[31:2]: begin
-                memory_mapped_register_read_value <= mtimecmp[31:0];
-                read_memory_mapped_register <= 1;
-            end
-            ADDRESS_MTIMECMPH[31:2]: begin
-                memory_mapped_register_read_value <= mtimecmp[63:32];
-                read_memory_mapped_register <= 1;
-            end
-            ADDRESS_LED[31:2]: begin
-                memory_mapped_register_read_value <= { 29'b0, ~led };
-                read_memory_mapped_register <= 1;
-            end
-            // TODO properly support non-word sized memory-mapped registers
-            ADDRESS_USB_CONTROL[31:2]: begin
-                memory_mapped_register_read_value <= { 16'bx, usb_control };
-                read_memory_mapped_register <= 1;
-            end
-            ADDRESS_USB_DEVICE_ADDRESS[31:2]: begin
-                memory_mapped_register_read_value <= { 24'bx, usb_device_address };
-                read_memory_mapped_register <= 1;
-            end
-            default: begin
-                memory_mapped_register_read_value <= 32'bx;
-                read_memory_mapped_register <= 0;
-
-                if (addressing_usb_data_buffer) begin
-                    read_usb_data_buffer <= 1;
+    reg read_usb_data_buffer_bank;
+    reg read_trace;
+    reg read_usb_out_fifo;
+    reg dma_read_was_usb_data_buffer;
+    reg dma_read_usb_data_buffer_bank;
+    reg fetch_external_memory = 0;
+    reg read_external_memory = 0;
+    reg external_memory_in_use = 0;
+    reg external_memory_owned_by_data;
+
+    // the memory and memory-mapped registers run on the same clock as the
+    // core so that mtime counts core clock cycles
+    always @(posedge core_clock) begin
+        // the reads for the core are kept while it waits for the caches
+        if (!memory_wait) begin
+            program_memory_low_value <= memory_low[fetch_low_index];
+            program_memory_high_value <= memory_high[fetch_high_index];
+            fetch_misaligned <= next_program_counter[1];
+            fetch_external_memory <= in_external_memory(next_program_counter);
+            // needs to be shifted for non-32 bit aligned reads, but that can't
+            // be done in this block because the synthesizer has trouble with it
+            block_ram_read_value <= { memory_high[memory_index], memory_low[memory_index] };
+            dma_read_was_usb_data_buffer <= dma_read_from_usb_data_buffer;
+            dma_read_usb_data_buffer_bank <= dma_read_address[10];
+            read_usb_data_buffer_bank <= memory_address[10];
+            read_external_memory <= memory_access && in_external_memory(memory_address);
+
+            read_usb_data_buffer <= 0;
+            read_trace <= 0;
+            read_usb_out_fifo <= 0;
+            case (memory_address[31:2])
+                ADDRESS_MTIME[31:2]: begin
+                    memory_mapped_register_read_value <= mtime[31:0];
+                    read_memory_mapped_register <= 1;
                 end
-            end
-        endcase
-        pending_read_shift <= memory_address[1:0];
+                ADDRESS_MTIMEH[31:2]: begin
+                    memory_mapped_register_read_value <= mtime[63:32];
+                    read_memory_mapped_register <= 1;
+                end
+                ADDRESS_MTIMECMP[31:2]: begin
+                    memory_mapped_register_read_value <= mtimecmp[31:0];
+                    read_memory_mapped_register <= 1;
+                end
+                ADDRESS_MTIMECMPH[31:2]: begin
+                    memory_mapped_register_read_value <= mtimecmp[63:32];
+                    read_memory_mapped_register <= 1;
+                end
+                ADDRESS_LED[31:2]: begin
+                    memory_mapped_register_read_value <= { 29'b0, ~led };
+                    read_memory_mapped_register <= 1;
+                end
+                // TODO properly support non-word sized memory-mapped registers
+                ADDRESS_USB_CONTROL[31:2]: begin
+                    memory_mapped_register_read_value <= { usb_control[1], usb_control[0] };
+                    read_memory_mapped_register <= 1;
+                end
+                ADDRESS_USB_DEVICE_ADDRESS[31:2]: begin
+                    memory_mapped_register_read_value <= { 24'bx, usb_device_address };
+                    read_memory_mapped_register <= 1;
+                end
+                ADDRESS_DMA_LENGTH[31:2]: begin
+                    memory_mapped_register_read_value <= dma_remaining;
+                    read_memory_mapped_register <= 1;
+                end
+                ADDRESS_TRACE_CONTROL[31:2]: begin
+                    memory_mapped_register_read_value <= trace_status;
+                    read_memory_mapped_register <= 1;
+                end
+                ADDRESS_USB_OUT_FIFO_DATA[31:2], ADDRESS_USB_OUT_FIFO_DATA_BYTE[31:2]: begin
+                    memory_mapped_register_read_value <= 32'bx;
+                    read_memory_mapped_register <= 0;
+                    read_usb_out_fifo <= 1;
+                end
+                ADDRESS_USB_OUT_FIFO_COUNT[31:2]: begin
+                    memory_mapped_register_read_value <= usb_out_fifo_count;
+                    read_memory_mapped_register <= 1;
+                end
+                ADDRESS_USB_OUT_FIFO_THRESHOLD[31:2]: begin
+                    memory_mapped_register_read_value <= usb_out_fifo_threshold;
+                    read_memory_mapped_register <= 1;
+                end
+                default: begin
+                    memory_mapped_register_read_value <= 32'bx;
+                    read_memory_mapped_register <= 0;
+
+                    if (addressing_usb_data_buffer) begin
+                        read_usb_data_buffer <= 1;
+                    end
+                    if (in_trace(memory_address)) begin
+                        read_trace <= 1;
+                    end
+                end
+            endcase
+            pending_read_shift <= memory_address[1:0];
+        end
 
-        if (memory_address < MEMORY_SIZE) begin
-            if (memory_write_sections[0]) begin
-                memory[memory_address[MEMORY_ADDRESS_TOP_INDEX:2]][7:0] <= memory_write_value[7:0];
-            end
-            if (memory_write_sections[1]) begin
-                memory[memory_address[MEMORY_ADDRESS_TOP_INDEX:2]][15:8] <= memory_write_value[15:8];
-            end
-            if (memory_write_sections[2]) begin
-                memory[memory_address[MEMORY_ADDRESS_TOP_INDEX:2]][23:16] <= memory_write_value[23:16];
-            end
-            if (memory_write_sections[3]) begin
-                memory[memory_address[MEMORY_ADDRESS_TOP_INDEX:2]][31:24] <= memory_write_value[31:24];
+        if (!external_memory_in_use) begin
+            if (data_cache_memory_request || instruction_cache_memory_request) begin
+                external_memory_in_use <= 1;
+                external_memory_owned_by_data <= data_cache_memory_request;
             end
+        end else if (external_memory_done) begin
+            external_memory_in_use <= 0;
         end
 
-        if (usb_data_buffer_write_sections[0]) begin
-            usb_data_buffer[usb_address][7:0] <= usb_data_buffer_write_value[7:0];
+        if (block_ram_write_sections[0]) begin
+            memory_low[memory_index][7:0] <= block_ram_write_value[7:0];
         end
-        if (usb_data_buffer_write_sections[1]) begin
-            usb_data_buffer[usb_address][15:8] <= usb_data_buffer_write_value[15:8];
+        if (block_ram_write_sections[1]) begin
+            memory_low[memory_index][15:8] <= block_ram_write_value[15:8];
         end
-        if (usb_data_buffer_write_sections[2]) begin
-            usb_data_buffer[usb_address][23:16] <= usb_data_buffer_write_value[23:16];
+        if (block_ram_write_sections[2]) begin
+            memory_high[memory_index][7:0] <= block_ram_write_value[23:16];
         end
-        if (usb_data_buffer_write_sections[3]) begin
-            usb_data_buffer[usb_address][31:24] <= usb_data_buffer_write_value[31:24];
-        end
-
-        if (usb_packet_ready) begin
-            if (memory_address[31:2] == ADDRESS_USB_CONTROL[31:2] && memory_write_sections[1:0] != 0) begin
-                usb_packet_ready <= 0;
-
-                if (memory_write_sections[0]) begin
-                    usb_control[7:0] <= memory_write_value[7:0];
-                end
-                if (memory_write_sections[1]) begin
-                    usb_control[15:8] <= memory_write_value[15:8];
-                end
-            end
-        end else begin
-            if (got_usb_packet) begin
-                usb_packet_ready <= 1;
-                usb_control[15:0] <= usb_usb_control;
-            end
+        if (block_ram_write_sections[3]) begin
+            memory_high[memory_index][15:8] <= block_ram_write_value[31:24];
         end
 
         case (memory_address[31:2])
@@ -299,14 +640,21 @@ module top(
         if (memory_address[31:2] == ADDRESS_USB_DEVICE_ADDRESS[31:2] && memory_write_sections[0]) begin
             usb_device_address <= memory_write_value[7:0];
         end
+
+        // write-only, a bit mask of endpoints that is held for a single cycle
+        if (memory_address[31:2] == ADDRESS_USB_RESET_DATA_TOGGLES[31:2] && memory_write_sections[0]) begin
+            usb_reset_data_toggles <= {
+                memory_write_sections[1] ? memory_write_value[15:8] : 8'b0,
+                memory_write_value[7:0]
+            };
+        end else begin
+            usb_reset_data_toggles <= 0;
+        end
     end
 
     // stateful regs written in the following block
-    reg [31:0] usb_data_buffer[USB_DATA_BUFFER_SIZE / 4];
-    reg usb_packet_ready = 0; // 1 means the core owns the buffer, 0 means the usb
-                              // module owns the buffer
-    reg [15:0] usb_control;
     reg [7:0] usb_device_address = 0;
+    reg [15:0] usb_reset_data_toggles = 0;
 
     // nextpnr reports this as a 12 mhz clock; this is a bug in nextpnr,
     // I confirmed on hardware that the observed clock is 24 mhz
@@ -322,4 +670,34 @@ module top(
         reset <= usr_btn;
     end
     assign rst_n = reset;
+
+    function in_external_memory(input [31:0] address);
+        in_external_memory = address >= ADDRESS_EXTERNAL_MEMORY
+            && address < (ADDRESS_EXTERNAL_MEMORY + EXTERNAL_MEMORY_SIZE);
+    endfunction
+
+    function in_usb_data_buffer(input [31:0] address);
+        in_usb_data_buffer = address >= ADDRESS_USB_DATA_BUFFER
+            && address < (ADDRESS_USB_DATA_BUFFER + USB_DATA_BUFFER_BANKS * USB_DATA_BUFFER_SIZE);
+    endfunction
+
+    function in_trace(input [31:0] address);
+        in_trace = address >= ADDRESS_TRACE && address < (ADDRESS_TRACE + TRACE_ENTRIES * 8);
+    endfunction
+
+    `ifdef simulation
+    task write_core_file();
+        reg [31:0] core_file;
+        core_file = $fopen("core", "w");
+        if (core_file != 0) begin
+            for (reg [31:0] i = 0; i < MEMORY_SIZE / 4; i = i + 1) begin
+                $fwriteb(core_file, "%u", { memory_high[i], memory_low[i] });
+            end
+            $display("core written to ./core");
+            $fclose(core_file);
+        end else begin
+            $display("could not create core file");
+        end
+    endtask
+    `endif
 endmodule
@@ -0,0 +1,246 @@
+// compresses the instructions retired by the core into a trace kept in a block
+// ram, in the spirit of the risc-v efficient trace: the decoder in
+// trace-decoder/ follows the program in the ELF binary, so only what the
+// program can't tell is written; whether each conditional branch was taken,
+// the target of each jalr and mret, and each trap
+//
+// the ram holds the last ENTRIES entries, the oldest is overwritten once it
+// wraps around. each entry is 64 bits:
+//     [63:61] the type, see below
+//     [60:56] the number of branches in [55:31], the earliest in bit 31, a bit
+//         is set for a taken branch; these are the branches since the entry
+//         before
+//     [30:0] bits [31:1] of an address
+// except for ENTRY_HANDLER:
+//     [60] set for an interrupt
+//     [35:31] bits [4:0] of mcause
+//     [30:0] bits [31:1] of the address of the trap handler
+//
+// the entries from the core can come faster than they are written to the ram
+// for a few cycles, a trap makes two, so they go through a small fifo; if it
+// is full the entries are lost and the next sync is ENTRY_SYNC_AFTER_LOSS
+module trace_encoder #(
+    parameter ENTRIES = 512
+) (
+    input clock,
+    // what the core did in this cycle, see the trace ports of core.v
+    input retired,
+    input branch,
+    input taken,
+    input indirect,
+    input trap,
+    input [31:0] program_counter,
+    input [31:0] target,
+    input [31:0] mcause,
+    // bit 0 enables the trace, bit 1 set clears it
+    input write_control,
+    input [31:0] control_write_value,
+    // bit 0 is set while enabled, bit 1 once the ram has wrapped around, bit 2
+    // while entries are still being written after the trace stopped, and bits
+    // [31:16] are the index of the entry written next
+    output [31:0] status,
+    input read_enable, // otherwise read_value is kept
+    input [$clog2(ENTRIES):0] read_index, // in 32 bit words, the low half first
+    output [31:0] read_value
+);
+    localparam ENTRY_BRANCHES = 3'd1; // the branch map is full, the address is 0
+    localparam ENTRY_JUMP = 3'd2; // a jalr or mret retired and went to the address
+    // a trap was taken before the instruction at the address, which is where
+    // its mret returns; an interrupt chained from an mret is taken after the
+    // mret retires. always followed by ENTRY_HANDLER
+    localparam ENTRY_TRAP = 3'd3;
+    localparam ENTRY_HANDLER = 3'd4;
+    // the instruction at the address retired next, where decoding can start;
+    // one is written when the trace starts and every SYNC_PERIOD entries after
+    localparam ENTRY_SYNC = 3'd5;
+    localparam ENTRY_SYNC_AFTER_LOSS = 3'd6;
+
+    localparam INDEX_BITS = $clog2(ENTRIES);
+    localparam [4:0] MAP_SIZE = 25;
+    localparam SYNC_PERIOD = 128;
+    localparam FIFO_SIZE = 4;
+
+    assign status = { {16 - INDEX_BITS{1'b0}}, write_index, 13'b0, writing, wrapped, enabled };
+    assign read_value = read_high ? read_entry[63:32] : read_entry[31:0];
+
+    // bits [60:31] of an entry
+    wire [29:0] map = { map_count, map_bits };
+
+    // wire-like regs set in the following combinational block
+    reg [63:0] first_entry, second_entry;
+    reg [1:0] pushes;
+    reg writes_sync;
+    reg [4:0] next_map_count;
+    reg [MAP_SIZE - 1:0] next_map_bits;
+
+    always @* begin
+        first_entry = 64'bx;
+        second_entry = 64'bx;
+        pushes = 0;
+        writes_sync = 0;
+        next_map_count = map_count;
+        next_map_bits = map_bits;
+
+        if (!enabled) begin
+            // the branches since the last entry are written when the trace
+            // stops so that the decoder can follow the program up to there
+            if (map_count != 0) begin
+                first_entry = { ENTRY_BRANCHES, map, 31'b0 };
+                pushes = 1;
+                clear_map();
+            end
+        end else if (trap) begin
+            first_entry = { ENTRY_TRAP, map, program_counter[31:1] };
+            second_entry = { ENTRY_HANDLER, mcause[31], 24'b0, mcause[4:0], target[31:1] };
+            pushes = 2;
+            clear_map();
+        end else if (retired && indirect) begin
+            first_entry = { ENTRY_JUMP, map, target[31:1] };
+            pushes = 1;
+            clear_map();
+        end else if (retired) begin
+            if (sync_pending) begin
+                first_entry = { lost ? ENTRY_SYNC_AFTER_LOSS : ENTRY_SYNC, map, program_counter[31:1] };
+                pushes = 1;
+                writes_sync = 1;
+                clear_map();
+            end
+
+            if (branch) begin
+                // the map was just emptied if there was a sync, so a full map
+                // never comes with one
+                if (next_map_count == MAP_SIZE - 1) begin
+                    first_entry = { ENTRY_BRANCHES, MAP_SIZE, taken, map_bits[MAP_SIZE - 2:0], 31'b0 };
+                    pushes = 1;
+                    clear_map();
+                end else begin
+                    next_map_bits[next_map_count] = taken;
+                    next_map_count = next_map_count + 1;
+                end
+            end
+        end
+    end
+
+    // stateful regs written in the following block
+    (* ram_style = "block" *)
+    reg [63:0] entries[ENTRIES];
+    reg [63:0] read_entry;
+    reg read_high;
+    reg [63:0] fifo[FIFO_SIZE];
+    reg [1:0] fifo_read_index = 0;
+    reg [2:0] fifo_count = 0;
+    reg [INDEX_BITS - 1:0] write_index = 0;
+    reg wrapped = 0;
+    reg enabled = 1;
+    reg [4:0] map_count = 0;
+    reg [MAP_SIZE - 1:0] map_bits = 0;
+    reg sync_pending = 1;
+    reg lost = 0;
+
+    wire pop = fifo_count != 0;
+    wire writing = pop || (!enabled && map_count != 0);
+    wire [2:0] fifo_space = FIFO_SIZE - fifo_count + (pop ? 1 : 0);
+    wire [1:0] fifo_write_index = fifo_read_index + fifo_count[1:0];
+
+    always @(posedge clock) begin
+        if (read_enable) begin
+            read_entry <= entries[read_index[INDEX_BITS:1]];
+            read_high <= read_index[0];
+        end
+
+        if (pop) begin
+            entries[write_index] <= fifo[fifo_read_index];
+            write_index <= write_index + 1;
+            if (write_index == ENTRIES - 1) begin
+                wrapped <= 1;
+            end
+        end
+
+        if (pushes > fifo_space) begin
+            // the branches in the map and the entries of this cycle are lost,
+            // the decoder starts again from the next sync
+            fifo_count <= fifo_count - (pop ? 1 : 0);
+            map_count <= 0;
+            map_bits <= 0;
+            lost <= 1;
+            sync_pending <= 1;
+        end else begin
+            if (pushes != 0) begin
+                fifo[fifo_write_index] <= first_entry;
+            end
+            if (pushes == 2) begin
+                fifo[fifo_write_index + 1] <= second_entry;
+            end
+            fifo_count <= fifo_count + pushes - (pop ? 1 : 0);
+            map_count <= next_map_count;
+            map_bits <= next_map_bits;
+            if (writes_sync) begin
+                lost <= 0;
+                sync_pending <= 0;
+            end
+        end
+        if (pop) begin
+            fifo_read_index <= fifo_read_index + 1;
+            if (write_index % SYNC_PERIOD == SYNC_PERIOD - 1) begin
+                sync_pending <= 1;
+            end
+        end
+
+        if (write_control) begin
+            enabled <= control_write_value[0];
+            if (control_write_value[0] && !enabled) begin
+                sync_pending <= 1;
+            end
+            if (control_write_value[1]) begin
+                write_index <= 0;
+                wrapped <= 0;
+                sync_pending <= 1;
+            end
+        end
+    end
+
+    task clear_map();
+        next_map_count = 0;
+        next_map_bits = 0;
+    endtask
+
+    `ifdef simulation
+    // writes the trace as read by trace_read in lib/cpulib.c, with the entries
+    // still in the fifo and the branches since the last entry, as if the trace
+    // was stopped first
+    task write_trace_file();
+        reg [31:0] trace_file;
+        reg [63:0] unwritten[FIFO_SIZE + 1];
+        reg [2:0] unwritten_count;
+        reg [INDEX_BITS - 1:0] index, offset;
+        unwritten_count = 0;
+        for (reg [2:0] i = 0; i < fifo_count; i = i + 1) begin
+            unwritten[unwritten_count] = fifo[fifo_read_index + i[1:0]];
+            unwritten_count = unwritten_count + 1;
+        end
+        if (map_count != 0) begin
+            unwritten[unwritten_count] = { ENTRY_BRANCHES, map, 31'b0 };
+            unwritten_count = unwritten_count + 1;
+        end
+        index = write_index + { {INDEX_BITS - 3{1'b0}}, unwritten_count };
+
+        trace_file = $fopen("trace", "wb");
+        if (trace_file != 0) begin
+            $fwrite(trace_file, "%u", { {16 - INDEX_BITS{1'b0}}, index, 14'b0, wrapped || index < write_index, 1'b0 });
+            for (reg [INDEX_BITS:0] i = 0; i < ENTRIES; i = i + 1) begin
+                // the unwritten entries go where the ram would have them
+                offset = i[INDEX_BITS - 1:0] - write_index;
+                if (offset < { {INDEX_BITS - 3{1'b0}}, unwritten_count }) begin
+                    $fwrite(trace_file, "%u%u", unwritten[offset[2:0]][31:0], unwritten[offset[2:0]][63:32]);
+                end else begin
+                    $fwrite(trace_file, "%u%u", entries[i[INDEX_BITS - 1:0]][31:0], entries[i[INDEX_BITS - 1:0]][63:32]);
+                end
+            end
+            $display("trace written to ./trace");
+            $fclose(trace_file);
+        end else begin
+            $display("could not create trace file");
+        end
+    endtask
+    `endif
+endmodule
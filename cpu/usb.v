@@ -21,20 +21,42 @@ localparam RESPONSE_TYPE_STALL = 2'b10;
 
 localparam RESET_CYCLES = 120; // 120 is the number of cycles in 2.5 microseconds at 48 mhz
 
-module usb(
+// bit times from the sample of the first se0 of a received end of packet to
+// the sample that starts the response; the spec allows the response to start 2
+// to 6.5 bit times after the end of the end of packet, and this starts it about
+// 4.5 bit times after, in the middle, so that the sampling phase and the delays
+// of the input synchronizer and the cable can't move it out of the window
+localparam RESPONSE_DELAY_BITS = 5;
+
+// the data of OUT packets on this endpoint goes to the out fifo rather than to
+// the core, see usb_out_fifo.v; must match BULK_OUT_ENDPOINT in lib/usb.c
+module usb #(
+    parameter OUT_FIFO_ENDPOINT = 1
+) (
     input clock48,
     inout usb_d_p,
     inout usb_d_n,
     output usb_pullup = 1,
     output reg got_usb_packet, 
     output reg [7:0] data_buffer_address,
-    input [31:0] data_buffer_read_value,
+    // the bank written and given to the core with the next packet, data is
+    // sent from the other bank, which has the response to the last packet
+    output reg data_buffer_bank = 0,
+    input [31:0] data_buffer_read_value, // from the bank that isn't data_buffer_bank
     output reg [31:0] data_buffer_write_value,
     output reg write_to_data_buffer,
-    input usb_packet_ready,
+    input [1:0] usb_packet_ready, // the banks the core owns
     input [6:0] device_address,
-    input [15:0] usb_control,
-    output wire [15:0] set_usb_control
+    input [15:0] usb_control, // of the bank that isn't data_buffer_bank
+    output wire [15:0] set_usb_control,
+    input [15:0] reset_data_toggles, // endpoints whose data toggles are reset to DATA0
+    // the data written with write_to_data_buffer is for the out fifo rather
+    // than data_buffer_bank
+    output reg data_to_out_fifo = 0,
+    input out_fifo_has_room,
+    // the packet written to the out fifo was acknowledged, its length is in
+    // set_usb_control
+    output reg out_fifo_commit = 0
 );
     reg [9:0] set_usb_control_data_length;
     // assigning this doesn't work sometimes when in the port connection,
@@ -47,6 +69,11 @@ module usb(
 
     wire [9:0] usb_control_data_length = usb_control[9:0];
     wire [1:0] usb_control_response_type = usb_control[11:10];
+    // the endpoint a data or stall response was written for
+    wire [3:0] usb_control_endpoint = usb_control[15:12];
+    // the core has handled every packet so usb_control is the response to the
+    // last one
+    wire have_response = usb_packet_ready == 0;
 
     reg [2:0] top_state = TOP_STATE_POWERED;
 
@@ -73,9 +100,11 @@ module usb(
     assign usb_d_n = write_enable ? output_data_n : 1'bz;
     reg output_data, output_data_n;
     reg send_eop = 0;
-    reg pending_load = 0;
-    wire [3:0] current_data_pid_receive = { data_sync_bit_receive, PID_DATA0[2:0] };
-    wire [3:0] current_data_pid_transmit = { data_sync_bit_transmit, PID_DATA0[2:0] };
+    wire [3:0] current_data_pid_receive = { data_sync_bits_receive[current_transaction_endpoint], PID_DATA0[2:0] };
+    wire [3:0] current_data_pid_transmit = { data_sync_bits_transmit[current_transaction_endpoint], PID_DATA0[2:0] };
+    // the data pid the host uses when retransmitting a packet whose ACK it did not receive
+    wire [3:0] previous_data_pid_receive = { !data_sync_bits_receive[current_transaction_endpoint], PID_DATA0[2:0] };
+    wire for_out_fifo = current_transaction_pid == PID_OUT && current_transaction_endpoint == OUT_FIFO_ENDPOINT;
 
     always @* begin
         if (send_eop) begin
@@ -104,7 +133,6 @@ module usb(
     reg next_previous_data;
     reg [31:0] next_read_write_buffer;
     reg [3:0] next_stall_counter;
-    reg next_pending_load;
     reg [8:0] next_words_read_written;
     reg [3:0] next_transaction_state;
     reg [3:0] next_current_transaction_pid;
@@ -113,15 +141,23 @@ module usb(
     reg next_send_eop;
     reg [3:0] next_current_transaction_endpoint;
     reg [9:0] next_set_usb_control_data_length;
-    reg next_data_sync_bit_receive;
-    reg next_data_sync_bit_transmit;
-    reg [4:0] next_token_crc;
-    reg [15:0] next_data_crc;
+    reg [15:0] next_data_sync_bits_receive;
+    reg [15:0] next_data_sync_bits_transmit;
+    reg next_read_crc_bit;
+    reg next_crc_bit;
+    reg next_reset_token_crc;
+    reg next_reset_data_crc;
+    reg next_pending_token;
+    reg [3:0] next_token_endpoint;
     reg [31:0] next_data_buffer_write_value;
     reg [7:0] next_data_buffer_address;
     reg next_got_usb_packet;
+    reg next_data_buffer_bank;
     reg next_write_to_data_buffer;
     reg next_failed_to_read_data;
+    reg next_got_duplicate_data;
+    reg next_data_to_out_fifo;
+    reg next_out_fifo_commit;
 
     // useful for debugging but not used normally
     reg error;
@@ -135,7 +171,6 @@ module usb(
         next_previous_data = previous_data;
         next_read_write_buffer = read_write_buffer;
         next_stall_counter = stall_counter;
-        next_pending_load = pending_load;
         next_words_read_written = words_read_written;
         next_transaction_state = transaction_state;
         next_current_transaction_pid = current_transaction_pid;
@@ -143,20 +178,31 @@ module usb(
         next_write_enable = write_enable;
         next_send_eop = send_eop;
         next_current_transaction_endpoint = current_transaction_endpoint;
-        next_data_sync_bit_receive = data_sync_bit_receive;
-        next_data_sync_bit_transmit = data_sync_bit_transmit;
-        next_token_crc = token_crc;
-        next_data_crc = data_crc;
+        next_data_sync_bits_receive = data_sync_bits_receive;
+        next_data_sync_bits_transmit = data_sync_bits_transmit;
+        next_read_crc_bit = 0;
+        next_crc_bit = crc_bit;
+        next_reset_token_crc = 0;
+        next_reset_data_crc = 0;
+        next_pending_token = pending_token;
+        next_token_endpoint = token_endpoint;
         next_data_buffer_write_value = data_buffer_write_value;
         next_data_buffer_address = data_buffer_address;
         next_got_usb_packet = got_usb_packet;
+        next_data_buffer_bank = data_buffer_bank;
         next_write_to_data_buffer = write_to_data_buffer;
         next_set_usb_control_data_length = set_usb_control_data_length;
         next_failed_to_read_data = failed_to_read_data;
+        next_got_duplicate_data = got_duplicate_data;
+        next_data_to_out_fifo = data_to_out_fifo;
+        next_out_fifo_commit = out_fifo_commit;
         error = 0;
 
         if (reset_counter >= RESET_CYCLES) begin
             next_top_state = TOP_STATE_IDLE;
+            next_data_sync_bits_receive = 0;
+            next_data_sync_bits_transmit = 0;
+            next_pending_token = 0;
         end else if (top_state == TOP_STATE_POWERED) begin
             // wait for reset
         end else if (top_state == TOP_STATE_IDLE) begin
@@ -184,27 +230,25 @@ module usb(
 
                 if (!skip_bit) begin
                     next_read_write_buffer = read_bits;
-                    next_data_crc = data_crc[15] ^ nzri_decoded_data
-                        ? (data_crc << 1) ^ 16'b1000000000000101
-                        : (data_crc << 1);
-                    next_token_crc = token_crc[4] ^ nzri_decoded_data
-                        ? (token_crc << 1) ^ 5'b00101
-                        : (token_crc << 1);
+                    // bits written are added to the crcs as they are written,
+                    // see the crc block
+                    next_read_crc_bit = !write_enable;
+                    next_crc_bit = nzri_decoded_data;
                     // run got_bit after everything else to allow it
                     // to override other values
                     got_bit();
                 end else begin
                     next_consecutive_nzri_data_ones = 0; // to prevent relying on the input data to reset consecutive_nzri_data_ones
                 end
-            end else if (pending_load) begin
-                // the way pending_load works requires the load to be
-                // performed in at most 3 48mhz periods
-                next_read_write_buffer = data_buffer_read_value;
             end
         end else begin
             error = 1;
             next_top_state = TOP_STATE_IDLE;
         end
+
+        // done last so that it takes precedence over any toggle done above
+        next_data_sync_bits_receive = next_data_sync_bits_receive & ~reset_data_toggles;
+        next_data_sync_bits_transmit = next_data_sync_bits_transmit & ~reset_data_toggles;
     end
 
     localparam PACKET_STATE_WRITE_DATA = 0;
@@ -216,7 +260,6 @@ module usb(
     localparam PACKET_STATE_READING_PID = 8;
     localparam PACKET_STATE_READING_TOKEN = 9;
     localparam PACKET_STATE_READING_DATA = 10;
-    localparam PACKET_STATE_FINISH = 11;
     localparam PACKET_STATE_WRITE_PAUSE = 12;
     localparam PACKET_STATE_WRITE_SYNC = 13;
     localparam PACKET_STATE_SEND_EOP = 14;
@@ -255,11 +298,47 @@ module usb(
     reg [3:0] transaction_state = TRANSACTION_STATE_IDLE;
     reg [3:0] stall_counter;
     reg [8:0] words_read_written;
-    reg data_sync_bit_receive;
-    reg data_sync_bit_transmit;
+    // DATA0/DATA1 toggle state, one bit per endpoint
+    reg [15:0] data_sync_bits_receive = 0;
+    reg [15:0] data_sync_bits_transmit = 0;
+    reg failed_to_read_data;
+    reg got_duplicate_data = 0;
+    // a token for this device was read, and is handled at its end of packet
+    // once its crc is checked
+    reg pending_token = 0;
+    reg [3:0] token_endpoint;
+
+    // the crcs are updated in their own block so that they aren't in series
+    // with the packet logic: bits read are added the cycle after they are
+    // sampled, so the crc of a packet is only checked at its end of packet,
+    // and bits written are added in the first cycle they are on the wire, so
+    // the data crc already has the last bit of the data when it is loaded to
+    // be written after it
     reg [4:0] token_crc;
     reg [15:0] data_crc;
-    reg failed_to_read_data;
+    reg read_crc_bit = 0; // crc_bit was read in the last cycle
+    reg crc_bit;
+    // set by got_bit to start the crc with the next bit read or written
+    reg reset_token_crc = 0;
+    reg reset_data_crc = 0;
+
+    wire write_crc_bit = write_enable && !send_eop && !skip_bit && read_write_clock_counter == 0;
+
+    always @(posedge clock48) begin
+        if (reset_token_crc) begin
+            token_crc <= ~0;
+        end else if (read_crc_bit) begin
+            token_crc <= crc5(token_crc, crc_bit);
+        end
+
+        if (write_crc_bit) begin
+            data_crc <= crc16(reset_data_crc ? ~0 : data_crc, read_write_buffer[0]);
+        end else if (reset_data_crc) begin
+            data_crc <= ~0;
+        end else if (read_crc_bit) begin
+            data_crc <= crc16(data_crc, crc_bit);
+        end
+    end
 
     wire read_complete = read_write_bits_count <= 1;
     wire write_complete = read_write_bits_count <= 1;
@@ -267,10 +346,16 @@ module usb(
     reg [4:0] i; 
 
     task got_bit();
+        // the core has the packet in data_buffer_bank now so the next one goes
+        // in the other bank
+        if (got_usb_packet) begin
+            next_data_buffer_bank = !data_buffer_bank;
+        end
+
         // reset the registers that should only be 1 for a single input bit
         next_got_usb_packet = 0;
         next_write_to_data_buffer = 0;
-        next_pending_load = 0;
+        next_out_fifo_commit = 0;
         next_send_eop = 0;
 
         if (read_write_bits_count > 1) begin
@@ -301,10 +386,11 @@ module usb(
                                     // could wait to check usb_packet_ready
                                     // until actually writing to the data
                                     // buffer to give as much time as possible
-                                    // to regain ownership of the data buffer
-                                    if (!usb_packet_ready) begin
+                                    // to regain ownership of the bank
+                                    if (for_out_fifo ? out_fifo_has_room : !usb_packet_ready[data_buffer_bank]) begin
+                                        next_data_to_out_fifo = for_out_fifo;
                                         next_packet_state = PACKET_STATE_READING_DATA;
-                                        next_data_crc = ~0;
+                                        next_reset_data_crc = 1;
                                         next_words_read_written = 0;
                                         next_read_write_bits_count = 32;
                                     end else begin
@@ -315,12 +401,24 @@ module usb(
                                                 $stop;
                                             end
                                         `endif
+                                        // the core still has the bank, or the out
+                                        // fifo doesn't have room for the packet
+                                        //
                                         // felt cute might send NAK later idk
                                         // (send NAK later)
                                         next_failed_to_read_data = 1;
                                         next_pending_send = 1;
                                         next_packet_state = PACKET_STATE_AWAIT_END_OF_PACKET;
                                     end
+                                end else if (read_bits[27:24] == previous_data_pid_receive
+                                    && current_transaction_pid == PID_OUT
+                                ) begin
+                                    // the host did not get the ACK for the last packet and
+                                    // sent it again; it has to be acknowledged again but the
+                                    // data was already handed to the core so drop it
+                                    next_got_duplicate_data = 1;
+                                    next_pending_send = 1;
+                                    next_packet_state = PACKET_STATE_AWAIT_END_OF_PACKET;
                                 end else begin
                                     `ifdef simulation
                                         $display("got bad pid for context %b", read_bits[27:24]);
@@ -339,7 +437,7 @@ module usb(
                                     next_read_write_bits_count = 16;
                                     next_current_transaction_pid = read_bits[27:24];
                                     next_packet_state = PACKET_STATE_READING_TOKEN;
-                                    next_token_crc = ~0;
+                                    next_reset_token_crc = 1;
                                 end else begin
                                     `ifdef simulation
                                         $stop;
@@ -356,14 +454,14 @@ module usb(
                                     // TRANSACTION_STATE_IDLE
                                     next_read_write_bits_count = 16;
                                     next_packet_state = PACKET_STATE_READING_TOKEN;
-                                    next_token_crc = ~0;
+                                    next_reset_token_crc = 1;
                                 end else begin
                                     `ifdef simulation
                                         if (read_bits[27:24] != PID_ACK) begin
                                             $stop;
                                         end
                                     `endif
-                                    next_data_sync_bit_transmit = !data_sync_bit_transmit;
+                                    next_data_sync_bits_transmit[current_transaction_endpoint] = !data_sync_bits_transmit[current_transaction_endpoint];
                                     next_transaction_state = TRANSACTION_STATE_IDLE;
                                     next_packet_state = PACKET_STATE_AWAIT_END_OF_PACKET;
                                     next_got_usb_packet = 1;
@@ -387,42 +485,14 @@ module usb(
             end
             PACKET_STATE_READING_TOKEN: begin
                 if (read_complete) begin
-                    if (next_token_crc == 5'b01100) begin
-                        if (read_bits[22:16] == device_address) begin
-                            next_current_transaction_endpoint = read_bits[26:23];
-
-                            if (current_transaction_pid == PID_OUT || current_transaction_pid == PID_SETUP) begin
-                                next_transaction_state = TRANSACTION_STATE_AWAIT_DATA;
-                                next_packet_state = PACKET_STATE_AWAIT_END_OF_PACKET; // TODO ignore if not receiving EOP immediately?
-
-                                if (current_transaction_pid == PID_SETUP) begin
-                                    next_data_sync_bit_transmit = 1;
-                                    next_data_sync_bit_receive = 0;
-                                end
-                            end else if (current_transaction_pid == PID_IN) begin
-                                next_pending_send = 1;
-                                next_packet_state = PACKET_STATE_AWAIT_END_OF_PACKET;
-                            end else begin
-                                // this is an internal error, should never happen
-                                `ifdef simulation
-                                    $stop;
-                                `endif
-                                error = 1;
-                            end
-                        end else begin
-                            `ifdef simulation
-                                $display("ignoring transaction due to device address");
-                            `endif
-                            next_packet_state = PACKET_STATE_AWAIT_END_OF_PACKET;
-                        end
-                    end else begin
+                    next_pending_token = read_bits[22:16] == device_address;
+                    next_token_endpoint = read_bits[26:23];
+                    if (read_bits[22:16] != device_address) begin
                         `ifdef simulation
-                            $display("got bad next_token_crc: 0x%h", next_token_crc);
-                            $stop;
-                        `else
-                            next_packet_state = PACKET_STATE_AWAIT_END_OF_PACKET;
+                            $display("ignoring transaction due to device address");
                         `endif
                     end
+                    next_packet_state = PACKET_STATE_AWAIT_END_OF_PACKET;
                 end
             end
             PACKET_STATE_READING_DATA: begin
@@ -435,14 +505,14 @@ module usb(
                             next_data_buffer_address = words_read_written[7:0];
                             next_write_to_data_buffer = 1;
                         end
-                        next_data_sync_bit_receive = !data_sync_bit_receive;
+                        next_data_sync_bits_receive[current_transaction_endpoint] = !data_sync_bits_receive[current_transaction_endpoint];
                         // 33 - read_write_bits_count is the number of bits that have been read on this word
                         // need to set all of it here
                         // - 2 because of the two crc bytes
                         next_set_usb_control_data_length = (words_read_written * 4) + ((33 - { 4'b0, read_write_bits_count }) / 8) - 2;
-                        next_got_usb_packet = 1;
+                        // the core gets the packet once it is acknowledged
                         next_pending_send = 1;
-                        next_packet_state = PACKET_STATE_FINISH;
+                        received_end_of_packet();
                     end else begin
                         `ifdef simulation
                             $display("got bad data_crc: 0x%h, words_read_written: %b", data_crc, words_read_written);
@@ -467,16 +537,11 @@ module usb(
                 // TODO implement timeout?
                 if (se0) begin
                     // end of packet
-                    next_packet_state = PACKET_STATE_FINISH;
-                end
-            end
-            PACKET_STATE_FINISH: begin // to implement a pause after receiving eop
-                if (pending_send) begin
-                    next_stall_counter = 4; // could be shorter while still complying with spec // TODO use read_write_bits_count instead of separate stall counter
-                    next_packet_state = PACKET_STATE_WRITE_PAUSE;
-                    next_pending_send = 0;
-                end else begin
-                    next_top_state = TOP_STATE_IDLE;
+                    if (pending_token) begin
+                        next_pending_token = 0;
+                        got_token();
+                    end
+                    received_end_of_packet();
                 end
             end
             PACKET_STATE_WRITE_PAUSE: begin
@@ -488,6 +553,7 @@ module usb(
                     next_read_write_bits_count = 16;
                     next_read_write_buffer[7:0] = DECODED_SYNC_PATTERN;
                     next_failed_to_read_data = 0;
+                    next_got_duplicate_data = 0;
 
                     case (current_transaction_pid)
                         PID_SETUP: begin
@@ -499,8 +565,15 @@ module usb(
                             // send handshake after receiving data
                             if (failed_to_read_data) begin
                                 next_read_write_buffer[15:8] = { ~PID_NAK, PID_NAK };
+                            end else if (got_duplicate_data) begin
+                                next_read_write_buffer[15:8] = { ~PID_ACK, PID_ACK };
+                            end else if (data_to_out_fifo) begin
+                                // the core isn't given the packet, it reads
+                                // the data from the out fifo
+                                next_read_write_buffer[15:8] = { ~PID_ACK, PID_ACK };
+                                next_out_fifo_commit = 1;
                             end else begin
-                                if (usb_control_response_type == RESPONSE_TYPE_STALL) begin
+                                if (have_response && usb_control_response_type == RESPONSE_TYPE_STALL) begin
                                     next_read_write_buffer[15:8] = { ~PID_STALL, PID_STALL };
                                 end else begin
                                     next_read_write_buffer[15:8] = { ~PID_ACK, PID_ACK };
@@ -511,8 +584,20 @@ module usb(
                             next_packet_state = PACKET_STATE_WRITE_HANDSHAKE;
                         end
                         PID_IN: begin
-                            if (!usb_packet_ready) begin
-                                case (usb_control_response_type)
+                            if (have_response
+                                && usb_control_response_type == RESPONSE_TYPE_DATA
+                                && usb_control_endpoint != current_transaction_endpoint
+                            ) begin
+                                // the data buffer holds data to send on another endpoint,
+                                // keep it there and don't interrupt the core
+                                next_read_write_buffer[15:8] = { ~PID_NAK, PID_NAK };
+                                next_packet_state = PACKET_STATE_WRITE_HANDSHAKE;
+                            end else if (have_response) begin
+                                // a stall response for another endpoint is handled as empty
+                                case (usb_control_endpoint == current_transaction_endpoint
+                                    ? usb_control_response_type
+                                    : RESPONSE_TYPE_EMPTY
+                                )
                                     RESPONSE_TYPE_STALL: begin
                                         next_read_write_buffer[15:8] = { ~PID_STALL, PID_STALL };
                                         next_packet_state = PACKET_STATE_WRITE_HANDSHAKE;
@@ -526,6 +611,8 @@ module usb(
                                     RESPONSE_TYPE_DATA: begin
                                         next_read_write_buffer[15:8] = { ~current_data_pid_transmit, current_data_pid_transmit };
                                         next_packet_state = PACKET_STATE_WRITE_DATA_PID;
+                                        // the first word is read while the pid is written
+                                        next_data_buffer_address = 0;
                                     end
                                     default: begin
                                         // internal error
@@ -562,11 +649,11 @@ module usb(
                     next_transaction_state = TRANSACTION_STATE_AWAIT_HANDSHAKE;
 
                     if (usb_control[9:0] > 0) begin // data length
-                        next_pending_load = 1;
+                        next_read_write_buffer = data_buffer_read_value;
                         next_words_read_written = 0;
-                        next_data_buffer_address = 0;
+                        next_data_buffer_address = 1;
                         next_read_write_bits_count = bytes_to_read_write_bit_count(usb_control[9:0]);
-                        next_data_crc = ~0;
+                        next_reset_data_crc = 1;
                         next_packet_state = PACKET_STATE_WRITE_DATA;
                     end else begin
                         next_read_write_buffer[15:0] = 0;
@@ -584,22 +671,21 @@ module usb(
                                                                                // guaranteed to greater than next_words_written * 4
                                                                                // because 4 bytes are always written if there
                                                                                // are 4 bytes available
-                        next_data_buffer_address = next_words_read_written[7:0];
-                        next_pending_load = 1; // needed because reads from memory are delayed one clock cycle
-                                               // (of the module input clock, not a bit time)
+                        // each word is read while the one before it is written,
+                        // since reads from the data buffer are delayed a
+                        // clock cycle of the core
+                        next_read_write_buffer = data_buffer_read_value;
+                        next_data_buffer_address = next_words_read_written[7:0] + 1;
                         next_read_write_bits_count = bytes_to_read_write_bit_count(usb_control[9:0] - (next_words_read_written * 4));
                     end else begin
                         // reverse and negate crc bits
                         for (i = 0; i < 16; i = i + 1) begin
-                            // use next_data_crc instead of data_crc because I need to include the current bit
-                            next_read_write_buffer[i] = !next_data_crc[15 - i];
+                            next_read_write_buffer[i] = !data_crc[15 - i];
                         end
                         next_read_write_bits_count = 16;
                         next_packet_state = PACKET_STATE_WRITE_DATA_CRC;
                     end
                 end
-
-                // TODO need to send the CRC16 at the end of the packet
             end
             PACKET_STATE_WRITE_DATA_CRC: begin
                 if (write_complete) begin
@@ -626,6 +712,47 @@ module usb(
         endcase
     endtask
 
+    // handles a token for this device at its end of packet
+    task got_token();
+        if (token_crc == 5'b01100) begin
+            next_current_transaction_endpoint = token_endpoint;
+
+            if (current_transaction_pid == PID_OUT || current_transaction_pid == PID_SETUP) begin
+                next_transaction_state = TRANSACTION_STATE_AWAIT_DATA;
+
+                if (current_transaction_pid == PID_SETUP) begin
+                    next_data_sync_bits_transmit[token_endpoint] = 1;
+                    next_data_sync_bits_receive[token_endpoint] = 0;
+                end
+            end else if (current_transaction_pid == PID_IN) begin
+                next_pending_send = 1;
+            end else begin
+                // this is an internal error, should never happen
+                `ifdef simulation
+                    $stop;
+                `endif
+                error = 1;
+            end
+        end else begin
+            `ifdef simulation
+                $display("got bad token_crc: 0x%h", token_crc);
+                $stop;
+            `endif
+        end
+    endtask
+
+    // at the first se0 of the end of packet of a received packet, starts the
+    // response to it if there is one
+    task received_end_of_packet();
+        if (next_pending_send) begin
+            next_stall_counter = RESPONSE_DELAY_BITS;
+            next_packet_state = PACKET_STATE_WRITE_PAUSE;
+            next_pending_send = 0;
+        end else begin
+            next_top_state = TOP_STATE_IDLE;
+        end
+    endtask
+
     always @(posedge clock48) begin
         top_state <= next_top_state;
         packet_state <= next_packet_state;
@@ -636,23 +763,30 @@ module usb(
         previous_data <= next_previous_data;
         read_write_buffer <= next_read_write_buffer;
         stall_counter <= next_stall_counter;
-        pending_load <= next_pending_load;
         current_transaction_pid <= next_current_transaction_pid;
         pending_send <= next_pending_send;
         write_enable <= next_write_enable;
         send_eop <= next_send_eop;
         words_read_written <= next_words_read_written;
         current_transaction_endpoint <= next_current_transaction_endpoint;
-        data_sync_bit_receive <= next_data_sync_bit_receive;
-        data_sync_bit_transmit <= next_data_sync_bit_transmit;
-        token_crc <= next_token_crc;
-        data_crc <= next_data_crc;
+        data_sync_bits_receive <= next_data_sync_bits_receive;
+        data_sync_bits_transmit <= next_data_sync_bits_transmit;
+        read_crc_bit <= next_read_crc_bit;
+        crc_bit <= next_crc_bit;
+        reset_token_crc <= next_reset_token_crc;
+        reset_data_crc <= next_reset_data_crc;
+        pending_token <= next_pending_token;
+        token_endpoint <= next_token_endpoint;
         data_buffer_write_value <= next_data_buffer_write_value;
         data_buffer_address <= next_data_buffer_address;
         set_usb_control_data_length <= next_set_usb_control_data_length;
         got_usb_packet <= next_got_usb_packet;
+        data_buffer_bank <= next_data_buffer_bank;
         write_to_data_buffer <= next_write_to_data_buffer;
         failed_to_read_data <= next_failed_to_read_data;
+        got_duplicate_data <= next_got_duplicate_data;
+        data_to_out_fifo <= next_data_to_out_fifo;
+        out_fifo_commit <= next_out_fifo_commit;
 
         if (se0) begin
             reset_counter <= reset_counter >= RESET_CYCLES ? RESET_CYCLES : reset_counter + 1;
@@ -661,6 +795,14 @@ module usb(
         end
     end
 
+    function [4:0] crc5(input [4:0] crc, input in);
+        crc5 = crc[4] ^ in ? (crc << 1) ^ 5'b00101 : (crc << 1);
+    endfunction
+
+    function [15:0] crc16(input [15:0] crc, input in);
+        crc16 = crc[15] ^ in ? (crc << 1) ^ 16'b1000000000000101 : (crc << 1);
+    endfunction
+
     function [5:0] bytes_to_read_write_bit_count(input [9:0] bytes);
         if (bytes > 4) begin
             bytes_to_read_write_bit_count = 32;
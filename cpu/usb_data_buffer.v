@@ -0,0 +1,34 @@
+// one bank of the usb data buffer in top.v, a block ram with separate read
+// and write ports so that whichever of the core and the usb module owns the
+// bank can use it without waiting on the other bank
+module usb_data_buffer(
+    input clock,
+    input read_enable, // otherwise read_value is kept
+    input [7:0] read_index,
+    output reg [31:0] read_value,
+    input [7:0] write_index,
+    input [3:0] write_sections,
+    input [31:0] write_value
+);
+    // 1024 bytes, see USB_DATA_BUFFER_SIZE
+    reg [31:0] data[256];
+
+    always @(posedge clock) begin
+        if (read_enable) begin
+            read_value <= data[read_index];
+        end
+
+        if (write_sections[0]) begin
+            data[write_index][7:0] <= write_value[7:0];
+        end
+        if (write_sections[1]) begin
+            data[write_index][15:8] <= write_value[15:8];
+        end
+        if (write_sections[2]) begin
+            data[write_index][23:16] <= write_value[23:16];
+        end
+        if (write_sections[3]) begin
+            data[write_index][31:24] <= write_value[31:24];
+        end
+    end
+endmodule
@@ -0,0 +1,109 @@
+// the fifo that the usb module writes the data of OUT packets on the bulk OUT
+// endpoint into, see OUT_FIFO_ENDPOINT in usb.v, and that the core pops with
+// usb_read; the core isn't interrupted for these packets, and the usb module
+// NAKs them while the fifo doesn't have room for a whole packet so that the
+// host sends them again later
+//
+// the fifo holds bytes so that packets of any length follow each other
+// without gaps: each byte lane is its own block ram with its own index so that
+// a word can be written or read starting at any byte
+//
+// the signals of the usb module are held for a bit time, which is several
+// cycles of the core clock, so the words of a packet are written at their
+// index from the end of the fifo, and the packet is only added to the fifo in
+// the first cycle of commit; the words past the packet's length, which hold
+// its crc, are overwritten by the next packet
+module usb_out_fifo #(
+    parameter SIZE = 2048, // in bytes, a power of two
+    parameter MAX_PACKET_SIZE = 64
+) (
+    input clock,
+    // from the usb module
+    input write,
+    input [7:0] write_index, // in words from the start of the packet
+    input [31:0] write_value,
+    input commit, // the packet was acknowledged
+    input [9:0] commit_length, // in bytes
+    output has_room, // for a packet of MAX_PACKET_SIZE
+    // from the core
+    input read_enable, // otherwise read_value is kept
+    // read_value is the next 4 bytes, the first in the low byte, and this many
+    // of them, up to count, are removed from the fifo; the bytes past count
+    // are undefined
+    input [2:0] pop_length,
+    output [31:0] read_value,
+    output [$clog2(SIZE):0] count, // in bytes
+    input write_threshold,
+    input [31:0] threshold_write_value,
+    output reg [$clog2(SIZE):0] threshold = 0,
+    // pending while count is at least threshold, unless threshold is 0
+    output interrupt
+);
+    localparam POINTER_BITS = $clog2(SIZE);
+    // the crc after the data of a packet fills at most one more word
+    localparam PACKET_WORDS = MAX_PACKET_SIZE / 4 + 1;
+
+    // the pointers have one more bit than a byte index so that a full fifo is
+    // told apart from an empty one
+    reg [POINTER_BITS:0] read_pointer = 0;
+    reg [POINTER_BITS:0] write_pointer = 0;
+    reg committing = 0;
+    // the byte of read_pointer when the lanes were read
+    reg [1:0] read_offset = 0;
+
+    assign count = write_pointer - read_pointer;
+    assign has_room = SIZE - count >= PACKET_WORDS * 4;
+    assign interrupt = threshold != 0 && count >= threshold;
+
+    wire [POINTER_BITS - 1:0] write_word_start = write_pointer[POINTER_BITS - 1:0] + write_index * 4;
+    wire [7:0] lane_read_values[4];
+    assign read_value = {
+        lane_read_values[read_offset + 2'd3],
+        lane_read_values[read_offset + 2'd2],
+        lane_read_values[read_offset + 2'd1],
+        lane_read_values[read_offset]
+    };
+
+    genvar lane;
+    generate
+        for (lane = 0; lane < 4; lane = lane + 1) begin : lanes
+            (* ram_style = "block" *)
+            reg [7:0] data[SIZE / 4];
+            reg [7:0] lane_read_value;
+            assign lane_read_values[lane] = lane_read_value;
+
+            // the byte of the word written or read that is in this lane
+            wire [1:0] write_byte = lane - write_word_start[1:0];
+            wire [1:0] read_byte = lane - read_pointer[1:0];
+            wire [POINTER_BITS - 1:0] write_byte_index = write_word_start + write_byte;
+            wire [POINTER_BITS - 1:0] read_byte_index = read_pointer[POINTER_BITS - 1:0] + read_byte;
+
+            always @(posedge clock) begin
+                if (read_enable) begin
+                    lane_read_value <= data[read_byte_index[POINTER_BITS - 1:2]];
+                end
+                if (write && write_index < PACKET_WORDS) begin
+                    data[write_byte_index[POINTER_BITS - 1:2]] <= write_value[write_byte * 8 +: 8];
+                end
+            end
+        end
+    endgenerate
+
+    always @(posedge clock) begin
+        committing <= commit;
+        // a longer packet than the endpoint allows is dropped, it can't have
+        // been written whole
+        if (commit && !committing && commit_length <= MAX_PACKET_SIZE) begin
+            write_pointer <= write_pointer + commit_length;
+        end
+
+        if (read_enable) begin
+            read_offset <= read_pointer[1:0];
+        end
+        read_pointer <= read_pointer + (count < pop_length ? count : pop_length);
+
+        if (write_threshold) begin
+            threshold <= threshold_write_value[POINTER_BITS:0];
+        end
+    end
+endmodule
@@ -0,0 +1,138 @@
+/* The code and function symbols of an ELF binary built for the CPU, shared by
+ * the tools that follow a program through a trace of its execution,
+ * profiler/ and trace-decoder/
+ */
+
+use elf::abi::SHF_EXECINSTR;
+use elf::abi::STT_FUNC;
+use elf::abi::STT_NOTYPE;
+use elf::endian::LittleEndian;
+use elf::ElfBytes;
+
+pub struct Function {
+    pub name: String,
+    pub address: u32,
+    // zero for labels in assembly, which extend to the next symbol
+    size: u32,
+    is_function: bool,
+}
+
+pub struct Program {
+    // sorted by address
+    pub functions: Vec<Function>,
+    // the address and contents of each executable section
+    code: Vec<(u32, Vec<u8>)>,
+}
+
+impl Program {
+    pub fn parse(file_data: &[u8]) -> Result<Program, String> {
+        let elf = ElfBytes::<LittleEndian>::minimal_parse(file_data)
+            .map_err(|error| format!("can't parse the ELF file: {error}"))?;
+
+        let mut code = Vec::new();
+        let mut executable_sections = Vec::new();
+        let section_headers = elf
+            .section_headers()
+            .ok_or("the ELF file has no sections")?;
+        for (index, section_header) in section_headers.iter().enumerate() {
+            if section_header.sh_flags & SHF_EXECINSTR as u64 != 0 {
+                let (data, _) = elf
+                    .section_data(&section_header)
+                    .map_err(|error| format!("can't read a section: {error}"))?;
+                code.push((section_header.sh_addr as u32, data.to_vec()));
+                executable_sections.push(index);
+            }
+        }
+
+        let (symbols, strings) = elf
+            .symbol_table()
+            .map_err(|error| format!("can't read the symbol table: {error}"))?
+            .ok_or("the ELF file has no symbol table")?;
+        let mut functions: Vec<Function> = symbols
+            .iter()
+            .filter(|symbol| {
+                (symbol.st_symtype() == STT_FUNC || symbol.st_symtype() == STT_NOTYPE)
+                    && executable_sections.contains(&usize::from(symbol.st_shndx))
+            })
+            .map(|symbol| Function {
+                name: strings
+                    .get(symbol.st_name as usize)
+                    .unwrap_or("")
+                    .to_string(),
+                address: symbol.st_value as u32,
+                size: symbol.st_size as u32,
+                is_function: symbol.st_symtype() == STT_FUNC,
+            })
+            // mapping symbols and assembler local labels
+            .filter(|function| {
+                !function.name.is_empty()
+                    && !function.name.starts_with('$')
+                    && !function.name.starts_with(".L")
+            })
+            .collect();
+
+        // prefer functions over labels at the same address
+        functions.sort_by_key(|function| (function.address, !function.is_function));
+        functions.dedup_by_key(|function| function.address);
+
+        Ok(Program { functions, code })
+    }
+
+    // returns functions.len() for addresses outside of any function
+    pub fn function_index(&self, address: u32) -> usize {
+        let index = self
+            .functions
+            .partition_point(|function| function.address <= address);
+        match index.checked_sub(1) {
+            Some(index)
+                if self.functions[index].size == 0
+                    || address - self.functions[index].address < self.functions[index].size =>
+            {
+                index
+            }
+            _ => self.functions.len(),
+        }
+    }
+
+    // the name of the function at the index from function_index
+    pub fn function_name(&self, index: usize) -> &str {
+        match self.functions.get(index) {
+            Some(function) => &function.name,
+            None => "[unknown]",
+        }
+    }
+
+    // the function containing the address and the offset into it
+    pub fn location(&self, address: u32) -> String {
+        match self.functions.get(self.function_index(address)) {
+            Some(function) => format!("{}+0x{:x}", function.name, address - function.address),
+            None => "[unknown]".to_string(),
+        }
+    }
+
+    // compressed instructions are returned in the low 16 bits
+    pub fn instruction(&self, address: u32) -> Option<u32> {
+        let (section_address, data) = self
+            .code
+            .iter()
+            .find(|(start, data)| address >= *start && address - start < data.len() as u32)?;
+        let offset = (address - section_address) as usize;
+
+        let low: u32 = u16::from_le_bytes(data.get(offset..offset + 2)?.try_into().unwrap()).into();
+        if low & 0b11 != 0b11 {
+            return Some(low);
+        }
+        let high: u32 =
+            u16::from_le_bytes(data.get(offset + 2..offset + 4)?.try_into().unwrap()).into();
+        Some(low | high << 16)
+    }
+}
+
+// the length in bytes of an instruction as returned by Program::instruction
+pub fn length(instruction: u32) -> u32 {
+    if instruction & 0b11 != 0b11 {
+        2
+    } else {
+        4
+    }
+}
@@ -0,0 +1,63 @@
+// measures the cost of loads; run in simulation with make benchmark, optionally
+// with core=pipelined, and compare the cycles per instruction of each loop from
+// the benchmark lines, see benchmarks/benchmark.h
+#include "benchmarks/benchmark.h"
+#include <string.h>
+
+#define ITERATIONS 256
+#define COPY_SIZE 1024
+
+static uint32_t source[COPY_SIZE / 4];
+static uint32_t destination[COPY_SIZE / 4];
+
+// each load is followed by an instruction that does not use its result
+static void independent_loads() {
+    const struct benchmark_counts start = benchmark_now();
+    __asm__ volatile("mv t2, %0\n"
+                     "li t3, %1\n"
+                     "1:\n"
+                     "lw t0, 0(t2)\n"
+                     "addi t3, t3, -1\n"
+                     "lw t1, 4(t2)\n"
+                     "xor t4, t4, t4\n"
+                     "bnez t3, 1b\n"
+                     :
+                     : "r"(source), "i"(ITERATIONS)
+                     : "t0", "t1", "t2", "t3", "t4");
+    benchmark_report("independent_loads", ITERATIONS, benchmark_since(start));
+}
+
+// each load is immediately followed by an instruction that uses its result
+static void dependent_loads() {
+    const struct benchmark_counts start = benchmark_now();
+    __asm__ volatile("mv t2, %0\n"
+                     "li t3, %1\n"
+                     "1:\n"
+                     "lw t0, 0(t2)\n"
+                     "add t4, t4, t0\n"
+                     "lw t1, 4(t2)\n"
+                     "add t3, t3, t1\n"
+                     "addi t3, t3, -1\n"
+                     "bnez t3, 1b\n"
+                     :
+                     : "r"(source), "i"(ITERATIONS)
+                     : "t0", "t1", "t2", "t3", "t4");
+    benchmark_report("dependent_loads", ITERATIONS, benchmark_since(start));
+}
+
+static void copy() {
+    const struct benchmark_counts start = benchmark_now();
+    memcpy(destination, source, COPY_SIZE);
+    benchmark_report("memcpy_1024", 1, benchmark_since(start));
+}
+
+int main() {
+    independent_loads();
+    dependent_loads();
+    copy();
+#ifdef SIMULATION
+    simulation_pass();
+#endif
+    while (1) {
+    }
+}
@@ -1,11 +1,23 @@
 #include "lib/cpulib.h"
-#include <assert.h>
 #include <string.h>
 
 int main() {
+    // usb transactions go straight to handle_usb_transaction through the
+    // default on_external_interrupt
+    enable_vectored_interrupts();
+
     while (1) {
         uint8_t read_buffer[32];
+        // sleeps until there is data or a usb transaction to handle when there
+        // is nothing to read, the transaction is taken once interrupts are
+        // enabled again
+        disable_interrupts();
         size_t bytes_read = usb_read(read_buffer, 32);
+        if (bytes_read == 0) {
+            wait_for_usb_data();
+        }
+        enable_interrupts();
+
         if (bytes_read > 0) {
             if (strncmp((char*)read_buffer, "red\n", bytes_read) == 0) {
                 led = LED_COLOR_RED;
@@ -28,15 +40,3 @@ int main() {
     }
 }
 
-[[gnu::interrupt]]
-void on_trap() {
-    unsigned int mcause;
-    __asm__("csrrs %0, mcause, zero" : "=r"(mcause));
-    switch (mcause) {
-        case MCAUSE_MACHINE_EXTERNAL_INTERRUPT:
-            handle_usb_transaction();
-            break;
-        default:
-            assert(false);
-    }
-}
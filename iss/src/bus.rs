@@ -0,0 +1,277 @@
+// the memory map of cpu/top.v
+//
+// like top.v every access is to the word containing the address: a store
+// writes the bytes of the value that fall within that word and a load
+// returns the word shifted right by the address, so an access that is not
+// naturally aligned behaves the same as on the core
+
+pub const MEMORY_SIZE: u32 = 0x10000;
+pub const EXTERNAL_MEMORY_ADDRESS: u32 = 0x40000000;
+pub const EXTERNAL_MEMORY_SIZE: u32 = 0x8000000;
+pub const USB_DATA_BUFFER_ADDRESS: u32 = 0xc0000000;
+pub const USB_DATA_BUFFER_SIZE: u32 = 2 * 1024; // both banks
+
+const ADDRESS_MTIME: u32 = 0x80000000;
+const ADDRESS_MTIMEH: u32 = ADDRESS_MTIME + 4;
+const ADDRESS_MTIMECMP: u32 = ADDRESS_MTIMEH + 4;
+const ADDRESS_MTIMECMPH: u32 = ADDRESS_MTIMECMP + 4;
+const ADDRESS_LED: u32 = 0x80000010;
+const ADDRESS_USB_CONTROL: u32 = 0x80000014;
+const ADDRESS_USB_DEVICE_ADDRESS: u32 = 0x80000018;
+const ADDRESS_USB_RESET_DATA_TOGGLES: u32 = 0x8000001c;
+const ADDRESS_DMA_SOURCE: u32 = 0x80000020;
+const ADDRESS_DMA_DESTINATION: u32 = 0x80000024;
+const ADDRESS_DMA_LENGTH: u32 = 0x80000028;
+const ADDRESS_TRACE_CONTROL: u32 = 0x8000002c;
+const ADDRESS_USB_OUT_FIFO_DATA: u32 = 0x80000030;
+const ADDRESS_USB_OUT_FIFO_COUNT: u32 = 0x80000038;
+const ADDRESS_USB_OUT_FIFO_THRESHOLD: u32 = 0x8000003c;
+const ADDRESS_TRACE: u32 = 0x90000000;
+const TRACE_SIZE: u32 = 512 * 8;
+
+pub struct Bus {
+    memory: Vec<u8>,
+    external_memory: Vec<u8>,
+    usb_data_buffer: Vec<u8>,
+    pub mtime: u64,
+    pub mtimecmp: u64,
+    led: u32,
+    usb_device_address: u32,
+    dma_source: u32,
+    dma_destination: u32,
+    pub dma_complete: bool,
+    usb_out_fifo_threshold: u32,
+    // set by a write to mtime, which keeps it from incrementing in that cycle
+    wrote_mtime: bool,
+}
+
+impl Bus {
+    pub fn new(memory_image: &[u8], external_memory_image: &[u8]) -> Result<Bus, String> {
+        if memory_image.len() > MEMORY_SIZE as usize {
+            return Err(format!(
+                "the memory image is {} bytes, more than the {} bytes of memory",
+                memory_image.len(),
+                MEMORY_SIZE
+            ));
+        }
+        if external_memory_image.len() > EXTERNAL_MEMORY_SIZE as usize {
+            return Err(format!(
+                "the external memory image is {} bytes, more than the {} bytes of external memory",
+                external_memory_image.len(),
+                EXTERNAL_MEMORY_SIZE
+            ));
+        }
+
+        let mut memory = vec![0; MEMORY_SIZE as usize];
+        memory[..memory_image.len()].copy_from_slice(memory_image);
+        let mut external_memory = vec![0; EXTERNAL_MEMORY_SIZE as usize];
+        external_memory[..external_memory_image.len()].copy_from_slice(external_memory_image);
+
+        Ok(Bus {
+            memory,
+            external_memory,
+            usb_data_buffer: vec![0; USB_DATA_BUFFER_SIZE as usize],
+            mtime: 0,
+            mtimecmp: 0,
+            led: 0,
+            usb_device_address: 0,
+            dma_source: 0,
+            dma_destination: 0,
+            dma_complete: false,
+            usb_out_fifo_threshold: 0,
+            wrote_mtime: false,
+        })
+    }
+
+    // advances mtime by one cycle, which the simulator takes to be one
+    // instruction
+    pub fn tick(&mut self) {
+        if !self.wrote_mtime {
+            self.mtime = self.mtime.wrapping_add(1);
+        }
+        self.wrote_mtime = false;
+    }
+
+    pub fn timer_interrupt_pending(&self) -> bool {
+        self.mtime >= self.mtimecmp
+    }
+
+    // whether a load from the address depends on the timing of the core or on
+    // the usb host, which the simulator does not model
+    pub fn timing_dependent(address: u32) -> bool {
+        Bus::ram(address).is_none()
+    }
+
+    // the ram containing the address and the offset of the address within it
+    fn ram(address: u32) -> Option<(Ram, usize)> {
+        if address < MEMORY_SIZE {
+            Some((Ram::Memory, address as usize))
+        } else if address.wrapping_sub(EXTERNAL_MEMORY_ADDRESS) < EXTERNAL_MEMORY_SIZE {
+            Some((Ram::External, (address - EXTERNAL_MEMORY_ADDRESS) as usize))
+        } else if address.wrapping_sub(USB_DATA_BUFFER_ADDRESS) < USB_DATA_BUFFER_SIZE {
+            Some((
+                Ram::UsbDataBuffer,
+                (address - USB_DATA_BUFFER_ADDRESS) as usize,
+            ))
+        } else {
+            None
+        }
+    }
+
+    fn ram_bytes(&mut self, ram: Ram) -> &mut [u8] {
+        match ram {
+            Ram::Memory => &mut self.memory,
+            Ram::External => &mut self.external_memory,
+            Ram::UsbDataBuffer => &mut self.usb_data_buffer,
+        }
+    }
+
+    // the halfword at the address for instruction fetch, which only has to be
+    // 16 bit aligned
+    pub fn fetch(&mut self, address: u32) -> Result<u16, String> {
+        match Bus::ram(address) {
+            Some((ram @ (Ram::Memory | Ram::External), offset)) if address % 2 == 0 => {
+                let bytes = self.ram_bytes(ram);
+                match bytes.get(offset..offset + 2) {
+                    Some(halfword) => Ok(u16::from_le_bytes(halfword.try_into().unwrap())),
+                    None => Err(format!(
+                        "instruction fetch past the end of memory at 0x{address:08x}"
+                    )),
+                }
+            }
+            _ => Err(format!("instruction fetch from 0x{address:08x}")),
+        }
+    }
+
+    // the word containing the address, shifted right by the address
+    pub fn load(&mut self, address: u32) -> Result<u32, String> {
+        let word_address = address & !3;
+        let word = match Bus::ram(word_address) {
+            Some((ram, offset)) => {
+                u32::from_le_bytes(self.ram_bytes(ram)[offset..offset + 4].try_into().unwrap())
+            }
+            None => match word_address {
+                ADDRESS_MTIME => self.mtime as u32,
+                ADDRESS_MTIMEH => (self.mtime >> 32) as u32,
+                ADDRESS_MTIMECMP => self.mtimecmp as u32,
+                ADDRESS_MTIMECMPH => (self.mtimecmp >> 32) as u32,
+                ADDRESS_LED => self.led,
+                // the usb host is not modelled so the core never owns a bank
+                ADDRESS_USB_CONTROL => 0,
+                ADDRESS_USB_DEVICE_ADDRESS => self.usb_device_address,
+                // the copy is done as soon as it starts
+                ADDRESS_DMA_LENGTH => 0,
+                ADDRESS_DMA_SOURCE..=ADDRESS_DMA_DESTINATION | ADDRESS_USB_RESET_DATA_TOGGLES => 0,
+                // the instruction trace is not modelled, it reads as stopped
+                // and empty
+                ADDRESS_TRACE_CONTROL => 0,
+                _ if word_address.wrapping_sub(ADDRESS_TRACE) < TRACE_SIZE => 0,
+                // nothing is received so the usb out fifo is always empty
+                ADDRESS_USB_OUT_FIFO_DATA..=ADDRESS_USB_OUT_FIFO_COUNT => 0,
+                ADDRESS_USB_OUT_FIFO_THRESHOLD => self.usb_out_fifo_threshold,
+                _ => return Err(format!("load from unmapped address 0x{address:08x}")),
+            },
+        };
+        Ok(word >> ((address & 3) * 8))
+    }
+
+    // writes the low size bytes of value
+    pub fn store(&mut self, address: u32, value: u32, size: u32) -> Result<(), String> {
+        let word_address = address & !3;
+        let shift = address & 3;
+        let sections = (((1u32 << size) - 1) << shift) & 0xf;
+        let shifted_value = value << (shift * 8);
+
+        if let Some((ram, offset)) = Bus::ram(word_address) {
+            let bytes = self.ram_bytes(ram);
+            for i in 0..4 {
+                if sections & (1 << i) != 0 {
+                    bytes[offset + i] = (shifted_value >> (i * 8)) as u8;
+                }
+            }
+            return Ok(());
+        }
+
+        let merge = |old: u32| {
+            let mask = (0..4)
+                .filter(|i| sections & (1 << i) != 0)
+                .fold(0u32, |mask, i| mask | 0xff << (i * 8));
+            old & !mask | shifted_value & mask
+        };
+        match word_address {
+            ADDRESS_MTIME => {
+                self.mtime = self.mtime & !0xffffffff | merge(self.mtime as u32) as u64;
+                self.wrote_mtime = true;
+            }
+            ADDRESS_MTIMEH => {
+                self.mtime =
+                    self.mtime & 0xffffffff | (merge((self.mtime >> 32) as u32) as u64) << 32;
+                self.wrote_mtime = true;
+            }
+            ADDRESS_MTIMECMP => {
+                self.mtimecmp = self.mtimecmp & !0xffffffff | merge(self.mtimecmp as u32) as u64;
+            }
+            ADDRESS_MTIMECMPH => {
+                self.mtimecmp =
+                    self.mtimecmp & 0xffffffff | (merge((self.mtimecmp >> 32) as u32) as u64) << 32;
+            }
+            ADDRESS_LED => {
+                if sections & 1 != 0 {
+                    self.led = shifted_value & 0b111;
+                }
+            }
+            ADDRESS_USB_CONTROL | ADDRESS_USB_RESET_DATA_TOGGLES | ADDRESS_TRACE_CONTROL => {}
+            ADDRESS_USB_DEVICE_ADDRESS => {
+                self.usb_device_address = merge(self.usb_device_address) & 0x7f;
+            }
+            ADDRESS_DMA_SOURCE => self.dma_source = shifted_value,
+            ADDRESS_DMA_DESTINATION => self.dma_destination = shifted_value,
+            ADDRESS_DMA_LENGTH => self.dma_copy(shifted_value)?,
+            // one more bit than a byte index of the 2048 byte fifo
+            ADDRESS_USB_OUT_FIFO_THRESHOLD => self.usb_out_fifo_threshold = shifted_value & 0xfff,
+            _ => return Err(format!("store to unmapped address 0x{address:08x}")),
+        }
+        Ok(())
+    }
+
+    // the whole copy of dma.v at once, which also copies nothing and completes
+    // if the source or destination isn't all in the block ram or all in the
+    // usb data buffer
+    fn dma_copy(&mut self, length: u32) -> Result<(), String> {
+        if !Bus::in_dma_memory(self.dma_source, length)
+            || !Bus::in_dma_memory(self.dma_destination, length)
+        {
+            self.dma_complete = length != 0;
+            return Ok(());
+        }
+        for i in 0..length {
+            let source = self.dma_source.wrapping_add(i);
+            let destination = self.dma_destination.wrapping_add(i);
+            let byte = match Bus::ram(source) {
+                Some((ram, offset)) => self.ram_bytes(ram)[offset],
+                None => return Err(format!("dma copy from unmapped address 0x{source:08x}")),
+            };
+            match Bus::ram(destination) {
+                Some((ram, offset)) => self.ram_bytes(ram)[offset] = byte,
+                None => return Err(format!("dma copy to unmapped address 0x{destination:08x}")),
+            }
+        }
+        self.dma_complete = length != 0;
+        Ok(())
+    }
+
+    fn in_dma_memory(start: u32, length: u32) -> bool {
+        let in_region = |base: u32, size: u32| {
+            let offset = start.wrapping_sub(base);
+            offset < size && length <= size - offset
+        };
+        in_region(0, MEMORY_SIZE) || in_region(USB_DATA_BUFFER_ADDRESS, USB_DATA_BUFFER_SIZE)
+    }
+}
+
+#[derive(Clone, Copy)]
+enum Ram {
+    Memory,
+    External,
+    UsbDataBuffer,
+}
@@ -0,0 +1,735 @@
+// the architectural state of cpu/core.v and cpu/csrs.v: RV32IMC, Zicsr, Zba,
+// Zbb, the shadow register bank of vectored interrupts and the custom
+// instructions for simulation
+//
+// the usb device is not modelled so the external interrupt is never pending
+
+use crate::bus::Bus;
+
+const MCAUSE_ILLEGAL_INSTRUCTION: u32 = 2;
+const MCAUSE_BREAKPOINT: u32 = 3;
+const MCAUSE_ENVIRONMENT_CALL_FROM_M_MODE: u32 = 11;
+const MCAUSE_MACHINE_TIMER_INTERRUPT: u32 = 1 << 31 | 7;
+const MCAUSE_DMA_INTERRUPT: u32 = 1 << 31 | 16;
+
+const ECALL: u32 = 0x00000073;
+const EBREAK: u32 = 0x00100073;
+const MRET: u32 = 0x30200073;
+const WFI: u32 = 0x10500073;
+const TEST_PASS: u32 = 0x8c000073;
+const TEST_FAIL: u32 = 0xcc000073;
+const SIMULATION_PUTCHAR: u32 = 0x0c000073;
+
+const HPM_COUNTER_COUNT: usize = 4;
+const HPM_EVENT_COUNT: u32 = 8;
+const HPM_EVENT_TAKEN_BRANCH: u32 = 2;
+const HPM_EVENT_TRAP: u32 = 3;
+const HPM_EVENT_INTERRUPT_PENDING: u32 = 4;
+const HPM_EVENT_IN_TRAP: u32 = 5;
+const HPM_EVENT_WAIT_FOR_INTERRUPT: u32 = 7;
+
+pub enum Step {
+    // rd is 0 for an instruction that does not write a register;
+    // timing_dependent is set when the value written depends on when the
+    // instruction ran on the core, like a load of mtime or a read of mcycle
+    Retired {
+        address: u32,
+        rd: u32,
+        value: u32,
+        timing_dependent: bool,
+    },
+    // an exception, the instruction did not retire
+    Trap {
+        address: u32,
+        mcause: u32,
+    },
+    // a wfi with no interrupt pending, nothing changed
+    Wait,
+    Pass,
+    Fail,
+    Putchar(u8),
+}
+
+#[derive(Default)]
+pub struct Hart {
+    pub pc: u32,
+    // the base and the shadow register bank, see registers.v
+    registers: [[u32; 32]; 2],
+    register_bank: usize,
+    // see shadow_bank_exception in csrs.v
+    shadow_bank_exception: bool,
+
+    mstatus_mie: bool,
+    mstatus_mpie: bool,
+    base: u32,
+    mtvec_vectored: bool,
+    mie_msie: bool,
+    mie_mtie: bool,
+    mie_meie: bool,
+    mie_dmaie: bool,
+    // the usb out fifo is always empty so its interrupt is never pending
+    mie_fifoie: bool,
+    mcycle: u64,
+    minstret: u64,
+    mscratch: u32,
+    mepc: u32,
+    mcause: u32,
+    in_trap: bool,
+    // set by a write to mcycle, which keeps it from incrementing in that cycle
+    wrote_mcycle: bool,
+    hpm_counters: [u64; HPM_COUNTER_COUNT],
+    hpm_events: [u32; HPM_COUNTER_COUNT],
+}
+
+impl Hart {
+    pub fn new(entry_address: u32) -> Hart {
+        Hart {
+            pc: entry_address,
+            ..Default::default()
+        }
+    }
+
+    pub fn register(&self, index: u32) -> u32 {
+        self.registers[self.register_bank][index as usize]
+    }
+
+    pub fn set_register(&mut self, index: u32, value: u32) {
+        if index != 0 {
+            self.registers[self.register_bank][index as usize] = value;
+        }
+    }
+
+    pub fn display_registers(&self) {
+        for (index, value) in self.registers[self.register_bank].iter().enumerate() {
+            println!("x{index}: 0x{value:08x}");
+        }
+    }
+
+    // not in the shadow register bank, see take_interrupt in csrs.v
+    pub fn interrupts_enabled(&self) -> bool {
+        self.mstatus_mie && self.register_bank == 0
+    }
+
+    // the mcause of the interrupt that is pending and enabled in mie, by the
+    // priority of csrs.v, whether or not interrupts are enabled in mstatus
+    pub fn pending_interrupt(&self, bus: &Bus) -> Option<u32> {
+        if self.mie_mtie && bus.timer_interrupt_pending() {
+            Some(MCAUSE_MACHINE_TIMER_INTERRUPT)
+        } else if self.mie_dmaie && bus.dma_complete {
+            Some(MCAUSE_DMA_INTERRUPT)
+        } else {
+            None
+        }
+    }
+
+    pub fn timer_interrupt_enabled(&self) -> bool {
+        self.mie_mtie
+    }
+
+    // takes the interrupt before the instruction at pc, or after it if it is a
+    // wfi, and returns the address that mret returns to
+    pub fn interrupt(&mut self, bus: &mut Bus, mcause: u32) -> Result<u32, String> {
+        let (instruction, length) = self.fetch(bus)?;
+        let address = if instruction == WFI {
+            self.pc.wrapping_add(length)
+        } else {
+            self.pc
+        };
+        self.trap(mcause, address);
+        Ok(address)
+    }
+
+    fn trap(&mut self, mcause: u32, address: u32) {
+        let interrupt = mcause >> 31 != 0;
+        self.mcause = mcause;
+        self.mepc = address & !1;
+        self.mstatus_mpie = self.mstatus_mie;
+        self.mstatus_mie = false;
+        self.in_trap = true;
+        if interrupt {
+            self.register_bank = self.mtvec_vectored as usize;
+        } else if self.register_bank == 1 {
+            self.shadow_bank_exception = true;
+        }
+        self.pc = if self.mtvec_vectored && interrupt {
+            (self.base << 2).wrapping_add((mcause & 0x3fffffff) << 2)
+        } else {
+            self.base << 2
+        };
+        self.count(HPM_EVENT_TRAP);
+    }
+
+    fn fetch(&self, bus: &mut Bus) -> Result<(u32, u32), String> {
+        let low = bus.fetch(self.pc)?;
+        if low & 0b11 != 0b11 {
+            Ok((decompress(low), 2))
+        } else {
+            let high = bus.fetch(self.pc.wrapping_add(2))?;
+            Ok(((high as u32) << 16 | low as u32, 4))
+        }
+    }
+
+    // advances the counters by the cycle that the last step took, which the
+    // simulator takes to be one cycle per step
+    pub fn tick(&mut self, bus: &Bus, waiting: bool) {
+        if !self.wrote_mcycle {
+            self.mcycle = self.mcycle.wrapping_add(1);
+        }
+        self.wrote_mcycle = false;
+        if self.in_trap {
+            self.count(HPM_EVENT_IN_TRAP);
+        }
+        if waiting {
+            self.count(HPM_EVENT_WAIT_FOR_INTERRUPT);
+        }
+        if self.mstatus_mie && self.pending_interrupt(bus).is_some() {
+            self.count(HPM_EVENT_INTERRUPT_PENDING);
+        }
+    }
+
+    fn count(&mut self, event: u32) {
+        for i in 0..HPM_COUNTER_COUNT {
+            if self.hpm_events[i] == event {
+                self.hpm_counters[i] = self.hpm_counters[i].wrapping_add(1);
+            }
+        }
+    }
+
+    // finishes a wfi without waiting for an interrupt
+    pub fn skip_wait(&mut self, bus: &mut Bus) -> Result<Step, String> {
+        let address = self.pc;
+        let (_, length) = self.fetch(bus)?;
+        self.pc = self.pc.wrapping_add(length);
+        Ok(self.retired(address, 0, 0, false))
+    }
+
+    pub fn step(&mut self, bus: &mut Bus) -> Result<Step, String> {
+        let address = self.pc;
+        let (instruction, length) = self.fetch(bus)?;
+        let next_pc = address.wrapping_add(length);
+
+        let opcode = instruction & 0x7f;
+        let rd = instruction >> 7 & 0x1f;
+        let funct3 = instruction >> 12 & 0b111;
+        let rs1 = instruction >> 15 & 0x1f;
+        let rs2 = instruction >> 20 & 0x1f;
+        let funct7 = instruction >> 25;
+        let value_1 = self.register(rs1);
+        let value_2 = self.register(rs2);
+        let i_immediate = (instruction as i32 >> 20) as u32;
+        let s_immediate = (instruction as i32 >> 25 << 5) as u32 | rd;
+        let b_immediate = (instruction as i32 >> 31 << 12) as u32
+            | (instruction & 0x80) << 4
+            | (instruction >> 20 & 0x7e0)
+            | (instruction >> 7 & 0x1e);
+        let u_immediate = instruction & 0xfffff000;
+        let j_immediate = (instruction as i32 >> 31 << 20) as u32
+            | (instruction & 0xff000)
+            | (instruction >> 9 & 0x800)
+            | (instruction >> 20 & 0x7fe);
+
+        let mut timing_dependent = false;
+        self.pc = next_pc;
+
+        let result = match opcode {
+            // lui
+            0b0110111 => u_immediate,
+            // auipc
+            0b0010111 => address.wrapping_add(u_immediate),
+            // jal
+            0b1101111 => {
+                self.pc = address.wrapping_add(j_immediate);
+                next_pc
+            }
+            // jalr
+            0b1100111 => {
+                if funct3 != 0 {
+                    return Ok(self.exception(address, MCAUSE_ILLEGAL_INSTRUCTION));
+                }
+                self.pc = value_1.wrapping_add(i_immediate) & !1;
+                next_pc
+            }
+            // branch
+            0b1100011 => {
+                let taken = match funct3 {
+                    0b000 => value_1 == value_2,
+                    0b001 => value_1 != value_2,
+                    0b100 => (value_1 as i32) < value_2 as i32,
+                    0b101 => value_1 as i32 >= value_2 as i32,
+                    0b110 => value_1 < value_2,
+                    0b111 => value_1 >= value_2,
+                    _ => {
+                        return Ok(self.exception(address, MCAUSE_ILLEGAL_INSTRUCTION));
+                    }
+                };
+                if taken {
+                    self.pc = address.wrapping_add(b_immediate);
+                    self.count(HPM_EVENT_TAKEN_BRANCH);
+                }
+                return Ok(self.retired(address, 0, 0, false));
+            }
+            // load
+            0b0000011 => {
+                let load_address = value_1.wrapping_add(i_immediate);
+                let value = match funct3 {
+                    0b000 => bus.load(load_address)? as i8 as u32,
+                    0b001 => bus.load(load_address)? as i16 as u32,
+                    0b010 => bus.load(load_address)?,
+                    0b100 => bus.load(load_address)? as u8 as u32,
+                    0b101 => bus.load(load_address)? as u16 as u32,
+                    _ => {
+                        return Ok(self.exception(address, MCAUSE_ILLEGAL_INSTRUCTION));
+                    }
+                };
+                timing_dependent = Bus::timing_dependent(load_address);
+                value
+            }
+            // store
+            0b0100011 => {
+                let size = match funct3 {
+                    0b000 => 1,
+                    0b001 => 2,
+                    0b010 => 4,
+                    _ => {
+                        return Ok(self.exception(address, MCAUSE_ILLEGAL_INSTRUCTION));
+                    }
+                };
+                bus.store(value_1.wrapping_add(s_immediate), value_2, size)?;
+                return Ok(self.retired(address, 0, 0, false));
+            }
+            // immediate
+            0b0010011 => match alu(instruction, value_1, i_immediate, true) {
+                Some(value) => value,
+                None => {
+                    return Ok(self.exception(address, MCAUSE_ILLEGAL_INSTRUCTION));
+                }
+            },
+            // arithmetic
+            0b0110011 => {
+                let value = if funct7 == 0b0000001 {
+                    muldiv(funct3, value_1, value_2)
+                } else {
+                    alu(instruction, value_1, value_2, false)
+                };
+                match value {
+                    Some(value) => value,
+                    None => {
+                        return Ok(self.exception(address, MCAUSE_ILLEGAL_INSTRUCTION));
+                    }
+                }
+            }
+            // fence
+            0b0001111 => 0,
+            // system
+            0b1110011 => {
+                if funct3 == 0 {
+                    return Ok(match instruction {
+                        ECALL => self.exception(address, MCAUSE_ENVIRONMENT_CALL_FROM_M_MODE),
+                        EBREAK => self.exception(address, MCAUSE_BREAKPOINT),
+                        MRET => {
+                            self.mstatus_mie = self.mstatus_mpie;
+                            self.mstatus_mpie = true;
+                            self.in_trap = false;
+                            if self.shadow_bank_exception {
+                                self.shadow_bank_exception = false;
+                            } else {
+                                self.register_bank = 0;
+                            }
+                            self.pc = self.mepc;
+                            self.retired(address, 0, 0, false)
+                        }
+                        WFI => {
+                            if self.pending_interrupt(bus).is_none() {
+                                self.pc = address;
+                                Step::Wait
+                            } else {
+                                self.retired(address, 0, 0, false)
+                            }
+                        }
+                        TEST_PASS => Step::Pass,
+                        TEST_FAIL => {
+                            self.pc = address;
+                            Step::Fail
+                        }
+                        SIMULATION_PUTCHAR => {
+                            self.minstret = self.minstret.wrapping_add(1);
+                            Step::Putchar(self.register(10) as u8)
+                        }
+                        _ => self.exception(address, MCAUSE_ILLEGAL_INSTRUCTION),
+                    });
+                }
+
+                let csr = instruction >> 20;
+                let write_value = if funct3 & 0b100 != 0 { rs1 } else { value_1 };
+                let writes = funct3 & 0b11 == 0b01 || rs1 != 0;
+                if funct3 & 0b11 == 0 || (csr >> 10 == 0b11 && writes) {
+                    return Ok(self.exception(address, MCAUSE_ILLEGAL_INSTRUCTION));
+                }
+                let old = self.read_csr(csr, bus);
+                timing_dependent = csr_timing_dependent(csr);
+                if writes {
+                    match funct3 & 0b11 {
+                        0b01 => self.write_csr(csr, write_value),
+                        0b10 => self.write_csr(csr, old | write_value),
+                        _ => self.write_csr(csr, old & !write_value),
+                    }
+                }
+                let step = self.retired(address, rd, old, timing_dependent);
+                // a write to minstret replaces the increment of the
+                // instruction that wrote it
+                if writes && (csr == 0xb02 || csr == 0xb82) {
+                    self.minstret = self.minstret.wrapping_sub(1);
+                }
+                return Ok(step);
+            }
+            _ => {
+                return Ok(self.exception(address, MCAUSE_ILLEGAL_INSTRUCTION));
+            }
+        };
+
+        Ok(self.retired(address, rd, result, timing_dependent))
+    }
+
+    fn exception(&mut self, address: u32, mcause: u32) -> Step {
+        self.trap(mcause, address);
+        Step::Trap { address, mcause }
+    }
+
+    fn retired(&mut self, address: u32, rd: u32, value: u32, timing_dependent: bool) -> Step {
+        self.set_register(rd, value);
+        self.minstret = self.minstret.wrapping_add(1);
+        Step::Retired {
+            address,
+            rd,
+            value: if rd == 0 { 0 } else { value },
+            timing_dependent,
+        }
+    }
+
+    fn read_csr(&self, csr: u32, bus: &Bus) -> u32 {
+        let hpm = |base: u32| csr.wrapping_sub(base) as usize;
+        match csr {
+            // misa: MXL 32, C, I and M
+            0x301 => 1 << 30 | 1 << 2 | 1 << 8 | 1 << 12,
+            0x300 => (self.mstatus_mpie as u32) << 7 | (self.mstatus_mie as u32) << 3 | 0b11 << 11,
+            0x305 => self.base << 2 | self.mtvec_vectored as u32,
+            0x344 => (bus.dma_complete as u32) << 16 | (bus.timer_interrupt_pending() as u32) << 7,
+            0x304 => {
+                (self.mie_fifoie as u32) << 17
+                    | (self.mie_dmaie as u32) << 16
+                    | (self.mie_meie as u32) << 11
+                    | (self.mie_mtie as u32) << 7
+                    | (self.mie_msie as u32) << 3
+            }
+            0xb00 => self.mcycle as u32,
+            0xb80 => (self.mcycle >> 32) as u32,
+            0xb02 => self.minstret as u32,
+            0xb82 => (self.minstret >> 32) as u32,
+            0x340 => self.mscratch,
+            0x341 => self.mepc,
+            0x342 => self.mcause,
+            _ if hpm(0xb03) < HPM_COUNTER_COUNT => self.hpm_counters[hpm(0xb03)] as u32,
+            _ if hpm(0xb83) < HPM_COUNTER_COUNT => (self.hpm_counters[hpm(0xb83)] >> 32) as u32,
+            _ if hpm(0x323) < HPM_COUNTER_COUNT => self.hpm_events[hpm(0x323)],
+            // the ids, mstatush, mtval, mconfigptr, menvcfg and the counters
+            // and events that are not implemented
+            _ => 0,
+        }
+    }
+
+    fn write_csr(&mut self, csr: u32, value: u32) {
+        let hpm = |base: u32| csr.wrapping_sub(base) as usize;
+        match csr {
+            0x300 => {
+                self.mstatus_mie = value & 1 << 3 != 0;
+                self.mstatus_mpie = value & 1 << 7 != 0;
+            }
+            0x305 => {
+                self.base = value >> 2;
+                self.mtvec_vectored = value & 0b11 == 0b01;
+            }
+            0x304 => {
+                self.mie_msie = value & 1 << 3 != 0;
+                self.mie_mtie = value & 1 << 7 != 0;
+                self.mie_meie = value & 1 << 11 != 0;
+                self.mie_dmaie = value & 1 << 16 != 0;
+                self.mie_fifoie = value & 1 << 17 != 0;
+            }
+            0xb00 => {
+                self.mcycle = self.mcycle & !0xffffffff | value as u64;
+                self.wrote_mcycle = true;
+            }
+            0xb80 => {
+                self.mcycle = self.mcycle & 0xffffffff | (value as u64) << 32;
+                self.wrote_mcycle = true;
+            }
+            0xb02 => self.minstret = self.minstret & !0xffffffff | value as u64,
+            0xb82 => self.minstret = self.minstret & 0xffffffff | (value as u64) << 32,
+            0x340 => self.mscratch = value,
+            0x341 => self.mepc = value & !1,
+            0x342 => self.mcause = value,
+            _ if hpm(0xb03) < HPM_COUNTER_COUNT => {
+                let counter = &mut self.hpm_counters[hpm(0xb03)];
+                *counter = *counter & !0xffffffff | value as u64;
+            }
+            _ if hpm(0xb83) < HPM_COUNTER_COUNT => {
+                let counter = &mut self.hpm_counters[hpm(0xb83)];
+                *counter = *counter & 0xffffffff | (value as u64) << 32;
+            }
+            _ if hpm(0x323) < HPM_COUNTER_COUNT => {
+                // unknown events are stored as no event
+                self.hpm_events[hpm(0x323)] = if value < HPM_EVENT_COUNT { value } else { 0 };
+            }
+            _ => {}
+        }
+    }
+}
+
+// the csrs whose value depends on the timing of the core
+fn csr_timing_dependent(csr: u32) -> bool {
+    matches!(csr, 0xb00..=0xb1f | 0xb80..=0xb9f | 0x344)
+}
+
+// the operations of alu_decoder.v and the comparator for slt and sltu, None if
+// the instruction is illegal
+fn alu(instruction: u32, operand_1: u32, operand_2: u32, immediate: bool) -> Option<u32> {
+    let funct3 = instruction >> 12 & 0b111;
+    let funct7 = instruction >> 25;
+    let rs2 = instruction >> 20 & 0x1f;
+    let shift = operand_2 & 0x1f;
+    const BASE: u32 = 0b0000000;
+    const ALTERNATE: u32 = 0b0100000;
+    const MIN_MAX: u32 = 0b0000101;
+    const SHIFT_ADD: u32 = 0b0010000;
+    const ROTATE: u32 = 0b0110000;
+    const ZERO_EXTEND: u32 = 0b0000100;
+
+    Some(match funct3 {
+        0b000 if immediate || funct7 == BASE => operand_1.wrapping_add(operand_2),
+        0b000 if funct7 == ALTERNATE => operand_1.wrapping_sub(operand_2),
+        0b001 if funct7 == BASE => operand_1 << shift,
+        0b001 if funct7 == ROTATE && !immediate => operand_1.rotate_left(shift),
+        0b001 if funct7 == ROTATE => match rs2 {
+            0b00000 => operand_1.leading_zeros(),
+            0b00001 => operand_1.trailing_zeros(),
+            0b00010 => operand_1.count_ones(),
+            0b00100 => operand_1 as i8 as u32,
+            0b00101 => operand_1 as i16 as u32,
+            _ => return None,
+        },
+        0b010 if funct7 == SHIFT_ADD && !immediate => (operand_1 << 1).wrapping_add(operand_2),
+        0b010 if immediate || funct7 == BASE => ((operand_1 as i32) < operand_2 as i32) as u32,
+        0b011 if immediate || funct7 == BASE => (operand_1 < operand_2) as u32,
+        0b100 if immediate || funct7 == BASE => operand_1 ^ operand_2,
+        0b100 if funct7 == ALTERNATE => !(operand_1 ^ operand_2),
+        0b100 if funct7 == MIN_MAX => (operand_1 as i32).min(operand_2 as i32) as u32,
+        0b100 if funct7 == ZERO_EXTEND && rs2 == 0 => operand_1 & 0xffff,
+        0b100 if funct7 == SHIFT_ADD => (operand_1 << 2).wrapping_add(operand_2),
+        0b101 if funct7 == BASE => operand_1 >> shift,
+        0b101 if funct7 == ALTERNATE => (operand_1 as i32 >> shift) as u32,
+        0b101 if funct7 == ROTATE => operand_1.rotate_right(shift),
+        0b101 if funct7 == MIN_MAX && !immediate => operand_1.min(operand_2),
+        0b101 if instruction >> 20 == 0x287 && immediate => (0..4).fold(0, |result, byte| {
+            if operand_1 >> (byte * 8) & 0xff != 0 {
+                result | 0xff << (byte * 8)
+            } else {
+                result
+            }
+        }),
+        0b101 if instruction >> 20 == 0x698 && immediate => operand_1.swap_bytes(),
+        0b110 if immediate || funct7 == BASE => operand_1 | operand_2,
+        0b110 if funct7 == ALTERNATE => operand_1 | !operand_2,
+        0b110 if funct7 == MIN_MAX => (operand_1 as i32).max(operand_2 as i32) as u32,
+        0b110 if funct7 == SHIFT_ADD => (operand_1 << 3).wrapping_add(operand_2),
+        0b111 if immediate || funct7 == BASE => operand_1 & operand_2,
+        0b111 if funct7 == ALTERNATE => operand_1 & !operand_2,
+        0b111 if funct7 == MIN_MAX && !immediate => operand_1.max(operand_2),
+        _ => return None,
+    })
+}
+
+// the M extension of muldiv.v
+fn muldiv(funct3: u32, operand_1: u32, operand_2: u32) -> Option<u32> {
+    let signed_1 = operand_1 as i32 as i64;
+    let signed_2 = operand_2 as i32 as i64;
+    Some(match funct3 {
+        0b000 => operand_1.wrapping_mul(operand_2),
+        0b001 => ((signed_1 * signed_2) >> 32) as u32,
+        0b010 => ((signed_1 * operand_2 as i64) >> 32) as u32,
+        0b011 => ((operand_1 as u64 * operand_2 as u64) >> 32) as u32,
+        0b100 if operand_2 == 0 => u32::MAX,
+        0b100 => (operand_1 as i32).wrapping_div(operand_2 as i32) as u32,
+        0b101 if operand_2 == 0 => u32::MAX,
+        0b101 => operand_1 / operand_2,
+        0b110 if operand_2 == 0 => operand_1,
+        0b110 => (operand_1 as i32).wrapping_rem(operand_2 as i32) as u32,
+        0b111 if operand_2 == 0 => operand_1,
+        0b111 => operand_1 % operand_2,
+        _ => return None,
+    })
+}
+
+// the 32 bit instruction of a compressed instruction as in decompressor.v, 0
+// for an illegal one
+fn decompress(compressed: u16) -> u32 {
+    let c = compressed as u32;
+    let bit = |index: u32| c >> index & 1;
+    let bits = |high: u32, low: u32| c >> low & ((1 << (high - low + 1)) - 1);
+    let funct3 = bits(15, 13);
+    let rd = bits(11, 7);
+    let rs2 = bits(6, 2);
+    let rd_prime = bits(4, 2) + 8;
+    let rs1_prime = bits(9, 7) + 8;
+    let sign_extend =
+        |value: u32, width: u32| ((value << (32 - width)) as i32 >> (32 - width)) as u32;
+    let immediate_6 = sign_extend(bit(12) << 5 | bits(6, 2), 6);
+    let shift_amount = bit(12) << 5 | bits(6, 2);
+    let jump_offset = sign_extend(
+        bit(12) << 11
+            | bit(8) << 10
+            | bits(10, 9) << 8
+            | bit(6) << 7
+            | bit(7) << 6
+            | bit(2) << 5
+            | bit(11) << 4
+            | bits(5, 3) << 1,
+        12,
+    );
+    let branch_offset = sign_extend(
+        bit(12) << 8 | bits(6, 5) << 6 | bit(2) << 5 | bits(11, 10) << 3 | bits(4, 3) << 1,
+        9,
+    );
+    let load_store_offset = bit(5) << 6 | bits(12, 10) << 3 | bit(6) << 2;
+
+    let i_type = |immediate: u32, rs1: u32, funct3: u32, rd: u32, opcode: u32| {
+        (immediate & 0xfff) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode
+    };
+    let s_type = |immediate: u32, rs2: u32, rs1: u32, funct3: u32| {
+        (immediate >> 5 & 0x7f) << 25
+            | rs2 << 20
+            | rs1 << 15
+            | funct3 << 12
+            | (immediate & 0x1f) << 7
+            | 0b0100011
+    };
+    let b_type = |offset: u32, rs1: u32, funct3: u32| {
+        (offset >> 12 & 1) << 31
+            | (offset >> 5 & 0x3f) << 25
+            | rs1 << 15
+            | funct3 << 12
+            | (offset >> 1 & 0xf) << 8
+            | (offset >> 11 & 1) << 7
+            | 0b1100011
+    };
+    let j_type = |offset: u32, rd: u32| {
+        (offset >> 20 & 1) << 31
+            | (offset >> 1 & 0x3ff) << 21
+            | (offset >> 11 & 1) << 20
+            | (offset >> 12 & 0xff) << 12
+            | rd << 7
+            | 0b1101111
+    };
+    let r_type = |funct7: u32, rs2: u32, rs1: u32, funct3: u32, rd: u32| {
+        funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | 0b0110011
+    };
+    const IMMEDIATE: u32 = 0b0010011;
+    const LOAD: u32 = 0b0000011;
+    const JALR: u32 = 0b1100111;
+
+    match (bits(1, 0), funct3) {
+        (0b00, 0b000) => {
+            // c.addi4spn
+            let immediate = bits(10, 7) << 6 | bits(12, 11) << 4 | bit(5) << 3 | bit(6) << 2;
+            if immediate == 0 {
+                0
+            } else {
+                i_type(immediate, 2, 0b000, rd_prime, IMMEDIATE)
+            }
+        }
+        // c.lw
+        (0b00, 0b010) => i_type(load_store_offset, rs1_prime, 0b010, rd_prime, LOAD),
+        // c.sw
+        (0b00, 0b110) => s_type(load_store_offset, rd_prime, rs1_prime, 0b010),
+        // c.addi
+        (0b01, 0b000) => i_type(immediate_6, rd, 0b000, rd, IMMEDIATE),
+        // c.jal
+        (0b01, 0b001) => j_type(jump_offset, 1),
+        // c.li
+        (0b01, 0b010) => i_type(immediate_6, 0, 0b000, rd, IMMEDIATE),
+        (0b01, 0b011) => {
+            if rd == 2 {
+                // c.addi16sp
+                let immediate = sign_extend(
+                    bit(12) << 9 | bits(4, 3) << 7 | bit(5) << 6 | bit(2) << 5 | bit(6) << 4,
+                    10,
+                );
+                if immediate == 0 {
+                    0
+                } else {
+                    i_type(immediate, 2, 0b000, 2, IMMEDIATE)
+                }
+            } else if immediate_6 == 0 {
+                0
+            } else {
+                // c.lui
+                immediate_6 << 12 | rd << 7 | 0b0110111
+            }
+        }
+        (0b01, 0b100) => match bits(11, 10) {
+            // c.srli
+            0b00 if bit(12) == 0 => i_type(shift_amount, rs1_prime, 0b101, rs1_prime, IMMEDIATE),
+            // c.srai
+            0b01 if bit(12) == 0 => i_type(
+                0b0100000 << 5 | shift_amount,
+                rs1_prime,
+                0b101,
+                rs1_prime,
+                IMMEDIATE,
+            ),
+            // c.andi
+            0b10 => i_type(immediate_6, rs1_prime, 0b111, rs1_prime, IMMEDIATE),
+            0b11 if bit(12) == 0 => {
+                let rs2_prime = rd_prime;
+                match bits(6, 5) {
+                    0b00 => r_type(0b0100000, rs2_prime, rs1_prime, 0b000, rs1_prime),
+                    0b01 => r_type(0, rs2_prime, rs1_prime, 0b100, rs1_prime),
+                    0b10 => r_type(0, rs2_prime, rs1_prime, 0b110, rs1_prime),
+                    _ => r_type(0, rs2_prime, rs1_prime, 0b111, rs1_prime),
+                }
+            }
+            _ => 0,
+        },
+        // c.j
+        (0b01, 0b101) => j_type(jump_offset, 0),
+        // c.beqz
+        (0b01, 0b110) => b_type(branch_offset, rs1_prime, 0b000),
+        // c.bnez
+        (0b01, 0b111) => b_type(branch_offset, rs1_prime, 0b001),
+        // c.slli
+        (0b10, 0b000) if bit(12) == 0 => i_type(shift_amount, rd, 0b001, rd, IMMEDIATE),
+        // c.lwsp
+        (0b10, 0b010) if rd != 0 => i_type(
+            bits(3, 2) << 6 | bit(12) << 5 | bits(6, 4) << 2,
+            2,
+            0b010,
+            rd,
+            LOAD,
+        ),
+        (0b10, 0b100) => match (bit(12), rs2, rd) {
+            (_, _, 0) if rs2 == 0 && bit(12) == 0 => 0,
+            // c.jr
+            (0, 0, _) => i_type(0, rd, 0b000, 0, JALR),
+            // c.mv
+            (0, _, _) => r_type(0, rs2, 0, 0b000, rd),
+            // c.ebreak
+            (1, 0, 0) => EBREAK,
+            // c.jalr
+            (1, 0, _) => i_type(0, rd, 0b000, 1, JALR),
+            // c.add
+            _ => r_type(0, rs2, rd, 0b000, rd),
+        },
+        // c.swsp
+        (0b10, 0b110) => s_type(bits(8, 7) << 6 | bits(12, 9) << 2, rs2, 2, 0b010),
+        _ => 0,
+    }
+}
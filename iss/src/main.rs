@@ -0,0 +1,232 @@
+/* This program is an instruction set simulator of the core that runs the
+ * images written by the loader much faster than the verilator simulation,
+ * see hart.rs for what it models
+ *
+ * it models the memory map of cpu/top.v except for the usb device, whose
+ * banks are never owned by the core, whose out fifo is always empty and whose
+ * interrupts are never pending, and
+ * the instruction trace, which reads as stopped and empty;
+ * mtime and mcycle advance by one for each instruction and a dma copy is done
+ * as soon as it starts, so programs that depend on timing can behave
+ * differently than on the core
+ *
+ * with --compare it checks each instruction against the trace written by the
+ * verilator simulation with +trace=<file>, see trace.rs, and stops at the
+ * first difference. it takes the interrupts that the core took, and takes the
+ * values that depend on timing, like loads of mtime, from the trace, so a
+ * difference is a bug in the core or in this program. the trace can be a fifo
+ * so that the two run in lockstep, see the lockstep target in top.mk
+ */
+
+mod bus;
+mod hart;
+mod trace;
+
+use std::io::BufWriter;
+use std::io::Write;
+use std::process::ExitCode;
+
+use clap::Parser;
+
+use bus::Bus;
+use hart::Hart;
+use hart::Step;
+use trace::Record;
+use trace::Trace;
+
+#[derive(Parser)]
+struct Args {
+    /// memory image written by the loader
+    memory_image: String,
+    /// entry point file written by the loader
+    entry_point: String,
+    /// external memory image written by the loader
+    #[arg(long = "external-memory")]
+    external_memory_image: Option<String>,
+    /// trace of the verilator simulation of the same program to compare
+    /// against
+    #[arg(long)]
+    compare: Option<String>,
+}
+
+fn main() -> ExitCode {
+    let args = Args::parse();
+
+    match run(&args) {
+        Ok(instructions) => {
+            eprintln!("passed after {instructions} instructions");
+            ExitCode::SUCCESS
+        }
+        Err(message) => {
+            eprintln!("{message}");
+            ExitCode::FAILURE
+        }
+    }
+}
+
+fn run(args: &Args) -> Result<u64, String> {
+    let read =
+        |path: &str| std::fs::read(path).map_err(|error| format!("can't read {path}: {error}"));
+    let memory_image = read(&args.memory_image)?;
+    let external_memory_image = match &args.external_memory_image {
+        Some(path) => read(path)?,
+        None => Vec::new(),
+    };
+    let entry_point = String::from_utf8_lossy(&read(&args.entry_point)?)
+        .trim()
+        .to_string();
+    let entry_address = entry_point
+        .parse::<u32>()
+        .map_err(|error| format!("bad entry point {entry_point}: {error}"))?;
+
+    let mut bus = Bus::new(&memory_image, &external_memory_image)?;
+    let mut hart = Hart::new(entry_address);
+
+    match &args.compare {
+        Some(path) => compare(&mut hart, &mut bus, &mut Trace::open(path)?),
+        None => simulate(&mut hart, &mut bus),
+    }
+}
+
+fn simulate(hart: &mut Hart, bus: &mut Bus) -> Result<u64, String> {
+    let mut output = BufWriter::new(std::io::stdout().lock());
+    let mut instructions = 0;
+
+    loop {
+        let mut waiting = false;
+        match hart.pending_interrupt(bus) {
+            Some(mcause) if hart.interrupts_enabled() => {
+                hart.interrupt(bus, mcause)?;
+            }
+            _ => match hart.step(bus)? {
+                Step::Retired { .. } => instructions += 1,
+                Step::Trap { .. } => {}
+                Step::Putchar(character) => {
+                    output.write_all(&[character]).unwrap();
+                    // doesn't print immediately otherwise
+                    if character == b'\n' {
+                        output.flush().unwrap();
+                    }
+                    instructions += 1;
+                }
+                Step::Wait => {
+                    // only the timer can end the wait, so skip to it
+                    if !hart.timer_interrupt_enabled() {
+                        output.flush().unwrap();
+                        return Err(fail(hart, "wfi with no interrupt that can become pending"));
+                    }
+                    bus.mtime = bus.mtimecmp.wrapping_sub(1);
+                    waiting = true;
+                }
+                Step::Pass => {
+                    output.flush().unwrap();
+                    return Ok(instructions);
+                }
+                Step::Fail => {
+                    output.flush().unwrap();
+                    return Err(fail(hart, "got fail instruction"));
+                }
+            },
+        }
+        hart.tick(bus, waiting);
+        bus.tick();
+    }
+}
+
+fn compare(hart: &mut Hart, bus: &mut Bus, trace: &mut Trace) -> Result<u64, String> {
+    let mut instructions = 0;
+
+    loop {
+        let record = trace.next()?;
+
+        if let Some(Record::Trap { address, mcause }) = record {
+            if mcause >> 31 != 0 {
+                let return_address = hart.interrupt(bus, mcause)?;
+                if return_address != address {
+                    return Err(diverged(hart, instructions, &record, "took the interrupt"));
+                }
+                hart.tick(bus, false);
+                bus.tick();
+                continue;
+            }
+        }
+
+        let address = hart.pc;
+        let step = match hart.step(bus)? {
+            // the core is waiting or the interrupt that ends the wait is the
+            // next record
+            Step::Wait => hart.skip_wait(bus)?,
+            step => step,
+        };
+        let simulated = match step {
+            Step::Retired {
+                address,
+                rd,
+                value,
+                timing_dependent,
+            } => match record {
+                Some(Record::Retired {
+                    rd: core_rd,
+                    value: core_value,
+                    ..
+                }) if timing_dependent && core_rd == rd => {
+                    hart.set_register(rd, core_value);
+                    Record::Retired {
+                        address,
+                        rd,
+                        value: core_value,
+                    }
+                }
+                _ => Record::Retired { address, rd, value },
+            },
+            Step::Trap { address, mcause } => Record::Trap { address, mcause },
+            Step::Putchar(_) => Record::Retired {
+                address,
+                rd: 0,
+                value: 0,
+            },
+            // the simulation finishes at the pass instruction without
+            // writing it
+            Step::Pass if record.is_none() => return Ok(instructions),
+            Step::Pass => {
+                return Err(diverged(
+                    hart,
+                    instructions,
+                    &record,
+                    "got pass instruction",
+                ))
+            }
+            Step::Fail => return Err(fail(hart, "got fail instruction")),
+            Step::Wait => unreachable!(),
+        };
+
+        let matches = record.as_ref() == Some(&simulated);
+        if !matches {
+            return Err(diverged(
+                hart,
+                instructions,
+                &record,
+                &format!("{simulated}"),
+            ));
+        }
+
+        instructions += 1;
+        hart.tick(bus, false);
+        bus.tick();
+    }
+}
+
+fn diverged(hart: &Hart, instructions: u64, record: &Option<Record>, simulated: &str) -> String {
+    let core = match record {
+        Some(record) => format!("{record}"),
+        None => "the end of the trace".to_string(),
+    };
+    hart.display_registers();
+    format!("diverged after {instructions} instructions\ncore: {core}\nsimulator: {simulated}")
+}
+
+fn fail(hart: &Hart, message: &str) -> String {
+    println!("pc: 0x{:08x}", hart.pc);
+    hart.display_registers();
+    message.to_string()
+}
@@ -0,0 +1,77 @@
+// the trace written by the verilator simulation with +trace=<file>, see
+// cpu/core.v
+//
+// each record is three little endian 32 bit words: the address of the
+// instruction; the register it wrote, or bit 31 set for a trap; and the value
+// written, 0 for no register, or the mcause of the trap. an instruction that
+// traps is not retired, and an interrupt taken at a wfi or chained from an
+// mret is at the address that its mret returns to
+
+use std::fmt;
+use std::fs::File;
+use std::io::BufReader;
+use std::io::ErrorKind;
+use std::io::Read;
+
+const TRAP: u32 = 1 << 31;
+
+pub struct Trace {
+    reader: BufReader<File>,
+}
+
+#[derive(PartialEq)]
+pub enum Record {
+    Retired { address: u32, rd: u32, value: u32 },
+    Trap { address: u32, mcause: u32 },
+}
+
+impl Trace {
+    pub fn open(path: &str) -> Result<Trace, String> {
+        let file = File::open(path).map_err(|error| format!("can't open {path}: {error}"))?;
+        Ok(Trace {
+            reader: BufReader::new(file),
+        })
+    }
+
+    // None at the end of the trace
+    pub fn next(&mut self) -> Result<Option<Record>, String> {
+        let mut bytes = [0; 12];
+        match self.reader.read_exact(&mut bytes) {
+            Ok(()) => {}
+            Err(error) if error.kind() == ErrorKind::UnexpectedEof => return Ok(None),
+            Err(error) => return Err(format!("can't read the trace: {error}")),
+        }
+        let word =
+            |index: usize| u32::from_le_bytes(bytes[index * 4..index * 4 + 4].try_into().unwrap());
+        let (address, kind, value) = (word(0), word(1), word(2));
+        Ok(Some(if kind & TRAP != 0 {
+            Record::Trap {
+                address,
+                mcause: value,
+            }
+        } else {
+            Record::Retired {
+                address,
+                rd: kind & 0x1f,
+                value,
+            }
+        }))
+    }
+}
+
+impl fmt::Display for Record {
+    fn fmt(&self, formatter: &mut fmt::Formatter) -> fmt::Result {
+        match self {
+            Record::Retired { address, rd, value } => {
+                write!(formatter, "0x{address:08x} retired")?;
+                if *rd != 0 {
+                    write!(formatter, ", x{rd} = 0x{value:08x}")?;
+                }
+                Ok(())
+            }
+            Record::Trap { address, mcause } => {
+                write!(formatter, "0x{address:08x} trap, mcause 0x{mcause:08x}")
+            }
+        }
+    }
+}
@@ -1,6 +1,7 @@
 #include "cpulib.h"
 #include <stdatomic.h>
 #include <stdio.h>
+#include <string.h>
 
 static int __stdout_putc(char c, FILE* file) {
 #ifdef SIMULATION
@@ -43,18 +44,266 @@ void _exit() {
 #ifdef SIMULATION
     simulation_fail();
 #else
+    trace_stop();
     morse(stderr_buffer);
 #endif
 }
 
-volatile uint64_t* timer_cmp = (uint64_t*)0x80000000 + 8;
+// mtime counts core clock cycles
+static volatile uint32_t* const mtime = (uint32_t*)0x80000000;
+static volatile uint32_t* const mtimecmp = (uint32_t*)0x80000008;
+
+#define MSTATUS_MIE (1 << 3)
+#define MIE_MTIE (1 << 7)
+
+uint64_t read_timer() {
+    uint32_t low, high, high_again;
+    do {
+        high = mtime[1];
+        low = mtime[0];
+        high_again = mtime[1];
+    } while (high != high_again);
+    return ((uint64_t)high << 32) | low;
+}
+
+static void write_timer_compare(uint64_t time) {
+    // the low half is set to the maximum first so that the intermediate value
+    // is never less than both the old and new values
+    mtimecmp[0] = UINT32_MAX;
+    mtimecmp[1] = time >> 32;
+    mtimecmp[0] = time;
+}
 
 void set_timer(uint64_t time) {
-    *timer_cmp = *timer_cmp + time;
-    int set_val = 1 << 7;
-    __asm__("csrrs zero, mie, %0" : : "r"(set_val));
-    set_val = 1 << 3;
-    __asm__("csrrs zero, mstatus, %0" : : "r"(set_val));
+    write_timer_compare(read_timer() + time);
+    __asm__ volatile("csrs mie, %0" : : "r"(MIE_MTIE));
+    enable_interrupts();
+}
+
+void enable_interrupts() {
+    __asm__ volatile("csrs mstatus, %0" : : "r"(MSTATUS_MIE));
+}
+
+void disable_interrupts() {
+    __asm__ volatile("csrc mstatus, %0" : : "r"(MSTATUS_MIE));
+}
+
+void wait_for_interrupt() {
+    __asm__ volatile("wfi");
+}
+
+static uint64_t read_timer_compare() {
+    return ((uint64_t)mtimecmp[1] << 32) | mtimecmp[0];
+}
+
+void sleep_for_clock_cycles(uint32_t cycles) {
+    const uint64_t deadline = read_timer() + cycles;
+
+    uint32_t mstatus;
+    __asm__ volatile("csrr %0, mstatus" : "=r"(mstatus));
+    while (read_timer() < deadline) {
+        // the timer interrupt only needs to wake the wfi, so it is never taken
+        // here: mtimecmp and the enable in mie are restored before interrupts
+        // are enabled again, and an alarm set with set_timer that is due
+        // before the deadline wakes the wfi and is then taken as usual. the
+        // alarm is read again each time since a handler may have changed it
+        disable_interrupts();
+        const uint64_t alarm = read_timer_compare();
+        uint32_t mie;
+        __asm__ volatile("csrrs %0, mie, %1" : "=r"(mie) : "r"(MIE_MTIE));
+        const bool alarm_first = (mstatus & MSTATUS_MIE) && (mie & MIE_MTIE) && alarm < deadline;
+        write_timer_compare(alarm_first ? alarm : deadline);
+        if (read_timer() < deadline) {
+            wait_for_interrupt();
+        }
+        write_timer_compare(alarm);
+        if (!(mie & MIE_MTIE)) {
+            __asm__ volatile("csrc mie, %0" : : "r"(MIE_MTIE));
+        }
+        if (mstatus & MSTATUS_MIE) {
+            enable_interrupts();
+        }
+    }
+}
+
+#define MIE_MEIE (1 << 11)
+
+void enable_external_interrupts() {
+    __asm__ volatile("csrrs zero, mie, %0" : : "r"(MIE_MEIE));
+}
+
+void disable_external_interrupts() {
+    __asm__ volatile("csrrc zero, mie, %0" : : "r"(MIE_MEIE));
+}
+
+// defined in cpulib.S
+extern const uint32_t interrupt_vector_table[];
+
+void enable_vectored_interrupts() {
+    // mode 1 is vectored
+    __asm__ volatile("csrw mtvec, %0" : : "r"((uintptr_t)interrupt_vector_table | 1));
+}
+
+[[gnu::weak]] void on_timer_interrupt() {
+    __asm__ volatile("csrc mie, %0" : : "r"(MIE_MTIE));
+}
+
+[[gnu::weak]] void on_external_interrupt() {
+    handle_usb_transaction();
+}
+
+// defined in the linker script
+extern volatile uint32_t dma_source;
+extern volatile uint32_t dma_destination;
+extern volatile uint32_t dma_length;
+
+#define MIE_DMAIE (1 << 16)
+
+void dma_start(void* destination, const void* source, size_t length) {
+    // the dma engine reads and writes memory without the compiler knowing
+    __asm__ volatile("" : : : "memory");
+    dma_source = (uintptr_t)source;
+    dma_destination = (uintptr_t)destination;
+    dma_length = length;
+}
+
+bool dma_busy() {
+    return dma_length != 0;
+}
+
+void dma_copy(void* destination, const void* source, size_t length) {
+    // interrupts are disabled before the copy starts so that a handler that
+    // copies too, like the usb interrupt's, can't take over the dma engine
+    // meanwhile. the completion interrupt only wakes the wfi, it isn't taken
+    // with interrupts disabled; the core doesn't access memory while waiting
+    // so the copy gets every cycle
+    uint32_t mstatus, mie;
+    __asm__ volatile("csrr %0, mstatus" : "=r"(mstatus));
+    disable_interrupts();
+    dma_start(destination, source, length);
+    __asm__ volatile("csrrs %0, mie, %1" : "=r"(mie) : "r"(MIE_DMAIE));
+    while (dma_busy()) {
+        wait_for_interrupt();
+    }
+    if (!(mie & MIE_DMAIE)) {
+        __asm__ volatile("csrc mie, %0" : : "r"(MIE_DMAIE));
+    }
+    dma_acknowledge();
+    if (mstatus & MSTATUS_MIE) {
+        enable_interrupts();
+    }
+
+    __asm__ volatile("" : : : "memory");
+}
+
+void dma_acknowledge() {
+    dma_length = 0;
+}
+
+[[gnu::weak]] void on_dma_interrupt() {
+    dma_acknowledge();
+}
+
+// defined in the linker script
+extern volatile uint32_t trace_control;
+extern const volatile uint8_t trace_ram[TRACE_ENTRIES * 8];
+
+#define TRACE_CONTROL_ENABLE (1 << 0)
+#define TRACE_CONTROL_CLEAR (1 << 1)
+#define TRACE_STATUS_WRITING (1 << 2)
+
+void trace_start() {
+    trace_control = TRACE_CONTROL_ENABLE | TRACE_CONTROL_CLEAR;
+}
+
+void trace_stop() {
+    trace_control = 0;
+    // the last entries are written in the cycles after
+    while (trace_control & TRACE_STATUS_WRITING) {
+    }
+}
+
+void trace_read(uint8_t* buffer) {
+    trace_stop();
+    const uint32_t status = trace_control;
+    memcpy(buffer, &status, sizeof(status));
+    for (size_t i = 0; i < sizeof(trace_ram); i++) {
+        buffer[sizeof(status) + i] = trace_ram[i];
+    }
+}
+
+static void usb_write_all(const uint8_t* in_buffer, size_t size) {
+    size_t written = 0;
+    while (written < size) {
+        written += usb_write(in_buffer + written, size - written);
+    }
+}
+
+void trace_send() {
+    trace_stop();
+    const uint32_t status = trace_control;
+    usb_write_all((const uint8_t*)&status, sizeof(status));
+    // usb_write only reads the bytes so the trace ram doesn't have to be copied first
+    usb_write_all((const uint8_t*)trace_ram, sizeof(trace_ram));
+}
+
+// csr numbers have to be immediates so each counter needs its own instructions
+#define READ_CSR_64(low, high) \
+    ({ \
+        uint32_t _low, _high, _high_again; \
+        do { \
+            __asm__ volatile("csrr %0, " #high : "=r"(_high)); \
+            __asm__ volatile("csrr %0, " #low : "=r"(_low)); \
+            __asm__ volatile("csrr %0, " #high : "=r"(_high_again)); \
+        } while (_high != _high_again); \
+        ((uint64_t)_high << 32) | _low; \
+    })
+
+#define START_COUNTER(counter, event) \
+    do { \
+        __asm__ volatile("csrw mhpmevent" #counter ", %0" : : "r"(event)); \
+        __asm__ volatile("csrw mhpmcounter" #counter "h, zero"); \
+        __asm__ volatile("csrw mhpmcounter" #counter ", zero"); \
+    } while (0)
+
+void performance_counter_start(unsigned int counter, enum performance_event event) {
+    switch (counter) {
+        case 0:
+            START_COUNTER(3, event);
+            break;
+        case 1:
+            START_COUNTER(4, event);
+            break;
+        case 2:
+            START_COUNTER(5, event);
+            break;
+        case 3:
+            START_COUNTER(6, event);
+            break;
+    }
+}
+
+uint64_t performance_counter_read(unsigned int counter) {
+    switch (counter) {
+        case 0:
+            return READ_CSR_64(mhpmcounter3, mhpmcounter3h);
+        case 1:
+            return READ_CSR_64(mhpmcounter4, mhpmcounter4h);
+        case 2:
+            return READ_CSR_64(mhpmcounter5, mhpmcounter5h);
+        case 3:
+            return READ_CSR_64(mhpmcounter6, mhpmcounter6h);
+        default:
+            return 0;
+    }
+}
+
+uint64_t read_cycle_counter() {
+    return READ_CSR_64(mcycle, mcycleh);
+}
+
+uint64_t read_instruction_counter() {
+    return READ_CSR_64(minstret, minstreth);
 }
 
 void sleep_ms(uint32_t time) {
@@ -84,69 +333,124 @@ void hexdump(const uint8_t* buffer, size_t length) {
     putchar('\n');
 }
 
-// read_index is the next index to read data from
-// write_index is the next index to write data to
-// when read_index == write_index there is no data to read
-// when write_index is one position before read_index the buffer is full
+// read_index is the number of bytes read and write_index is the number of bytes written, both
+// run freely and are masked with length - 1 to index the buffer since the length is a power of
+// two; write_index - read_index bytes can be read even once the indices overflow, and the whole
+// buffer can be used
 
-size_t ring_buffer_read(struct ring_buffer* ring_buffer, uint8_t* out_buffer, size_t size) {
-    const size_t length = ring_buffer->length;
-    size_t read_index = ring_buffer->read_index;
-    uint8_t* buffer = ring_buffer->buffer;
+static void copy_with_memcpy(void* destination, const void* source, size_t length) {
+    memcpy(destination, source, length);
+}
 
-    const size_t write_index =
-        atomic_load_explicit(&ring_buffer->write_index, memory_order_acquire);
+// the bytes are copied in at most two parts since they can wrap around the end of the buffer,
+// memcpy copies the parts a word at a time where they have the same alignment
+static size_t ring_buffer_peek_with(
+    struct ring_buffer* ring_buffer,
+    uint8_t* out_buffer,
+    size_t size,
+    void (*copy)(void*, const void*, size_t)
+) {
+    const size_t length = ring_buffer->length;
+    const size_t read_index = ring_buffer->read_index;
+    const size_t offset = read_index & (length - 1);
 
-    size_t bytes_read = 0;
-    while (read_index != write_index && bytes_read < size) {
-        out_buffer[bytes_read] = buffer[read_index];
+    const size_t available =
+        atomic_load_explicit(&ring_buffer->write_index, memory_order_acquire) - read_index;
+    const size_t bytes_read = available < size ? available : size;
+    const size_t first_part_length = bytes_read < length - offset ? bytes_read : length - offset;
 
-        read_index++;
-        if (read_index >= length) {
-            read_index = 0;
-        }
-        bytes_read++;
+    copy(out_buffer, ring_buffer->buffer + offset, first_part_length);
+    if (bytes_read > first_part_length) {
+        copy(out_buffer + first_part_length, ring_buffer->buffer, bytes_read - first_part_length);
     }
 
-    atomic_store_explicit(&ring_buffer->read_index, read_index, memory_order_release);
     return bytes_read;
 }
 
-size_t ring_buffer_write(struct ring_buffer* ring_buffer, const uint8_t* in_buffer, size_t size) {
+size_t ring_buffer_peek(struct ring_buffer* ring_buffer, uint8_t* out_buffer, size_t size) {
+    return ring_buffer_peek_with(ring_buffer, out_buffer, size, copy_with_memcpy);
+}
+
+size_t ring_buffer_peek_dma(struct ring_buffer* ring_buffer, uint8_t* out_buffer, size_t size) {
+    return ring_buffer_peek_with(ring_buffer, out_buffer, size, dma_copy);
+}
+
+const uint8_t* ring_buffer_peek_span(struct ring_buffer* ring_buffer, size_t* size) {
     const size_t length = ring_buffer->length;
-    size_t write_index = ring_buffer->write_index;
-    uint8_t* buffer = ring_buffer->buffer;
+    const size_t read_index = ring_buffer->read_index;
+    const size_t offset = read_index & (length - 1);
 
-    const size_t read_index = atomic_load_explicit(&ring_buffer->read_index, memory_order_acquire);
+    const size_t available =
+        atomic_load_explicit(&ring_buffer->write_index, memory_order_acquire) - read_index;
+    *size = available < length - offset ? available : length - offset;
+    return ring_buffer->buffer + offset;
+}
 
-    size_t bytes_written = 0;
-    size_t next_write_index = write_index + 1;
-    if (next_write_index >= length) {
-        next_write_index = 0;
-    }
-    while (next_write_index != read_index && bytes_written < size) {
-        buffer[write_index] = in_buffer[bytes_written];
+void ring_buffer_consume(struct ring_buffer* ring_buffer, size_t size) {
+    atomic_store_explicit(
+        &ring_buffer->read_index,
+        ring_buffer->read_index + size,
+        memory_order_release
+    );
+}
 
-        write_index++;
-        if (write_index >= length) {
-            write_index = 0;
-        }
-        next_write_index = write_index + 1;
-        if (next_write_index >= length) {
-            next_write_index = 0;
-        }
+size_t ring_buffer_read(struct ring_buffer* ring_buffer, uint8_t* out_buffer, size_t size) {
+    const size_t bytes_read = ring_buffer_peek(ring_buffer, out_buffer, size);
+    ring_buffer_consume(ring_buffer, bytes_read);
+    return bytes_read;
+}
 
-        bytes_written++;
+static size_t ring_buffer_write_with(
+    struct ring_buffer* ring_buffer,
+    const uint8_t* in_buffer,
+    size_t size,
+    void (*copy)(void*, const void*, size_t)
+) {
+    const size_t length = ring_buffer->length;
+    const size_t write_index = ring_buffer->write_index;
+    const size_t offset = write_index & (length - 1);
+
+    const size_t read_index = atomic_load_explicit(&ring_buffer->read_index, memory_order_acquire);
+    const size_t space = length - (write_index - read_index);
+    const size_t bytes_written = space < size ? space : size;
+    const size_t first_part_length =
+        bytes_written < length - offset ? bytes_written : length - offset;
+
+    copy(ring_buffer->buffer + offset, in_buffer, first_part_length);
+    if (bytes_written > first_part_length) {
+        copy(ring_buffer->buffer, in_buffer + first_part_length, bytes_written - first_part_length);
     }
 
-    atomic_store_explicit(&ring_buffer->write_index, write_index, memory_order_release);
+    ring_buffer_commit(ring_buffer, bytes_written);
     return bytes_written;
 }
 
-extern struct bulk_read_ring_buffer* bulk_read_ring_buffer;
+size_t ring_buffer_write(struct ring_buffer* ring_buffer, const uint8_t* in_buffer, size_t size) {
+    return ring_buffer_write_with(ring_buffer, in_buffer, size, copy_with_memcpy);
+}
+
+size_t
+ring_buffer_write_dma(struct ring_buffer* ring_buffer, const uint8_t* in_buffer, size_t size) {
+    return ring_buffer_write_with(ring_buffer, in_buffer, size, dma_copy);
+}
+
+uint8_t* ring_buffer_reserve(struct ring_buffer* ring_buffer, size_t* size) {
+    const size_t length = ring_buffer->length;
+    const size_t write_index = ring_buffer->write_index;
+    const size_t offset = write_index & (length - 1);
+
+    const size_t read_index = atomic_load_explicit(&ring_buffer->read_index, memory_order_acquire);
+    const size_t space = length - (write_index - read_index);
+    *size = space < length - offset ? space : length - offset;
+    return ring_buffer->buffer + offset;
+}
 
-size_t usb_read(uint8_t* out_buffer, size_t max_size) {
-    return ring_buffer_read((struct ring_buffer*)&bulk_read_ring_buffer, out_buffer, max_size);
+void ring_buffer_commit(struct ring_buffer* ring_buffer, size_t size) {
+    atomic_store_explicit(
+        &ring_buffer->write_index,
+        ring_buffer->write_index + size,
+        memory_order_release
+    );
 }
 
 #define MORSE_TIME_UNIT 200 // in ms
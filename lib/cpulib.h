@@ -2,7 +2,12 @@
 #include <stdint.h>
 #include <stdatomic.h>
 
-#define CLOCK_FREQUENCY 12000000
+#ifdef PIPELINED_CORE
+    // the pipelined core runs on the undivided clock
+    #define CLOCK_FREQUENCY 24000000
+#else
+    #define CLOCK_FREQUENCY 12000000
+#endif
 
 #ifdef SIMULATION
     #define simulation_pass() __asm__(".insn 0x8c000073"); // custom instruction to pass test
@@ -17,6 +22,8 @@ enum mcause {
     MCAUSE_ENVIRONMENT_CALL_FROM_M_MODE = 11,
     MCAUSE_MACHINE_TIMER_INTERRUPT = 0x80000007,
     MCAUSE_MACHINE_EXTERNAL_INTERRUPT = 0x8000000b,
+    MCAUSE_DMA_INTERRUPT = 0x80000010,
+    MCAUSE_USB_OUT_FIFO_INTERRUPT = 0x80000011,
 };
 
 enum led_color {
@@ -32,18 +39,137 @@ enum led_color {
 
 extern volatile enum led_color led;
 
+// places a variable or function in the external memory, which is much larger
+// than the block ram but is accessed through the caches, so a miss takes many
+// cycles; code and data without this stay in the block ram
+#define EXTERNAL_MEMORY [[gnu::section(".dram")]]
+
+// the trap handler, defined by the program; this declaration makes sure it
+// has the 4 byte alignment that mtvec requires, functions are otherwise only
+// 2 byte aligned with the C extension
+[[gnu::interrupt, gnu::aligned(4)]] void on_trap();
+
+// switches to vectored interrupts, after which timer and usb interrupts call
+// on_timer_interrupt and on_external_interrupt directly and exceptions still
+// call on_trap; the interrupt handlers run in the shadow register bank on
+// their own stack, so they are ordinary functions that need no register
+// saving and are entered in a few cycles; there is only one shadow bank, so a
+// handler is never interrupted, even if it enables interrupts, and an
+// interrupt that becomes pending during it is taken once it returns; an
+// exception in a handler calls on_trap in the shadow bank, and the handler has
+// to save mepc and mstatus around it since on_trap's mret overwrites them
+void enable_vectored_interrupts();
+// the default disables the timer interrupt
+void on_timer_interrupt();
+// the default calls handle_usb_transaction
+void on_external_interrupt();
+// called when a copy started with dma_start is done if the dma interrupt, bit
+// 16 of mie, is enabled; the default calls dma_acknowledge
+void on_dma_interrupt();
+// called while usb_read can read at least the bytes set with
+// usb_set_read_threshold if the usb out fifo interrupt, bit 17 of mie, is
+// enabled; the default disables the interrupt
+void on_usb_out_fifo_interrupt();
+
+// the value of mtime, which counts core clock cycles
+uint64_t read_timer();
+// enables the timer interrupt to be taken after the given number of cycles
 void set_timer(uint64_t);
+// waits in wfi until the time has passed, so the core is idle rather than
+// spinning; other interrupts, including a timer interrupt set with set_timer,
+// are still taken while sleeping, and mtimecmp is left as it was
 void sleep_for_clock_cycles(uint32_t);
+void sleep_ms(uint32_t);
+
+// sets and clears the interrupt enable bit in mstatus
+void enable_interrupts();
+void disable_interrupts();
+// holds the core idle until an interrupt enabled in mie is pending, even if
+// interrupts are disabled in mstatus; checking for work with interrupts
+// disabled and then calling this avoids missing an interrupt that happens in
+// between, it is taken once interrupts are enabled again
+void wait_for_interrupt();
 void morse(const char*);
 
 // TODO make this a better API
 void enable_external_interrupts();
+void disable_external_interrupts();
 
 void clear_usb_interrupt();
 void handle_usb_transaction();
+// the usb_control of the transaction handle_usb_transaction handles next
+uint16_t next_usb_control();
 
 void hexdump(const uint8_t*, size_t);
 
+// the dma engine copies between memory and usb_data_buffer, or within either,
+// with any alignment and in cycles where the core is not accessing memory;
+// a bank of usb_data_buffer can only be used while the core owns it, which is
+// while handling a usb transaction
+//
+// starts a copy, which must not be done while another copy is in progress; the
+// source and destination must each be entirely in the block ram or entirely in
+// usb_data_buffer, the dma engine can't reach external memory, and a copy that
+// isn't copies nothing and completes at once. handle_usb_transaction copies
+// with the dma engine too, so dma_start and dma_busy must not be used while the
+// usb interrupt is enabled, except from the interrupt handlers; dma_copy can
+// always be used
+void dma_start(void* destination, const void* source, size_t length);
+bool dma_busy();
+// clears the completion interrupt
+void dma_acknowledge();
+// copies and waits in wfi until the copy is done, which makes the copy take
+// about a cycle per word
+void dma_copy(void* destination, const void* source, size_t length);
+
+// the instruction trace of cpu/trace_encoder.v keeps the last TRACE_ENTRIES
+// entries of the branches, jumps and traps since the program started, and
+// trace-decoder/ turns it back into the instructions with the ELF binary;
+// _exit stops it so that it ends where the program failed
+#define TRACE_ENTRIES 512
+// the status word and then the entries, see trace_read
+#define TRACE_SIZE (4 + TRACE_ENTRIES * 8)
+
+// clears the trace and starts it again
+void trace_start();
+void trace_stop();
+// stops the trace and copies it to buffer in the format read by
+// trace-decoder/, buffer must hold TRACE_SIZE bytes
+void trace_read(uint8_t* buffer);
+// stops the trace and sends it with usb_write, waiting until it is all queued,
+// so the usb interrupt has to be enabled; read it with `usb-wrapper read`
+void trace_send();
+
+// must match the HPM_EVENT_* values in cpu/core_constants.v
+enum performance_event {
+    PERFORMANCE_EVENT_NONE = 0,
+    // cycles where the core is waiting, such as for a division
+    PERFORMANCE_EVENT_STALL = 1,
+    PERFORMANCE_EVENT_TAKEN_BRANCH = 2,
+    // traps taken, including interrupts
+    PERFORMANCE_EVENT_TRAP = 3,
+    // cycles where an enabled interrupt is pending but not yet taken
+    PERFORMANCE_EVENT_INTERRUPT_PENDING = 4,
+    // cycles between a trap and mret, the time spent in on_trap
+    PERFORMANCE_EVENT_IN_TRAP = 5,
+    // cycles where the core owns a bank of the usb data buffer, the usb module
+    // has to wait while the core owns both
+    PERFORMANCE_EVENT_USB_BUFFER_OWNED = 6,
+    // cycles spent waiting in wfi
+    PERFORMANCE_EVENT_WAIT_FOR_INTERRUPT = 7,
+};
+
+// the number of performance counters, numbered from 0
+#define PERFORMANCE_COUNTER_COUNT 4
+
+// resets the counter to 0 and makes it count the event
+void performance_counter_start(unsigned int counter, enum performance_event event);
+uint64_t performance_counter_read(unsigned int counter);
+
+uint64_t read_cycle_counter();
+uint64_t read_instruction_counter();
+
+// the length must be a power of two
 struct ring_buffer {
     const size_t length;
     atomic_size_t read_index;
@@ -55,8 +181,51 @@ struct ring_buffer {
 size_t
 ring_buffer_read(struct ring_buffer* ring_buffer, uint8_t* out_buffer, size_t max_size);
 
+// same as ring_buffer_read but the bytes stay in the ring buffer
+size_t
+ring_buffer_peek(struct ring_buffer* ring_buffer, uint8_t* out_buffer, size_t max_size);
+
+// removes size bytes, which must not be more than can be read
+void ring_buffer_consume(struct ring_buffer* ring_buffer, size_t size);
+
+// returns the bytes that can be read without copying them and sets size to how many there are,
+// which is fewer than can be read when they wrap around the end of the buffer; the bytes stay in
+// the ring buffer until ring_buffer_consume
+const uint8_t* ring_buffer_peek_span(struct ring_buffer* ring_buffer, size_t* size);
+
 // returns the number of bytes written
 size_t
 ring_buffer_write(struct ring_buffer* ring_buffer, const uint8_t* in_buffer, size_t size);
 
+// returns the space that can be written in place and sets size to how large it is, which is
+// less than the space left when it wraps around the end of the buffer; the bytes written there
+// are added to the ring buffer by ring_buffer_commit
+uint8_t* ring_buffer_reserve(struct ring_buffer* ring_buffer, size_t* size);
+// adds size bytes, which must not be more than ring_buffer_reserve returned
+void ring_buffer_commit(struct ring_buffer* ring_buffer, size_t size);
+
+// same as ring_buffer_peek and ring_buffer_write but copy with dma_copy
+size_t
+ring_buffer_peek_dma(struct ring_buffer* ring_buffer, uint8_t* out_buffer, size_t max_size);
+size_t
+ring_buffer_write_dma(struct ring_buffer* ring_buffer, const uint8_t* in_buffer, size_t size);
+
+// the data the host sent to the bulk OUT endpoint, which the gateware keeps in
+// a fifo without interrupting the core; the host is NAKed while it is full
 size_t usb_read(uint8_t* out_buffer, size_t max_size);
+// the number of bytes usb_read can read
+size_t usb_read_available();
+// the usb out fifo interrupt is pending while usb_read can read at least this
+// many bytes, 0 never makes it pending
+void usb_set_read_threshold(size_t bytes);
+// like wait_for_interrupt, but also ends the wait when usb_read has data. it
+// returns once any interrupt is pending, like a usb transaction, which isn't
+// taken while interrupts are disabled, so usb_read can still have nothing;
+// callers loop, enabling interrupts between waits, like read_all in
+// bootloader/bootloader.c
+void wait_for_usb_data();
+
+// queues data to be sent to the host, returns the number of bytes queued
+size_t usb_write(const uint8_t* in_buffer, size_t size);
+// the number of bytes queued by usb_write that the host has not received yet
+size_t usb_write_pending();
@@ -18,6 +18,8 @@ enum bRequest : uint8_t {
     BREQUEST_GET_INTERFACE = 10,
     BREQUEST_SET_INTERFACE = 11,
     BREQUEST_SYNCH_FRAME = 12,
+    // stalled, usb_read only reads the data of the bulk OUT endpoint, which the gateware writes to
+    // the out fifo without the core
     BREQUEST_CUSTOM_OUT = 13,
     BREQUEST_CUSTOM_IN = 14,
 };
@@ -83,6 +85,30 @@ struct interface_descriptor {
 };
 #define INTERFACE_DESCRIPTOR_SIZE 9
 
+struct endpoint_descriptor {
+    uint8_t bLength;
+    enum bDescriptorType bDescriptorType;
+    uint8_t bEndpointAddress;
+    uint8_t bmAttributes;
+    uint16_t wMaxPacketSize;
+    uint8_t bInterval;
+};
+#define ENDPOINT_DESCRIPTOR_SIZE 7
+
+enum endpoint_transfer_type : uint8_t {
+    ENDPOINT_TRANSFER_TYPE_CONTROL = 0b00,
+    ENDPOINT_TRANSFER_TYPE_ISOCHRONOUS = 0b01,
+    ENDPOINT_TRANSFER_TYPE_BULK = 0b10,
+    ENDPOINT_TRANSFER_TYPE_INTERRUPT = 0b11,
+};
+
+#define ENDPOINT_DIRECTION_IN 0x80
+
+// receives the data read by usb_read, must match USB_OUT_FIFO_ENDPOINT in cpu/top.v
+#define BULK_OUT_ENDPOINT 1
+// sends the data written by usb_write
+#define BULK_IN_ENDPOINT 2
+
 enum transaction {
     TRANSACTION_OUT = 0b00,
     TRANSACTION_IN = 0b10,
@@ -100,25 +126,60 @@ enum handshake {
 #define MAX_PACKET_SIZE 64
 
 #define USB_DATA_BUFFER_LENGTH 1023
-extern uint8_t usb_data_buffer[USB_DATA_BUFFER_LENGTH];
+// the gateware receives into one bank while the core handles the packet in the other, each
+// bank is 1024 bytes so that it is made of whole memory words
+#define USB_DATA_BUFFER_BANKS 2
+extern uint8_t usb_data_buffer[USB_DATA_BUFFER_BANKS][1024];
 
-/* bits 0-9: length of data in bytes, bidirectional
+/* one for each bank of usb_data_buffer, the gateware gives the banks to the core in turn
+ *
+ * bits 0-9: length of data in bytes, bidirectional
  * bits 10-11: when receiving an interrupt, an enum transaction that is the transaction that was just done
  *             when writing the response to send, an enum response_type
  * bits 12-15: when receiving an interrupt, endpoint of the received transaction
+ *             when writing the response to send, the endpoint the response is for; IN
+ *             transactions on other endpoints are NAKed, without an interrupt if the
+ *             response is data
  *
- * writing to this clear the interrupt and signals the gateware to continue
+ * writing to this gives the bank back to the gateware; the interrupt is pending while the core
+ * has either bank
  */
-extern volatile uint16_t usb_control;
+extern volatile uint16_t usb_control[USB_DATA_BUFFER_BANKS];
 // only set by software, used by the gatware to filter transactions to only the specified address
 extern volatile uint8_t usb_device_address;
+// write-only, writing a bit mask of endpoints resets their DATA0/DATA1 toggles in the gateware
+extern volatile uint16_t usb_reset_data_toggles;
+
+/* the fifo the gateware writes the data of the bulk OUT endpoint to, the core is not interrupted
+ * for those transactions and the gateware NAKs them while the fifo doesn't have room for a packet
+ *
+ * usb_out_fifo_data: reading pops the next 4 bytes, the first in the low byte; the bytes past
+ *                    usb_out_fifo_count are undefined
+ * usb_out_fifo_data_byte: reading pops the next byte
+ * usb_out_fifo_count: the number of bytes in the fifo
+ * usb_out_fifo_threshold: the usb out fifo interrupt, bit 17 of mip, is pending while the count is
+ *                         at least this, unless this is 0
+ */
+extern volatile uint32_t usb_out_fifo_data;
+extern volatile uint8_t usb_out_fifo_data_byte;
+extern volatile uint32_t usb_out_fifo_count;
+extern volatile uint32_t usb_out_fifo_threshold;
+#define MIE_USB_OUT_FIFO_IE (1 << 17)
+
+// the state of the usb session that outlives the program, so that a program started by the
+// bootloader continues the session that the bootloader enumerated; it is above the stack at a
+// fixed address, see the linker script, which is zero at power up
+extern struct usb_session {
+    // the bank of the next transaction to handle, the gateware gives the core the banks in turn
+    // so they are handled in the same order
+    uint8_t bank;
+    uint8_t bConfigurationValue;
+} usb_session;
 
 static bool in_control_transfer;
 static struct setup_data setup_data;
 static uint16_t data_bytes_sent;
 
-static uint8_t bConfigurationValue = 0;
-
 static const struct device_descriptor device_descriptor = {
     .bLength = DEVICE_DESCRIPTOR_SIZE,
     .bDescriptorType = DESCRIPTOR_TYPE_DEVICE,
@@ -139,7 +200,7 @@ static const struct device_descriptor device_descriptor = {
 static const struct configuration_descriptor configuration = {
     CONFIGURATION_DESCRIPTOR_SIZE,
     DESCRIPTOR_TYPE_CONFIGURATION,
-    CONFIGURATION_DESCRIPTOR_SIZE + INTERFACE_DESCRIPTOR_SIZE,
+    CONFIGURATION_DESCRIPTOR_SIZE + INTERFACE_DESCRIPTOR_SIZE + 2 * ENDPOINT_DESCRIPTOR_SIZE,
     1,
     1,
     0,
@@ -152,13 +213,44 @@ static const struct interface_descriptor interface = {
     .bDescriptorType = DESCRIPTOR_TYPE_INTERFACE,
     .bInterfaceNumber = 0,
     .bAlternateSetting = 0,
-    .bNumEndpoints = 0,
+    .bNumEndpoints = 2,
     .bInterfaceClass = 0xff, // vendor-specific
     .bInterfaceSubClass = 0xff,
     .bInterfaceProtocol = 0xff, //vendor-specific
     .iInterface = 0,
 };
 
+static const struct endpoint_descriptor bulk_out_endpoint = {
+    .bLength = ENDPOINT_DESCRIPTOR_SIZE,
+    .bDescriptorType = DESCRIPTOR_TYPE_ENDPOINT,
+    .bEndpointAddress = BULK_OUT_ENDPOINT,
+    .bmAttributes = ENDPOINT_TRANSFER_TYPE_BULK,
+    .wMaxPacketSize = MAX_PACKET_SIZE,
+    .bInterval = 0, // ignored for full-speed bulk endpoints
+};
+
+static const struct endpoint_descriptor bulk_in_endpoint = {
+    .bLength = ENDPOINT_DESCRIPTOR_SIZE,
+    .bDescriptorType = DESCRIPTOR_TYPE_ENDPOINT,
+    .bEndpointAddress = ENDPOINT_DIRECTION_IN | BULK_IN_ENDPOINT,
+    .bmAttributes = ENDPOINT_TRANSFER_TYPE_BULK,
+    .wMaxPacketSize = MAX_PACKET_SIZE,
+    .bInterval = 0,
+};
+
+// the descriptors returned for a configuration descriptor request, in order
+static const struct {
+    const void* descriptor;
+    uint8_t size;
+} configuration_descriptors[] = {
+    { &configuration, CONFIGURATION_DESCRIPTOR_SIZE },
+    { &interface, INTERFACE_DESCRIPTOR_SIZE },
+    { &bulk_out_endpoint, ENDPOINT_DESCRIPTOR_SIZE },
+    { &bulk_in_endpoint, ENDPOINT_DESCRIPTOR_SIZE },
+};
+#define CONFIGURATION_DESCRIPTOR_COUNT \
+    (sizeof(configuration_descriptors) / sizeof(configuration_descriptors[0]))
+
 struct response {
     enum response_type {
         // tells the gateware there is no data to send and the buffer can be written with new data
@@ -175,14 +267,15 @@ struct response {
 #define RESPONSE_DATA(LENGTH) ((struct response){ RESPONSE_TYPE_DATA, LENGTH })
 #define RESPONSE_STALL ((struct response){ RESPONSE_TYPE_STALL, 0 })
 
-#define BULK_READ_BUFFER_LENGTH 64
-struct bulk_read_ring_buffer {
+// the ring buffer length must be a power of two
+#define BULK_WRITE_BUFFER_LENGTH 512
+struct bulk_write_ring_buffer {
     const size_t length;
     atomic_size_t read_index;
     atomic_size_t write_index;
-    uint8_t buffer[BULK_READ_BUFFER_LENGTH];
-} bulk_read_ring_buffer = {
-    BULK_READ_BUFFER_LENGTH,
+    uint8_t buffer[BULK_WRITE_BUFFER_LENGTH];
+} bulk_write_ring_buffer = {
+    BULK_WRITE_BUFFER_LENGTH,
     0,
     0,
 };
@@ -194,8 +287,8 @@ static struct response send_device_descriptor() {
     const uint16_t bytes_to_send_this_packet =
         min(total_transaction_bytes - data_bytes_sent, MAX_PACKET_SIZE);
 
-    memcpy(
-        usb_data_buffer,
+    dma_copy(
+        usb_data_buffer[usb_session.bank],
         (const uint8_t*)&device_descriptor + data_bytes_sent,
         bytes_to_send_this_packet
     );
@@ -204,26 +297,32 @@ static struct response send_device_descriptor() {
 }
 
 static struct response send_configuration() {
-    // send configuration and interface descriptors
+    // send configuration, interface and endpoint descriptors
     const uint16_t total_transaction_bytes = min(setup_data.wLength, configuration.wTotalLength);
     assert(data_bytes_sent <= total_transaction_bytes);
     const uint16_t bytes_to_send_this_packet =
         min(total_transaction_bytes - data_bytes_sent, MAX_PACKET_SIZE);
 
-    const uint16_t configuration_bytes_to_send = data_bytes_sent < CONFIGURATION_DESCRIPTOR_SIZE
-        ? min(bytes_to_send_this_packet, CONFIGURATION_DESCRIPTOR_SIZE - data_bytes_sent)
-        : 0;
-    const uint8_t interface_bytes_to_send = bytes_to_send_this_packet - configuration_bytes_to_send;
-    memcpy(
-        usb_data_buffer,
-        (const uint8_t*)&configuration + data_bytes_sent,
-        configuration_bytes_to_send
-    );
-    memcpy(
-        usb_data_buffer + configuration_bytes_to_send,
-        (const uint8_t*)&interface + (INTERFACE_DESCRIPTOR_SIZE - interface_bytes_to_send),
-        interface_bytes_to_send
-    );
+    // copy the part of each descriptor that overlaps with the bytes to send
+    const uint16_t packet_start = data_bytes_sent;
+    const uint16_t packet_end = data_bytes_sent + bytes_to_send_this_packet;
+    uint16_t descriptor_start = 0;
+    for (size_t i = 0; i < CONFIGURATION_DESCRIPTOR_COUNT; i++) {
+        const uint16_t descriptor_end = descriptor_start + configuration_descriptors[i].size;
+        if (descriptor_end > packet_start && descriptor_start < packet_end) {
+            const uint16_t copy_start =
+                descriptor_start > packet_start ? descriptor_start : packet_start;
+            const uint16_t copy_end = descriptor_end < packet_end ? descriptor_end : packet_end;
+            dma_copy(
+                usb_data_buffer[usb_session.bank] + (copy_start - packet_start),
+                (const uint8_t*)configuration_descriptors[i].descriptor
+                    + (copy_start - descriptor_start),
+                copy_end - copy_start
+            );
+        }
+        descriptor_start = descriptor_end;
+    }
+
     data_bytes_sent += bytes_to_send_this_packet;
     return RESPONSE_DATA(bytes_to_send_this_packet);
 }
@@ -239,12 +338,11 @@ static struct response send_descriptor() {
     }
 }
 
-static struct response
-make_default_control_endpoint_response(enum transaction transaction, uint16_t data_length) {
+static struct response make_default_control_endpoint_response(enum transaction transaction) {
     if (transaction == TRANSACTION_SETUP) {
         in_control_transfer = true;
         // TODO consider whether I need all the data
-        setup_data = *(struct setup_data*)usb_data_buffer;
+        setup_data = *(struct setup_data*)usb_data_buffer[usb_session.bank];
     }
 
     switch (setup_data.bRequest) {
@@ -267,7 +365,9 @@ make_default_control_endpoint_response(enum transaction transaction, uint16_t da
             switch (transaction) {
                 case TRANSACTION_SETUP:
                     if (setup_data.wValue <= 1) {
-                        bConfigurationValue = setup_data.wValue;
+                        usb_session.bConfigurationValue = setup_data.wValue;
+                        // configuring an endpoint always resets its data toggle
+                        usb_reset_data_toggles = 1 << BULK_OUT_ENDPOINT | 1 << BULK_IN_ENDPOINT;
                         return RESPONSE_DATA(0);
                     } else {
                         return RESPONSE_STALL;
@@ -289,7 +389,7 @@ make_default_control_endpoint_response(enum transaction transaction, uint16_t da
         case BREQUEST_GET_CONFIGURATION:
             switch (transaction) {
                 case TRANSACTION_SETUP:
-                    usb_data_buffer[0] = bConfigurationValue;
+                    usb_data_buffer[usb_session.bank][0] = usb_session.bConfigurationValue;
                     return RESPONSE_DATA(1);
                 case TRANSACTION_IN:
                     return RESPONSE_EMPTY;
@@ -315,16 +415,16 @@ make_default_control_endpoint_response(enum transaction transaction, uint16_t da
                 case TRANSACTION_SETUP:
                     switch (setup_data.bmRequestType & 0b11) {
                         case 0b00: // device
-                            usb_data_buffer[0] = 0;
-                            usb_data_buffer[1] = 0;
+                            usb_data_buffer[usb_session.bank][0] = 0;
+                            usb_data_buffer[usb_session.bank][1] = 0;
                             return RESPONSE_DATA(2);
                         case 0b01: // interface
-                            usb_data_buffer[0] = 0;
-                            usb_data_buffer[1] = 0;
+                            usb_data_buffer[usb_session.bank][0] = 0;
+                            usb_data_buffer[usb_session.bank][1] = 0;
                             return RESPONSE_DATA(2);
                         case 0b10: // endpoint
-                            usb_data_buffer[0] = 0;
-                            usb_data_buffer[1] = 0;
+                            usb_data_buffer[usb_session.bank][0] = 0;
+                            usb_data_buffer[usb_session.bank][1] = 0;
                             return RESPONSE_DATA(2);
                         default:
                             return RESPONSE_STALL;
@@ -338,27 +438,34 @@ make_default_control_endpoint_response(enum transaction transaction, uint16_t da
         case BREQUEST_SYNCH_FRAME:
             return RESPONSE_STALL;
 
-        // custom transfers
-        case BREQUEST_CUSTOM_OUT:
-            switch (transaction) {
-                case TRANSACTION_SETUP:
-                    return RESPONSE_EMPTY;
-                case TRANSACTION_OUT:
-                    const size_t bytes_written = ring_buffer_write(
-                        (struct ring_buffer*)&bulk_read_ring_buffer,
-                        usb_data_buffer,
-                        data_length
-                    );
-                    if (bytes_written == data_length) {
-                        return RESPONSE_DATA(0);
-                    } else {
-                        return RESPONSE_STALL;
-                    }
-                case TRANSACTION_IN:
-                    in_control_transfer = false;
-                    return RESPONSE_EMPTY;
-            }
+        default:
+            return RESPONSE_STALL;
+    }
+}
 
+// the number of bytes from bulk_write_ring_buffer in usb_data_buffer if the last
+// response was data for the bulk IN endpoint, otherwise 0
+static uint16_t bulk_in_staged_length;
+
+static struct response
+make_bulk_in_endpoint_response(enum transaction transaction, uint16_t staged_length) {
+    switch (transaction) {
+        case TRANSACTION_IN:
+            // the gateware only interrupts after an IN that sent data once the
+            // host acknowledged it, otherwise the IN was NAKed because there
+            // was no data ready; the host polls IN so keep data ready if there
+            // is any
+            ring_buffer_consume((struct ring_buffer*)&bulk_write_ring_buffer, staged_length);
+            bulk_in_staged_length = ring_buffer_peek_dma(
+                (struct ring_buffer*)&bulk_write_ring_buffer,
+                usb_data_buffer[usb_session.bank],
+                MAX_PACKET_SIZE
+            );
+            if (bulk_in_staged_length > 0) {
+                return RESPONSE_DATA(bulk_in_staged_length);
+            } else {
+                return RESPONSE_EMPTY;
+            }
         default:
             return RESPONSE_STALL;
     }
@@ -371,19 +478,25 @@ static struct response make_usb_response(const uint32_t usb_control_copy) {
     const uint16_t data_length = usb_control_copy & 0x3ff;
     assert(data_length <= USB_DATA_BUFFER_LENGTH);
 
+    // any transaction other than an IN on the bulk IN endpoint overwrote the
+    // staged data, it stays in bulk_write_ring_buffer until it is acknowledged
+    const uint16_t staged_length = bulk_in_staged_length;
+    bulk_in_staged_length = 0;
+
+    // OUT transactions on the bulk OUT endpoint go to the out fifo and never get here
     uint8_t endpoint = (usb_control_copy >> 12) & 0xf;
-    // at one point I had another endpoint so keep this as a switch if I add an endpoint later
     switch (endpoint) {
         case 0:
-            return make_default_control_endpoint_response(transaction, data_length);
+            return make_default_control_endpoint_response(transaction);
+        case BULK_IN_ENDPOINT:
+            return make_bulk_in_endpoint_response(transaction, staged_length);
         default:
             return RESPONSE_STALL;
     }
 }
 
-void handle_usb_transaction() {
-    const struct response response = make_usb_response(usb_control);
-    uint32_t result_usb_control = response.type << 10;
+static void write_usb_response(const struct response response, uint8_t endpoint) {
+    uint32_t result_usb_control = endpoint << 12 | response.type << 10;
     if (response.type == RESPONSE_TYPE_DATA) {
         result_usb_control |= response.data_length & 0x3ff;
     }
@@ -392,5 +505,68 @@ void handle_usb_transaction() {
     // to usb_data_buffer
     __asm__ volatile ("" : : : "memory");
     
-    usb_control = result_usb_control;
+    usb_control[usb_session.bank] = result_usb_control;
+    usb_session.bank = (usb_session.bank + 1) % USB_DATA_BUFFER_BANKS;
+}
+
+uint16_t next_usb_control() {
+    return usb_control[usb_session.bank];
+}
+
+void handle_usb_transaction() {
+    const uint16_t usb_control_copy = usb_control[usb_session.bank];
+    const struct response response = make_usb_response(usb_control_copy);
+    write_usb_response(response, (usb_control_copy >> 12) & 0xf);
+}
+
+size_t usb_read(uint8_t* out_buffer, size_t max_size) {
+    // the gateware only adds to the fifo, so at least this many bytes can be popped
+    const size_t available = usb_out_fifo_count;
+    const size_t bytes_read = available < max_size ? available : max_size;
+
+    size_t offset = 0;
+    for (; offset + 4 <= bytes_read; offset += 4) {
+        const uint32_t word = usb_out_fifo_data;
+        memcpy(out_buffer + offset, &word, 4);
+    }
+    for (; offset < bytes_read; offset++) {
+        out_buffer[offset] = usb_out_fifo_data_byte;
+    }
+
+    return bytes_read;
+}
+
+size_t usb_read_available() {
+    return usb_out_fifo_count;
+}
+
+void usb_set_read_threshold(size_t bytes) {
+    usb_out_fifo_threshold = bytes;
+}
+
+void wait_for_usb_data() {
+    // like dma_copy, the interrupt only wakes the wfi
+    const uint32_t threshold = usb_out_fifo_threshold;
+    uint32_t mie;
+    usb_out_fifo_threshold = 1;
+    __asm__ volatile("csrrs %0, mie, %1" : "=r"(mie) : "r"(MIE_USB_OUT_FIFO_IE));
+    wait_for_interrupt();
+    if (!(mie & MIE_USB_OUT_FIFO_IE)) {
+        __asm__ volatile("csrc mie, %0" : : "r"(MIE_USB_OUT_FIFO_IE));
+    }
+    usb_out_fifo_threshold = threshold;
+}
+
+[[gnu::weak]] void on_usb_out_fifo_interrupt() {
+    __asm__ volatile("csrc mie, %0" : : "r"(MIE_USB_OUT_FIFO_IE));
+}
+
+size_t usb_write(const uint8_t* in_buffer, size_t size) {
+    // sent once the host polls the bulk IN endpoint
+    return ring_buffer_write((struct ring_buffer*)&bulk_write_ring_buffer, in_buffer, size);
+}
+
+size_t usb_write_pending() {
+    // the bytes stay in the ring buffer until the IN that sent them is acknowledged
+    return bulk_write_ring_buffer.write_index - atomic_load(&bulk_write_ring_buffer.read_index);
 }
@@ -1,12 +1,25 @@
 /* This program takes an ELF binary and generates data suitable for loading
  * onto the processor
  *
- * ouputs files:
+ * ouputs files, each optional except for the entry point:
  *     memory_image: the initial memory image of the processor
+ *     memory_low_hex, memory_high_hex: the low and high halves of each word
+ *         of the memory image for $readmemh, see memory_low and memory_high in
+ *         cpu/top.v
+ *     external_memory_image: the initial image of the external memory, from
+ *         its start address
+ *     external_memory_hex: the words of the external memory image for
+ *         $readmemh, see cpu/external_memory.v
  *     entry_point: the initial value of the program counter
+ *
+ * the hex files are sparse: each run of loaded words starts with an @ record
+ * of its word index, and the gaps between the runs are left out since the
+ * memories start zeroed
  */
 
 use std::fs::File;
+use std::io::BufWriter;
+use std::io::Read;
 use std::io::Write;
 
 use clap::Parser;
@@ -15,13 +28,110 @@ use elf::abi::PT_LOAD;
 use elf::endian::LittleEndian;
 use elf::ElfBytes;
 
+// see ADDRESS_EXTERNAL_MEMORY in cpu/top.v
+const EXTERNAL_MEMORY_ADDRESS: u32 = 0x40000000;
+
+// the loaded bytes of a memory in runs of whole words, in order of address,
+// with zeros between the runs
+struct Image {
+    start_address: u32,
+    runs: Vec<Run>,
+}
+
+struct Run {
+    // from the start address, a multiple of 4
+    offset: u32,
+    bytes: Vec<u8>,
+}
+
+impl Image {
+    fn new(start_address: u32) -> Image {
+        Image {
+            start_address,
+            runs: Vec::new(),
+        }
+    }
+
+    // segments are added in order of address, the .bss part of a segment,
+    // past its data, is zeros
+    fn add_segment(&mut self, address: u32, data: &[u8], memory_size: u32) {
+        let offset = address - self.start_address;
+        let start = offset & !3;
+        let end = (offset + memory_size).next_multiple_of(4);
+
+        // segments that share a word, or are next to each other, go in the
+        // same run
+        if !matches!(self.runs.last(), Some(run) if start <= run.end()) {
+            self.runs.push(Run {
+                offset: start,
+                bytes: Vec::new(),
+            });
+        }
+        let run = self.runs.last_mut().unwrap();
+        assert!(offset >= run.offset);
+        let length = (end - run.offset) as usize;
+        if run.bytes.len() < length {
+            run.bytes.resize(length, 0);
+        }
+        let data_start = (offset - run.offset) as usize;
+        run.bytes[data_start..data_start + data.len()].copy_from_slice(data);
+    }
+
+    fn write_binary(&self, path: &str) {
+        let mut writer = create(path);
+        let mut offset = 0;
+        for run in &self.runs {
+            let zeros = run.offset - offset;
+            std::io::copy(&mut std::io::repeat(0).take(zeros.into()), &mut writer).unwrap();
+            writer.write_all(&run.bytes).unwrap();
+            offset = run.end();
+        }
+        writer.flush().unwrap();
+    }
+
+    // writes value(word) for each little endian word of the runs
+    fn write_hex(&self, path: &str, value: impl Fn(u32) -> u32) {
+        let mut writer = create(path);
+        for run in &self.runs {
+            writeln!(writer, "@{:x}", run.offset / 4).unwrap();
+            for word in run.bytes.chunks_exact(4) {
+                let word = u32::from_le_bytes(word.try_into().unwrap());
+                writeln!(writer, "{:x}", value(word)).unwrap();
+            }
+        }
+        writer.flush().unwrap();
+    }
+}
+
+impl Run {
+    fn end(&self) -> u32 {
+        self.offset + u32::try_from(self.bytes.len()).unwrap()
+    }
+}
+
+fn create(path: &str) -> BufWriter<File> {
+    BufWriter::new(File::create(path).unwrap())
+}
+
 #[derive(Parser)]
 struct Args {
     /// input ELF file
     elf: String,
     /// path of the memory image output file
     #[arg(short = 'o', long = "memory")]
-    memory_image: String,
+    memory_image: Option<String>,
+    /// path of the hex file of the low halves of the memory words
+    #[arg(long = "memory-low-hex")]
+    memory_low_hex: Option<String>,
+    /// path of the hex file of the high halves of the memory words
+    #[arg(long = "memory-high-hex")]
+    memory_high_hex: Option<String>,
+    /// path of the external memory image output file
+    #[arg(long = "external-memory")]
+    external_memory_image: Option<String>,
+    /// path of the hex file of the external memory words
+    #[arg(long = "external-memory-hex")]
+    external_memory_hex: Option<String>,
     /// path of the entry point ouptup file
     #[arg(long = "entry")]
     entry_point: String,
@@ -34,20 +144,11 @@ fn main() {
     let elf = ElfBytes::<LittleEndian>::minimal_parse(&file_data).unwrap();
     let elf_header = elf.ehdr;
 
-    let mut entry_point_file = File::create(args.entry_point).unwrap();
     let entry_address: u32 = elf_header.e_entry.try_into().unwrap();
-    entry_point_file
-        .write(entry_address.to_string().as_bytes())
-        .unwrap();
-    drop(entry_point_file);
-
-    let mut memory_image_file = File::create(args.memory_image).unwrap();
-    let mut memory_offset: u32 = 0;
+    std::fs::write(args.entry_point, entry_address.to_string()).unwrap();
 
-    let mut write = |bytes: &[u8], offset: &mut u32| {
-        memory_image_file.write_all(bytes).unwrap();
-        *offset += u32::try_from(std::mem::size_of_val(bytes)).unwrap();
-    };
+    let mut memory_image = Image::new(0);
+    let mut external_memory_image = Image::new(EXTERNAL_MEMORY_ADDRESS);
 
     let program_headers = elf.segments().unwrap();
 
@@ -56,20 +157,31 @@ fn main() {
         .filter(|header| header.p_type == PT_LOAD)
     {
         let destination_address: u32 = program_header.p_vaddr.try_into().unwrap();
-        assert!(destination_address >= memory_offset);
-
-        let pad_amount: u32 = destination_address - memory_offset;
-        for _ in 0..pad_amount {
-            write(&[0], &mut memory_offset);
-        }
-
-        let segment_data = &elf.segment_data(&program_header).unwrap();
-        write(segment_data, &mut memory_offset);
+        let image = if destination_address >= EXTERNAL_MEMORY_ADDRESS {
+            &mut external_memory_image
+        } else {
+            &mut memory_image
+        };
+        image.add_segment(
+            destination_address,
+            &elf.segment_data(&program_header).unwrap(),
+            u32::try_from(program_header.p_memsz).unwrap(),
+        );
+    }
 
-        let additional_zeros = u32::try_from(program_header.p_memsz).unwrap()
-            - u32::try_from(segment_data.len()).unwrap();
-        for _ in 0..additional_zeros {
-            write(&[0], &mut memory_offset);
-        }
+    if let Some(path) = &args.memory_image {
+        memory_image.write_binary(path);
+    }
+    if let Some(path) = &args.memory_low_hex {
+        memory_image.write_hex(path, |word| word & 0xffff);
+    }
+    if let Some(path) = &args.memory_high_hex {
+        memory_image.write_hex(path, |word| word >> 16);
+    }
+    if let Some(path) = &args.external_memory_image {
+        external_memory_image.write_binary(path);
+    }
+    if let Some(path) = &args.external_memory_hex {
+        external_memory_image.write_hex(path, |word| word);
     }
 }
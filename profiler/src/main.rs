@@ -0,0 +1,205 @@
+/* This program reads the trace written by the simulation with +profile=<file>,
+ * see cpu/csrs.v, and reports the cycles, instructions and cycles per
+ * instruction spent in each function of the simulated ELF binary
+ *
+ * the call stack is reconstructed from the calls, returns and traps in the
+ * trace, so it can be wrong for code that manipulates the return address
+ *
+ * ouputs files:
+ *     folded (optional): the cycles spent in each call stack, in the folded
+ *         stack format read by flamegraph.pl and inferno
+ */
+
+use std::collections::HashMap;
+use std::fs::File;
+use std::io::BufWriter;
+use std::io::Write;
+
+use clap::Parser;
+
+use elf_program::Program;
+
+const MRET: u32 = 0x30200073;
+
+#[derive(Parser)]
+struct Args {
+    /// input ELF file that was simulated
+    elf: String,
+    /// trace written by the simulation
+    trace: String,
+    /// path of the folded call stack output file
+    #[arg(long)]
+    folded: Option<String>,
+}
+
+#[derive(Clone, Copy, Default)]
+struct Counts {
+    cycles: u64,
+    instructions: u64,
+}
+
+// how an instruction changes the call stack when the next instruction
+// retires
+#[derive(Clone, Copy)]
+enum ControlFlow {
+    Sequential,
+    Jump,
+    Call,
+    Return,
+}
+
+// calls and returns are recognized by the use of ra or t0 as the link
+// register, as in the calling convention
+fn control_flow(instruction: u32) -> ControlFlow {
+    let is_link = |register| register == 1 || register == 5;
+    let rd = (instruction >> 7) & 0x1f;
+
+    if instruction & 0b11 != 0b11 {
+        let quadrant = instruction & 0b11;
+        let funct3 = (instruction >> 13) & 0b111;
+        let rs2 = (instruction >> 2) & 0x1f;
+        return match (quadrant, funct3) {
+            (0b01, 0b001) => ControlFlow::Call,                 // c.jal
+            (0b01, 0b101 | 0b110 | 0b111) => ControlFlow::Jump, // c.j, c.beqz, c.bnez
+            (0b10, 0b100) if rs2 == 0 && rd != 0 => {
+                if instruction & (1 << 12) != 0 {
+                    ControlFlow::Call // c.jalr
+                } else if is_link(rd) {
+                    ControlFlow::Return // c.jr ra
+                } else {
+                    ControlFlow::Jump // c.jr
+                }
+            }
+            _ => ControlFlow::Sequential,
+        };
+    }
+
+    let opcode = instruction & 0x7f;
+    let rs1 = (instruction >> 15) & 0x1f;
+    match opcode {
+        0b1101111 if is_link(rd) => ControlFlow::Call, // jal
+        0b1100111 if is_link(rd) => ControlFlow::Call, // jalr
+        0b1100111 if is_link(rs1) => ControlFlow::Return, // jalr
+        0b1101111 | 0b1100111 | 0b1100011 => ControlFlow::Jump,
+        _ if instruction == MRET => ControlFlow::Return,
+        _ => ControlFlow::Sequential,
+    }
+}
+
+fn main() {
+    let args = Args::parse();
+
+    let program = Program::parse(&std::fs::read(args.elf).unwrap()).unwrap();
+    let trace = std::fs::read(args.trace).unwrap();
+
+    // the last entry is for addresses outside of any function
+    let mut counts = vec![Counts::default(); program.functions.len() + 1];
+    let mut stack_cycles: HashMap<Vec<usize>, u64> = HashMap::new();
+    // the top of the stack is always the function executing in the current
+    // cycle
+    let mut stack: Vec<usize> = Vec::new();
+    // the address, control flow and length of the last retired instruction,
+    // applied to the stack when the next instruction retires
+    let mut last_retired: Option<(u32, ControlFlow, u32)> = None;
+
+    for word in trace.chunks_exact(4) {
+        let word = u32::from_le_bytes(word.try_into().unwrap());
+        let address = word & !1;
+        let retired = word & 1 != 0;
+        let function = program.function_index(address);
+
+        if retired {
+            if let Some((last_address, last_control_flow, last_length)) = last_retired {
+                match last_control_flow {
+                    ControlFlow::Call => stack.push(function),
+                    ControlFlow::Return => {
+                        if stack.len() > 1 {
+                            stack.pop();
+                        }
+                    }
+                    ControlFlow::Jump => {}
+                    ControlFlow::Sequential => {
+                        // otherwise the instruction trapped or was
+                        // interrupted
+                        if address != last_address.wrapping_add(last_length) {
+                            stack.push(function);
+                        }
+                    }
+                }
+            }
+
+            let instruction = program.instruction(address);
+            last_retired = Some((
+                address,
+                instruction.map_or(ControlFlow::Sequential, control_flow),
+                instruction.map_or(4, elf_program::length),
+            ));
+            counts[function].instructions += 1;
+        }
+
+        match stack.last_mut() {
+            Some(top) => *top = function,
+            None => stack.push(function),
+        }
+        counts[function].cycles += 1;
+        if let Some(cycles) = stack_cycles.get_mut(&stack) {
+            *cycles += 1;
+        } else {
+            stack_cycles.insert(stack.clone(), 1);
+        }
+    }
+
+    let total_cycles: u64 = counts.iter().map(|counts| counts.cycles).sum();
+    let total_instructions: u64 = counts.iter().map(|counts| counts.instructions).sum();
+
+    let mut sorted: Vec<(usize, Counts)> = counts
+        .iter()
+        .copied()
+        .enumerate()
+        .filter(|(_, counts)| counts.cycles != 0)
+        .collect();
+    sorted.sort_by_key(|(_, counts)| std::cmp::Reverse(counts.cycles));
+
+    println!(
+        "{:>12} {:>7} {:>12} {:>7}  function",
+        "cycles", "%", "instructions", "cpi"
+    );
+    for (index, counts) in sorted {
+        println!(
+            "{:>12} {:>7.2} {:>12} {:>7}  {}",
+            counts.cycles,
+            counts.cycles as f64 * 100.0 / total_cycles as f64,
+            counts.instructions,
+            cycles_per_instruction(counts),
+            program.function_name(index)
+        );
+    }
+    println!(
+        "{:>12} {:>7.2} {:>12} {:>7}  total",
+        total_cycles,
+        100.0,
+        total_instructions,
+        cycles_per_instruction(Counts {
+            cycles: total_cycles,
+            instructions: total_instructions
+        })
+    );
+
+    if let Some(folded) = args.folded {
+        let mut folded_file = BufWriter::new(File::create(folded).unwrap());
+        for (stack, cycles) in &stack_cycles {
+            let names: Vec<&str> = stack
+                .iter()
+                .map(|&index| program.function_name(index))
+                .collect();
+            writeln!(folded_file, "{} {}", names.join(";"), cycles).unwrap();
+        }
+    }
+}
+
+fn cycles_per_instruction(counts: Counts) -> String {
+    if counts.instructions == 0 {
+        return "-".to_string();
+    }
+    format!("{:.2}", counts.cycles as f64 / counts.instructions as f64)
+}
@@ -1,7 +1,12 @@
+`ifdef CPP_HARNESS
+// cpu/sim_main.cpp drives the clock, see harness in top.mk
+module tb_top(input clock);
+`else
 module tb_top;
     
     reg clock = 0;
     always #10.4166667ns clock <= ~clock; // 48 mhz
+`endif
     wire usb_d_p, usb_d_n, usb_pullup, r, g, b, null;
     top top(
         clock,
@@ -1,3 +1,15 @@
 #!/bin/bash
+# runs every test on both cores; with --fast the simulations are built with
+# sim-fast, and the cpu tests with the c++ harness, see top.mk
+#
+# usage: ./test.sh [--fast]
 
-make -C tests/cpu sim && make -C tests/usb test
+if [ "$1" = --fast ]; then
+    fast_options="fast=1"
+    cpu_options="fast=1 harness=cpp"
+fi
+
+make -C tests/cpu test $cpu_options \
+    && make -C tests/cpu test core=pipelined $cpu_options \
+    && make -C tests/usb test $fast_options \
+    && make -C tests/usb test core=pipelined $fast_options
@@ -1,7 +1,14 @@
+# the tests are written assuming 32 bit instructions, compressed instructions
+# are only tested where they are enabled below
+.option norvc
 
 string:
 .ascii "hello"
 
+# the load and store test below overwrites the start of string
+dma_string:
+.ascii "hello"
+
 .align 4
 bad_instruction:
 .4byte 0xFFFFFFFF
@@ -66,6 +73,105 @@ _start:
     lbu t1, (t0)
     bne t1, a0, fail
 
+    # test multiply and divide
+    li t0, -7
+    li t1, 3
+    mul t2, t0, t1
+    li t3, -21
+    bne t2, t3, fail
+    mulh t2, t0, t1
+    li t3, -1
+    bne t2, t3, fail
+    mulhu t2, t0, t1
+    li t3, 2
+    bne t2, t3, fail
+    mulhsu t2, t0, t1
+    li t3, -1
+    bne t2, t3, fail
+    div t2, t0, t1
+    li t3, -2
+    bne t2, t3, fail
+    rem t2, t0, t1
+    li t3, -1
+    bne t2, t3, fail
+    divu t2, t0, t1
+    li t3, 0x55555553
+    bne t2, t3, fail
+    remu t2, t0, t1
+    li t3, 0
+    bne t2, t3, fail
+    # division by zero
+    div t2, t0, zero
+    li t3, -1
+    bne t2, t3, fail
+    rem t2, t0, zero
+    bne t2, t0, fail
+    # signed overflow
+    li t0, 0x80000000
+    li t1, -1
+    div t2, t0, t1
+    bne t2, t0, fail
+    rem t2, t0, t1
+    bne t2, zero, fail
+
+    # test bit manipulation instructions
+    li t0, 0x00f0ff00
+    li t1, 0x0000ffff
+    andn t2, t0, t1
+    li t3, 0x00f00000
+    bne t2, t3, fail
+    clz t2, t0
+    li t3, 8
+    bne t2, t3, fail
+    ctz t2, t0
+    bne t2, t3, fail
+    cpop t2, t0
+    li t3, 12
+    bne t2, t3, fail
+    rev8 t2, t0
+    li t3, 0x00fff000
+    bne t2, t3, fail
+    orc.b t2, t0
+    li t3, 0x00ffff00
+    bne t2, t3, fail
+    li t1, -1
+    min t2, t0, t1
+    bne t2, t1, fail
+    minu t2, t0, t1
+    bne t2, t0, fail
+    sext.b t2, t1
+    bne t2, t1, fail
+    zext.h t2, t1
+    li t3, 0xffff
+    bne t2, t3, fail
+    rori t2, t0, 8
+    li t3, 0x0000f0ff
+    bne t2, t3, fail
+    li t1, 3
+    sh2add t2, t1, t0
+    li t3, 0x00f0ff0c
+    bne t2, t3, fail
+
+    # test compressed instructions
+    .option push
+    .option rvc
+    .align 2
+    c.li a0, 5
+    addi a0, a0, 1000 # a 32 bit instruction that is not 32 bit aligned
+    c.mv a1, a0
+    c.addi a1, -5
+    li a2, 1000
+    bne a1, a2, fail
+    c.jal compressed_call
+compressed_call_return:
+    c.j compressed_done
+compressed_call:
+    la a3, compressed_call_return
+    bne ra, a3, fail
+    c.jr ra
+compressed_done:
+    .option pop
+
     # test csr's
     li x1, 0
     csrrw x1, misa, x0
@@ -95,6 +201,16 @@ _start:
     li x2, 3
     bne x1, x2, fail
 
+    # test performance counters
+    li t0, 2 # taken branches
+    csrrw zero, mhpmevent3, t0
+    csrrw zero, mhpmcounter3, zero
+    beq zero, zero, performance_counter_branch
+performance_counter_branch:
+    csrrs t1, mhpmcounter3, zero
+    li t2, 1
+    bne t1, t2, fail
+
     li x3, 0
     li x2, 0x80000000
     sw x0, 0(x2)
@@ -131,6 +247,155 @@ _start:
     li t0, 0xFFFFFFFF
     csrrc zero, mie, t0
 
+    # test vectored interrupts; the handler runs in the shadow register bank
+    # and leaves the timer interrupt pending the first time so that its mret
+    # enters it again. it also takes an ecall, whose handler runs in the shadow
+    # bank too and returns to it, before the handler returns to the base bank
+    la t0, vector_table + 1 # vectored mode
+    csrrw zero, mtvec, t0
+    csrrs t1, mtvec, zero
+    bne t0, t1, fail
+    la t0, scratch
+    sw zero, 0(t0)
+    li s1, 0x12345678
+    li s6, 0
+    li x1, 0x80000008 # mtimercmp
+    sw zero, 0(x1)
+    li x2, 0x8000000c # mtimercmph
+    sw zero, 0(x2)
+    li t0, 0b10000000 # timer interrupt
+    csrrs zero, mie, t0
+    li t0, 0b1000
+    # this should result in two timer interrupts
+    csrrs zero, mstatus, t0
+    li t0, 0x12345678
+    bne s1, t0, fail
+    bnez s6, fail
+    la t0, scratch
+    lw t1, 0(t0)
+    li t2, 2
+    bne t1, t2, fail
+    li t0, 0xFFFFFFFF
+    csrrc zero, mie, t0
+    lui a0, %hi(trap)
+    addi a0, a0, %lo(trap)
+    csrrw x0, mtvec, a0
+
+    # test wfi; with interrupts disabled in mstatus it waits until the timer
+    # interrupt is pending and then continues within a fixed number of cycles
+    li t0, 0b1000
+    csrrc zero, mstatus, t0
+    li t0, 0b10000000 # timer interrupt
+    csrrs zero, mie, t0
+    li t1, 0x80000000 # mtime
+    lw t2, 0(t1)
+    addi t2, t2, 100
+    sw t2, 8(t1) # mtimecmp
+    sw zero, 12(t1) # mtimecmph
+    wfi
+    lw t3, 0(t1)
+    sub t3, t3, t2
+    bltz t3, fail # woke up early
+    li t4, 8 # wakeup latency in cycles
+    bge t3, t4, fail
+
+    # with interrupts enabled the interrupt is taken and returns after the wfi
+    # instead of waiting again
+    li x31, 0
+    lw t2, 0(t1)
+    addi t2, t2, 100
+    sw t2, 8(t1) # mtimecmp
+    li t0, 0b1000
+    csrrs zero, mstatus, t0
+    wfi
+    li t0, 1
+    bne x31, t0, fail
+    li t0, 0xFFFFFFFF
+    csrrc zero, mie, t0
+
+    # test the dma engine with a copy between different alignments
+    la t0, scratch
+    sw zero, 0(t0)
+    sw zero, 4(t0)
+    li t2, 0x80000020 # dma source
+    la t1, dma_string + 1
+    sw t1, 0(t2)
+    addi t1, t0, 2
+    sw t1, 4(t2) # dma destination
+    li t1, 3
+    sw t1, 8(t2) # dma length, starts the copy
+dma_wait:
+    lw t1, 8(t2)
+    bnez t1, dma_wait
+    csrrs t1, mip, zero
+    li t3, 1 << 16 # dma completion interrupt
+    and t1, t1, t3
+    beqz t1, fail
+    lw t1, 0(t0)
+    li t4, 0x6c650000 # "el" in the high bytes
+    bne t1, t4, fail
+    lw t1, 4(t0)
+    li t4, 0x6c # "l" in the low byte
+    bne t1, t4, fail
+    sw zero, 8(t2) # clears the completion interrupt
+    csrrs t1, mip, zero
+    and t1, t1, t3
+    bnez t1, fail
+
+    # a copy to external memory copies nothing and completes at once; the
+    # destination has the same low bits as scratch, which must not change
+    li t1, 0x40000000
+    add t1, t1, t0
+    sw t1, 4(t2) # dma destination
+    li t1, 3
+    sw t1, 8(t2) # dma length
+    lw t1, 8(t2)
+    bnez t1, fail
+    csrrs t1, mip, zero
+    and t1, t1, t3
+    beqz t1, fail
+    lw t1, 0(t0)
+    li t4, 0x6c650000
+    bne t1, t4, fail
+    sw zero, 8(t2)
+
+    # test the usb out fifo registers, the fifo stays empty without a host so
+    # its interrupt isn't pending at any threshold but 0
+    li t2, 0x80000038 # usb out fifo count
+    lw t1, 0(t2)
+    bnez t1, fail
+    li t1, 1
+    sw t1, 4(t2) # usb out fifo threshold
+    lw t3, 4(t2)
+    bne t1, t3, fail
+    csrrs t1, mip, zero
+    li t3, 1 << 17 # usb out fifo interrupt
+    and t1, t1, t3
+    bnez t1, fail
+    sw zero, 4(t2)
+
+    # test the external memory through the caches: a store that misses, a
+    # load that fills the line, a store that updates it, another line at the
+    # same cache index and then the first line again
+    li t0, 0x40001000
+    li t1, 0x12345678
+    sw t1, 0(t0)
+    lw t2, 0(t0)
+    bne t1, t2, fail
+    sb zero, 1(t0)
+    lw t2, 0(t0)
+    li t3, 0x12340078
+    bne t2, t3, fail
+    li t4, 0x40001400 # the same cache index as t0
+    sw t3, 0(t4)
+    lw t2, 0(t4)
+    bne t2, t3, fail
+    lw t2, 0(t0)
+    bne t2, t3, fail
+    call external_code
+    li t0, 107
+    bne a0, t0, fail
+
     li sp, 0x69
     li t0, 289
     sw t0, 0(sp)
@@ -182,9 +447,61 @@ got_unimp_test:
     csrrw zero, mepc, t0
     mret
 
+.align 2
+vector_table:
+    j vectored_exception
+    .rept 6
+    j fail
+    .endr
+    j vectored_timer_interrupt
+
+vectored_timer_interrupt:
+    # s1 and s6 are only changed in the shadow register bank
+    la s1, scratch
+    lw s2, 0(s1)
+    addi s2, s2, 1
+    sw s2, 0(s1)
+    # the ecall overwrites mepc
+    csrrs s5, mepc, zero
+    li s6, 0
+    ecall
+    li s3, 1
+    bne s6, s3, fail # the exception handler didn't run in this bank
+    csrrw zero, mepc, s5
+    li s3, 2
+    bne s2, s3, vectored_timer_interrupt_return
+    li s3, 0xFFFFFFFF
+    li s4, 0x8000000c # mtimercmph
+    sw s3, 0(s4)
+vectored_timer_interrupt_return:
+    mret
+
+vectored_exception:
+    csrrs s3, mcause, zero
+    li s4, 11 # environment call from machine mode
+    bne s3, s4, fail
+    csrrs s3, mepc, zero
+    addi s3, s3, 4
+    csrrw zero, mepc, s3
+    li s6, 1
+    mret
+
 timer_interrupt:
     li x31, 1
     li x30, 0xFFFFFFFF
     li x29, 0x8000000c # mtimercmph
     sw x30, 0(x29)
     mret
+
+.section .dram, "awx"
+.option push
+.option rvc
+.align 4
+external_code:
+    c.li a0, 1
+    .rept 6
+    c.addi a0, 1
+    .endr
+    addi a0, a0, 100 # starts at the end of one cache line and ends in the next
+    c.jr ra
+.option pop
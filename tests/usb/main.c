@@ -0,0 +1,29 @@
+// echoes the bulk OUT endpoint back on the bulk IN endpoint so that tb_usb.v
+// can check both
+#include "lib/cpulib.h"
+#include <assert.h>
+
+int main() {
+    while (true) {
+        uint8_t buffer[64];
+        const size_t bytes_read = usb_read(buffer, sizeof(buffer));
+
+        size_t bytes_written = 0;
+        while (bytes_written < bytes_read) {
+            bytes_written += usb_write(buffer + bytes_written, bytes_read - bytes_written);
+        }
+    }
+}
+
+[[gnu::interrupt]]
+void on_trap() {
+    unsigned int mcause;
+    __asm__("csrrs %0, mcause, zero" : "=r"(mcause));
+    switch (mcause) {
+        case MCAUSE_MACHINE_EXTERNAL_INTERRUPT:
+            handle_usb_transaction();
+            break;
+        default:
+            assert(false);
+    }
+}
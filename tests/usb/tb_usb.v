@@ -4,6 +4,19 @@ localparam FULL_SPEED_PERIOD = 83.3333333ns; // the period of usb full-speed tra
 localparam SYNC_PATTERN = 8'b01010100;
 localparam STDIN = 32'h8000_0000;
 
+// the bus reset and the waits that give the device time to act, shortened with
+// FAST_SIMULATION, see sim-fast in top.mk; the device takes a reset after
+// RESET_CYCLES in usb.v and the firmware responds within microseconds
+`ifdef FAST_SIMULATION
+    localparam RESET_TIME = 10us;
+    localparam SETTLE_TIME = 500us;
+    localparam RETRY_DELAY = 10us;
+`else
+    localparam RESET_TIME = 30ms;
+    localparam SETTLE_TIME = 10ms;
+    localparam RETRY_DELAY = 100us;
+`endif
+
 module tb_usb();
     wire usb_pullup;
 
@@ -12,21 +25,33 @@ module tb_usb();
     tri1 data_wire = write_enable ? output_data : 1'bz;
     tri0 data_n_wire = write_enable ? output_data_n : 1'bz;
     wire end_of_packet = !data_wire && !data_n_wire;
-    reg data_sync_bit_receive = 0;
-    reg data_sync_bit_transmit = 0;
-    wire [3:0] current_data_pid_receive = { data_sync_bit_receive, PID_DATA0[2:0] };
-    wire [3:0] current_data_pid_transmit = { data_sync_bit_transmit, PID_DATA0[2:0] };
+    reg [15:0] data_sync_bits_receive = 0;
+    reg [15:0] data_sync_bits_transmit = 0;
+    wire [3:0] current_data_pid_receive = { data_sync_bits_receive[test_device_endpoint], PID_DATA0[2:0] };
+    wire [3:0] current_data_pid_transmit = { data_sync_bits_transmit[test_device_endpoint], PID_DATA0[2:0] };
 
     wire gpio_1, gpio_2, gpio_3, gpio_4, gpio_5, gpio_6, gpio_7, gpio_8, gpio_9, gpio_10;
 
     reg [7:0] data_list[1023];
     reg [31:0] data_list_length;
+    reg [7:0] input_data[1023];
+    reg [7:0] packet_data[1023];
+    reg [31:0] echoed_bytes;
+    reg [3:0] empty_bulk_in_pid;
 
     reg clock48;
 
     reg [6:0] test_device_address = 0;
     reg [3:0] test_device_endpoint = 0;
 
+    // with +stress=<transactions> the testbench drives that many random
+    // transactions back to back after enumeration instead of streaming stdin
+    // to the bulk OUT endpoint, with benchmarks/usb-stress echoing the bulk OUT
+    // endpoint on the bulk IN endpoint; see run_stress
+    reg [31:0] stress_transactions = 0;
+    reg verbose = 1;
+    realtime retry_delay = RETRY_DELAY; // between retries of a transaction after a NAK
+
     wire r, g, b, null;
     top top(
         clock48,
@@ -50,21 +75,24 @@ module tb_usb();
     );
 
     initial begin
-        reg [31:0] bytes_read = $fread(data_list, STDIN);
+        reg [31:0] bytes_read = 0;
+        if (!$value$plusargs("stress=%d", stress_transactions)) begin
+            bytes_read = $fread(input_data, STDIN);
+        end
 
         // reset
         write_enable = 1;
         output_data = 0;
         output_data_n = 0;
-        #30ms
+        #RESET_TIME
         write_enable = 0;
 
         // idle
-        #10ms
+        #SETTLE_TIME
 
         $display("tb_usb.v: set device address");
         set_device_address(1);
-        #10ms // give some time for the device to change address; this is in
+        #SETTLE_TIME // give some time for the device to change address; this is in
               // place of the correct thing to do here which would be to retry
               // until the device responds
 
@@ -113,6 +141,15 @@ module tb_usb();
         if (data_list[1] != DESCRIPTOR_TYPE_CONFIGURATION) $stop;
         if (data_list[2] <= 9) $stop;
         if (data_list[9] != 9) $stop;
+        if (data_list[13] != 2) $stop; // number of endpoints of the interface
+        if (data_list[18] != 7) $stop;
+        if (data_list[19] != DESCRIPTOR_TYPE_ENDPOINT) $stop;
+        if (data_list[20] != 8'h01) $stop; // endpoint 1, OUT
+        if (data_list[21] != 8'b10) $stop; // bulk
+        if (data_list[25] != 7) $stop;
+        if (data_list[26] != DESCRIPTOR_TYPE_ENDPOINT) $stop;
+        if (data_list[27] != 8'h82) $stop; // endpoint 2, IN
+        if (data_list[28] != 8'b10) $stop; // bulk
 
         do_control_transfer(
             8'b00000000,
@@ -135,16 +172,59 @@ module tb_usb();
         if (data_list_length != 1) $stop;
         if (data_list[0] != 1) $stop;
 
-        do_control_transfer(
-            8'b00000000,
-            13,
-            0,
-            0,
-            1,
-            data_list,
-            data_list_length
-        );
-        #10ms
+        #SETTLE_TIME
+
+        if (stress_transactions != 0) begin
+            run_stress(stress_transactions);
+            $finish;
+        end
+
+        $display("tb_usb.v: bulk in from endpoint 2 with nothing to send");
+        test_device_endpoint = 2;
+        send_token_packet(PID_IN);
+        receive_handshake(empty_bulk_in_pid);
+        if (empty_bulk_in_pid != PID_NAK) begin
+            $display("got pid 0b%b instead of NAK for bulk in with nothing to send", empty_bulk_in_pid);
+            $stop;
+        end
+        test_device_endpoint = 0;
+
+        // twice so that the echo comes back with both data toggles
+        for (reg [31:0] round = 0; round < 2; round = round + 1) begin
+            $display("tb_usb.v: bulk out to endpoint 1");
+            test_device_endpoint = 1;
+            for (reg [31:0] i = 0; i < bytes_read; i = i + 64) begin
+                for (reg [31:0] j = 0; j < 64 && i + j < bytes_read; j = j + 1) begin
+                    packet_data[j] = input_data[i + j];
+                end
+                do_bulk_out_transaction(
+                    packet_data,
+                    bytes_read - i < 64 ? bytes_read - i : 64,
+                    current_data_pid_transmit
+                );
+            end
+
+            // tests/usb/main.c echoes the data on endpoint 2
+            $display("tb_usb.v: bulk in of the echo from endpoint 2");
+            test_device_endpoint = 2;
+            echoed_bytes = 0;
+            while (echoed_bytes < bytes_read) begin
+                do_bulk_in_transaction(data_list, data_list_length);
+                if (echoed_bytes + data_list_length > bytes_read) begin
+                    $display("tb_usb.v: echoed %0d bytes with %0d sent", echoed_bytes + data_list_length, bytes_read);
+                    $stop;
+                end
+                for (reg [31:0] i = 0; i < data_list_length; i = i + 1) begin
+                    if (data_list[i] != input_data[echoed_bytes + i]) begin
+                        $display("tb_usb.v: echoed 0x%h instead of 0x%h", data_list[i], input_data[echoed_bytes + i]);
+                        $stop;
+                    end
+                end
+                echoed_bytes = echoed_bytes + data_list_length;
+            end
+            test_device_endpoint = 0;
+        end
+        #SETTLE_TIME
 
         $finish;
     end
@@ -153,6 +233,160 @@ module tb_usb();
         clock48 <= ~clock48;
     end
 
+    // the device's turnaround in bit times, from the end of the end of packet
+    // of the host's packet to the start of the device's response, indexed by
+    // the pid of the token that started the transaction
+    reg [3:0] last_token_pid;
+    realtime end_of_host_packet, start_of_device_packet;
+    reg awaiting_device_packet = 0;
+    real turnaround_min[16], turnaround_max[16], turnaround_total[16];
+    reg [31:0] turnaround_count[16];
+
+    always @(negedge data_wire) begin
+        if (awaiting_device_packet && !write_enable) begin
+            start_of_device_packet = $realtime;
+            awaiting_device_packet = 0;
+        end
+    end
+
+    task add_turnaround(input real bit_times);
+        if (turnaround_count[last_token_pid] == 0 || bit_times < turnaround_min[last_token_pid]) begin
+            turnaround_min[last_token_pid] = bit_times;
+        end
+        if (turnaround_count[last_token_pid] == 0 || bit_times > turnaround_max[last_token_pid]) begin
+            turnaround_max[last_token_pid] = bit_times;
+        end
+        turnaround_total[last_token_pid] = turnaround_total[last_token_pid] + bit_times;
+        turnaround_count[last_token_pid] = turnaround_count[last_token_pid] + 1;
+    endtask
+
+    // the usb spec requires a device to respond between 2 and 6.5 bit times
+    // after the end of the host's packet
+    reg turnaround_in_spec;
+    task report_turnaround(input [3:0] pid, input [8 * 5:1] name);
+        if (turnaround_count[pid] > 0) begin
+            $display(
+                "tb_usb.v: turnaround after %0s: min %0.2f, average %0.2f, max %0.2f bit times",
+                name,
+                turnaround_min[pid],
+                turnaround_total[pid] / turnaround_count[pid],
+                turnaround_max[pid]
+            );
+            if (turnaround_min[pid] < 2 || turnaround_max[pid] > 6.5) begin
+                turnaround_in_spec = 0;
+            end
+        end
+    endtask
+
+    // the bulk OUT data sent by run_stress that the device has not echoed yet
+    reg [7:0] echo_data[65536];
+    reg [15:0] echo_write_index = 0;
+    reg [15:0] echo_read_index = 0;
+    reg [31:0] echo_pending = 0;
+    reg [31:0] stress_payload_bytes;
+
+    // drives transactions back to back, retrying immediately after a NAK: a
+    // control read on endpoint 0, an OUT transaction with 0 to 64 random bytes
+    // on endpoint 1 or an IN transaction on endpoint 2 that checks the echo
+    // of the OUT data, then reads the rest of the echo and reports the payload
+    // throughput and turnaround; the random sequence can be changed with
+    // +verilator+seed+<seed>
+    task run_stress(input [31:0] transactions);
+        realtime start_time;
+        real seconds;
+        reg [31:0] choice;
+
+        verbose = 0;
+        retry_delay = 0;
+        stress_payload_bytes = 0;
+        for (reg [31:0] i = 0; i < 16; i = i + 1) begin
+            turnaround_count[i] = 0;
+            turnaround_total[i] = 0;
+        end
+
+        $display("tb_usb.v: %0d stress transactions", transactions);
+        start_time = $realtime;
+        for (reg [31:0] i = 0; i < transactions; i = i + 1) begin
+            // the device buffers more than 512 bytes of the echo so OUT
+            // transactions are only NAKed while it catches up
+            choice = $urandom % 8;
+            if (choice == 0) begin
+                test_device_endpoint = 0;
+                do_control_transfer(
+                    8'b10000000,
+                    BREQUEST_GET_CONFIGURATION,
+                    0,
+                    0,
+                    1,
+                    data_list,
+                    data_list_length
+                );
+                if (data_list_length != 1) $stop;
+                if (data_list[0] != 1) $stop;
+                stress_payload_bytes = stress_payload_bytes + 8 + data_list_length;
+            end else if (echo_pending < 512 && (choice < 5 || echo_pending == 0)) begin
+                stress_out();
+            end else begin
+                stress_in();
+            end
+        end
+        while (echo_pending > 0) begin
+            stress_in();
+        end
+
+        seconds = ($realtime - start_time) / 1s;
+        $display(
+            "tb_usb.v: %0d payload bytes in %0.3f ms, %0.0f bytes per second",
+            stress_payload_bytes,
+            seconds * 1000,
+            stress_payload_bytes / seconds
+        );
+        turnaround_in_spec = 1;
+        report_turnaround(PID_SETUP, "SETUP");
+        report_turnaround(PID_OUT, "OUT");
+        report_turnaround(PID_IN, "IN");
+        if (!turnaround_in_spec) begin
+            $display("tb_usb.v: turnaround outside of 2 to 6.5 bit times");
+            $stop;
+        end
+    endtask
+
+    task stress_out();
+        reg [31:0] byte_count;
+        byte_count = $urandom % 65;
+        for (reg [31:0] i = 0; i < byte_count; i = i + 1) begin
+            packet_data[i] = $urandom;
+            echo_data[echo_write_index] = packet_data[i];
+            echo_write_index = echo_write_index + 1;
+        end
+        test_device_endpoint = 1;
+        do_bulk_out_transaction(packet_data, byte_count, current_data_pid_transmit);
+        echo_pending = echo_pending + byte_count;
+        stress_payload_bytes = stress_payload_bytes + byte_count;
+    endtask
+
+    task stress_in();
+        test_device_endpoint = 2;
+        do_bulk_in_transaction(data_list, data_list_length);
+        if (data_list_length > echo_pending) begin
+            $display("tb_usb.v: echoed %0d bytes with %0d sent", data_list_length, echo_pending);
+            $stop;
+        end
+        for (reg [31:0] i = 0; i < data_list_length; i = i + 1) begin
+            if (data_list[i] != echo_data[echo_read_index]) begin
+                $display(
+                    "tb_usb.v: echoed 0x%h instead of 0x%h",
+                    data_list[i],
+                    echo_data[echo_read_index]
+                );
+                $stop;
+            end
+            echo_read_index = echo_read_index + 1;
+        end
+        echo_pending = echo_pending - data_list_length;
+        stress_payload_bytes = stress_payload_bytes + data_list_length;
+    endtask
+
     task set_device_address(input [6:0] address);
         do_control_transfer(0, BREQUEST_SET_ADDRESS, { 9'b0, address }, 0, 0, data_list, data_list_length);
         test_device_address = address;
@@ -198,7 +432,7 @@ module tb_usb();
     reg [3:0] do_bulk_out_transaction_pid;
     reg [31:0] do_bulk_out_transaction_timeout;
     task do_bulk_out_transaction(input [7:0] data[1023], input [31:0] byte_count, input [3:0] data_pid);
-        $display("tb_usb.v: do_bulk_out_transaction");
+        if (verbose) $display("tb_usb.v: do_bulk_out_transaction");
         do_bulk_out_transaction_timeout = 0;
 
         send_token_packet(PID_OUT);
@@ -211,24 +445,24 @@ module tb_usb();
             end
 
             do_bulk_out_transaction_timeout = do_bulk_out_transaction_timeout + 1;
-            if (do_bulk_out_transaction_timeout >= 500) begin // takes 50ms
+            if (do_bulk_out_transaction_timeout >= 500) begin // takes 50ms with a RETRY_DELAY of 100us
                 $display("timeout when doing bulk out transaction");
                 $stop;
             end
 
-            #100us;
+            #retry_delay;
             send_token_packet(PID_OUT);
             send_data_packet(current_data_pid_transmit, data, byte_count);
             receive_handshake(do_bulk_out_transaction_pid);
         end
 
-        data_sync_bit_transmit = !data_sync_bit_transmit;
+        data_sync_bits_transmit[test_device_endpoint] = !data_sync_bits_transmit[test_device_endpoint];
     endtask
 
     reg [3:0] do_bulk_in_transaction_pid;
     reg [31:0] do_bulk_in_transaction_timeout;
     task do_bulk_in_transaction(output [7:0] data[1023], output [31:0] byte_count);
-        $display("tb_usb.v: do_bulk_in_transaction");
+        if (verbose) $display("tb_usb.v: do_bulk_in_transaction");
         do_bulk_in_transaction_timeout = 0;
 
         send_token_packet(PID_IN);
@@ -240,17 +474,17 @@ module tb_usb();
             end
 
             do_bulk_in_transaction_timeout = do_bulk_in_transaction_timeout + 1;
-            if (do_bulk_in_transaction_timeout >= 500) begin // takes 50ms
+            if (do_bulk_in_transaction_timeout >= 500) begin // takes 50ms with a RETRY_DELAY of 100us
                 $display("timeout when doing bulk in transaction");
                 $stop;
             end
 
-            #100us;
+            #retry_delay;
             send_token_packet(PID_IN);
             receive_packet(do_bulk_in_transaction_pid, data, byte_count);
         end
 
-        data_sync_bit_receive = !data_sync_bit_receive;
+        data_sync_bits_receive[test_device_endpoint] = !data_sync_bits_receive[test_device_endpoint];
         send_token_packet(PID_ACK);
     endtask
 
@@ -263,7 +497,7 @@ module tb_usb();
         input [15:0] wIndex,
         input [15:0] wLength
     );
-        $display("tb_usb.v: do_setup_transaction");
+        if (verbose) $display("tb_usb.v: do_setup_transaction");
         send_token_packet(PID_SETUP);
         do_setup_transaction_data[0] = bmRequestType;
         do_setup_transaction_data[1] = bRequest;
@@ -274,8 +508,8 @@ module tb_usb();
         do_setup_transaction_data[6] = wLength[7:0];
         do_setup_transaction_data[7] = wLength[15:8];
         send_data_packet(PID_DATA0, do_setup_transaction_data, 8);
-        data_sync_bit_transmit = 1;
-        data_sync_bit_receive = 1;
+        data_sync_bits_transmit[test_device_endpoint] = 1;
+        data_sync_bits_receive[test_device_endpoint] = 1;
         receive_handshake(do_setup_transaction_pid);
         if (do_setup_transaction_pid != PID_ACK) begin
             $display("did not get ACK after setup packet, got pid 0b%b", do_setup_transaction_pid);
@@ -291,6 +525,9 @@ module tb_usb();
     reg [7:0] send_token_packet_data[1026];
     reg [4:0] token_crc;
     task send_token_packet(input [3:0] pid);
+        if (pid != PID_ACK) begin
+            last_token_pid = pid;
+        end
         send_token_packet_data[0] = { ~pid, pid };
 
         // generate crc
@@ -380,6 +617,8 @@ module tb_usb();
         #FULL_SPEED_PERIOD;
         #FULL_SPEED_PERIOD;
         write_enable = 0;
+        end_of_host_packet = $realtime;
+        awaiting_device_packet = 1;
 
         // the spec requires at least a two bit-time delay between packets,
         // do it here so upon exit from this task it is valid to send another
@@ -418,6 +657,8 @@ module tb_usb();
             end
         end
 
+        add_turnaround((start_of_device_packet - end_of_host_packet) / FULL_SPEED_PERIOD);
+
         // read output_data
         previous_data = SYNC_PATTERN[0];
         consecutive_decoded_ones = 1;
@@ -7,18 +7,58 @@ gcc_binary_prefix = ~/riscv-gcc/bin/riscv32-elf-
 # includes trailing slash
 current_directory := $(dir $(lastword $(MAKEFILE_LIST)))
 
+# which core implementation to use, either single_cycle (core.v), which runs
+# at half of the 48 mhz clock, or pipelined (pipelined_core.v), which runs at
+# the full 48 mhz clock
+core ?= single_cycle
+
 # the top files must be included before their dependencies for yosys
-needed_verilog_files := $(foreach file, top.v core.v comparator.v alu.v registers.v usb_constants.v usb.v, $(current_directory)cpu/$(file))
+needed_verilog_files := $(foreach file, top.v core_constants.v core.v pipelined_core.v csrs.v muldiv.v decompressor.v comparator.v alu.v alu_decoder.v registers.v dma.v usb_constants.v usb.v usb_data_buffer.v usb_out_fifo.v cache.v external_memory.v trace_encoder.v, $(current_directory)cpu/$(file))
 
 VERILATOR_OPTIONS := +1364-2005ext+v -Wwarn-BLKSEQ -y $(current_directory)cpu
-GCC_OPTIONS := -march=rv32i_zicsr -mabi=ilp32 -std=c23 -Wall
+GCC_OPTIONS := -march=rv32imc_zicsr_zba_zbb -mabi=ilp32 -std=c23 -Wall
+
+ifeq ($(core), pipelined)
+	VERILATOR_OPTIONS += +define+PIPELINED_CORE
+	YOSYS_DEFINES := -DPIPELINED_CORE
+	GCC_OPTIONS += -D PIPELINED_CORE
+else ifneq ($(core), single_cycle)
+	$(error unknown core $(core), must be single_cycle or pipelined)
+endif
 
 testbench ?= $(current_directory)/tb_top.v
 
-target_directory := $(current_directory)target/$(shell realpath --relative-to $(current_directory) .)
-linker_script := $(current_directory)linker-script
+# sim-fast builds the simulation with verilator's --threads and with
+# FAST_SIMULATION defined, which shortens the waits of the testbenches that
+# only pass time, like the 30 ms usb reset; fast=1 makes sim and the test
+# targets use that build too. harness=cpp drives the clock from
+# cpu/sim_main.cpp instead of verilator's timing scheduler, which only works
+# with tb_top.v since the other testbenches drive more than the clock
+sim_threads ?= 4
+harness ?= verilog
+
+ifeq ($(harness), cpp)
+	ifneq ($(abspath $(testbench)), $(abspath $(current_directory)tb_top.v))
+$(error harness=cpp only works with tb_top.v)
+	endif
+	fast_simulation_options := --cc --exe --build +define+CPP_HARNESS $(current_directory)cpu/sim_main.cpp
+else ifeq ($(harness), verilog)
+	fast_simulation_options := --binary
+else
+$(error unknown harness $(harness), must be verilog or cpp)
+endif
+
+# each core has its own target directory since the programs and library are
+# built for a specific clock frequency
+target_directory := $(current_directory)target/$(core)/$(shell realpath --relative-to $(current_directory) .)
+# bootloader/ sets its own, which includes linker-symbols like this one
+linker_script ?= $(current_directory)linker-script
+# the simulation loads the program when it starts, see top.v, so it is built
+# once for each core and testbench and a changed program doesn't rebuild it
+simulation_directory := $(current_directory)target/$(core)/verilator/$(basename $(notdir $(testbench)))
+simulation := $(simulation_directory)$(if $(fast),-fast-$(harness))/sim
 lib := $(current_directory)lib
-lib_target_directory := $(current_directory)target/lib
+lib_target_directory := $(current_directory)target/$(core)/lib
 simulation_cpulib.o := $(lib_target_directory)/simulation/cpulib.o
 hardware_cpulib.o := $(lib_target_directory)/hardware/cpulib.o
 ifndef no_link_library
@@ -33,24 +73,33 @@ libc_headers := $(picolibc_install_directory)/include
 
 .NOTINTERMEDIATE:
 
-$(target_directory)/verilator/sim: $(testbench) $(target_directory)/simulation/memory.hex $(target_directory)/simulation/entry.txt $(needed_verilog_files)
-	verilator $(VERILATOR_OPTIONS) \
-		+define+simulation \
-		+define+INITIAL_PROGRAM_COUNTER=$$(cat $(target_directory)/simulation/entry.txt) \
-		+define+MEMORY_FILE=\"$(target_directory)/simulation/memory.hex\" \
-		--binary \
-		-j 0 \
-		$(testbench) \
-		-Mdir $(@D) \
-		-o $(@F)
+simulation_prerequisites := $(testbench) $(needed_verilog_files)
+simulation_command = verilator $(VERILATOR_OPTIONS) \
+                        +define+simulation \
+                        -j 0 \
+                        $(testbench) \
+                        -Mdir $(@D) \
+                        -o $(@F)
+
+# every run of the simulation depends on simulation_image and passes
+# simulation_arguments to load it
+simulation_image := $(foreach file, memory_low.hex memory_high.hex external_memory.hex entry.txt, $(target_directory)/simulation/$(file))
+simulation_arguments = +image=$(target_directory)/simulation +entry=$$(cat $(target_directory)/simulation/entry.txt)
+
+$(simulation_directory)/sim: $(simulation_prerequisites)
+	$(simulation_command) --binary
+
+$(simulation_directory)-fast-$(harness)/sim: $(simulation_prerequisites) $(current_directory)cpu/sim_main.cpp
+	$(simulation_command) $(fast_simulation_options) +define+FAST_SIMULATION --threads $(sim_threads)
 
 # arguments have to be in the right order so I need this chaos
 binary_postfix_arguments := $(program_files) $(libc.a) -lgcc 
-common_binary_prerequisites := $(program_files) $(libc.a) $(linker_script) $(libc_headers)
+common_binary_prerequisites := $(program_files) $(libc.a) $(linker_script) $(current_directory)linker-symbols $(libc_headers)
 binary_base_build_command = $(gcc_binary_prefix)gcc \
                                $(GCC_OPTIONS) \
                                -I $(current_directory) \
                                -T $(linker_script) \
+                               -L $(current_directory) \
                                -nostdlib \
                                -o $@ \
                                -I$(libc_headers) \
@@ -59,17 +108,18 @@ binary_base_build_command = $(gcc_binary_prefix)gcc \
                                -ggdb
 
 $(target_directory)/simulation/a.out: $(common_binary_prerequisites) $(simulation_cpulib_argument) | $(target_directory)/simulation
-	$(binary_base_build_command) $(simulation_cpulib_argument) $(binary_postfix_arguments)
+	$(binary_base_build_command) -D SIMULATION $(simulation_cpulib_argument) $(binary_postfix_arguments)
 
 $(target_directory)/hardware/a.out: $(common_binary_prerequisites) $(hardware_cpulib_argument) | $(target_directory)/hardware
 	$(binary_base_build_command) $(hardware_cpulib_argument) $(binary_postfix_arguments)
 
-%/memory.bin %/entry.txt &: %/a.out | %
-	cargo run --manifest-path $(current_directory)loader/Cargo.toml -- \
-		--memory $*/memory.bin --entry $*/entry.txt $<
-
-%/memory.hex: %/memory.bin | %
-	hexdump -v -e '/4 "%x "' $< > $@
+# the .bin images are for iss/, the .hex images for $readmemh in top.v and
+# external_memory.v
+%/memory.bin %/external_memory.bin %/memory_low.hex %/memory_high.hex %/external_memory.hex %/entry.txt &: %/a.out | %
+	cargo run --release --manifest-path $(current_directory)loader/Cargo.toml -- \
+		--memory $*/memory.bin --external-memory $*/external_memory.bin \
+		--memory-low-hex $*/memory_low.hex --memory-high-hex $*/memory_high.hex \
+		--external-memory-hex $*/external_memory.hex --entry $*/entry.txt $<
 
 cpulib_prerequisites := $(lib)/cpulib.h $(lib)/cpulib.c $(lib)/cpulib.S $(lib)/usb.c $(libc_headers)
 cpulib_build_command = $(gcc_binary_prefix)gcc \
@@ -89,7 +139,7 @@ $(simulation_cpulib.o): $(cpulib_prerequisites) | $(lib_target_directory)/simula
 $(hardware_cpulib.o): $(cpulib_prerequisites) | $(lib_target_directory)/hardware
 	$(cpulib_build_command)
 
-$(target_directory) $(target_directory)/simulation $(target_directory)/hardware $(current_directory)target/lib/simulation $(current_directory)target/lib/hardware:
+$(target_directory) $(target_directory)/simulation $(target_directory)/hardware $(lib_target_directory)/simulation $(lib_target_directory)/hardware:
 	mkdir -p $@
 
 $(libc.a) $(libc_headers) &: $(lib)/picolibc
@@ -105,11 +155,11 @@ $(libc.a) $(libc_headers) &: $(lib)/picolibc
 		ninja && \
 		ninja install
 
-$(target_directory)/cpu.json: $(needed_verilog_files) $(target_directory)/hardware/memory.hex $(target_directory)/hardware/entry.txt
+$(target_directory)/cpu.json: $(needed_verilog_files) $(target_directory)/hardware/memory_low.hex $(target_directory)/hardware/memory_high.hex $(target_directory)/hardware/entry.txt
 	@# run verilator --lint-only before building because yosys does not report many simple errors
 	INITIAL_PROGRAM_COUNTER=$$(cat $(target_directory)/hardware/entry.txt) && \
-	verilator  --lint-only $(VERILATOR_OPTIONS) +define+INITIAL_PROGRAM_COUNTER=$$INITIAL_PROGRAM_COUNTER +define+MEMORY_FILE='"$(target_directory)/hardware/memory.hex"' top.v && \
-	yosys -p "read_verilog -DYOSYS -DINITIAL_PROGRAM_COUNTER=$$INITIAL_PROGRAM_COUNTER -DMEMORY_FILE=\"$(target_directory)/hardware/memory.hex\" $(needed_verilog_files); synth_ecp5 -json $@"
+	verilator  --lint-only $(VERILATOR_OPTIONS) +define+INITIAL_PROGRAM_COUNTER=$$INITIAL_PROGRAM_COUNTER +define+MEMORY_FILE_LOW='"$(target_directory)/hardware/memory_low.hex"' +define+MEMORY_FILE_HIGH='"$(target_directory)/hardware/memory_high.hex"' top.v && \
+	yosys -p "read_verilog -DYOSYS $(YOSYS_DEFINES) -DINITIAL_PROGRAM_COUNTER=$$INITIAL_PROGRAM_COUNTER -DMEMORY_FILE_LOW=\"$(target_directory)/hardware/memory_low.hex\" -DMEMORY_FILE_HIGH=\"$(target_directory)/hardware/memory_high.hex\" $(needed_verilog_files); synth_ecp5 -json $@"
 
 %.config: %.json $(current_directory)cpu/orangecrab.lpf
 	nextpnr-ecp5 --85k --package CSFBGA285 --lpf $(current_directory)cpu/orangecrab.lpf --json $< --textcfg $@
@@ -125,9 +175,61 @@ $(target_directory)/cpu.json: $(needed_verilog_files) $(target_directory)/hardwa
 install: $(target_directory)/cpu.dfu
 	dfu-util --alt 0 -D $<
 
+# sends the program to the bootloader on the board instead of building a
+# bitstream with it, see bootloader/; the board runs the bootloader after
+# make -C bootloader install and after each power cycle
+.PHONY: upload
+upload: $(target_directory)/hardware/memory.bin $(target_directory)/hardware/entry.txt
+	cargo run --release --manifest-path $(current_directory)usb-wrapper/Cargo.toml -- upload $^
+
 .PHONY: sim
-sim: $(target_directory)/verilator/sim
-	$<
+sim: $(simulation) $(simulation_image)
+	$< $(simulation_arguments)
+
+.PHONY: sim-fast
+sim-fast: $(simulation_directory)-fast-$(harness)/sim $(simulation_image)
+	$< $(simulation_arguments)
+
+.PHONY: profile
+profile: $(simulation_directory)/sim $(simulation_image) $(target_directory)/simulation/a.out
+	$< $(simulation_arguments) +profile=$(target_directory)/simulation/profile.bin
+	cargo run --manifest-path $(current_directory)profiler/Cargo.toml -- \
+		--folded $(target_directory)/simulation/profile.folded \
+		$(target_directory)/simulation/a.out $(target_directory)/simulation/profile.bin
+
+# runs the program on iss/, an instruction set simulator that is much faster
+# than the verilator simulation but does not model the usb device or timing
+.PHONY: iss
+iss: $(target_directory)/simulation/memory.bin $(target_directory)/simulation/external_memory.bin $(target_directory)/simulation/entry.txt
+	cargo run --release --manifest-path $(current_directory)iss/Cargo.toml -- \
+		--external-memory $(target_directory)/simulation/external_memory.bin \
+		$(target_directory)/simulation/memory.bin $(target_directory)/simulation/entry.txt
+
+# runs the simulation of core.v and iss/ together through a fifo and stops at
+# the first instruction where they differ
+.PHONY: lockstep
+lockstep: $(simulation_directory)/sim $(simulation_image) $(target_directory)/simulation/memory.bin $(target_directory)/simulation/external_memory.bin $(target_directory)/simulation/entry.txt
+	@[ $(core) = single_cycle ] || { echo "lockstep needs core=single_cycle, only core.v writes the trace"; exit 1; }
+	rm -f $(target_directory)/simulation/trace.fifo
+	mkfifo $(target_directory)/simulation/trace.fifo
+	$< $(simulation_arguments) +trace=$(target_directory)/simulation/trace.fifo & \
+	cargo run --release --manifest-path $(current_directory)iss/Cargo.toml -- \
+		--compare $(target_directory)/simulation/trace.fifo \
+		--external-memory $(target_directory)/simulation/external_memory.bin \
+		$(target_directory)/simulation/memory.bin $(target_directory)/simulation/entry.txt; \
+	status=$$?; \
+	kill $$! 2> /dev/null; \
+	exit $$status
+
+# decodes the instruction trace that the simulation writes to ./trace on a
+# fail or illegal instruction, see trace-decoder/; decode-hardware-trace is for
+# a trace read from the board, set trace to the file it was written to
+trace ?= trace
+.PHONY: decode-trace decode-hardware-trace
+decode-trace: $(target_directory)/simulation/a.out
+decode-hardware-trace: $(target_directory)/hardware/a.out
+decode-trace decode-hardware-trace:
+	cargo run --release --manifest-path $(current_directory)trace-decoder/Cargo.toml -- $< $(trace)
 
 .PHONY: synth
 synth: $(target_directory)/cpu.json
@@ -0,0 +1,80 @@
+// the instructions that change where the program goes next
+
+const MRET: u32 = 0x30200073;
+
+// what the decoder needs to know about an instruction to follow the program
+// past it
+pub enum Kind {
+    Sequential,
+    // jal, whose target is in the instruction
+    Jump { target: u32 },
+    Branch { target: u32 },
+    // jalr or mret, whose target is in the trace
+    Indirect { is_mret: bool },
+}
+
+// the targets are relative to address, the address of the instruction
+pub fn kind(instruction: u32, address: u32) -> Kind {
+    let bit = |index: u32| (instruction >> index) & 1;
+    let bits = |high: u32, low: u32| (instruction >> low) & ((1 << (high - low + 1)) - 1);
+    // sign extends from the given bit
+    let relative = |offset: u32, sign_bit: u32| {
+        let shift = 31 - sign_bit;
+        address.wrapping_add((((offset << shift) as i32) >> shift) as u32)
+    };
+
+    if instruction & 0b11 != 0b11 {
+        let quadrant = instruction & 0b11;
+        let funct3 = bits(15, 13);
+        return match (quadrant, funct3) {
+            // c.jal and c.j
+            (0b01, 0b001 | 0b101) => {
+                let offset = bit(12) << 11
+                    | bit(11) << 4
+                    | bits(10, 9) << 8
+                    | bit(8) << 10
+                    | bit(7) << 6
+                    | bit(6) << 7
+                    | bits(5, 3) << 1
+                    | bit(2) << 5;
+                Kind::Jump {
+                    target: relative(offset, 11),
+                }
+            }
+            // c.beqz and c.bnez
+            (0b01, 0b110 | 0b111) => {
+                let offset = bit(12) << 8
+                    | bits(11, 10) << 3
+                    | bits(6, 5) << 6
+                    | bits(4, 3) << 1
+                    | bit(2) << 5;
+                Kind::Branch {
+                    target: relative(offset, 8),
+                }
+            }
+            // c.jr and c.jalr
+            (0b10, 0b100) if bits(6, 2) == 0 && bits(11, 7) != 0 => {
+                Kind::Indirect { is_mret: false }
+            }
+            _ => Kind::Sequential,
+        };
+    }
+
+    match instruction & 0x7f {
+        0b1101111 => {
+            let offset = bit(31) << 20 | bits(19, 12) << 12 | bit(20) << 11 | bits(30, 21) << 1;
+            Kind::Jump {
+                target: relative(offset, 20),
+            }
+        }
+        0b1100111 => Kind::Indirect { is_mret: false },
+        0b1100011 => {
+            let offset = bit(31) << 12 | bit(7) << 11 | bits(30, 25) << 5 | bits(11, 8) << 1;
+            Kind::Branch {
+                target: relative(offset, 12),
+            }
+        }
+        _ if instruction == MRET => Kind::Indirect { is_mret: true },
+        _ => Kind::Sequential,
+    }
+}
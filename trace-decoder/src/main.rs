@@ -0,0 +1,317 @@
+/* This program reconstructs the instructions that the core executed from the
+ * trace of cpu/trace_encoder.v and the ELF binary that was traced, see there
+ * for the format of the entries
+ *
+ * the trace is written to ./trace by the simulation on a fail or illegal
+ * instruction, or is read from the board with trace_read or trace_send in
+ * lib/cpulib.h; it starts with the status word of the trace and then has the
+ * entries of the trace ram
+ *
+ * decoding starts at the oldest sync entry in the trace, since the entries
+ * before it can't be followed without knowing where they start, and follows
+ * the program in the ELF binary past the last entry until it needs a branch or
+ * a jump target that is not in the trace
+ */
+
+mod instruction;
+
+use std::collections::VecDeque;
+use std::io::BufWriter;
+use std::io::Write;
+use std::process::ExitCode;
+
+use clap::Parser;
+
+use elf_program::Program;
+use instruction::Kind;
+
+// must match cpu/trace_encoder.v
+const ENTRY_BRANCHES: u64 = 1;
+const ENTRY_JUMP: u64 = 2;
+const ENTRY_TRAP: u64 = 3;
+const ENTRY_HANDLER: u64 = 4;
+const ENTRY_SYNC: u64 = 5;
+const ENTRY_SYNC_AFTER_LOSS: u64 = 6;
+const STATUS_WRAPPED: u32 = 1 << 1;
+// the custom instructions that pass and fail the simulation, where it stops
+const TEST_PASS: u32 = 0x8c000073;
+const TEST_FAIL: u32 = 0xcc000073;
+
+// a loop of instructions without a branch can't be told apart from running
+// into the next entry, so following the program stops after this many
+const MAX_INSTRUCTIONS_BETWEEN_ENTRIES: u64 = 1 << 20;
+
+#[derive(Parser)]
+struct Args {
+    /// ELF file of the program that was traced
+    elf: String,
+    /// trace written by the simulation or read from the board
+    trace: String,
+    /// print the number of instructions executed in each function instead of
+    /// each instruction
+    #[arg(long)]
+    counts: bool,
+    /// fail unless the program is followed past the last entry to the pass or
+    /// fail instruction of a simulation, for tests/cpu
+    #[arg(long)]
+    complete: bool,
+}
+
+// why following the program stopped
+enum Stop {
+    // at the address that was looked for, with no branches left
+    Address,
+    // at a branch with no branches left
+    Branch,
+    // at a jalr or mret, which is not printed yet
+    Indirect { is_mret: bool },
+}
+
+struct Decoder<'a, W: Write> {
+    program: &'a Program,
+    output: W,
+    counts: Option<Vec<u64>>,
+    program_counter: u32,
+    // whether each branch was taken, in the order they retired
+    branches: VecDeque<bool>,
+    instructions: u64,
+}
+
+fn main() -> ExitCode {
+    let args = Args::parse();
+
+    match run(&args) {
+        Ok(()) => ExitCode::SUCCESS,
+        Err(message) => {
+            eprintln!("{message}");
+            ExitCode::FAILURE
+        }
+    }
+}
+
+fn run(args: &Args) -> Result<(), String> {
+    let read =
+        |path: &str| std::fs::read(path).map_err(|error| format!("can't read {path}: {error}"));
+    let program = Program::parse(&read(&args.elf)?)?;
+    let entries = entries(&read(&args.trace)?)?;
+
+    let mut decoder = Decoder {
+        program: &program,
+        output: BufWriter::new(std::io::stdout().lock()),
+        counts: args.counts.then(|| vec![0; program.functions.len() + 1]),
+        program_counter: 0,
+        branches: VecDeque::new(),
+        instructions: 0,
+    };
+
+    let start = entries
+        .iter()
+        .position(|entry| kind(*entry) == ENTRY_SYNC || kind(*entry) == ENTRY_SYNC_AFTER_LOSS)
+        .ok_or("the trace has no sync entry to start from")?;
+    decoder.program_counter = address(entries[start]);
+
+    let mut index = start + 1;
+    while index < entries.len() {
+        let entry = entries[index];
+        decoder
+            .decode(entry, entries.get(index + 1).copied())
+            .map_err(|message| format!("entry {index}, 0x{entry:016x}: {message}"))?;
+        index += if kind(entry) == ENTRY_TRAP { 2 } else { 1 };
+    }
+    decoder.finish(args.complete)
+}
+
+// the entries from the oldest to the newest
+fn entries(trace: &[u8]) -> Result<Vec<u64>, String> {
+    if trace.len() < 4 || (trace.len() - 4) % 8 != 0 {
+        return Err(format!(
+            "the trace is {} bytes, not a status word and whole entries",
+            trace.len()
+        ));
+    }
+    let status = u32::from_le_bytes(trace[0..4].try_into().unwrap());
+    let write_index = (status >> 16) as usize;
+    let ram: Vec<u64> = trace[4..]
+        .chunks_exact(8)
+        .map(|entry| u64::from_le_bytes(entry.try_into().unwrap()))
+        .collect();
+    if write_index >= ram.len() {
+        return Err(format!(
+            "the status 0x{status:08x} is past the {} entries",
+            ram.len()
+        ));
+    }
+
+    Ok(if status & STATUS_WRAPPED != 0 {
+        [&ram[write_index..], &ram[..write_index]].concat()
+    } else {
+        ram[..write_index].to_vec()
+    })
+}
+
+fn kind(entry: u64) -> u64 {
+    entry >> 61
+}
+
+fn address(entry: u64) -> u32 {
+    (entry as u32 & 0x7fffffff) << 1
+}
+
+// the branches in bits [55:31], the earliest first
+fn branches(entry: u64) -> impl Iterator<Item = bool> {
+    let count = (entry >> 56) & 0x1f;
+    (0..count).map(move |index| (entry >> (31 + index)) & 1 != 0)
+}
+
+impl<W: Write> Decoder<'_, W> {
+    // next is the entry after this one, the handler of a trap
+    fn decode(&mut self, entry: u64, next: Option<u64>) -> Result<(), String> {
+        match kind(entry) {
+            ENTRY_BRANCHES => {
+                self.branches.extend(branches(entry));
+            }
+            ENTRY_JUMP => {
+                self.branches.extend(branches(entry));
+                match self.follow(|_| false)? {
+                    Stop::Indirect { .. } if self.branches.is_empty() => {
+                        self.retire(self.program_counter)?;
+                        self.program_counter = address(entry);
+                    }
+                    _ => return Err(self.mismatch("a jalr or mret")),
+                }
+            }
+            ENTRY_TRAP => {
+                self.branches.extend(branches(entry));
+                let return_address = address(entry);
+                match self.follow(|address| address == return_address)? {
+                    Stop::Address => {}
+                    // an interrupt chained from an mret
+                    Stop::Indirect { is_mret: true } if self.branches.is_empty() => {
+                        self.retire(self.program_counter)?;
+                    }
+                    _ => return Err(self.mismatch(&format!("0x{return_address:08x}"))),
+                }
+
+                let handler = match next {
+                    Some(handler) if kind(handler) == ENTRY_HANDLER => handler,
+                    _ => return Err("a trap without a handler entry after it".to_string()),
+                };
+                let interrupt = (handler >> 60) & 1;
+                let mcause = (interrupt << 31 | (handler >> 31) & 0x1f) as u32;
+                self.print(&format!(
+                    "trap, mcause 0x{mcause:08x}, returns to 0x{return_address:08x}"
+                ))?;
+                self.program_counter = address(handler);
+            }
+            ENTRY_SYNC => {
+                self.branches.extend(branches(entry));
+                let sync_address = address(entry);
+                match self.follow(|address| address == sync_address)? {
+                    Stop::Address => {}
+                    _ => return Err(self.mismatch(&format!("0x{sync_address:08x}"))),
+                }
+            }
+            ENTRY_SYNC_AFTER_LOSS => {
+                self.print("entries lost")?;
+                self.branches.clear();
+                self.program_counter = address(entry);
+            }
+            ENTRY_HANDLER => return Err("a handler entry without a trap before it".to_string()),
+            _ => return Err("unknown entry type".to_string()),
+        }
+        Ok(())
+    }
+
+    // follows the program past the last entry
+    fn finish(&mut self, complete: bool) -> Result<(), String> {
+        let program = self.program;
+        let end = self.follow(|address| {
+            matches!(program.instruction(address), Some(TEST_PASS | TEST_FAIL))
+        })?;
+        if complete && !matches!(end, Stop::Address) {
+            return Err(self.mismatch("the pass or fail instruction"));
+        }
+        if let Some(counts) = &self.counts {
+            let mut sorted: Vec<(usize, u64)> = counts
+                .iter()
+                .copied()
+                .enumerate()
+                .filter(|(_, count)| *count != 0)
+                .collect();
+            sorted.sort_by_key(|(_, count)| std::cmp::Reverse(*count));
+
+            for (index, count) in sorted {
+                let name = self.program.function_name(index);
+                writeln!(self.output, "{count:>12}  {name}").map_err(write_error)?;
+            }
+        }
+        writeln!(self.output, "{} instructions", self.instructions).map_err(write_error)?;
+        self.output.flush().map_err(write_error)
+    }
+
+    // retires instructions from program_counter until stop returns true for
+    // the address of the next one with no branches left, or until it needs a
+    // branch that is not in the trace or the target of a jalr or mret
+    fn follow(&mut self, stop: impl Fn(u32) -> bool) -> Result<Stop, String> {
+        for _ in 0..MAX_INSTRUCTIONS_BETWEEN_ENTRIES {
+            let address = self.program_counter;
+            if self.branches.is_empty() && stop(address) {
+                return Ok(Stop::Address);
+            }
+            let instruction = self
+                .program
+                .instruction(address)
+                .ok_or(format!("no instruction at 0x{address:08x} in the ELF file"))?;
+            self.program_counter = match instruction::kind(instruction, address) {
+                Kind::Sequential => address.wrapping_add(elf_program::length(instruction)),
+                Kind::Jump { target } => target,
+                Kind::Branch { target } => match self.branches.pop_front() {
+                    Some(true) => target,
+                    Some(false) => address.wrapping_add(elf_program::length(instruction)),
+                    None => return Ok(Stop::Branch),
+                },
+                Kind::Indirect { is_mret } => return Ok(Stop::Indirect { is_mret }),
+            };
+            self.retire(address)?;
+        }
+        Err(format!(
+            "no entry for the {MAX_INSTRUCTIONS_BETWEEN_ENTRIES} instructions after 0x{:08x}",
+            self.program_counter
+        ))
+    }
+
+    fn retire(&mut self, address: u32) -> Result<(), String> {
+        self.instructions += 1;
+        match &mut self.counts {
+            Some(counts) => {
+                counts[self.program.function_index(address)] += 1;
+                Ok(())
+            }
+            None => writeln!(
+                self.output,
+                "0x{address:08x} {}",
+                self.program.location(address)
+            )
+            .map_err(write_error),
+        }
+    }
+
+    fn print(&mut self, message: &str) -> Result<(), String> {
+        if self.counts.is_none() {
+            writeln!(self.output, "{message}").map_err(write_error)?;
+        }
+        Ok(())
+    }
+
+    fn mismatch(&self, expected: &str) -> String {
+        format!(
+            "expected to reach {expected} but the program goes to 0x{:08x} with {} branches left",
+            self.program_counter,
+            self.branches.len()
+        )
+    }
+}
+
+fn write_error(error: std::io::Error) -> String {
+    format!("can't write the output: {error}")
+}
@@ -1,8 +1,74 @@
+/* Streams data between stdin/stdout and the device
+ *
+ * usage:
+ *     usb-wrapper          sends stdin to the device, read with usb_read
+ *     usb-wrapper read     writes data from the device, sent with usb_write, to stdout
+ *     usb-wrapper stream [<transfers> [<transfer size>]]
+ *                          sends stdin like the default mode with this many
+ *                          transfers of this many bytes in flight, and reports
+ *                          the throughput, see stream.rs
+ *     usb-wrapper upload <memory image> <entry point>
+ *                          sends a program to bootloader/ and starts it, the
+ *                          files are written by the loader
+ */
+
+mod stream;
+
 use std::io;
 use std::io::Read;
+use std::io::Write;
 use std::time::Duration;
 
+use rusb::DeviceHandle;
+use rusb::GlobalContext;
+
+// must match the endpoint descriptors in lib/usb.c
+const BULK_OUT_ENDPOINT: u8 = 0x01;
+const BULK_IN_ENDPOINT: u8 = 0x82;
+const MAX_PACKET_SIZE: usize = 64;
+const INTERFACE: u8 = 0;
+const CONFIGURATION: u8 = 1;
+
+// must match bootloader/bootloader.c
+const CHUNK_MAGIC: u32 = 0x6b6e6863;
+const MAX_CHUNK_LENGTH: usize = 1024;
+const STATUS_OK: u8 = 0;
+const STATUS_BAD_HEADER: u8 = 1;
+const STATUS_OUT_OF_RANGE: u8 = 2;
+const STATUS_BAD_CRC: u8 = 3;
+// for each chunk that arrives corrupt
+const MAX_ATTEMPTS: usize = 3;
+// the bootloader answers each chunk as soon as it has it
+const STATUS_TIMEOUT: Duration = Duration::from_secs(1);
+
 fn main() {
+    let mode = std::env::args().nth(1);
+    let mut device_handle = open_device();
+
+    match mode.as_deref() {
+        None => write_stdin(&device_handle),
+        Some("read") => read_stdout(&device_handle),
+        Some("stream") => {
+            let number = |index: usize, default: usize| match std::env::args().nth(index) {
+                Some(argument) => argument.parse().expect("bad number"),
+                None => default,
+            };
+            stream::stream(
+                &mut device_handle,
+                number(2, stream::DEFAULT_TRANSFERS),
+                number(3, stream::DEFAULT_TRANSFER_SIZE),
+            );
+        }
+        Some("upload") => {
+            let memory_image = std::env::args().nth(2).expect("no memory image given");
+            let entry_point = std::env::args().nth(3).expect("no entry point given");
+            upload(&device_handle, &memory_image, &entry_point);
+        }
+        Some(other) => panic!("unknown mode {other}"),
+    }
+}
+
+fn open_device() -> DeviceHandle<GlobalContext> {
     let device_list = rusb::devices().unwrap();
     let mut eligible_devices = device_list.iter().filter(|device| {
         let device_descriptor = device.device_descriptor().unwrap();
@@ -14,27 +80,145 @@ fn main() {
         panic!("multiple eligible devices found");
     }
 
-    let device_handle = got_device.open().unwrap();
+    let mut device_handle = got_device.open().unwrap();
+    if device_handle.active_configuration().unwrap() != CONFIGURATION {
+        device_handle.set_active_configuration(CONFIGURATION).unwrap();
+    }
+    device_handle.claim_interface(INTERFACE).unwrap();
+    device_handle
+}
 
+fn write_stdin(device_handle: &DeviceHandle<GlobalContext>) {
     let mut stdin = io::stdin();
-    let mut buffer = [0u8; 64];
+    // libusb splits each write into as many max size packets as needed, so
+    // this only limits how much is submitted at once
+    let mut buffer = [0u8; 4096];
     loop {
-        if let Ok(got_bytes) = stdin.read(&mut buffer) {
-            let _ = device_handle
-                .write_control(
-                    rusb::request_type(
-                        rusb::Direction::Out,
-                        rusb::RequestType::Vendor,
-                        rusb::Recipient::Device,
-                    ),
-                    13, // this is a custom out request type
-                    0,
-                    0,
-                    &buffer[0..got_bytes],
-                    Duration::from_millis(500),
-                );
-        } else {
+        let got_bytes = read_retrying(&mut stdin, &mut buffer).expect("reading stdin failed");
+        if got_bytes == 0 {
             break;
         }
+
+        let mut sent_bytes = 0;
+        while sent_bytes < got_bytes {
+            // no timeout; the device NAKs while it is busy and the host
+            // controller keeps retrying
+            sent_bytes += device_handle
+                .write_bulk(
+                    BULK_OUT_ENDPOINT,
+                    &buffer[sent_bytes..got_bytes],
+                    Duration::ZERO,
+                )
+                .expect("bulk write failed");
+        }
+    }
+}
+
+// a read that is retried when a signal interrupts it
+fn read_retrying(reader: &mut impl Read, buffer: &mut [u8]) -> io::Result<usize> {
+    loop {
+        match reader.read(buffer) {
+            Err(error) if error.kind() == io::ErrorKind::Interrupted => {}
+            result => return result,
+        }
+    }
+}
+
+fn read_stdout(device_handle: &DeviceHandle<GlobalContext>) {
+    let mut stdout = io::stdout();
+    // one packet at a time so that data is written out as soon as it arrives
+    // instead of when a larger transfer fills up
+    let mut buffer = [0u8; MAX_PACKET_SIZE];
+    loop {
+        // no timeout; the device NAKs while it has nothing to send
+        let got_bytes = device_handle
+            .read_bulk(BULK_IN_ENDPOINT, &mut buffer, Duration::ZERO)
+            .expect("bulk read failed");
+
+        if stdout
+            .write_all(&buffer[..got_bytes])
+            .and_then(|_| stdout.flush())
+            .is_err()
+        {
+            break;
+        }
+    }
+}
+
+fn upload(device_handle: &DeviceHandle<GlobalContext>, memory_image: &str, entry_point: &str) {
+    let image = std::fs::read(memory_image).unwrap();
+    let entry_address: u32 = std::fs::read_to_string(entry_point)
+        .unwrap()
+        .trim()
+        .parse()
+        .expect("bad entry point");
+
+    // the image starts at address 0 and includes the zeros of .bss, which are
+    // sent too since an upload that failed part way can have left data there
+    for (index, data) in image.chunks(MAX_CHUNK_LENGTH).enumerate() {
+        let address = u32::try_from(index * MAX_CHUNK_LENGTH).unwrap();
+        send_chunk(device_handle, address, data);
+    }
+    send_chunk(device_handle, entry_address, &[]);
+    eprintln!(
+        "sent {} bytes, started at 0x{entry_address:08x}",
+        image.len()
+    );
+}
+
+fn send_chunk(device_handle: &DeviceHandle<GlobalContext>, address: u32, data: &[u8]) {
+    let length = u32::try_from(data.len()).unwrap();
+    let mut checked = Vec::new();
+    checked.extend_from_slice(&address.to_le_bytes());
+    checked.extend_from_slice(&length.to_le_bytes());
+    checked.extend_from_slice(data);
+
+    let mut chunk = Vec::new();
+    chunk.extend_from_slice(&CHUNK_MAGIC.to_le_bytes());
+    chunk.extend_from_slice(&checked[..8]);
+    chunk.extend_from_slice(&crc32(&checked).to_le_bytes());
+    chunk.extend_from_slice(data);
+
+    for _ in 0..MAX_ATTEMPTS {
+        let mut sent_bytes = 0;
+        while sent_bytes < chunk.len() {
+            sent_bytes += device_handle
+                .write_bulk(BULK_OUT_ENDPOINT, &chunk[sent_bytes..], Duration::ZERO)
+                .expect("bulk write failed");
+        }
+
+        let mut status = [0u8; MAX_PACKET_SIZE];
+        let got_bytes = device_handle
+            .read_bulk(BULK_IN_ENDPOINT, &mut status, STATUS_TIMEOUT)
+            .expect("no answer from the bootloader, is it running?");
+        match status[..got_bytes] {
+            [STATUS_OK] => return,
+            [STATUS_BAD_CRC] => eprintln!("chunk at 0x{address:08x} was corrupted, sending again"),
+            [STATUS_OUT_OF_RANGE] => {
+                panic!("the program doesn't fit below the bootloader, chunk at 0x{address:08x}")
+            }
+            [STATUS_BAD_HEADER] => panic!("the bootloader is out of sync, power cycle the board"),
+            _ => panic!(
+                "unexpected answer {:?} from the bootloader",
+                &status[..got_bytes]
+            ),
+        }
+    }
+    panic!("chunk at 0x{address:08x} was corrupted {MAX_ATTEMPTS} times");
+}
+
+// crc-32 as in zlib
+fn crc32(bytes: &[u8]) -> u32 {
+    let mut crc = !0u32;
+    for byte in bytes {
+        crc ^= u32::from(*byte);
+        for _ in 0..8 {
+            crc = if crc & 1 != 0 {
+                (crc >> 1) ^ 0xedb88320
+            } else {
+                crc >> 1
+            };
+        }
     }
+    !crc
 }
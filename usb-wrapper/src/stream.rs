@@ -0,0 +1,478 @@
+/* The stream mode, which sends stdin to the device like the default mode but
+ * keeps several transfers in flight with the asynchronous api of libusb, so
+ * that the host controller has the next transfer queued when one completes
+ * instead of waiting for stdin to be read and the next transfer to be
+ * submitted, and reports the throughput on stderr
+ *
+ * each transfer is filled from stdin up to the transfer size, so only the last
+ * one can be shorter, and the stream stops if reading stdin fails. the
+ * transfers have no timeout, the host controller keeps
+ * retrying while the device NAKs. a transfer that fails, like on a STALL,
+ * stops the stream: the transfers in flight are cancelled, since the ones
+ * after it would otherwise send their data out of order, the endpoint's halt is
+ * cleared after a STALL, and what is left of each transfer is sent again in
+ * order
+ *
+ * the board never halts its bulk OUT endpoint, but a stand-in for it can, see
+ * the README for one made with dummy_hcd that the stream mode can be tested
+ * against without the board
+ */
+
+use std::io;
+use std::io::Read;
+use std::os::raw::c_int;
+use std::os::raw::c_void;
+use std::sync::atomic::AtomicBool;
+use std::sync::atomic::Ordering;
+use std::sync::mpsc;
+use std::time::Duration;
+use std::time::Instant;
+
+use rusb::DeviceHandle;
+use rusb::Direction;
+use rusb::GlobalContext;
+use rusb::TransferType;
+use rusb::UsbContext;
+use rusb::ffi;
+use rusb::ffi::constants::LIBUSB_TRANSFER_CANCELLED;
+use rusb::ffi::constants::LIBUSB_TRANSFER_COMPLETED;
+use rusb::ffi::constants::LIBUSB_TRANSFER_NO_DEVICE;
+use rusb::ffi::constants::LIBUSB_TRANSFER_STALL;
+use rusb::ffi::constants::LIBUSB_TRANSFER_TYPE_BULK;
+
+use crate::INTERFACE;
+
+pub const DEFAULT_TRANSFERS: usize = 4;
+pub const DEFAULT_TRANSFER_SIZE: usize = 16 * 1024;
+const REPORT_INTERVAL: Duration = Duration::from_secs(1);
+// of handle_events, how long the event thread takes to notice that the stream
+// has ended
+const EVENT_TIMEOUT: Duration = Duration::from_millis(100);
+// recoveries in a row without a transfer completing before the stream gives up
+const MAX_RECOVERIES: usize = 3;
+
+struct Slot {
+    transfer: *mut ffi::libusb_transfer,
+    // user_data of transfer
+    callback_data: *mut CallbackData,
+    buffer: Vec<u8>,
+    // the bytes of buffer to send and how many of them the device took
+    length: usize,
+    sent: usize,
+    // the order of the data in stdin
+    sequence: u64,
+    in_flight: bool,
+    submitted: Instant,
+}
+
+struct CallbackData {
+    slot: usize,
+    sender: mpsc::Sender<Completion>,
+}
+
+struct Completion {
+    slot: usize,
+    status: c_int,
+    actual_length: usize,
+    time: Instant,
+}
+
+#[derive(Default)]
+struct Stats {
+    bytes: u64,
+    // from submitting each transfer until it completed, so with several in
+    // flight it includes waiting for the ones before it
+    latencies: Vec<Duration>,
+    stalls: u64,
+    errors: u64,
+    resubmitted: u64,
+}
+
+struct Stream<'a> {
+    device_handle: &'a mut DeviceHandle<GlobalContext>,
+    endpoint: u8,
+    slots: Vec<Slot>,
+    receiver: mpsc::Receiver<Completion>,
+    // the slots not in flight and not waiting to be sent again
+    free: Vec<usize>,
+    next_sequence: u64,
+    // the transfers in flight are being cancelled
+    recovering: bool,
+    stalled: bool,
+    // stops the stream once the transfers in flight are cancelled
+    failure: Option<String>,
+    // recoveries since a transfer last completed
+    recoveries: usize,
+    stats: Stats,
+    start: Instant,
+    last_report: Instant,
+    last_report_bytes: u64,
+}
+
+pub fn stream(
+    device_handle: &mut DeviceHandle<GlobalContext>,
+    transfers: usize,
+    transfer_size: usize,
+) {
+    assert!(transfers > 0 && transfer_size > 0);
+    let mut stream = Stream::new(device_handle, transfers, transfer_size);
+
+    let done = AtomicBool::new(false);
+    let result = std::thread::scope(|scope| {
+        // the callbacks run on this thread, so that their completion times
+        // don't wait for stdin
+        let events = scope.spawn(|| {
+            while !done.load(Ordering::Relaxed) {
+                GlobalContext::default()
+                    .handle_events(Some(EVENT_TIMEOUT))
+                    .expect("handling usb events failed");
+            }
+        });
+        let result = stream.run();
+        done.store(true, Ordering::Relaxed);
+        events.join().unwrap();
+        result
+    });
+
+    stream.report_summary();
+    if let Err(message) = result {
+        panic!("{message}");
+    }
+}
+
+impl<'a> Stream<'a> {
+    fn new(
+        device_handle: &'a mut DeviceHandle<GlobalContext>,
+        transfers: usize,
+        transfer_size: usize,
+    ) -> Stream<'a> {
+        let endpoint = bulk_out_endpoint(device_handle);
+        let (sender, receiver) = mpsc::channel();
+        let slots = (0..transfers)
+            .map(|slot| {
+                let transfer = unsafe { ffi::libusb_alloc_transfer(0) };
+                assert!(!transfer.is_null(), "allocating a transfer failed");
+                let callback_data = Box::into_raw(Box::new(CallbackData {
+                    slot,
+                    sender: sender.clone(),
+                }));
+                // buffer and length are set when it is submitted
+                unsafe {
+                    (*transfer).dev_handle = device_handle.as_raw();
+                    (*transfer).endpoint = endpoint;
+                    (*transfer).transfer_type = LIBUSB_TRANSFER_TYPE_BULK;
+                    (*transfer).timeout = 0;
+                    (*transfer).callback = transfer_callback;
+                    (*transfer).user_data = callback_data as *mut c_void;
+                }
+                Slot {
+                    transfer,
+                    callback_data,
+                    buffer: vec![0; transfer_size],
+                    length: 0,
+                    sent: 0,
+                    sequence: 0,
+                    in_flight: false,
+                    submitted: Instant::now(),
+                }
+            })
+            .collect();
+
+        let now = Instant::now();
+        Stream {
+            device_handle,
+            endpoint,
+            slots,
+            receiver,
+            free: (0..transfers).rev().collect(),
+            next_sequence: 0,
+            recovering: false,
+            stalled: false,
+            failure: None,
+            recoveries: 0,
+            stats: Stats::default(),
+            start: now,
+            last_report: now,
+            last_report_bytes: 0,
+        }
+    }
+
+    // returns once all of stdin is sent, or with every transfer completed on
+    // an error
+    fn run(&mut self) -> Result<(), String> {
+        let mut stdin = io::stdin().lock();
+        let mut end_of_input = false;
+        loop {
+            while !end_of_input && !self.recovering {
+                let Some(slot) = self.free.pop() else {
+                    break;
+                };
+                let got_bytes = match fill(&mut stdin, &mut self.slots[slot].buffer) {
+                    Ok(got_bytes) => got_bytes,
+                    Err(error) => {
+                        self.free.push(slot);
+                        end_of_input = true;
+                        // once the transfers in flight are cancelled
+                        self.stop(format!("reading stdin failed: {error}"));
+                        self.fail_transfer()?;
+                        break;
+                    }
+                };
+                if got_bytes == 0 {
+                    self.free.push(slot);
+                    end_of_input = true;
+                    break;
+                }
+                let slot_data = &mut self.slots[slot];
+                slot_data.length = got_bytes;
+                slot_data.sent = 0;
+                slot_data.sequence = self.next_sequence;
+                self.next_sequence += 1;
+                self.submit(slot)?;
+            }
+
+            if self.in_flight() == 0 {
+                return Ok(());
+            }
+            // a sender is kept in each slot's callback data
+            let completion = self.receiver.recv().unwrap();
+            self.complete(completion)?;
+            self.report_progress();
+        }
+    }
+
+    fn in_flight(&self) -> usize {
+        self.slots.iter().filter(|slot| slot.in_flight).count()
+    }
+
+    // sends what is left of the slot's buffer
+    fn submit(&mut self, slot: usize) -> Result<(), String> {
+        let slot_data = &mut self.slots[slot];
+        let transfer = slot_data.transfer;
+        let remaining = &mut slot_data.buffer[slot_data.sent..slot_data.length];
+        unsafe {
+            (*transfer).buffer = remaining.as_mut_ptr();
+            (*transfer).length = c_int::try_from(remaining.len()).unwrap();
+        }
+        slot_data.submitted = Instant::now();
+        match unsafe { ffi::libusb_submit_transfer(transfer) } {
+            0 => {
+                slot_data.in_flight = true;
+                Ok(())
+            }
+            error => {
+                self.stop(format!(
+                    "submitting a transfer failed: {}",
+                    error_name(error)
+                ));
+                // the slot is sent again if the stream recovers
+                self.fail_transfer()
+            }
+        }
+    }
+
+    fn complete(&mut self, completion: Completion) -> Result<(), String> {
+        let slot = completion.slot;
+        let slot_data = &mut self.slots[slot];
+        slot_data.in_flight = false;
+        slot_data.sent += completion.actual_length;
+        self.stats.bytes += completion.actual_length as u64;
+
+        // a transfer that completed without an error is done even if it is
+        // short; the device can only NAK or STALL an OUT, so only the host
+        // controller ends one early, and sending the rest again would send it
+        // after the transfers queued behind it
+        if slot_data.sent == slot_data.length || completion.status == LIBUSB_TRANSFER_COMPLETED {
+            self.stats
+                .latencies
+                .push(completion.time - slot_data.submitted);
+            self.recoveries = 0;
+            self.free.push(slot);
+            return self.try_recover();
+        }
+
+        match completion.status {
+            // the transfers cancelled by a recovery
+            LIBUSB_TRANSFER_CANCELLED => {}
+            LIBUSB_TRANSFER_STALL => {
+                eprintln!("the endpoint stalled, sending the rest again");
+                self.stats.stalls += 1;
+                self.stalled = true;
+            }
+            LIBUSB_TRANSFER_NO_DEVICE => self.stop("the device was disconnected".to_string()),
+            status => {
+                eprintln!("a transfer failed with status {status}, sending the rest again");
+                self.stats.errors += 1;
+            }
+        }
+        self.fail_transfer()
+    }
+
+    // the failed slot stays out of free until it is sent again
+    fn fail_transfer(&mut self) -> Result<(), String> {
+        if !self.recovering {
+            self.recovering = true;
+            for slot_data in self.slots.iter().filter(|slot_data| slot_data.in_flight) {
+                // fails if the transfer has already completed, then its
+                // completion is already on the way
+                unsafe { ffi::libusb_cancel_transfer(slot_data.transfer) };
+            }
+        }
+        self.try_recover()
+    }
+
+    // sends the unfinished slots again in order once every transfer in flight
+    // has completed
+    fn try_recover(&mut self) -> Result<(), String> {
+        if !self.recovering || self.in_flight() != 0 {
+            return Ok(());
+        }
+        if let Some(failure) = self.failure.take() {
+            return Err(failure);
+        }
+        self.recoveries += 1;
+        if self.recoveries > MAX_RECOVERIES {
+            return Err(format!(
+                "the stream failed {MAX_RECOVERIES} times without sending anything"
+            ));
+        }
+        if self.stalled {
+            self.device_handle
+                .clear_halt(self.endpoint)
+                .map_err(|error| format!("clearing the halt of the endpoint failed: {error}"))?;
+            self.stalled = false;
+        }
+
+        let mut unfinished: Vec<usize> = (0..self.slots.len())
+            .filter(|slot| !self.free.contains(slot))
+            .collect();
+        unfinished.sort_by_key(|slot| self.slots[*slot].sequence);
+        self.recovering = false;
+        for slot in unfinished {
+            self.stats.resubmitted += 1;
+            self.submit(slot)?;
+            // a failed submit started another recovery
+            if self.recovering {
+                break;
+            }
+        }
+        Ok(())
+    }
+
+    fn stop(&mut self, message: String) {
+        if self.failure.is_none() {
+            self.failure = Some(message);
+        }
+    }
+
+    fn report_progress(&mut self) {
+        let now = Instant::now();
+        let elapsed = now - self.last_report;
+        if elapsed >= REPORT_INTERVAL {
+            let bytes = self.stats.bytes - self.last_report_bytes;
+            eprintln!("{}", rate(bytes, elapsed));
+            self.last_report = now;
+            self.last_report_bytes = self.stats.bytes;
+        }
+    }
+
+    fn report_summary(&mut self) {
+        let stats = &mut self.stats;
+        eprintln!(
+            "sent {} bytes in {:.3} s, {}",
+            stats.bytes,
+            self.start.elapsed().as_secs_f64(),
+            rate(stats.bytes, self.start.elapsed())
+        );
+        if !stats.latencies.is_empty() {
+            stats.latencies.sort();
+            let percentile = |percent: usize| {
+                let latency = stats.latencies[(stats.latencies.len() - 1) * percent / 100];
+                latency.as_secs_f64() * 1000.0
+            };
+            eprintln!(
+                "transfer latency in ms: p50 {:.3}, p90 {:.3}, p99 {:.3}, max {:.3}",
+                percentile(50),
+                percentile(90),
+                percentile(99),
+                percentile(100)
+            );
+        }
+        eprintln!(
+            "{} stalls, {} other errors, {} transfers sent again",
+            stats.stalls, stats.errors, stats.resubmitted
+        );
+    }
+}
+
+impl Drop for Stream<'_> {
+    fn drop(&mut self) {
+        for slot in &self.slots {
+            // a transfer still in flight can't be freed, this only happens
+            // when the program is stopping anyway
+            if slot.in_flight {
+                continue;
+            }
+            unsafe {
+                ffi::libusb_free_transfer(slot.transfer);
+                drop(Box::from_raw(slot.callback_data));
+            }
+        }
+    }
+}
+
+// runs on the event thread
+extern "system" fn transfer_callback(transfer: *mut ffi::libusb_transfer) {
+    let transfer = unsafe { &*transfer };
+    let callback_data = unsafe { &*(transfer.user_data as *const CallbackData) };
+    // the receiver is kept until every transfer has completed
+    callback_data
+        .sender
+        .send(Completion {
+            slot: callback_data.slot,
+            status: transfer.status,
+            actual_length: usize::try_from(transfer.actual_length).unwrap(),
+            time: Instant::now(),
+        })
+        .unwrap();
+}
+
+// reads until the buffer is full or stdin ends, returns the bytes read
+fn fill(stdin: &mut impl Read, buffer: &mut [u8]) -> io::Result<usize> {
+    let mut filled = 0;
+    while filled < buffer.len() {
+        match crate::read_retrying(stdin, &mut buffer[filled..])? {
+            0 => break,
+            got_bytes => filled += got_bytes,
+        }
+    }
+    Ok(filled)
+}
+
+// the first bulk OUT endpoint of the interface, BULK_OUT_ENDPOINT on the
+// board, so that a stand-in for the board can have it at another address
+fn bulk_out_endpoint(device_handle: &DeviceHandle<GlobalContext>) -> u8 {
+    let config_descriptor = device_handle.device().active_config_descriptor().unwrap();
+    config_descriptor
+        .interfaces()
+        .filter(|interface| interface.number() == INTERFACE)
+        .flat_map(|interface| interface.descriptors())
+        .flat_map(|descriptor| descriptor.endpoint_descriptors())
+        .find(|endpoint| {
+            endpoint.transfer_type() == TransferType::Bulk && endpoint.direction() == Direction::Out
+        })
+        .map(|endpoint| endpoint.address())
+        .expect("the device has no bulk OUT endpoint")
+}
+
+fn rate(bytes: u64, elapsed: Duration) -> String {
+    format!(
+        "{:.1} KiB/s",
+        bytes as f64 / 1024.0 / elapsed.as_secs_f64().max(f64::MIN_POSITIVE)
+    )
+}
+
+fn error_name(error: c_int) -> String {
+    let name = unsafe { std::ffi::CStr::from_ptr(ffi::libusb_error_name(error)) };
+    name.to_string_lossy().into_owned()
+}